@@ -134,6 +134,7 @@
 #define NS_ENCRYPT_BUFSIZE 	 16
 #define NS_DRIVER_ASYNC		  1	/* Use async read-ahead. */
 #define NS_DRIVER_SSL		  2	/* Use SSL port, protocol defaults. */
+#define NS_DRIVER_SENDFILE	  4	/* Opt in to sendfile on plain socket. */
 #define NS_DRIVER_VERSION_1       1
 
 /*
@@ -206,6 +207,14 @@ typedef ns_int64 INT64;
 
 #define NS_CACHE_FREE		((Ns_Callback *) (-1))
 
+/*
+ * Cache eviction policies.
+ */
+
+#define NS_CACHE_LRU		0
+#define NS_CACHE_2Q		1
+#define NS_CACHE_TINYLFU	2
+
 #ifdef _WIN32
 NS_EXTERN char *		NsWin32ErrMsg(int err);
 NS_EXTERN SOCKET		ns_sockdup(SOCKET sock);
@@ -403,6 +412,7 @@ typedef struct Ns_ConnFile {
     Ns_Set *headers;
     off_t   offset;
     off_t   length;
+    char   *path;		/* Temp file of streamed upload, if any. */
 } Ns_ConnFile;
 
 /*
@@ -555,6 +565,13 @@ NS_EXTERN Ns_Cache *Ns_CacheCreate(char *name, int keys, time_t timeout,
 				Ns_Callback *freeProc);
 NS_EXTERN Ns_Cache *Ns_CacheCreateSz(char *name, int keys, size_t maxSize,
 				  Ns_Callback *freeProc);
+NS_EXTERN Ns_Cache *Ns_CacheCreateSharded(char *name, int keys, size_t maxSize,
+				  Ns_Callback *freeProc, int nshards);
+NS_EXTERN Ns_Cache *Ns_CacheCreateEx(char *name, int keys, size_t maxSize,
+				  Ns_Callback *freeProc, int nshards,
+				  int policy);
+NS_EXTERN Ns_Cache *Ns_CacheShard(Ns_Cache *cache, char *key);
+NS_EXTERN int Ns_CacheGetPolicy(char *policy);
 NS_EXTERN void Ns_CacheDestroy(Ns_Cache *cache);
 NS_EXTERN Ns_Cache *Ns_CacheFind(char *name);
 NS_EXTERN void *Ns_CacheMalloc(Ns_Cache *cache, size_t len) _nsmalloc;
@@ -845,6 +862,7 @@ NS_EXTERN double Ns_DRand(void);
  */
 
 NS_EXTERN Ns_TaskQueue *Ns_CreateTaskQueue(char *name);
+NS_EXTERN Ns_TaskQueue *Ns_CreateTaskQueueEx(char *name, int nthreads);
 NS_EXTERN void Ns_DestroyTaskQueue(Ns_TaskQueue *queue);
 NS_EXTERN Ns_Task *Ns_TaskCreate(SOCKET sock, Ns_TaskProc *proc, void *arg);
 NS_EXTERN int  Ns_TaskEnqueue(Ns_Task *task, Ns_TaskQueue *queue);
@@ -853,6 +871,9 @@ NS_EXTERN void Ns_TaskCallback(Ns_Task *task, int when, Ns_Time *timeoutPtr);
 NS_EXTERN void Ns_TaskDone(Ns_Task *task);
 NS_EXTERN int  Ns_TaskCancel(Ns_Task *task);
 NS_EXTERN int  Ns_TaskWait(Ns_Task *task, Ns_Time *timeoutPtr);
+NS_EXTERN int  Ns_TaskWaitList(Ns_Task **tasks, int ntasks, int all,
+			     Ns_Time *timeoutPtr);
+NS_EXTERN int  Ns_TaskCompleted(Ns_Task *task);
 NS_EXTERN SOCKET Ns_TaskFree(Ns_Task *task);
 
 /*
@@ -84,7 +84,17 @@ typedef enum {
     DbFn_SpExec,
     DbFn_SpReturnCode,
     DbFn_SpGetParams,
-    DbFn_End
+    DbFn_End,
+
+    /*
+     * Ids added after DbFn_End so the values above, compiled into
+     * existing drivers, do not change.
+     */
+
+    DbFn_Ping,
+    DbFn_Prepare,
+    DbFn_ExecPrepared,
+    DbFn_FreePrepared
 } Ns_DbProcId;
 
 /*
@@ -146,6 +156,9 @@ NS_EXTERN int Ns_DbGetRow(Ns_DbHandle *handle, Ns_Set *row);
 NS_EXTERN int Ns_DbFlush(Ns_DbHandle *handle);
 NS_EXTERN int Ns_DbCancel(Ns_DbHandle *handle);
 NS_EXTERN int Ns_DbResetHandle(Ns_DbHandle *handle);
+NS_EXTERN int Ns_DbPrepare(Ns_DbHandle *handle, char *sql);
+NS_EXTERN int Ns_DbExecPrepared(Ns_DbHandle *handle, char *sql, int nvalues,
+				char **values);
 NS_EXTERN int Ns_DbSpStart(Ns_DbHandle *handle, char *procname);
 NS_EXTERN int Ns_DbSpSetParam(Ns_DbHandle *handle, char *paramname,
 			   char *paramtype, char *inout, char *value);
@@ -326,7 +326,9 @@ EvalObjCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv, int flags)
  * NsTclAdpIncludeObjCmd --
  *
  *	Process the Tcl _ns_adp_include commands to evaluate an
- *	ADP.
+ *	ADP.  With -cache, the output may be cached separately for
+ *	each value of the query parameters, headers and cookies
+ *	given with -vary.
  *
  * Results:
  *	A standard Tcl result.
@@ -345,15 +347,17 @@ NsTclAdpIncludeObjCmd(ClientData arg, Tcl_Interp *interp, int objc,
     Tcl_DString *dsPtr;
     int i, skip, cache;
     Ns_Time *ttlPtr, ttl;
+    Tcl_Obj *varyObj;
     char *file;
 
     if (objc < 2) {
 badargs:
-	Tcl_WrongNumArgs(interp, 1, objv, "?-cache ttl | -nocache? "
-					  "file ?args ...?");
+	Tcl_WrongNumArgs(interp, 1, objv, "?-cache ttl ?-vary list? | "
+					  "-nocache? file ?args ...?");
 	return TCL_ERROR;
     }
     ttlPtr = NULL;
+    varyObj = NULL;
     skip = cache = 1;
     file = Tcl_GetString(objv[1]);
     if (STREQ(file, "-nocache")) {
@@ -377,6 +381,13 @@ badargs:
 	}
 	ttlPtr = &ttl;
 	skip = 3;
+	if (STREQ(Tcl_GetString(objv[3]), "-vary")) {
+	    if (objc < 6) {
+		goto badargs;
+	    }
+	    varyObj = objv[4];
+	    skip = 5;
+	}
     }
     file = Tcl_GetString(objv[skip]);
     objc -= skip;
@@ -398,7 +409,7 @@ badargs:
     	Tcl_DStringAppend(dsPtr, "%>", 2);
 	return TCL_OK;
     }
-    return NsAdpInclude(arg, objc, objv, file, ttlPtr);
+    return NsAdpInclude(arg, objc, objv, file, ttlPtr, varyObj);
 }
 
 
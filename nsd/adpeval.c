@@ -41,11 +41,14 @@ static const char *RCSID = "@(#) $Header$, compiled: " __DATE__ " " __TIME__;
  * The following structure defines a cached ADP page result.  A cached
  * object is created by executing the non-cached code and saving the
  * resulting output which may include embedded non-cached components
- * (see NsTclAdpIncludeObjCmd for details).
+ * (see NsTclAdpIncludeObjCmd for details).  Page variant results
+ * are stored in the server variants cache and reference counted
+ * under the cache lock instead of the page lock.
  */
 
 typedef struct AdpCache {
     int	      	   refcnt;	/* Current interps using cached results. */ 
+    int		   locked;	/* Variant locked for cache update. */
     Ns_Time	   expires;	/* Expiration time of cached results. */
     AdpCode	   code;	/* ADP code for cached result. */
 } AdpCache;
@@ -63,7 +66,10 @@ typedef struct Page {
     int		   flags;	/* Flags used on last compile, e.g., SAFE. */
     int	      	   refcnt;	/* Refcnt of current interps using page. */
     int		   evals;	/* Count of page evaluations. */
+    int		   hits;	/* Count of variant cache hits. */
+    int		   misses;	/* Count of variant cache misses. */
     int		   locked;	/* Page locked for cache update. */
+    int		   preload;	/* Page held in table by ns_adp_compile. */
     int		   cacheGen;	/* Cache generation id. */
     AdpCache	  *cachePtr;	/* Cached output. */
     AdpCode	   code;	/* ADP code blocks. */
@@ -97,14 +103,30 @@ typedef struct InterpPage {
  * Local functions defined in this file.
  */
 
+static Page *FindPage(NsInterp *itPtr, char *file, struct stat *stPtr,
+		      int flags, char *key, FileKey *ukeyPtr);
 static Page *ParseFile(NsInterp *itPtr, char *file, struct stat *stPtr,
 		       int flags);
+static Page *NewPage(NsServer *servPtr, char *file, struct stat *stPtr,
+		     int flags);
+static void FreePage(Page *pagePtr);
+static void ReleasePreload(Page *pagePtr);
+static int CompilePage(NsInterp *itPtr, char *file, int *countPtr);
+static int CompileDir(NsInterp *itPtr, Ns_DString *dsPtr, int *countPtr);
 static int AdpEval(NsInterp *itPtr, int objc, Tcl_Obj *objv[], int flags,
 		   char *resvar);
 static int AdpExec(NsInterp *itPtr, int objc, Tcl_Obj *objv[], char *file,
 		   AdpCode *codePtr, Objs *objsPtr, Tcl_DString *outputPtr);
 static int AdpSource(NsInterp *itPtr, int objc, Tcl_Obj *objv[], char *file,
-		     Ns_Time *ttlPtr, int flags, Tcl_DString *outputPtr);
+		     Ns_Time *ttlPtr, Tcl_Obj *varyObj, int flags,
+		     Tcl_DString *outputPtr);
+static int VariantKey(NsInterp *itPtr, int objc, Tcl_Obj *objv[],
+		      char *file, Page *pagePtr, Tcl_Obj *varyObj,
+		      Tcl_DString *dsPtr);
+static AdpCache *GetVariant(NsInterp *itPtr, int objc, Tcl_Obj *objv[],
+			    char *file, InterpPage *ipagePtr, Ns_Time *ttlPtr,
+			    Tcl_Obj *varyObj, int flags, int *hitPtr);
+static char *GetCookie(Ns_DString *dsPtr, Ns_Set *hdrs, char *name);
 static int AdpDebug(NsInterp *itPtr, char *ptr, int len, int nscript);
 static void DecrCache(AdpCache *cachePtr);
 static Objs *AllocObjs(int nobjs);
@@ -161,7 +183,8 @@ AdpEval(NsInterp *itPtr, int objc, Tcl_Obj *objv[], int flags, char *resvar)
     Tcl_DStringInit(&output);
     obj0 = Tcl_GetString(objv[0]);
     if (flags & ADP_EVAL_FILE) {
-    	result = AdpSource(itPtr, objc, objv, obj0, NULL, flags, &output);
+    	result = AdpSource(itPtr, objc, objv, obj0, NULL, NULL, flags,
+			   &output);
     } else {
     	NsAdpParse(&code, itPtr->servPtr, obj0, flags);
     	result = AdpExec(itPtr, objc, objv, NULL, &code, NULL, &output);
@@ -197,6 +220,8 @@ AdpEval(NsInterp *itPtr, int objc, Tcl_Obj *objv[], int flags, char *resvar)
  * NsAdpInclude --
  *
  *	Evaluate an ADP file, utilizing per-thread byte-code pages.
+ *	If ttlPtr is given, the output is cached, optionally keyed by
+ *	the query, header and cookie values listed in varyObj.
  *
  * Results:
  *	A standard Tcl result.
@@ -209,7 +234,7 @@ AdpEval(NsInterp *itPtr, int objc, Tcl_Obj *objv[], int flags, char *resvar)
 
 int
 NsAdpInclude(NsInterp *itPtr, int objc, Tcl_Obj *objv[], char *file,
-		Ns_Time *ttlPtr)
+		Ns_Time *ttlPtr, Tcl_Obj *varyObj)
 {
     Ns_DString *outputPtr;
     int flags = itPtr->adp.flags;
@@ -224,7 +249,8 @@ NsAdpInclude(NsInterp *itPtr, int objc, Tcl_Obj *objv[], char *file,
     } else {
 	outputPtr = &itPtr->adp.output;
     }
-    return AdpSource(itPtr, objc, objv, file, ttlPtr, flags, outputPtr);
+    return AdpSource(itPtr, objc, objv, file, ttlPtr, varyObj, flags,
+		     outputPtr);
 }
 
 
@@ -313,21 +339,20 @@ NsAdpReset(NsInterp *itPtr)
 
 static int
 AdpSource(NsInterp *itPtr, int objc, Tcl_Obj *objv[], char *file,
-       Ns_Time *ttlPtr, int flags, Tcl_DString *outputPtr)
+       Ns_Time *ttlPtr, Tcl_Obj *varyObj, int flags, Tcl_DString *outputPtr)
 {
     NsServer  *servPtr = itPtr->servPtr;
     Tcl_Interp *interp = itPtr->interp;
-    Tcl_HashEntry *hPtr;
     struct stat st;
     Ns_DString tmp, path;
     InterpPage *ipagePtr;
-    Page *pagePtr, *oldPagePtr;
+    Page *pagePtr;
     AdpCache *cachePtr;
     AdpCode *codePtr;
     Ns_Time now;
     Ns_Entry *ePtr;
     Objs *objsPtr;
-    int new, cacheGen;
+    int new, cacheGen, hit;
     char *p, *key;
     FileKey ukey;
     int result;
@@ -417,61 +442,7 @@ AdpSource(NsInterp *itPtr, int objc, Tcl_Obj *objv[], char *file,
 	    }
 	}
 	if (ipagePtr == NULL) {
-	    /*
-	     * Find or create valid page in server table.
-	     */
-	     
-    	    Ns_MutexLock(&servPtr->adp.pagelock);
-	    hPtr = Tcl_CreateHashEntry(&servPtr->adp.pages, key, &new);
-	    while (!new && (pagePtr = Tcl_GetHashValue(hPtr)) == NULL) {
-		/* NB: Wait for other thread to read/parse page. */
-		Ns_CondWait(&servPtr->adp.pagecond, &servPtr->adp.pagelock);
-		hPtr = Tcl_CreateHashEntry(&servPtr->adp.pages, key, &new);
-	    }
-	    if (!new && (pagePtr->mtime != st.st_mtime
-			|| pagePtr->size != st.st_size
-			|| pagePtr->flags != flags)) {
-		/* NB: Clear entry to indicate read/parse in progress. */
-		Tcl_SetHashValue(hPtr, NULL);
-		pagePtr->hPtr = NULL;
-		new = 1;
-	    }
-	    if (new) {
-		Ns_MutexUnlock(&servPtr->adp.pagelock);
-		pagePtr = ParseFile(itPtr, file, &st, flags);
-		Ns_MutexLock(&servPtr->adp.pagelock);
-		if (pagePtr == NULL) {
-		    Tcl_DeleteHashEntry(hPtr);
-		} else {
-#ifdef _WIN32
-            	    if (pagePtr->mtime != st.st_mtime
-				|| pagePtr->size != st.st_size)
-#else
-            	    if (ukey.dev != st.st_dev || ukey.ino != st.st_ino)
-#endif
-		    {
-			/* NB: File changed between stat above and ParseFile. */
-		    	Tcl_DeleteHashEntry(hPtr);
-#ifndef _WIN32
-                	ukey.dev = st.st_dev;
-		    	ukey.ino = st.st_ino;
-#endif
-		    	hPtr = Tcl_CreateHashEntry(&servPtr->adp.pages, key,
-						   &new);
-		    	if (!new) {
-			    oldPagePtr = Tcl_GetHashValue(hPtr);
-			    oldPagePtr->hPtr = NULL;
-		    	}
-		    }
-		    pagePtr->hPtr = hPtr;
-		    Tcl_SetHashValue(hPtr, pagePtr);
-		}
-		Ns_CondBroadcast(&servPtr->adp.pagecond);
-	    }
-	    if (pagePtr != NULL) {
-	    	++pagePtr->refcnt;
-	    }
-	    Ns_MutexUnlock(&servPtr->adp.pagelock);
+	    pagePtr = FindPage(itPtr, file, &st, flags, key, &ukey);
 	    if (pagePtr != NULL) {
 	    	ipagePtr = ns_malloc(sizeof(InterpPage));
 		ipagePtr->pagePtr = pagePtr;
@@ -494,8 +465,13 @@ AdpSource(NsInterp *itPtr, int objc, Tcl_Obj *objv[], char *file,
          
     if (ipagePtr != NULL) {
 	pagePtr = ipagePtr->pagePtr;
+	hit = -1;
+	cacheGen = 0;
 	if (ttlPtr == NULL || (flags & ADP_NOCACHE)) {
 	   cachePtr = NULL;
+	} else if (varyObj != NULL) {
+	    cachePtr = GetVariant(itPtr, objc, objv, file, ipagePtr, ttlPtr,
+				  varyObj, flags, &hit);
 	} else {
 	    Ns_MutexLock(&servPtr->adp.pagelock);
 
@@ -537,6 +513,7 @@ AdpSource(NsInterp *itPtr, int objc, Tcl_Obj *objv[], char *file,
 		    Ns_GetTime(&cachePtr->expires);
 		    Ns_IncrTime(&cachePtr->expires, ttlPtr->sec, ttlPtr->usec);
 	    	    cachePtr->refcnt = 1;
+		    cachePtr->locked = 0;
 		}
 		Ns_DStringTrunc(&tmp, 0);
 	    	Ns_MutexLock(&servPtr->adp.pagelock);
@@ -557,6 +534,15 @@ AdpSource(NsInterp *itPtr, int objc, Tcl_Obj *objv[], char *file,
 	if (cachePtr == NULL) {
 	   codePtr = &pagePtr->code;
 	   objsPtr = ipagePtr->objs;
+	} else if (hit >= 0) {
+	    /*
+	     * Variant results are shared by many keys so the scripts,
+	     * typically just the embedded non-cached components, are
+	     * compiled for this execution only.
+	     */
+
+	    codePtr = &cachePtr->code;
+	    objsPtr = AllocObjs(AdpCodeScripts(codePtr));
 	} else {
 	    codePtr = &cachePtr->code;
 	    if (ipagePtr->cacheObjs != NULL && cacheGen != ipagePtr->cacheGen) {
@@ -569,9 +555,24 @@ AdpSource(NsInterp *itPtr, int objc, Tcl_Obj *objv[], char *file,
 	    }
 	    objsPtr = ipagePtr->cacheObjs;
 	}
-	result = AdpExec(itPtr, objc, objv, file, codePtr, objsPtr, outputPtr);
+	if (hit < 0 || cachePtr != NULL) {
+	    result = AdpExec(itPtr, objc, objv, file, codePtr, objsPtr,
+			     outputPtr);
+	}
+	if (hit >= 0 && cachePtr != NULL) {
+	    FreeObjs(objsPtr);
+	    Ns_CacheLock(servPtr->adp.variants);
+	    DecrCache(cachePtr);
+	    Ns_CacheUnlock(servPtr->adp.variants);
+	    cachePtr = NULL;
+	}
 	Ns_MutexLock(&servPtr->adp.pagelock);
 	++ipagePtr->pagePtr->evals;
+	if (hit > 0) {
+	    ++ipagePtr->pagePtr->hits;
+	} else if (hit == 0) {
+	    ++ipagePtr->pagePtr->misses;
+	}
 	if (cachePtr != NULL) {
 	    DecrCache(cachePtr);
 	}
@@ -587,6 +588,343 @@ done:
     return result;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FindPage --
+ *
+ *	Find or create valid page in server table.
+ *
+ * Results:
+ *	Pointer to Page with reference count incremented or NULL on
+ *	error.
+ *
+ * Side effects:
+ *	File may be read and parsed or loaded from the compile
+ *	directory.  Key may be updated if the file was replaced.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Page *
+FindPage(NsInterp *itPtr, char *file, struct stat *stPtr, int flags,
+	 char *key, FileKey *ukeyPtr)
+{
+    NsServer *servPtr = itPtr->servPtr;
+    Tcl_HashEntry *hPtr;
+    Page *pagePtr, *oldPagePtr;
+    int new;
+
+    Ns_MutexLock(&servPtr->adp.pagelock);
+    hPtr = Tcl_CreateHashEntry(&servPtr->adp.pages, key, &new);
+    while (!new && (pagePtr = Tcl_GetHashValue(hPtr)) == NULL) {
+	/* NB: Wait for other thread to read/parse page. */
+	Ns_CondWait(&servPtr->adp.pagecond, &servPtr->adp.pagelock);
+	hPtr = Tcl_CreateHashEntry(&servPtr->adp.pages, key, &new);
+    }
+    if (!new && (pagePtr->mtime != stPtr->st_mtime
+		|| pagePtr->size != stPtr->st_size
+		|| pagePtr->flags != flags)) {
+	/* NB: Clear entry to indicate read/parse in progress. */
+	Tcl_SetHashValue(hPtr, NULL);
+	pagePtr->hPtr = NULL;
+	ReleasePreload(pagePtr);
+	new = 1;
+    }
+    if (new) {
+	Ns_MutexUnlock(&servPtr->adp.pagelock);
+	pagePtr = ParseFile(itPtr, file, stPtr, flags);
+	Ns_MutexLock(&servPtr->adp.pagelock);
+	if (pagePtr == NULL) {
+	    Tcl_DeleteHashEntry(hPtr);
+	} else {
+#ifdef _WIN32
+	    if (pagePtr->mtime != stPtr->st_mtime
+			|| pagePtr->size != stPtr->st_size)
+#else
+	    if (ukeyPtr->dev != stPtr->st_dev
+		    || ukeyPtr->ino != stPtr->st_ino)
+#endif
+	    {
+		/* NB: File changed between stat above and ParseFile. */
+		Tcl_DeleteHashEntry(hPtr);
+#ifndef _WIN32
+		ukeyPtr->dev = stPtr->st_dev;
+		ukeyPtr->ino = stPtr->st_ino;
+#endif
+		hPtr = Tcl_CreateHashEntry(&servPtr->adp.pages, key,
+					   &new);
+		if (!new) {
+		    oldPagePtr = Tcl_GetHashValue(hPtr);
+		    oldPagePtr->hPtr = NULL;
+		    ReleasePreload(oldPagePtr);
+		}
+	    }
+	    pagePtr->hPtr = hPtr;
+	    Tcl_SetHashValue(hPtr, pagePtr);
+	}
+	Ns_CondBroadcast(&servPtr->adp.pagecond);
+    }
+    if (pagePtr != NULL) {
+	++pagePtr->refcnt;
+    }
+    Ns_MutexUnlock(&servPtr->adp.pagelock);
+    return pagePtr;
+}
+
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetVariant --
+ *
+ *	Find or create the cached result of a page variant, i.e., the
+ *	page output for the current values of the query parameters,
+ *	headers and cookies listed in varyObj.  Only one thread builds
+ *	a given variant at a time: other threads wait for the initial
+ *	result or continue to use the expired result until the refresh
+ *	is complete.
+ *
+ * Results:
+ *	Pointer to AdpCache with reference count incremented or NULL
+ *	on error.  The hitPtr is set to 1 if the result was found in
+ *	the cache, 0 otherwise.
+ *
+ * Side effects:
+ *	Page may be executed in refresh mode and the result saved in
+ *	the server variants cache, possibly pruning other variants.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static AdpCache *
+GetVariant(NsInterp *itPtr, int objc, Tcl_Obj *objv[], char *file,
+	   InterpPage *ipagePtr, Ns_Time *ttlPtr, Tcl_Obj *varyObj,
+	   int flags, int *hitPtr)
+{
+    Ns_Cache *cache = itPtr->servPtr->adp.variants;
+    Page *pagePtr = ipagePtr->pagePtr;
+    AdpCache *cachePtr;
+    Ns_Entry *ePtr;
+    Ns_DString key, out;
+    Ns_Time now;
+    int new, result;
+
+    *hitPtr = 0;
+    Ns_DStringInit(&key);
+    if (VariantKey(itPtr, objc, objv, file, pagePtr, varyObj,
+		   &key) != TCL_OK) {
+	Ns_DStringFree(&key);
+	return NULL;
+    }
+
+    /*
+     * Wait for an initial result if another thread is building it
+     * and return the cached result unless it has expired.  The
+     * entry is looked up again after each wait as it may have been
+     * pruned in the meantime.
+     */
+
+    Ns_CacheLock(cache);
+    while (1) {
+	ePtr = Ns_CacheCreateEntry(cache, key.string, &new);
+	cachePtr = Ns_CacheGetValue(ePtr);
+	if (new || cachePtr != NULL) {
+	    break;
+	}
+	Ns_CacheWait(cache);
+    }
+    if (cachePtr != NULL) {
+	Ns_GetTime(&now);
+	if (cachePtr->locked
+		|| Ns_DiffTime(&cachePtr->expires, &now, NULL) >= 0) {
+	    ++cachePtr->refcnt;
+	    Ns_CacheUnlock(cache);
+	    Ns_DStringFree(&key);
+	    *hitPtr = 1;
+	    return cachePtr;
+	}
+	cachePtr->locked = 1;
+    }
+    Ns_CacheUnlock(cache);
+
+    /*
+     * Build the variant result as with the page cache in AdpSource
+     * and save it, holding one reference for the cache and one for
+     * the caller.  On error, release waiting threads to try again.
+     */
+
+    Ns_DStringInit(&out);
+    ++itPtr->adp.refresh;
+    result = AdpExec(itPtr, objc, objv, file, &pagePtr->code,
+		     ipagePtr->objs, &out);
+    --itPtr->adp.refresh;
+    cachePtr = NULL;
+    if (result == TCL_OK) {
+	cachePtr = ns_malloc(sizeof(AdpCache));
+	NsAdpParse(&cachePtr->code, itPtr->servPtr, out.string, flags);
+	Ns_GetTime(&cachePtr->expires);
+	Ns_IncrTime(&cachePtr->expires, ttlPtr->sec, ttlPtr->usec);
+	cachePtr->locked = 0;
+	cachePtr->refcnt = 2;
+    }
+    Ns_CacheLock(cache);
+    ePtr = Ns_CacheCreateEntry(cache, key.string, &new);
+    if (cachePtr != NULL) {
+	Ns_CacheSetValueSz(ePtr, cachePtr, (size_t) out.length);
+    } else if (Ns_CacheGetValue(ePtr) == NULL) {
+	Ns_CacheFlushEntry(ePtr);
+    } else {
+	((AdpCache *) Ns_CacheGetValue(ePtr))->locked = 0;
+    }
+    Ns_CacheBroadcast(cache);
+    Ns_CacheUnlock(cache);
+    Ns_DStringFree(&out);
+    Ns_DStringFree(&key);
+    return cachePtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * VariantKey --
+ *
+ *	Append the variants cache key for a page to given dstring.
+ *	The key includes the file, page version and include args
+ *	followed by each element of the vary list, one of
+ *	query:name, header:name or cookie:name, and its current
+ *	value in the connection, if any.
+ *
+ * Results:
+ *	TCL_OK or TCL_ERROR on invalid vary list.
+ *
+ * Side effects:
+ *	Query data may be parsed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+VariantKey(NsInterp *itPtr, int objc, Tcl_Obj *objv[], char *file,
+	   Page *pagePtr, Tcl_Obj *varyObj, Tcl_DString *dsPtr)
+{
+    Ns_Conn *conn = itPtr->conn;
+    Tcl_Obj **specv;
+    Ns_Set *query;
+    Ns_DString cookie;
+    char *spec, *name, *value, type;
+    int i, len, nspec;
+
+    if (Tcl_ListObjGetElements(itPtr->interp, varyObj, &nspec,
+			       &specv) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    Tcl_DStringAppendElement(dsPtr, file);
+    Ns_DStringPrintf(dsPtr, " %ld %ld %d %d", (long) pagePtr->mtime,
+		     (long) pagePtr->size, pagePtr->flags, objc);
+    for (i = 1; i < objc; ++i) {
+	Tcl_DStringAppendElement(dsPtr, Tcl_GetString(objv[i]));
+    }
+    Ns_DStringInit(&cookie);
+    for (i = 0; i < nspec; ++i) {
+	spec = Tcl_GetString(specv[i]);
+	name = strchr(spec, ':');
+	type = '\0';
+	if (name != NULL) {
+	    len = name++ - spec;
+	    if ((len == 5 && strncmp(spec, "query", 5) == 0)
+		    || (len == 6 && (strncmp(spec, "header", 6) == 0
+				     || strncmp(spec, "cookie", 6) == 0))) {
+		type = *spec;
+	    }
+	}
+	if (type == '\0' || *name == '\0') {
+	    Tcl_AppendResult(itPtr->interp, "invalid vary \"", spec,
+		"\": should be query:name, header:name or cookie:name", NULL);
+	    Ns_DStringFree(&cookie);
+	    return TCL_ERROR;
+	}
+	value = NULL;
+	if (conn != NULL) {
+	    if (type == 'q') {
+		query = Ns_ConnGetQuery(conn);
+		if (query != NULL) {
+		    value = Ns_SetGet(query, name);
+		}
+	    } else if (type == 'h') {
+		value = Ns_SetIGet(Ns_ConnHeaders(conn), name);
+	    } else {
+		value = GetCookie(&cookie, Ns_ConnHeaders(conn), name);
+	    }
+	}
+	Tcl_DStringAppendElement(dsPtr, spec);
+	if (value == NULL) {
+	    Tcl_DStringAppendElement(dsPtr, "0");
+	} else {
+	    Tcl_DStringAppendElement(dsPtr, "1");
+	    Tcl_DStringAppendElement(dsPtr, value);
+	}
+    }
+    Ns_DStringFree(&cookie);
+    return TCL_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetCookie --
+ *
+ *	Find the value of a cookie in the Cookie request headers.
+ *
+ * Results:
+ *	Pointer to value copied to given dstring or NULL if not found.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+GetCookie(Ns_DString *dsPtr, Ns_Set *hdrs, char *name)
+{
+    char *p, *end;
+    size_t len;
+    int i;
+
+    len = strlen(name);
+    for (i = 0; i < Ns_SetSize(hdrs); ++i) {
+	if (strcasecmp(Ns_SetKey(hdrs, i), "cookie") != 0) {
+	    continue;
+	}
+	p = Ns_SetValue(hdrs, i);
+	while (*p != '\0') {
+	    while (*p == ';' || isspace(UCHAR(*p))) {
+		++p;
+	    }
+	    end = strchr(p, ';');
+	    if (end == NULL) {
+		end = p + strlen(p);
+	    }
+	    if (strncmp(p, name, len) == 0 && p[len] == '=') {
+		p += len + 1;
+		while (end > p && isspace(UCHAR(end[-1]))) {
+		    --end;
+		}
+		Ns_DStringTrunc(dsPtr, 0);
+		Ns_DStringNAppend(dsPtr, p, end - p);
+		return dsPtr->string;
+	    }
+	    p = end;
+	}
+    }
+    return NULL;
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -669,7 +1007,7 @@ NsTclAdpStatsCmd(ClientData arg, Tcl_Interp *interp, int argc, char **argv)
     NsInterp *itPtr = arg;
     NsServer *servPtr = itPtr->servPtr;
     FileKey *keyPtr;
-    char buf[200];
+    char buf[300];
     Tcl_HashSearch search;
     Tcl_HashEntry *hPtr;
     Page *pagePtr;
@@ -681,10 +1019,11 @@ NsTclAdpStatsCmd(ClientData arg, Tcl_Interp *interp, int argc, char **argv)
 	keyPtr = (FileKey *) Tcl_GetHashKey(&servPtr->adp.pages, hPtr);
 	Tcl_AppendElement(interp, pagePtr->file);
 	sprintf(buf, "dev %ld ino %ld mtime %ld refcnt %d evals %d "
-		     "size %ld blocks %d scripts %d",
+		     "size %ld blocks %d scripts %d hits %d misses %d",
 		(long) keyPtr->dev, (long) keyPtr->ino, (long) pagePtr->mtime,
 		pagePtr->refcnt, pagePtr->evals, (long) pagePtr->size,
-		pagePtr->code.nblocks, pagePtr->code.nscripts);
+		pagePtr->code.nblocks, pagePtr->code.nscripts,
+		pagePtr->hits, pagePtr->misses);
 	Tcl_AppendElement(interp, buf);
 	hPtr = Tcl_NextHashEntry(&search);
     }
@@ -692,6 +1031,233 @@ NsTclAdpStatsCmd(ClientData arg, Tcl_Interp *interp, int argc, char **argv)
     return TCL_OK;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclAdpCompileObjCmd --
+ *
+ *	Implement the ns_adp_compile command to parse ADP files, or
+ *	all *.adp files below a directory, into the server page
+ *	table and the compile directory, if any, ahead of requests.
+ *	Relative paths are relative to the server pageroot.
+ *
+ * Results:
+ *	Standard Tcl result with count of pages compiled.
+ *
+ * Side effects:
+ *	Pages are held in the server table until changed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsTclAdpCompileObjCmd(ClientData arg, Tcl_Interp *interp, int objc,
+		      Tcl_Obj **objv)
+{
+    NsInterp *itPtr = arg;
+    Ns_DString ds;
+    struct stat st;
+    char *file;
+    int i, count, result;
+
+    if (objc < 2) {
+	Tcl_WrongNumArgs(interp, 1, objv, "path ?path ...?");
+	return TCL_ERROR;
+    }
+    Ns_DStringInit(&ds);
+    count = 0;
+    result = TCL_OK;
+    for (i = 1; result == TCL_OK && i < objc; ++i) {
+	file = Tcl_GetString(objv[i]);
+	Ns_DStringTrunc(&ds, 0);
+	if (!Ns_PathIsAbsolute(file)) {
+	    Ns_MakePath(&ds, itPtr->servPtr->fastpath.pageroot, file, NULL);
+	} else {
+	    Ns_DStringAppend(&ds, file);
+	}
+	if (stat(ds.string, &st) == 0 && S_ISDIR(st.st_mode)) {
+	    result = CompileDir(itPtr, &ds, &count);
+	} else {
+	    result = CompilePage(itPtr, ds.string, &count);
+	}
+    }
+    Ns_DStringFree(&ds);
+    if (result != TCL_OK) {
+	return TCL_ERROR;
+    }
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(count));
+    return TCL_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsAdpPrecompile --
+ *
+ *	Startup callback to compile all ADP files below the server
+ *	pageroot before the drivers begin accepting connections.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	See NsTclAdpCompileObjCmd.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsAdpPrecompile(void *arg)
+{
+    NsServer *servPtr = arg;
+    Tcl_Interp *interp;
+    Ns_DString ds;
+    Ns_Time start, end, diff;
+    int count;
+
+    interp = Ns_TclAllocateInterp(servPtr->server);
+    if (interp == NULL) {
+	return;
+    }
+    Ns_DStringInit(&ds);
+    Ns_DStringAppend(&ds, servPtr->fastpath.pageroot);
+    count = 0;
+    Ns_GetTime(&start);
+    if (CompileDir(NsGetInterpData(interp), &ds, &count) != TCL_OK) {
+	Ns_TclLogError(interp);
+    }
+    Ns_GetTime(&end);
+    Ns_DiffTime(&end, &start, &diff);
+    Ns_Log(Notice, "adp[%s]: precompiled %d pages in %ld.%06lds",
+	   servPtr->server, count, diff.sec, diff.usec);
+    Ns_DStringFree(&ds);
+    Ns_TclDeAllocateInterp(interp);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CompileDir --
+ *
+ *	Compile all *.adp files in the directory in given dstring
+ *	and, recursively, its subdirectories.  Errors on individual
+ *	files are logged and skipped.
+ *
+ * Results:
+ *	TCL_OK or TCL_ERROR if the directory could not be read.
+ *
+ * Side effects:
+ *	See CompilePage.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+CompileDir(NsInterp *itPtr, Ns_DString *dsPtr, int *countPtr)
+{
+    DIR *dp;
+    struct dirent *ent;
+    struct stat st;
+    int len;
+
+    dp = opendir(dsPtr->string);
+    if (dp == NULL) {
+	Tcl_AppendResult(itPtr->interp, "could not open directory \"",
+	    dsPtr->string, "\": ", Tcl_PosixError(itPtr->interp), NULL);
+	return TCL_ERROR;
+    }
+    len = dsPtr->length;
+    while ((ent = ns_readdir(dp)) != NULL) {
+	if (ent->d_name[0] == '.') {
+	    continue;
+	}
+	Ns_DStringTrunc(dsPtr, len);
+	Ns_DStringVarAppend(dsPtr, "/", ent->d_name, NULL);
+	if (lstat(dsPtr->string, &st) != 0) {
+	    continue;
+	}
+	if (S_ISDIR(st.st_mode)) {
+	    (void) CompileDir(itPtr, dsPtr, countPtr);
+	} else if (Tcl_StringMatch(ent->d_name, "*.adp")
+		&& CompilePage(itPtr, dsPtr->string, countPtr) != TCL_OK) {
+	    Ns_Log(Warning, "adp: could not compile %s: %s", dsPtr->string,
+		   Tcl_GetStringResult(itPtr->interp));
+	}
+	Tcl_ResetResult(itPtr->interp);
+    }
+    closedir(dp);
+    Ns_DStringTrunc(dsPtr, len);
+    return TCL_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CompilePage --
+ *
+ *	Find or parse the page for a file and hold it in the server
+ *	table.
+ *
+ * Results:
+ *	TCL_OK or TCL_ERROR if the file could not be parsed.
+ *
+ * Side effects:
+ *	Count is incremented on success.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+CompilePage(NsInterp *itPtr, char *file, int *countPtr)
+{
+    NsServer *servPtr = itPtr->servPtr;
+    Ns_DString path;
+    struct stat st;
+    Page *pagePtr;
+    FileKey ukey;
+    char *key;
+
+    Ns_DStringInit(&path);
+    file = Ns_NormalizePath(&path, file);
+    pagePtr = NULL;
+    if (stat(file, &st) != 0) {
+	Tcl_AppendResult(itPtr->interp, "could not stat \"",
+	    file, "\": ", Tcl_PosixError(itPtr->interp), NULL);
+    } else if (S_ISREG(st.st_mode) == 0) {
+    	Tcl_AppendResult(itPtr->interp, "not an ordinary file: ", file,
+			 NULL);
+    } else {
+#ifdef _WIN32
+	key = file;
+#else
+	ukey.dev = st.st_dev;
+	ukey.ino = st.st_ino;
+	key = (char *) &ukey;
+#endif
+	pagePtr = FindPage(itPtr, file, &st, servPtr->adp.flags, key, &ukey);
+    }
+    Ns_DStringFree(&path);
+    if (pagePtr == NULL) {
+	return TCL_ERROR;
+    }
+    Ns_MutexLock(&servPtr->adp.pagelock);
+    if (pagePtr->preload || pagePtr->hPtr == NULL) {
+	if (--pagePtr->refcnt == 0) {
+	    FreePage(pagePtr);
+	}
+    } else {
+	pagePtr->preload = 1;
+    }
+    Ns_MutexUnlock(&servPtr->adp.pagelock);
+    ++(*countPtr);
+    return TCL_OK;
+}
+
+
 
 /*
  *----------------------------------------------------------------------
@@ -713,13 +1279,28 @@ NsTclAdpStatsCmd(ClientData arg, Tcl_Interp *interp, int argc, char **argv)
 static Page *
 ParseFile(NsInterp *itPtr, char *file, struct stat *stPtr, int flags)
 {
+    NsServer *servPtr = itPtr->servPtr;
     Tcl_Interp *interp = itPtr->interp;
     Tcl_Encoding encoding;
     Tcl_DString utf;
-    char *page, *buf;
+    char *page, *buf, *encname;
     int fd, n, trys;
     size_t size;
     Page *pagePtr;
+
+    /*
+     * Use code saved in the compile directory if still valid.
+     */
+
+    encoding = Ns_GetFileEncoding(file);
+    encname = encoding ? (char *) Tcl_GetEncodingName(encoding) : "";
+    pagePtr = NewPage(servPtr, file, stPtr, flags);
+    if (NsAdpLoadCode(&pagePtr->code, servPtr, file, stPtr, flags,
+		      encname) == NS_OK) {
+	return pagePtr;
+    }
+    ns_free(pagePtr);
+    pagePtr = NULL;
     
     fd = open(file, O_RDONLY | O_BINARY);
     if (fd < 0) {
@@ -774,26 +1355,17 @@ ParseFile(NsInterp *itPtr, char *file, struct stat *stPtr, int flags)
     } else {
 	buf[n] = '\0';
 	Tcl_DStringInit(&utf);
-	encoding = Ns_GetFileEncoding(file);
 	if (encoding == NULL) {
 	    page = buf;
 	} else {
 	    Tcl_ExternalToUtfDString(encoding, buf, n, &utf);
 	    page = utf.string;
 	}
-	pagePtr = ns_malloc(sizeof(Page) + strlen(file));
-	strcpy(pagePtr->file, file);
-	pagePtr->servPtr = itPtr->servPtr;
-	pagePtr->flags = flags;
-	pagePtr->refcnt = 0;
-	pagePtr->evals = 0;
-	pagePtr->locked = 0;
-	pagePtr->cacheGen = 0;
-	pagePtr->cachePtr = NULL;
-	pagePtr->mtime = stPtr->st_mtime;
-	pagePtr->size = stPtr->st_size;
-	NsAdpParse(&pagePtr->code, itPtr->servPtr, page, flags);
+	pagePtr = NewPage(servPtr, file, stPtr, flags);
+	NsAdpParse(&pagePtr->code, servPtr, page, flags);
 	Tcl_DStringFree(&utf);
+	(void) NsAdpSaveCode(&pagePtr->code, servPtr, file, stPtr, flags,
+			     encname);
     }
 
 done:
@@ -802,6 +1374,47 @@ done:
     return pagePtr;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NewPage --
+ *
+ *	Allocate a new Page for the given file, leaving the code
+ *	to be filled in by the caller.
+ *
+ * Results:
+ *	Pointer to new Page.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Page *
+NewPage(NsServer *servPtr, char *file, struct stat *stPtr, int flags)
+{
+    Page *pagePtr;
+
+    pagePtr = ns_malloc(sizeof(Page) + strlen(file));
+    strcpy(pagePtr->file, file);
+    pagePtr->servPtr = servPtr;
+    pagePtr->hPtr = NULL;
+    pagePtr->flags = flags;
+    pagePtr->refcnt = 0;
+    pagePtr->evals = 0;
+    pagePtr->hits = 0;
+    pagePtr->misses = 0;
+    pagePtr->locked = 0;
+    pagePtr->preload = 0;
+    pagePtr->cacheGen = 0;
+    pagePtr->cachePtr = NULL;
+    pagePtr->mtime = stPtr->st_mtime;
+    pagePtr->size = stPtr->st_size;
+    return pagePtr;
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -892,7 +1505,7 @@ NsAdpLogError(NsInterp *itPtr)
 	if (objv[1] == NULL) {
 	    objv[1] = Tcl_GetObjResult(interp);
 	}
-	(void) NsAdpInclude(itPtr, 2, objv, adp, NULL);
+	(void) NsAdpInclude(itPtr, 2, objv, adp, NULL, NULL);
 	Tcl_DecrRefCount(objv[0]);
 	--itPtr->adp.errorLevel;
     }
@@ -1129,20 +1742,75 @@ FreeInterpPage(void *arg)
     FreeObjs(ipagePtr->objs);
     Ns_MutexLock(&servPtr->adp.pagelock);
     if (--pagePtr->refcnt == 0) {
-	if (pagePtr->hPtr != NULL) {
-	    Tcl_DeleteHashEntry(pagePtr->hPtr);
-	}
 	if (pagePtr->cachePtr != NULL) {
     	    FreeObjs(ipagePtr->cacheObjs);
-	    DecrCache(pagePtr->cachePtr);
 	}
-	NsAdpFreeCode(&pagePtr->code);
-	ns_free(pagePtr);
+	FreePage(pagePtr);
     }
     Ns_MutexUnlock(&servPtr->adp.pagelock);
     ns_free(ipagePtr);
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreePage --
+ *
+ *	Free a page without references, called with the page lock
+ *	held.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Page is removed from the server table if still present.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreePage(Page *pagePtr)
+{
+    if (pagePtr->hPtr != NULL) {
+	Tcl_DeleteHashEntry(pagePtr->hPtr);
+    }
+    if (pagePtr->cachePtr != NULL) {
+	DecrCache(pagePtr->cachePtr);
+    }
+    NsAdpFreeCode(&pagePtr->code);
+    ns_free(pagePtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ReleasePreload --
+ *
+ *	Release the reference held by ns_adp_compile on a page no
+ *	longer in the server table, called with the page lock held.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Page is freed if no interps reference it.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ReleasePreload(Page *pagePtr)
+{
+    if (pagePtr->preload) {
+	pagePtr->preload = 0;
+	if (--pagePtr->refcnt == 0) {
+	    FreePage(pagePtr);
+	}
+    }
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -1227,6 +1895,29 @@ DecrCache(AdpCache *cachePtr)
     }
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsAdpFreeVariant --
+ *
+ *  	Server variants cache free proc, called with the cache locked.
+ *
+ * Results:
+ *	None.
+ *
+ * Side Effects:
+ *	See DecrCache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsAdpFreeVariant(void *arg)
+{
+    DecrCache((AdpCache *) arg);
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -76,6 +76,30 @@ typedef struct Parse {
     Tcl_DString    lines;	/* Line number of block for debug messages. */
 } Parse;
 
+/*
+ * The following structure is the header of an AdpCode saved in the
+ * server compile directory.  It is followed by the null terminated
+ * source file and encoding names and the AdpCode text, including
+ * the block length and line arrays.
+ */
+
+#define CODE_MAGIC	"nsadpc1"
+#define CODE_ORDER	0x01020304
+
+typedef struct CodeHeader {
+    char	   magic[8];	/* CODE_MAGIC. */
+    int		   order;	/* CODE_ORDER in native byte order. */
+    int		   flags;	/* Parse flags, e.g., ADP_SINGLE. */
+    unsigned int   tags;	/* Signature of registered tags. */
+    int		   nblocks;	/* Number of text and script blocks. */
+    int		   nscripts;	/* Number of script blocks. */
+    int		   offset;	/* Offset of the len array in text. */
+    int		   length;	/* Length of text. */
+    int		   namelen;	/* Length of file and encoding names. */
+    Tcl_WideInt	   mtime;	/* Modify time of source file. */
+    Tcl_WideInt	   size;	/* Size of source file. */
+} CodeHeader;
+
 /*
  * Local functions defined in this file
  */
@@ -89,6 +113,10 @@ static void Blocks2Script(AdpCode *codePtr);
 static void AppendLengths(AdpCode *codePtr, int *lens, int *lines);
 static void GetTag(Tcl_DString *dsPtr, char *s, char *e, char **aPtr);
 static char *GetScript(char *tag, char *a, char *e, int *streamPtr);
+static unsigned int TagsSignature(NsServer *servPtr);
+static unsigned int HashString(unsigned int hash, char *string);
+static char *CodeFile(Tcl_DString *dsPtr, NsServer *servPtr, char *file);
+static int WriteCode(int fd, struct iovec *iov, int niov);
 
 
 /*
@@ -478,6 +506,170 @@ NsAdpFreeCode(AdpCode *codePtr)
     codePtr->len = codePtr->line = NULL;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsAdpLoadCode, NsAdpSaveCode --
+ *
+ *	Load or save the parsed AdpCode of a file in the server
+ *	compile directory.  Saved code is only loaded if the source
+ *	file modify time and size, parse flags, file encoding and
+ *	registered tags all match those used to parse the file.
+ *
+ * Results:
+ *	NS_OK if code was loaded or saved, NS_ERROR otherwise.
+ *
+ * Side effects:
+ *	On load, given AdpCode structure is initialized with a copy
+ *	of the mapped file.  On save, the file is replaced atomically,
+ *	except on Win32 where the old file is removed first, and errors
+ *	other than a missing directory are logged.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsAdpLoadCode(AdpCode *codePtr, NsServer *servPtr, char *file,
+	      struct stat *stPtr, int flags, char *encoding)
+{
+    CodeHeader *hdrPtr;
+    Tcl_DString path;
+    struct stat st;
+    char *addr, *names;
+    void *arg;
+    int fd, status;
+
+    if (servPtr->adp.compiledir == NULL) {
+	return NS_ERROR;
+    }
+    Tcl_DStringInit(&path);
+    fd = open(CodeFile(&path, servPtr, file), O_RDONLY | O_BINARY);
+    Tcl_DStringFree(&path);
+    if (fd < 0) {
+	return NS_ERROR;
+    }
+    status = NS_ERROR;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(CodeHeader)) {
+	goto done;
+    }
+    addr = NsMap(fd, 0, (size_t) st.st_size, 0, &arg);
+    if (addr == MAP_FAILED) {
+	goto done;
+    }
+    hdrPtr = (CodeHeader *) addr;
+    names = addr + sizeof(CodeHeader);
+    if (memcmp(hdrPtr->magic, CODE_MAGIC, sizeof(hdrPtr->magic)) == 0
+	    && hdrPtr->order == CODE_ORDER
+	    && hdrPtr->flags == flags
+	    && hdrPtr->mtime == (Tcl_WideInt) stPtr->st_mtime
+	    && hdrPtr->size == (Tcl_WideInt) stPtr->st_size
+	    && hdrPtr->nblocks >= 0 && hdrPtr->length >= 0
+	    && hdrPtr->offset >= 0 && (hdrPtr->offset % LENSZ) == 0
+	    && hdrPtr->offset + (hdrPtr->nblocks * LENSZ * 2)
+		<= (size_t) hdrPtr->length
+	    && st.st_size == (off_t) (sizeof(CodeHeader) + hdrPtr->namelen
+				      + hdrPtr->length)
+	    && hdrPtr->namelen == strlen(file) + strlen(encoding) + 2
+	    && STREQ(names, file)
+	    && STREQ(names + strlen(file) + 1, encoding)
+	    && hdrPtr->tags == TagsSignature(servPtr)) {
+	Tcl_DStringInit(&codePtr->text);
+	Tcl_DStringSetLength(&codePtr->text, hdrPtr->length);
+	memcpy(codePtr->text.string, names + hdrPtr->namelen,
+	       (size_t) hdrPtr->length);
+	codePtr->nblocks = hdrPtr->nblocks;
+	codePtr->nscripts = hdrPtr->nscripts;
+	codePtr->len = (int *) (codePtr->text.string + hdrPtr->offset);
+	codePtr->line = codePtr->len + codePtr->nblocks;
+	status = NS_OK;
+    }
+    NsUnMap(addr, arg);
+
+done:
+    close(fd);
+    return status;
+}
+
+int
+NsAdpSaveCode(AdpCode *codePtr, NsServer *servPtr, char *file,
+	      struct stat *stPtr, int flags, char *encoding)
+{
+    CodeHeader hdr;
+    Tcl_DString path, tmp;
+    struct iovec iov[4];
+    int fd, status;
+    size_t len;
+
+    if (servPtr->adp.compiledir == NULL) {
+	return NS_ERROR;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CODE_MAGIC, sizeof(hdr.magic));
+    hdr.order = CODE_ORDER;
+    hdr.flags = flags;
+    hdr.tags = TagsSignature(servPtr);
+    hdr.nblocks = codePtr->nblocks;
+    hdr.nscripts = codePtr->nscripts;
+    hdr.offset = (char *) codePtr->len - codePtr->text.string;
+    hdr.length = codePtr->text.length;
+    hdr.namelen = strlen(file) + strlen(encoding) + 2;
+    hdr.mtime = stPtr->st_mtime;
+    hdr.size = stPtr->st_size;
+    iov[0].iov_base = (void *) &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = file;
+    iov[1].iov_len = strlen(file) + 1;
+    iov[2].iov_base = encoding;
+    iov[2].iov_len = strlen(encoding) + 1;
+    iov[3].iov_base = codePtr->text.string;
+    iov[3].iov_len = codePtr->text.length;
+    len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len + iov[3].iov_len;
+
+    Tcl_DStringInit(&path);
+    Tcl_DStringInit(&tmp);
+    CodeFile(&path, servPtr, file);
+    Tcl_DStringAppend(&tmp, path.string, path.length);
+    Tcl_DStringAppend(&tmp, ".XXXXXX", -1);
+    status = NS_ERROR;
+#ifdef _WIN32
+    fd = -1;
+    if (_mktemp(tmp.string) != NULL) {
+	fd = open(tmp.string, O_WRONLY | O_CREAT | O_EXCL | O_BINARY,
+		  _S_IREAD | _S_IWRITE);
+    }
+#else
+    fd = mkstemp(tmp.string);
+#endif
+    if (fd < 0) {
+	if (errno != ENOENT) {
+	    Ns_Log(Error, "adp: mkstemp(%s) failed: %s", tmp.string,
+		   strerror(errno));
+	}
+    } else {
+	if (WriteCode(fd, iov, 4) != (int) len) {
+	    Ns_Log(Error, "adp: write(%s) failed: %s", tmp.string,
+		   strerror(errno));
+	    close(fd);
+	} else if (close(fd) != 0
+#ifdef _WIN32
+		   || (unlink(path.string) != 0 && errno != ENOENT)
+#endif
+		   || rename(tmp.string, path.string) != 0) {
+	    Ns_Log(Error, "adp: rename(%s, %s) failed: %s", tmp.string,
+		   path.string, strerror(errno));
+	} else {
+	    status = NS_OK;
+	}
+	if (status != NS_OK) {
+	    unlink(tmp.string);
+	}
+    }
+    Tcl_DStringFree(&tmp);
+    Tcl_DStringFree(&path);
+    return status;
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -873,3 +1065,138 @@ AppendLengths(AdpCode *codePtr, int *len, int *line)
     memcpy(codePtr->len,  len, (size_t) ncopy);
     memcpy(codePtr->line, line, (size_t) ncopy);
 }
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CodeFile --
+ *
+ *	Construct the name of the compiled code file for a source
+ *	file, a hash of the full source path in the compile directory.
+ *
+ * Results:
+ *	Pointer to dstring string.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+CodeFile(Tcl_DString *dsPtr, NsServer *servPtr, char *file)
+{
+    Ns_DStringPrintf(dsPtr, "%s/%08x.adpc", servPtr->adp.compiledir,
+		     HashString(0, file));
+    return dsPtr->string;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriteCode --
+ *
+ *	Write the buffers of a compiled code file, with writev where
+ *	available.
+ *
+ * Results:
+ *	Number of bytes written or -1 on error.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+WriteCode(int fd, struct iovec *iov, int niov)
+{
+#ifdef _WIN32
+    int i, n, nwrote;
+
+    nwrote = 0;
+    for (i = 0; i < niov; ++i) {
+	n = write(fd, iov[i].iov_base, (unsigned int) iov[i].iov_len);
+	if (n < 0) {
+	    return -1;
+	}
+	nwrote += n;
+	if (n != (int) iov[i].iov_len) {
+	    break;
+	}
+    }
+    return nwrote;
+#else
+    return (int) writev(fd, iov, niov);
+#endif
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TagsSignature --
+ *
+ *	Compute a signature of the registered tags which determine
+ *	the result of parsing, independent of registration order.
+ *
+ * Results:
+ *	Signature value.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static unsigned int
+TagsSignature(NsServer *servPtr)
+{
+    Tcl_HashSearch search;
+    Tcl_HashEntry *hPtr;
+    Tag *tagPtr;
+    unsigned int sig, hash;
+
+    sig = 0;
+    Ns_RWLockRdLock(&servPtr->adp.taglock);
+    hPtr = Tcl_FirstHashEntry(&servPtr->adp.tags, &search);
+    while (hPtr != NULL) {
+	tagPtr = Tcl_GetHashValue(hPtr);
+	hash = HashString((unsigned int) tagPtr->type, tagPtr->tag);
+	hash = HashString(hash, tagPtr->endtag ? tagPtr->endtag : "");
+	sig += HashString(hash, tagPtr->string);
+	hPtr = Tcl_NextHashEntry(&search);
+    }
+    Ns_RWLockUnlock(&servPtr->adp.taglock);
+    return sig;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HashString --
+ *
+ *	Continue an FNV-1a hash of the given string.
+ *
+ * Results:
+ *	Hash value.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static unsigned int
+HashString(unsigned int hash, char *string)
+{
+    hash ^= 2166136261U;
+    while (*string != '\0') {
+	hash ^= UCHAR(*string++);
+	hash *= 16777619U;
+    }
+    return hash;
+}
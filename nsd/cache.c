@@ -54,15 +54,37 @@ typedef struct Entry {
     Ns_Time mtime;
     size_t size;
     void *value;
+    int list;			/* Index of list holding the entry. */
+    unsigned int hash;		/* Key hash for frequency sketch. */
 } Entry;
 
+/*
+ * The following structure defines a list of entries in order
+ * of use, most recent first.  Caches use the LIST_WINDOW list
+ * for LRU, the LIST_PROBATION and LIST_PROTECTED lists for
+ * 2Q, i.e., segmented LRU, and all three for TinyLFU which
+ * places new entries in a small LRU window before admitting
+ * them to the segmented lists.
+ */
+
+#define LIST_WINDOW	0
+#define LIST_PROBATION	1
+#define LIST_PROTECTED	2
+#define LIST_MAX	3
+
+typedef struct List {
+    Entry *firstPtr;
+    Entry *lastPtr;
+    size_t size;
+} List;
+
 /*
  * The following structure defines a cache
  */
 
 typedef struct Cache {
-    Entry *firstEntryPtr;
-    Entry *lastEntryPtr;
+    List lists[LIST_MAX];
+    int policy;
     Tcl_HashEntry *hPtr;
     int keys;
     time_t timeout;
@@ -76,20 +98,72 @@ typedef struct Cache {
     unsigned int nhit;
     unsigned int nmiss;
     unsigned int nflush;
+    unsigned int nevict;	/* Entries pruned for size. */
+    unsigned int nreject;	/* New entries not admitted by TinyLFU. */
+    unsigned char *sketch;	/* TinyLFU frequency counters. */
+    unsigned int sketchMask;
+    unsigned int sketchAdds;
     Tcl_HashTable entriesTable;
+    struct Cache *parentPtr;	/* Sharded cache of a shard. */
+    struct Cache **shards;	/* Shards of a sharded cache. */
+    int nshards;
+    int shard;			/* Index of a shard in its parent. */
     char    name[1];
 } Cache;
 
+/*
+ * Maximum number of shards of a sharded cache.
+ */
+
+#define MAX_SHARDS 256
+
+/*
+ * The TinyLFU frequency sketch has SKETCH_ROWS rows of counters
+ * saturating at SKETCH_MAX which are halved after SKETCH_AGE
+ * times the row width additions to age old frequencies.
+ */
+
+#define SKETCH_ROWS	4
+#define SKETCH_MAX	15
+#define SKETCH_AGE	10
+#define SKETCH_INDEX(c,h,i) ((((h) * seeds[(i)]) >> 16) & (c)->sketchMask)
+
 
 /*
  * Local functions defined in this file
  */
 
 static Ns_Cache * CacheCreate(char *name, int keys, time_t timeout,
-			      size_t maxSize, Ns_Callback *freeProc);
+			      size_t maxSize, Ns_Callback *freeProc,
+			      int nshards, int policy);
+static Cache *NewCache(char *name, int keys, time_t timeout, size_t maxSize,
+		       Ns_Callback *freeProc, int policy);
+static void FreeCache(Cache *cachePtr);
+static unsigned int HashKey(int keys, char *key);
+static Ns_Entry *NextShard(Ns_CacheSearch *search, Tcl_HashEntry *hPtr);
+static void WakeParent(Cache *cachePtr, int all);
 static int GetCache(Tcl_Interp *interp, char *name, Cache **cachePtrPtr);
 static void Delink(Entry *ePtr);
 static void Push(Entry *ePtr);
+static void Touch(Entry *ePtr);
+static void Prune(Cache *cachePtr, Entry *keepPtr);
+static Entry *Tail(Cache *cachePtr, int list, Entry *keepPtr);
+static void SketchAdd(Cache *cachePtr, unsigned int hash);
+static int SketchGet(Cache *cachePtr, unsigned int hash);
+
+/*
+ * Names of the eviction policies, indexed by NS_CACHE_LRU, etc.
+ */
+
+static char *policies[] = {"lru", "2q", "tinylfu", NULL};
+
+/*
+ * Multipliers to index each row of a frequency sketch.
+ */
+
+static unsigned int seeds[SKETCH_ROWS] = {
+    0x9e3779b1U, 0x85ebca77U, 0xc2b2ae3dU, 0x27d4eb2fU
+};
 
 /*
  * Static variables defined in this file
@@ -143,7 +217,7 @@ NsInitCache(void)
 Ns_Cache *
 Ns_CacheCreate(char *name, int keys, time_t timeout, Ns_Callback *freeProc)
 {
-    return CacheCreate(name, keys, timeout, 0, freeProc);
+    return CacheCreate(name, keys, timeout, 0, freeProc, 1, NS_CACHE_LRU);
 }
 
 
@@ -166,7 +240,137 @@ Ns_CacheCreate(char *name, int keys, time_t timeout, Ns_Callback *freeProc)
 Ns_Cache *
 Ns_CacheCreateSz(char *name, int keys, size_t maxSize, Ns_Callback *freeProc)
 {
-    return CacheCreate(name, keys, -1, maxSize, freeProc);
+    return CacheCreate(name, keys, -1, maxSize, freeProc, 1, NS_CACHE_LRU);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CacheCreateSharded --
+ *
+ *	Create a size based cache partitioned by key hash into nshards,
+ *	rounded up to a power of two, each with its own lock, condition,
+ *	LRU list and an equal part of maxSize.  The cache may be used
+ *	through the ordinary API but threads hold a single shard lock
+ *	only when using the cache returned by Ns_CacheShard for a key.
+ *
+ * Results:
+ *	See CacheCreate()
+ *
+ * Side effects:
+ *	See CacheCreate()
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_Cache *
+Ns_CacheCreateSharded(char *name, int keys, size_t maxSize,
+		      Ns_Callback *freeProc, int nshards)
+{
+    return CacheCreate(name, keys, -1, maxSize, freeProc, nshards,
+		       NS_CACHE_LRU);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CacheCreateEx --
+ *
+ *	Create a size based, optionally sharded, cache with the given
+ *	eviction policy:
+ *
+ *	NS_CACHE_LRU:	    Evict the least recently used entry.
+ *	NS_CACHE_2Q:	    Segmented LRU where entries hit while on
+ *			    probation are protected from eviction
+ *			    until pushed out of the protected 80%.
+ *	NS_CACHE_TINYLFU:   New entries enter a 1% LRU window and are
+ *			    admitted to the 2Q segments only if used
+ *			    more often, as estimated by a frequency
+ *			    sketch of recent lookups, than the entry
+ *			    which would otherwise be evicted.
+ *
+ *	Both 2Q and TinyLFU keep the working set through scans which
+ *	would flush an LRU cache.
+ *
+ * Results:
+ *	See CacheCreate()
+ *
+ * Side effects:
+ *	See CacheCreate()
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_Cache *
+Ns_CacheCreateEx(char *name, int keys, size_t maxSize, Ns_Callback *freeProc,
+		 int nshards, int policy)
+{
+    return CacheCreate(name, keys, -1, maxSize, freeProc, nshards, policy);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CacheGetPolicy --
+ *
+ *	Get the eviction policy for the given name, i.e., "lru", "2q",
+ *	or "tinylfu".
+ *
+ * Results:
+ *	NS_CACHE_LRU, etc. or -1 if name is not valid.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ns_CacheGetPolicy(char *policy)
+{
+    int i;
+
+    for (i = 0; policies[i] != NULL; ++i) {
+	if (STRIEQ(policy, policies[i])) {
+	    return i;
+	}
+    }
+    return -1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CacheShard --
+ *
+ *	Return the shard of a sharded cache for the given key. The
+ *	shard may be locked, searched, waited on and signaled for the
+ *	key as any other cache.
+ *
+ * Results:
+ *	Pointer to the shard or the given cache if not sharded.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_Cache *
+Ns_CacheShard(Ns_Cache *cache, char *key)
+{
+    Cache *cachePtr = (Cache *) cache;
+    unsigned int i;
+
+    if (cachePtr->nshards > 1) {
+	i = HashKey(cachePtr->keys, key) & (cachePtr->nshards - 1);
+	cache = (Ns_Cache *) cachePtr->shards[i];
+    }
+    return cache;
 }
 
 
@@ -190,6 +394,7 @@ void
 Ns_CacheDestroy(Ns_Cache *cache)
 {
     Cache *cachePtr = (Cache *) cache;
+    int i;
 
     /*
      * Unschedule the flusher if time-based cache.
@@ -228,10 +433,13 @@ Ns_CacheDestroy(Ns_Cache *cache)
     }
     Ns_MutexUnlock(&lock);
 
-    Ns_MutexDestroy(&cachePtr->lock);
-    Ns_CondDestroy(&cachePtr->cond);
-    Tcl_DeleteHashTable(&cachePtr->entriesTable);
-    ns_free(cachePtr);
+    if (cachePtr->nshards > 1) {
+	for (i = 0; i < cachePtr->nshards; ++i) {
+	    FreeCache(cachePtr->shards[i]);
+	}
+	ns_free(cachePtr->shards);
+    }
+    FreeCache(cachePtr);
 }
 
 
@@ -325,7 +533,8 @@ Ns_CacheFree(Ns_Cache *cache, void *ptr)
  *	A pointer to an Ns_Entry cache entry 
  *
  * Side effects:
- *	The cache entry will move to the top of the LRU list. 
+ *	The cache entry will move to the top of the LRU list or be
+ *	promoted according to the cache policy.
  *
  *----------------------------------------------------------------------
  */
@@ -337,6 +546,12 @@ Ns_CacheFindEntry(Ns_Cache *cache, char *key)
     Tcl_HashEntry *hPtr;
     Entry *ePtr;
 
+    if (cachePtr->nshards > 1) {
+	return Ns_CacheFindEntry(Ns_CacheShard(cache, key), key);
+    }
+    if (cachePtr->sketch != NULL) {
+	SketchAdd(cachePtr, HashKey(cachePtr->keys, key));
+    }
     hPtr = Tcl_FindHashEntry(&cachePtr->entriesTable, key);
     if (hPtr == NULL) {
 	++cachePtr->nmiss;
@@ -344,8 +559,7 @@ Ns_CacheFindEntry(Ns_Cache *cache, char *key)
     }
     ++cachePtr->nhit;
     ePtr = Tcl_GetHashValue(hPtr);
-    Delink(ePtr);
-    Push(ePtr);
+    Touch(ePtr);
     
     return (Ns_Entry *) ePtr;
 }
@@ -375,20 +589,35 @@ Ns_CacheCreateEntry(Ns_Cache *cache, char *key, int *newPtr)
     Cache *cachePtr = (Cache *) cache;
     Tcl_HashEntry *hPtr;
     Entry *ePtr;
+    unsigned int hash;
 
+    if (cachePtr->nshards > 1) {
+	return Ns_CacheCreateEntry(Ns_CacheShard(cache, key), key, newPtr);
+    }
+    hash = 0;
+    if (cachePtr->sketch != NULL) {
+	hash = HashKey(cachePtr->keys, key);
+	SketchAdd(cachePtr, hash);
+    }
     hPtr = Tcl_CreateHashEntry(&cachePtr->entriesTable, key, newPtr);
     if (*newPtr == 0) {
 	ePtr = Tcl_GetHashValue(hPtr);
-    	Delink(ePtr);
+	Touch(ePtr);
 	++cachePtr->nhit;
     } else {
 	ePtr = ns_calloc(1, sizeof(Entry));
 	ePtr->hPtr = hPtr;
 	ePtr->cachePtr = cachePtr;
+	ePtr->hash = hash;
+	if (cachePtr->policy == NS_CACHE_2Q) {
+	    ePtr->list = LIST_PROBATION;
+	} else {
+	    ePtr->list = LIST_WINDOW;
+	}
 	Tcl_SetHashValue(hPtr, ePtr);
+	Push(ePtr);
 	++cachePtr->nmiss;
     }
-    Push(ePtr);
     
     return (Ns_Entry *) ePtr;
 }
@@ -415,6 +644,9 @@ Ns_CacheName(Ns_Entry *entry)
 {
     Entry *ePtr = (Entry *) entry;
 
+    if (ePtr->cachePtr->parentPtr != NULL) {
+	return ePtr->cachePtr->parentPtr->name;
+    }
     return ePtr->cachePtr->name;
 }
 
@@ -520,11 +752,9 @@ Ns_CacheSetValueSz(Ns_Entry *entry, void *value, size_t size)
     ePtr->value = value;
     ePtr->size = size;
     cachePtr->currentSize += size;
+    cachePtr->lists[ePtr->list].size += size;
     if (ePtr->cachePtr->maxSize > 0) {
-	while (cachePtr->currentSize > cachePtr->maxSize &&
-	    cachePtr->lastEntryPtr != ePtr) {
-	    Ns_CacheFlushEntry((Ns_Entry *) cachePtr->lastEntryPtr);
-	}
+	Prune(cachePtr, ePtr);
     }
 }
 
@@ -555,6 +785,7 @@ Ns_CacheUnsetValue(Ns_Entry *entry)
     if (ePtr->value != NULL) {
 	cachePtr = ePtr->cachePtr;
 	cachePtr->currentSize -= ePtr->size;
+	cachePtr->lists[ePtr->list].size -= ePtr->size;
 	if (cachePtr->freeProc == NS_CACHE_FREE) {
 	    Ns_CacheFree((Ns_Cache *) cachePtr, ePtr->value);
 	} else if (cachePtr->freeProc != NULL) {
@@ -641,15 +872,14 @@ Ns_CacheFlushEntry(Ns_Entry *entry)
 Ns_Entry *
 Ns_CacheFirstEntry(Ns_Cache *cache, Ns_CacheSearch *search)
 {
-    Tcl_HashSearch *sPtr = (Tcl_HashSearch *) search;
     Cache *cachePtr = (Cache *) cache;
     Tcl_HashEntry *hPtr;
 
-    hPtr = Tcl_FirstHashEntry(&cachePtr->entriesTable, sPtr);
-    if (hPtr == NULL) {
-	return NULL;
+    if (cachePtr->nshards > 1) {
+	cachePtr = cachePtr->shards[0];
     }
-    return (Ns_Entry *) Tcl_GetHashValue(hPtr);
+    hPtr = Tcl_FirstHashEntry(&cachePtr->entriesTable, search);
+    return NextShard(search, hPtr);
 }
 
 
@@ -673,14 +903,7 @@ Ns_CacheFirstEntry(Ns_Cache *cache, Ns_CacheSearch *search)
 Ns_Entry *
 Ns_CacheNextEntry(Ns_CacheSearch *search)
 {
-    Tcl_HashSearch *sPtr = (Tcl_HashSearch *) search;
-    Tcl_HashEntry *hPtr;
-
-    hPtr = Tcl_NextHashEntry(sPtr);
-    if (hPtr == NULL) {
-	return NULL;
-    }
-    return (Ns_Entry *) Tcl_GetHashValue(hPtr);
+    return NextShard(search, Tcl_NextHashEntry(search));
 }
 
 
@@ -719,7 +942,7 @@ Ns_CacheFlush(Ns_Cache *cache)
  *
  * Ns_CacheLock --
  *
- *	Lock the cache
+ *	Lock the cache, i.e., every shard of a sharded cache.
  *
  * Results:
  *      None.
@@ -734,8 +957,15 @@ void
 Ns_CacheLock(Ns_Cache *cache)
 {
     Cache *cachePtr = (Cache *) cache;
+    int i;
 
-    Ns_MutexLock(&cachePtr->lock);
+    if (cachePtr->nshards > 1) {
+	for (i = 0; i < cachePtr->nshards; ++i) {
+	    Ns_MutexLock(&cachePtr->shards[i]->lock);
+	}
+    } else {
+	Ns_MutexLock(&cachePtr->lock);
+    }
 }
 
 
@@ -759,7 +989,19 @@ int
 Ns_CacheTryLock(Ns_Cache *cache)
 {
     Cache *cachePtr = (Cache *) cache;
-
+    int i;
+
+    if (cachePtr->nshards > 1) {
+	for (i = 0; i < cachePtr->nshards; ++i) {
+	    if (Ns_MutexTryLock(&cachePtr->shards[i]->lock) != NS_OK) {
+		while (--i >= 0) {
+		    Ns_MutexUnlock(&cachePtr->shards[i]->lock);
+		}
+		return NS_TIMEOUT;
+	    }
+	}
+	return NS_OK;
+    }
     return Ns_MutexTryLock(&cachePtr->lock);
 }
 
@@ -784,8 +1026,15 @@ void
 Ns_CacheUnlock(Ns_Cache *cache)
 {
     Cache *cachePtr = (Cache *) cache;
+    int i;
 
-    Ns_MutexUnlock(&cachePtr->lock);
+    if (cachePtr->nshards > 1) {
+	for (i = cachePtr->nshards - 1; i >= 0; --i) {
+	    Ns_MutexUnlock(&cachePtr->shards[i]->lock);
+	}
+    } else {
+	Ns_MutexUnlock(&cachePtr->lock);
+    }
 }
 
 
@@ -797,6 +1046,11 @@ Ns_CacheUnlock(Ns_Cache *cache)
  *	Wait for the cache's condition variable to be
  *  	signaled or the given absolute timeout if timePtr is not NULL.
  *
+ *	A sharded cache, locked with Ns_CacheLock, waits on its own
+ *	mutex and condition which every shard signals under the same
+ *	mutex.  The mutex is locked before the shard locks are
+ *	released so a wakeup from any shard cannot be lost.
+ *
  * Results:
  *	None.
  *
@@ -810,7 +1064,20 @@ int
 Ns_CacheTimedWait(Ns_Cache *cache, Ns_Time *timePtr)
 {
     Cache *cachePtr = (Cache *) cache;
+    int i, status;
     
+    if (cachePtr->nshards > 1) {
+	Ns_MutexLock(&cachePtr->lock);
+	for (i = cachePtr->nshards - 1; i >= 0; --i) {
+	    Ns_MutexUnlock(&cachePtr->shards[i]->lock);
+	}
+	status = Ns_CondTimedWait(&cachePtr->cond, &cachePtr->lock, timePtr);
+	Ns_MutexUnlock(&cachePtr->lock);
+	for (i = 0; i < cachePtr->nshards; ++i) {
+	    Ns_MutexLock(&cachePtr->shards[i]->lock);
+	}
+	return status;
+    }
     return Ns_CondTimedWait(&cachePtr->cond, &cachePtr->lock, timePtr);
 }
 
@@ -848,13 +1115,16 @@ Ns_CacheWait(Ns_Cache *cache)
  *  	thread (if any).
  *
  *  	NOTE:  Be sure you don't really want to wake all threads with
- *  	Ns_CacheBroadcast.
+ *  	Ns_CacheBroadcast.  Signaling a shard also wakes one thread
+ *  	waiting on the whole sharded cache, and signaling a sharded
+ *  	cache wakes one thread waiting on it and one waiting on each
+ *  	shard, as their waits may depend on any of the shards.
  *
  * Results:
  *	None.
  *
  * Side effects:
- *	A single thread may resume.
+ *	A single thread, or one per condition as above, may resume.
  *
  *----------------------------------------------------------------------
  */
@@ -863,8 +1133,19 @@ void
 Ns_CacheSignal(Ns_Cache *cache)
 {
     Cache *cachePtr = (Cache *) cache;
+    int i;
     
-    Ns_CondSignal(&cachePtr->cond);
+    if (cachePtr->nshards > 1) {
+	for (i = 0; i < cachePtr->nshards; ++i) {
+	    Ns_CondSignal(&cachePtr->shards[i]->cond);
+	}
+	WakeParent(cachePtr, 0);
+    } else {
+	Ns_CondSignal(&cachePtr->cond);
+	if (cachePtr->parentPtr != NULL) {
+	    WakeParent(cachePtr->parentPtr, 0);
+	}
+    }
 }
 
 
@@ -874,7 +1155,8 @@ Ns_CacheSignal(Ns_Cache *cache)
  * Ns_CacheBroadcast --
  *
  *	Broadcast the cache's condition variable, waking all waiting
- *  	threads (if any).
+ *  	threads (if any), including threads waiting on the other
+ *	shards or the whole of a sharded cache.
  *
  * Results:
  *	None.
@@ -889,8 +1171,19 @@ void
 Ns_CacheBroadcast(Ns_Cache *cache)
 {
     Cache *cachePtr = (Cache *) cache;
+    int i;
     
-    Ns_CondBroadcast(&cachePtr->cond);
+    if (cachePtr->nshards > 1) {
+	for (i = 0; i < cachePtr->nshards; ++i) {
+	    Ns_CondBroadcast(&cachePtr->shards[i]->cond);
+	}
+	WakeParent(cachePtr, 1);
+    } else {
+	Ns_CondBroadcast(&cachePtr->cond);
+	if (cachePtr->parentPtr != NULL) {
+	    WakeParent(cachePtr->parentPtr, 1);
+	}
+    }
 }
 
 
@@ -978,9 +1271,10 @@ NsTclCacheNamesCmd(ClientData dummy, Tcl_Interp *interp, int argc, char **argv)
 int
 NsTclCacheStatsCmd(ClientData dummy, Tcl_Interp *interp, int argc, char **argv)
 {
-    Cache *cachePtr;
-    char buf[200];
-    int entries, flushed, hits, misses, total, hitrate;
+    Cache *cachePtr, *shardPtr;
+    char buf[200], key[20];
+    int i, nshards, entries, flushed, hits, misses, evicted, rejected;
+    int total, hitrate;
 
     if (argc != 2 && argc != 3) {
 	Tcl_AppendResult(interp, "wrong # args: should be \"",
@@ -990,19 +1284,33 @@ NsTclCacheStatsCmd(ClientData dummy, Tcl_Interp *interp, int argc, char **argv)
     if (GetCache(interp, argv[1], &cachePtr) != TCL_OK) {
     	return TCL_ERROR;
     }
-    Ns_MutexLock(&cachePtr->lock);
-    entries = cachePtr->entriesTable.numEntries;
-    flushed = cachePtr->nflush;
-    hits = cachePtr->nhit;
-    misses = cachePtr->nmiss;
-    total = cachePtr->nhit + cachePtr->nmiss;
-    hitrate = (total ? (cachePtr->nhit * 100) / total : 0);
-    Ns_MutexUnlock(&cachePtr->lock);
+    nshards = cachePtr->nshards;
+    entries = flushed = hits = misses = evicted = rejected = 0;
+    for (i = 0; i < nshards; ++i) {
+	shardPtr = (nshards > 1 ? cachePtr->shards[i] : cachePtr);
+	Ns_MutexLock(&shardPtr->lock);
+	entries += shardPtr->entriesTable.numEntries;
+	flushed += shardPtr->nflush;
+	hits += shardPtr->nhit;
+	misses += shardPtr->nmiss;
+	evicted += shardPtr->nevict;
+	rejected += shardPtr->nreject;
+	Ns_MutexUnlock(&shardPtr->lock);
+    }
+    total = hits + misses;
+    hitrate = (total ? (hits * 100) / total : 0);
 
     if (argc == 2) {
 	sprintf(buf,
-	    "entries: %d  flushed: %d  hits: %d  misses: %d  hitrate: %d",
-	    entries, flushed, hits, misses, hitrate);
+	    "entries: %d  flushed: %d  hits: %d  misses: %d  hitrate: %d"
+	    "  evicted: %d  policy: %s", entries, flushed, hits, misses,
+	    hitrate, evicted, policies[cachePtr->policy]);
+	if (cachePtr->policy == NS_CACHE_TINYLFU) {
+	    sprintf(buf + strlen(buf), "  rejected: %d", rejected);
+	}
+	if (nshards > 1) {
+	    sprintf(buf + strlen(buf), "  shards: %d", nshards);
+	}
 	Tcl_SetResult(interp, buf, TCL_VOLATILE);
     } else {
     	sprintf(buf, "%d", entries);
@@ -1030,6 +1338,51 @@ NsTclCacheStatsCmd(ClientData dummy, Tcl_Interp *interp, int argc, char **argv)
 			TCL_LEAVE_ERR_MSG) == NULL) {
 	    return TCL_ERROR;
         }
+    	sprintf(buf, "%d", evicted);
+    	if (Tcl_SetVar2(interp, argv[2], "evicted", buf,
+			TCL_LEAVE_ERR_MSG) == NULL) {
+	    return TCL_ERROR;
+        }
+    	sprintf(buf, "%d", rejected);
+    	if (Tcl_SetVar2(interp, argv[2], "rejected", buf,
+			TCL_LEAVE_ERR_MSG) == NULL) {
+	    return TCL_ERROR;
+        }
+    	if (Tcl_SetVar2(interp, argv[2], "policy",
+			policies[cachePtr->policy],
+			TCL_LEAVE_ERR_MSG) == NULL) {
+	    return TCL_ERROR;
+        }
+
+	/*
+	 * Add the stats of each shard of a sharded cache as
+	 * elements shard0, shard1, etc.
+	 */
+
+	if (nshards > 1) {
+	    sprintf(buf, "%d", nshards);
+	    if (Tcl_SetVar2(interp, argv[2], "shards", buf,
+			    TCL_LEAVE_ERR_MSG) == NULL) {
+		return TCL_ERROR;
+	    }
+	    for (i = 0; i < nshards; ++i) {
+		shardPtr = cachePtr->shards[i];
+		Ns_MutexLock(&shardPtr->lock);
+		total = shardPtr->nhit + shardPtr->nmiss;
+		sprintf(buf, "entries: %d  flushed: %d  hits: %d  misses: %d"
+		    "  hitrate: %d  evicted: %d",
+		    shardPtr->entriesTable.numEntries, shardPtr->nflush,
+		    shardPtr->nhit, shardPtr->nmiss,
+		    total ? (shardPtr->nhit * 100) / total : 0,
+		    shardPtr->nevict);
+		Ns_MutexUnlock(&shardPtr->lock);
+		sprintf(key, "shard%d", i);
+		if (Tcl_SetVar2(interp, argv[2], key, buf,
+				TCL_LEAVE_ERR_MSG) == NULL) {
+		    return TCL_ERROR;
+		}
+	    }
+	}
     }
 
     return TCL_OK;
@@ -1073,6 +1426,9 @@ NsTclCacheFlushCmd(ClientData dummy, Tcl_Interp *interp, int argc, char **argv)
 	return TCL_ERROR;
     }
     cache = (Ns_Cache *) cachePtr;
+    if (argc > 2) {
+	cache = Ns_CacheShard(cache, argv[2]);
+    }
     Ns_CacheLock(cache);
     if (argc == 2) {
 	Ns_CacheFlush(cache);
@@ -1109,9 +1465,10 @@ NsTclCacheFlushCmd(ClientData dummy, Tcl_Interp *interp, int argc, char **argv)
 int
 NsTclCacheSizeCmd(ClientData dummy, Tcl_Interp *interp, int argc, char **argv)
 {
-    Cache *cachePtr;
+    Cache *cachePtr, *shardPtr;
     size_t maxSize, currentSize;
     char buf[200];
+    int i;
     
     if (argc != 2) {
 	Tcl_AppendResult(interp, "wrong # args: should be \"",
@@ -1121,10 +1478,14 @@ NsTclCacheSizeCmd(ClientData dummy, Tcl_Interp *interp, int argc, char **argv)
     if (GetCache(interp, argv[1], &cachePtr) != TCL_OK) {
     	return TCL_ERROR;
     }
-    Ns_MutexLock(&cachePtr->lock);
-    maxSize = cachePtr->maxSize;
-    currentSize = cachePtr->currentSize;
-    Ns_MutexUnlock(&cachePtr->lock);
+    maxSize = currentSize = 0;
+    for (i = 0; i < cachePtr->nshards; ++i) {
+	shardPtr = (cachePtr->nshards > 1 ? cachePtr->shards[i] : cachePtr);
+	Ns_MutexLock(&shardPtr->lock);
+	maxSize += shardPtr->maxSize;
+	currentSize += shardPtr->currentSize;
+	Ns_MutexUnlock(&shardPtr->lock);
+    }
     sprintf(buf, "%ld %ld", (long) maxSize, (long) currentSize);
     Tcl_SetResult(interp, buf, TCL_VOLATILE);
     return TCL_OK;
@@ -1218,27 +1579,43 @@ NsTclCacheKeysCmd(ClientData dummy, Tcl_Interp *interp, int argc, char **argv)
 
 static Ns_Cache *
 CacheCreate(char *name, int keys, time_t timeout, size_t maxSize,
-	    Ns_Callback *freeProc)
+	    Ns_Callback *freeProc, int nshards, int policy)
 {
-    Cache *cachePtr;
-    int new;
+    Cache *cachePtr, *shardPtr;
+    Tcl_DString ds;
+    int i, n, new;
 
-    cachePtr = ns_calloc(1, sizeof(Cache) + strlen(name));
-    cachePtr->freeProc = freeProc;
-    cachePtr->timeout = timeout;
-    cachePtr->maxSize = maxSize;
-    cachePtr->currentSize = 0;
-    cachePtr->keys = keys;
-    strcpy(cachePtr->name, name);
-    cachePtr->nflush = cachePtr->nhit = cachePtr->nmiss = 0;
-    Ns_MutexSetName2(&cachePtr->lock, "ns:cache", name);
-    Tcl_InitHashTable(&cachePtr->entriesTable, keys);
+    if (timeout > 0 || maxSize == 0
+	    || policy < NS_CACHE_LRU || policy > NS_CACHE_TINYLFU) {
+	policy = NS_CACHE_LRU;
+    }
+    cachePtr = NewCache(name, keys, timeout, maxSize, freeProc,
+			nshards > 1 ? NS_CACHE_LRU : policy);
+    if (nshards > 1) {
+	n = 2;
+	while (n < nshards && n < MAX_SHARDS) {
+	    n <<= 1;
+	}
+	if (maxSize > 0) {
+	    maxSize = _MAX(maxSize / n, 1);
+	}
+	cachePtr->nshards = n;
+	cachePtr->shards = ns_malloc(sizeof(Cache *) * n);
+	Tcl_DStringInit(&ds);
+	for (i = 0; i < n; ++i) {
+	    Tcl_DStringTrunc(&ds, 0);
+	    Ns_DStringPrintf(&ds, "%s:%d", name, i);
+	    shardPtr = NewCache(ds.string, keys, -1, maxSize, freeProc, policy);
+	    shardPtr->parentPtr = cachePtr;
+	    shardPtr->shard = i;
+	    cachePtr->shards[i] = shardPtr;
+	}
+	Tcl_DStringFree(&ds);
+	cachePtr->policy = policy;
+    }
     if (timeout > 0) {
     	cachePtr->schedId = Ns_ScheduleProc(NsCachePurge, cachePtr, 0, timeout);
-    } else {
-    	cachePtr->schedId = -1;
     }
-    cachePtr->schedStop = 0;
     Ns_MutexLock(&lock);
     cachePtr->hPtr = Tcl_CreateHashEntry(&caches, name, &new);
     if (!new) {
@@ -1253,6 +1630,210 @@ CacheCreate(char *name, int keys, time_t timeout, size_t maxSize,
     return (Ns_Cache *) cachePtr;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NewCache --
+ *
+ *	Allocate and initialize a cache or cache shard with the given
+ *	eviction policy.
+ *
+ * Results:
+ *	A pointer to the new cache.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Cache *
+NewCache(char *name, int keys, time_t timeout, size_t maxSize,
+	 Ns_Callback *freeProc, int policy)
+{
+    Cache *cachePtr;
+    unsigned int n;
+
+    cachePtr = ns_calloc(1, sizeof(Cache) + strlen(name));
+    cachePtr->freeProc = freeProc;
+    cachePtr->timeout = timeout;
+    cachePtr->maxSize = maxSize;
+    cachePtr->currentSize = 0;
+    cachePtr->keys = keys;
+    strcpy(cachePtr->name, name);
+    cachePtr->nflush = cachePtr->nhit = cachePtr->nmiss = 0;
+    Ns_MutexSetName2(&cachePtr->lock, "ns:cache", name);
+    Tcl_InitHashTable(&cachePtr->entriesTable, keys);
+    cachePtr->schedId = -1;
+    cachePtr->schedStop = 0;
+    cachePtr->nshards = 1;
+    cachePtr->policy = policy;
+    if (policy == NS_CACHE_TINYLFU) {
+	/*
+	 * Size the sketch rows assuming entries average 256 bytes.
+	 */
+
+	n = 256;
+	while (n < maxSize / 256 && n < 16384) {
+	    n <<= 1;
+	}
+	cachePtr->sketchMask = n - 1;
+	cachePtr->sketch = ns_calloc(SKETCH_ROWS, n);
+    }
+    return cachePtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreeCache --
+ *
+ *	Free a cache or cache shard after all entries are flushed.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreeCache(Cache *cachePtr)
+{
+    Ns_MutexDestroy(&cachePtr->lock);
+    Ns_CondDestroy(&cachePtr->cond);
+    Tcl_DeleteHashTable(&cachePtr->entriesTable);
+    if (cachePtr->sketch != NULL) {
+	ns_free(cachePtr->sketch);
+    }
+    ns_free(cachePtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HashKey --
+ *
+ *	Hash a string, one word, or array key to select a shard.
+ *
+ * Results:
+ *	Mixed hash value.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static unsigned int
+HashKey(int keys, char *key)
+{
+    unsigned int hash;
+    int i, *iPtr;
+
+    hash = 0;
+    if (keys == TCL_STRING_KEYS) {
+	while (*key != '\0') {
+	    hash += (hash << 3) + UCHAR(*key);
+	    ++key;
+	}
+    } else if (keys == TCL_ONE_WORD_KEYS) {
+	hash = (unsigned int) (unsigned long) key;
+    } else {
+	iPtr = (int *) key;
+	for (i = 0; i < keys; ++i) {
+	    hash += (hash << 3) + (unsigned int) iPtr[i];
+	}
+    }
+
+    /*
+     * Mix the bits as Tcl uses the low bits of a similar hash
+     * within each shard.
+     */
+
+    hash *= 2654435761U;
+    return hash ^ (hash >> 16);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NextShard --
+ *
+ *	Continue a search with the following shards of a sharded
+ *	cache when the current shard has no more entries.  The shard
+ *	is found from the table of the search so Ns_CacheSearch
+ *	remains a plain Tcl_HashSearch.
+ *
+ * Results:
+ *	Next entry or NULL if no more entries.
+ *
+ * Side effects:
+ *	Search is updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Ns_Entry *
+NextShard(Ns_CacheSearch *search, Tcl_HashEntry *hPtr)
+{
+    Cache *shardPtr, *cachePtr;
+    int shard;
+
+    if (hPtr == NULL) {
+	shardPtr = (Cache *) ((char *) search->tablePtr
+			      - offsetof(Cache, entriesTable));
+	cachePtr = shardPtr->parentPtr;
+	shard = shardPtr->shard;
+	while (hPtr == NULL && cachePtr != NULL
+	       && ++shard < cachePtr->nshards) {
+	    hPtr = Tcl_FirstHashEntry(&cachePtr->shards[shard]->entriesTable,
+				      search);
+	}
+    }
+    if (hPtr == NULL) {
+	return NULL;
+    }
+    return (Ns_Entry *) Tcl_GetHashValue(hPtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WakeParent --
+ *
+ *	Signal or broadcast the condition of a sharded cache under
+ *	its mutex, which Ns_CacheTimedWait holds until the wait
+ *	begins.  Called with one or all shard locks held.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Threads waiting on the sharded cache may resume.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WakeParent(Cache *cachePtr, int all)
+{
+    Ns_MutexLock(&cachePtr->lock);
+    if (all) {
+	Ns_CondBroadcast(&cachePtr->cond);
+    } else {
+	Ns_CondSignal(&cachePtr->cond);
+    }
+    Ns_MutexUnlock(&cachePtr->lock);
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -1275,17 +1856,20 @@ CacheCreate(char *name, int keys, time_t timeout, size_t maxSize,
 static void
 Delink(Entry *ePtr)
 {
+    List *listPtr = &ePtr->cachePtr->lists[ePtr->list];
+
     if (ePtr->prevPtr != NULL) {
 	ePtr->prevPtr->nextPtr = ePtr->nextPtr;
     } else {
-	ePtr->cachePtr->firstEntryPtr = ePtr->nextPtr;
+	listPtr->firstPtr = ePtr->nextPtr;
     }
     if (ePtr->nextPtr != NULL) {
 	ePtr->nextPtr->prevPtr = ePtr->prevPtr;
     } else {
-	ePtr->cachePtr->lastEntryPtr = ePtr->prevPtr;
+	listPtr->lastPtr = ePtr->prevPtr;
     }
     ePtr->prevPtr = ePtr->nextPtr = NULL;
+    listPtr->size -= ePtr->size;
 }
 
 
@@ -1294,7 +1878,7 @@ Delink(Entry *ePtr)
  *
  * Push --
  *
- *	Stick an entry at the top of the linked list of entries, making
+ *	Stick an entry at the top of its linked list of entries, making
  *      it the Most Recently Used
  *
  * Results:
@@ -1310,18 +1894,238 @@ Delink(Entry *ePtr)
 static void
 Push(Entry *ePtr)
 {
+    List *listPtr = &ePtr->cachePtr->lists[ePtr->list];
+
     if (ePtr->cachePtr->timeout > 0) {
 	Ns_GetTime(&ePtr->mtime);
     }
-    if (ePtr->cachePtr->firstEntryPtr != NULL) {
-	ePtr->cachePtr->firstEntryPtr->prevPtr = ePtr;
+    if (listPtr->firstPtr != NULL) {
+	listPtr->firstPtr->prevPtr = ePtr;
     }
     ePtr->prevPtr = NULL;
-    ePtr->nextPtr = ePtr->cachePtr->firstEntryPtr;
-    ePtr->cachePtr->firstEntryPtr = ePtr;
-    if (ePtr->cachePtr->lastEntryPtr == NULL) {
-	ePtr->cachePtr->lastEntryPtr = ePtr;
+    ePtr->nextPtr = listPtr->firstPtr;
+    listPtr->firstPtr = ePtr;
+    if (listPtr->lastPtr == NULL) {
+	listPtr->lastPtr = ePtr;
+    }
+    listPtr->size += ePtr->size;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Touch --
+ *
+ *	Update an entry on a cache hit, moving it to the top of its
+ *	list and promoting an entry on probation to the protected
+ *	list.  The least recently used protected entries are then
+ *	demoted to probation while protected entries exceed 80% of
+ *	the max size.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The linked lists will be changed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Touch(Entry *ePtr)
+{
+    Cache *cachePtr = ePtr->cachePtr;
+    List *protPtr = &cachePtr->lists[LIST_PROTECTED];
+    Entry *lastPtr;
+
+    Delink(ePtr);
+    if (ePtr->list == LIST_PROBATION) {
+	ePtr->list = LIST_PROTECTED;
+    }
+    Push(ePtr);
+    if (ePtr->list == LIST_PROTECTED) {
+	while (protPtr->size > cachePtr->maxSize / 5 * 4
+		&& (lastPtr = protPtr->lastPtr) != ePtr) {
+	    Delink(lastPtr);
+	    lastPtr->list = LIST_PROBATION;
+	    Push(lastPtr);
+	}
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Prune --
+ *
+ *	Evict entries until the cache is within its max size according
+ *	to the cache policy, never evicting the given entry which is
+ *	being set.  With TinyLFU, entries leaving the window move to
+ *	probation if there is room or if used more often than the
+ *	entry which would be evicted for them, otherwise they are
+ *	evicted instead.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Entries are flushed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Prune(Cache *cachePtr, Entry *keepPtr)
+{
+    Entry *candPtr, *victPtr;
+
+    if (cachePtr->policy == NS_CACHE_TINYLFU) {
+	while (cachePtr->lists[LIST_WINDOW].size > cachePtr->maxSize / 100
+		&& (candPtr = Tail(cachePtr, LIST_WINDOW, keepPtr)) != NULL) {
+	    victPtr = NULL;
+	    if (cachePtr->currentSize > cachePtr->maxSize) {
+		victPtr = Tail(cachePtr, LIST_PROBATION, keepPtr);
+		if (victPtr == NULL) {
+		    victPtr = Tail(cachePtr, LIST_PROTECTED, keepPtr);
+		}
+		if (victPtr != NULL && SketchGet(cachePtr, candPtr->hash)
+			<= SketchGet(cachePtr, victPtr->hash)) {
+		    ++cachePtr->nreject;
+		    ++cachePtr->nevict;
+		    Ns_CacheFlushEntry((Ns_Entry *) candPtr);
+		    continue;
+		}
+	    }
+	    Delink(candPtr);
+	    candPtr->list = LIST_PROBATION;
+	    Push(candPtr);
+	    if (victPtr != NULL) {
+		++cachePtr->nevict;
+		Ns_CacheFlushEntry((Ns_Entry *) victPtr);
+	    }
+	}
+    }
+    while (cachePtr->currentSize > cachePtr->maxSize) {
+	victPtr = NULL;
+	if (cachePtr->policy != NS_CACHE_LRU) {
+	    victPtr = Tail(cachePtr, LIST_PROBATION, keepPtr);
+	    if (victPtr == NULL) {
+		victPtr = Tail(cachePtr, LIST_PROTECTED, keepPtr);
+	    }
+	}
+	if (victPtr == NULL) {
+	    victPtr = Tail(cachePtr, LIST_WINDOW, keepPtr);
+	    if (victPtr == NULL) {
+		break;
+	    }
+	}
+	++cachePtr->nevict;
+	Ns_CacheFlushEntry((Ns_Entry *) victPtr);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Tail --
+ *
+ *	Return the least recently used entry of a list other than
+ *	the given entry.
+ *
+ * Results:
+ *	Pointer to entry or NULL if none.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Entry *
+Tail(Cache *cachePtr, int list, Entry *keepPtr)
+{
+    Entry *ePtr;
+
+    ePtr = cachePtr->lists[list].lastPtr;
+    if (ePtr == keepPtr) {
+	ePtr = ePtr->prevPtr;
+    }
+    return ePtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SketchAdd --
+ *
+ *	Count a lookup of a key in the TinyLFU frequency sketch,
+ *	halving all counters periodically.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SketchAdd(Cache *cachePtr, unsigned int hash)
+{
+    unsigned char *cPtr;
+    unsigned int i, n;
+
+    n = cachePtr->sketchMask + 1;
+    for (i = 0; i < SKETCH_ROWS; ++i) {
+	cPtr = cachePtr->sketch + i * n + SKETCH_INDEX(cachePtr, hash, i);
+	if (*cPtr < SKETCH_MAX) {
+	    ++(*cPtr);
+	}
+    }
+    if (++cachePtr->sketchAdds >= n * SKETCH_AGE) {
+	for (i = 0; i < n * SKETCH_ROWS; ++i) {
+	    cachePtr->sketch[i] >>= 1;
+	}
+	cachePtr->sketchAdds /= 2;
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SketchGet --
+ *
+ *	Estimate the recent frequency of a key.
+ *
+ * Results:
+ *	Minimum of the key counters.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SketchGet(Cache *cachePtr, unsigned int hash)
+{
+    unsigned int i, n, count, min;
+
+    n = cachePtr->sketchMask + 1;
+    min = SKETCH_MAX;
+    for (i = 0; i < SKETCH_ROWS; ++i) {
+	count = cachePtr->sketch[i * n + SKETCH_INDEX(cachePtr, hash, i)];
+	if (count < min) {
+	    min = count;
+	}
     }
+    return (int) min;
 }
 
 
@@ -1386,7 +2190,7 @@ NsCachePurge(void *arg)
     } else {
 	Ns_GetTime(&expired);
 	Ns_IncrTime(&expired, -cachePtr->timeout, 0);
-	while ((ePtr = cachePtr->lastEntryPtr) != NULL) {
+	while ((ePtr = cachePtr->lists[LIST_WINDOW].lastPtr) != NULL) {
 	    if (ePtr->mtime.sec > expired.sec) {
 		break;
 	    }
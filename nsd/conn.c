@@ -748,7 +748,7 @@ Ns_ConnModifiedSince(Ns_Conn *conn, time_t since)
     char           *hdr;
 
     if (connPtr->servPtr->opts.flags & SERV_MODSINCE) {
-        hdr = Ns_SetIGet(conn->headers, "If-Modified-Since");
+        hdr = NsConnHeader(connPtr, HDR_IF_MODIFIED_SINCE);
         if (hdr != NULL && Ns_ParseHttpTime(hdr) >= since) {
 	    return NS_FALSE;
         }
@@ -1094,7 +1094,7 @@ NsTclConnObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
          "authpassword", "authuser", "channel", "close",
 	 "contentavail", "content", "contentlength", "contentsentlength",
 	 "contentchannel", "copy", "driver", "encoding", "files",
-	 "fileoffset", "filelength", "fileheaders", "flags", "form",
+	 "fileoffset", "filelength", "fileheaders", "filepath", "flags", "form",
 	 "headers", "host", "id", "isconnected", "location", "method",
 	 "outputheaders", "peeraddr", "peerport", "port", "protocol",
 	 "query", "request", "server", "sock", "start", "status",
@@ -1105,7 +1105,7 @@ NsTclConnObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	 CAuthPasswordIdx, CAuthUserIdx, CChannelIdx, CCloseIdx, CAvailIdx, CContentIdx,
 	 CContentLengthIdx, CContentSentLenIdx, CContentChannelIdx, CCopyIdx, CDriverIdx,
 	 CEncodingIdx, CFilesIdx, CFileOffIdx, CFileLenIdx,
-	 CFileHdrIdx, CFlagsIdx, CFormIdx, CHeadersIdx, CHostIdx,
+	 CFileHdrIdx, CFilePathIdx, CFlagsIdx, CFormIdx, CHeadersIdx, CHostIdx,
 	 CIdIdx, CIsConnectedIdx, CLocationIdx, CMethodIdx,
 	 COutputHeadersIdx, CPeerAddrIdx, CPeerPortIdx, CPortIdx,
 	 CProtocolIdx, CQueryIdx, CRequestIdx, CServerIdx, CSockIdx,
@@ -1288,6 +1288,7 @@ NsTclConnObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	case CFileOffIdx:
 	case CFileLenIdx:
 	case CFileHdrIdx:
+	case CFilePathIdx:
 	    if (objc != 3) {
 		Tcl_WrongNumArgs(interp, 2, objv, "file");
 		return TCL_ERROR;
@@ -1302,6 +1303,10 @@ NsTclConnObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	    	Tcl_SetLongObj(result, (long) filePtr->offset);
 	    } else if (opt == CFileLenIdx) {
 	    	Tcl_SetLongObj(result, (long) filePtr->length);
+	    } else if (opt == CFilePathIdx) {
+		if (filePtr->path != NULL) {
+		    Tcl_SetResult(interp, filePtr->path, TCL_VOLATILE);
+		}
 	    } else {
 		Ns_TclEnterSet(interp, filePtr->headers, NS_TCL_SET_STATIC);
 	    }
@@ -43,6 +43,7 @@ static const char *RCSID = "@(#) $Header$, compiled: " __DATE__ " " __TIME__;
  * Local functions defined in this file
  */
 
+static int ConnSendFile(Ns_Conn *conn, int fd, off_t off, int nsend);
 static int ConnSend(Ns_Conn *conn, int nsend, Tcl_Channel chan,
         FILE *fp, int fd, off_t off);
 static int ConnCopy(Ns_Conn *conn, size_t ncopy, Ns_DString *dsPtr,
@@ -171,7 +172,7 @@ Ns_ConnFlush(Ns_Conn *conn, char *buf, int len, int stream)
 	    && (conn->flags & NS_CONN_GZIP)
 	    && (servPtr->opts.flags & SERV_GZIP)
 	    && (len > (int) servPtr->opts.gzipmin)
-	    && (ahdr = Ns_SetIGet(conn->headers, "Accept-Encoding")) != NULL
+	    && (ahdr = NsConnHeader(connPtr, HDR_ACCEPT_ENCODING)) != NULL
 	    && strstr(ahdr, "gzip") != NULL
 	    && Ns_Gzip(buf, len, servPtr->opts.gziplevel, &gzip) == NS_OK) {
 	buf = gzip.string;
@@ -277,13 +278,21 @@ Ns_ConnFlushDirect(Ns_Conn *conn, char *buf, int len, int stream)
     }
 
     /*
-     * Write the output buffer and if not streaming, close the
-     * connection.
+     * Write the output buffer, or hand off a large complete
+     * response to a writer thread, and if not streaming, close
+     * the connection.
      */
 
-    nwrote = Ns_ConnSend(conn, iov, ioc);
-    if (nwrote != towrite) {
-    	return NS_ERROR;
+    if (!stream && ioc == 1 && !(conn->flags & NS_CONN_CHUNK)
+	    && NsWriterQueue(conn, -1, 0, len, buf)) {
+	if (NsRunFilters(conn, NS_FILTER_WRITE) != NS_OK) {
+	    return NS_ERROR;
+	}
+    } else {
+	nwrote = Ns_ConnSend(conn, iov, ioc);
+	if (nwrote != towrite) {
+	    return NS_ERROR;
+	}
     }
     if (!stream && Ns_ConnClose(conn) != NS_OK) {
 	return NS_ERROR;
@@ -912,6 +921,14 @@ ConnSend(Ns_Conn *conn, int nsend, Tcl_Channel chan, FILE *fp, int fd,
         Ns_WriteConn(conn, NULL, 0);
     }
 
+    /*
+     * Send files without copying only when the driver opted in.
+     */
+
+    if (fd >= 0 && nsend > 0 && NsConnCanSendFile(conn)) {
+	return ConnSendFile(conn, fd, off, nsend);
+    }
+
     status = NS_OK;
     while (status == NS_OK && nsend > 0) {
         toread = (size_t) nsend;
@@ -947,3 +964,47 @@ ConnSend(Ns_Conn *conn, int nsend, Tcl_Channel chan, FILE *fp, int fd,
     }
     return status;
 }
+
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ConnSendFile --
+ *
+ *	Send content from an fd with sendfile, flushing any queued
+ *	headers first with the socket corked so they share packets
+ *	with the start of the file.
+ *
+ * Results:
+ *  	NS_OK or NS_ERROR if a write failed.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+ConnSendFile(Ns_Conn *conn, int fd, off_t off, int nsend)
+{
+    Conn *connPtr = (Conn *) conn;
+    SOCKET sock = connPtr->sockPtr->sock;
+    int nwrote, status;
+
+    NsSockCork(sock, 1);
+    status = Ns_WriteConn(conn, NULL, 0);
+    if (status == NS_OK) {
+	nwrote = NsConnSendFile(conn, fd, off, nsend);
+	if (nwrote < 0) {
+	    status = NS_ERROR;
+	} else {
+	    connPtr->nContentSent += nwrote;
+	    if (NsRunFilters(conn, NS_FILTER_WRITE) != NS_OK) {
+		status = NS_ERROR;
+	    }
+	}
+    }
+    NsSockCork(sock, 0);
+    return status;
+}
@@ -145,6 +145,7 @@ DnsGet(GetProc *getProc, Ns_DString *dsPtr, Ns_Cache **cachePtr, char *key, int
         status = (*getProc)(dsPtr, key);
     } else {
 	time(&now);
+	cache = Ns_CacheShard(cache, key);
 	Ns_CacheLock(cache);
 	ePtr = Ns_CacheCreateEntry(cache, key, &new);
 	if (!new) {
@@ -96,6 +96,7 @@ typedef enum {
     E_CRANGE,
     E_FILTER,
     E_QUEWAIT,
+    E_FORM,
 } ReadErr;
 
 /*
@@ -108,10 +109,17 @@ typedef enum {
 #define DRIVER_FAILED      8
 #define DRIVER_QUERY	  16
 #define DRIVER_DEBUG	  32
+#define DRIVER_EPOLL	  64
+#define DRIVER_REUSEPORT 128
 
 /*
  * The following structure manages polling.  The PollIn macro is
  * used for the common case of checking for readability.
+ *
+ * With the "epoll" pollmode, idle Sock's in read or close wait are
+ * parked in a persistent event set polled through a single entry in
+ * the pfds array.  Ready Sock's are moved back to the wait list each
+ * spin and parked Sock's are swept for timeouts at most once a second.
  */
 
 typedef struct PollData {
@@ -119,10 +127,25 @@ typedef struct PollData {
     int maxfds;			/* Max fd's (will grow as needed). */
     struct pollfd *pfds;	/* Dynamic array of poll struct's. */
     Ns_Time *timeoutPtr;	/* Min timeout, if any, for next spin. */
+    int nparked;		/* Number of Sock's parked in event set. */
+    struct Sock *parkPtr;	/* List of parked Sock's. */
+    Ns_Time sweep;		/* Next timeout sweep of parked Sock's. */
+#ifdef HAVE_SYS_EPOLL_H
+    int maxevents;		/* Size of events array. */
+    struct epoll_event *events;	/* Array of epoll_wait() results. */
+#endif
 } PollData;
 
 #define PollIn(ppd,i)		((ppd)->pfds[(i)].revents & POLLIN)
 
+/*
+ * The following are valid Sock event set flags.
+ */
+
+#define SOCK_EVENTSET	1	/* Registered in driver event set. */
+#define SOCK_PARKED	2	/* Parked waiting for events or timeout. */
+#define SOCK_NOEVENT	4	/* Registration failed, use poll(). */
+
 /*
  * The following structure defines a Host header to server mappings.
  */
@@ -152,6 +175,8 @@ typedef struct QueWait {
 
 static Ns_ThreadProc DriverThread;
 static Ns_ThreadProc ReaderThread;
+static void InitDriver(Driver *drvPtr);
+static void QueryDriver(Driver *drvPtr, Tcl_DString *dsPtr);
 static void TriggerDriver(Driver *drvPtr);
 static Sock *SockAccept(SOCKET lsock, Driver *drvPtr);
 static void SockClose(Sock *sockPtr);
@@ -159,6 +184,13 @@ static void SockRead(Sock *sockPtr);
 static ReadErr SockReadLine(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr);
 static ReadErr SockReadContent(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr);
 static int Poll(PollData *pdataPtr, SOCKET sock, int events, Ns_Time *timeoutPtr);
+static void EventPark(Driver *drvPtr, PollData *pdataPtr, Sock *sockPtr,
+		      Sock **waitPtrPtr);
+static void EventUnpark(PollData *pdataPtr, Sock *sockPtr);
+static void EventWait(Driver *drvPtr, PollData *pdataPtr, int ready,
+		      Ns_Time *nowPtr, int stop, Sock **waitPtrPtr);
+static void EventRemove(Sock *sockPtr);
+static void QuerySock(Driver *drvPtr, PollData *pdataPtr, Sock *sockPtr);
 static Conn *AllocConn(Driver *drvPtr, Ns_Time *nowPtr, Sock *sockPtr);
 static void FreeConn(Conn *connPtr);
 static int RunQueWaits(PollData *pdataPtr, Ns_Time *nowPtr, Sock *sockPtr);
@@ -227,16 +259,15 @@ NsInitDrivers(void)
 int
 Ns_DriverInit(char *server, char *module, Ns_DriverInitData *init)
 {
-    char *path, *address, *host, *bindaddr, *defproto, *defserver;
-    int i, n, socktimeout, defport;
+    char *path, *address, *host, *bindaddr, *defproto, *defserver, *pollmode;
+    int i, n, socktimeout, defport, nthreads;
     ServerMap *mapPtr;
     Tcl_HashEntry *hPtr;
     Ns_DString ds;
     Ns_Set *set;
     struct in_addr  ia;
     struct hostent *he;
-    Driver *drvPtr;
-    Sock *sockPtr;
+    Driver *drvPtr, *thrPtr;
     NsServer *servPtr = NULL;
 
     if (init->version != NS_DRIVER_VERSION_1) {
@@ -341,10 +372,6 @@ Ns_DriverInit(char *server, char *module, Ns_DriverInitData *init)
     Ns_DStringInit(&ds);
     drvPtr = ns_calloc(1, sizeof(Driver));
     drvPtr->flags = DRIVER_STOPPED;
-    Ns_MutexSetName2(&drvPtr->lock, "ns:drv", module);
-    if (ns_sockpair(drvPtr->trigger) != 0) {
-	Ns_Fatal("ns_sockpair() failed: %s", ns_sockstrerror(ns_sockerrno));
-    }
     Ns_DStringVarAppend(&ds, server, "/", module, NULL);
     drvPtr->fullname = Ns_DStringExport(&ds);
     drvPtr->server = server;
@@ -353,6 +380,13 @@ Ns_DriverInit(char *server, char *module, Ns_DriverInitData *init)
     drvPtr->proc = init->proc;
     drvPtr->arg = init->arg;
     drvPtr->opts = init->opts;
+#ifdef HAVE_SYS_SENDFILE_H
+    if (init->opts & NS_DRIVER_SSL) {
+	drvPtr->opts &= ~NS_DRIVER_SENDFILE;
+    }
+#else
+    drvPtr->opts &= ~NS_DRIVER_SENDFILE;
+#endif
     drvPtr->servPtr = servPtr;
     if (Ns_ConfigGetBool(path, "debug", &n) && n) {
 	drvPtr->flags |= DRIVER_DEBUG;
@@ -418,18 +452,41 @@ Ns_DriverInit(char *server, char *module, Ns_DriverInitData *init)
     }
     n = _MAX(n, 1);     /* Minimum of 1 reader thread. */
     drvPtr->maxreaders = n;
-    drvPtr->readers = ns_calloc((size_t) n, sizeof(Ns_Thread));
+    if (!Ns_ConfigGetInt(path, "driverthreads", &n) || n < 1) {
+        n = 1;          /* Single driver thread. */
+    }
+    nthreads = n;
+    if (!Ns_ConfigGetInt(path, "writerthreads", &n) || n < 0) {
+        n = 0;          /* No writer threads, send from conn threads. */
+    }
+    if (n > 0 && !(drvPtr->opts & NS_DRIVER_SENDFILE)) {
+	Ns_Log(Warning, "%s: writer threads require sendfile", module);
+	n = 0;
+    }
+    drvPtr->nwriters = n;
+    if (!Ns_ConfigGetInt(path, "writersize", &n) || n < 1) {
+        n = 1024 * 1024; /* Hand off responses of 1m or more. */
+    }
+    drvPtr->writersize = n;
+    if (Ns_ConfigGetBool(path, "reuseport", &n) && n) {
+	drvPtr->flags |= DRIVER_REUSEPORT;
+    }
 
     /*
-     * Pre-allocate Sock structures.
+     * Use a persistent event set if requested, falling back
+     * to rebuilding the poll array each spin otherwise.
      */
-          
-    drvPtr->freeSockPtr = NULL;
-    sockPtr = ns_malloc(sizeof(Sock) * drvPtr->maxsock);
-    for (n = 0; n < drvPtr->maxsock; ++n) {
-        sockPtr->nextPtr = drvPtr->freeSockPtr;
-        drvPtr->freeSockPtr = sockPtr;
-        ++sockPtr;
+
+    pollmode = Ns_ConfigGetValue(path, "pollmode");
+    if (pollmode != NULL && STRIEQ(pollmode, "epoll")) {
+#ifdef HAVE_SYS_EPOLL_H
+	drvPtr->flags |= DRIVER_EPOLL;
+#else
+	Ns_Log(Warning, "%s: epoll not supported, using poll", module);
+#endif
+    } else if (pollmode != NULL && !STRIEQ(pollmode, "poll")) {
+	Ns_Log(Warning, "%s: invalid pollmode, using poll: %s",
+	       module, pollmode);
     }
 
     /*
@@ -456,6 +513,22 @@ Ns_DriverInit(char *server, char *module, Ns_DriverInitData *init)
     drvPtr->nextPtr = firstDrvPtr;
     firstDrvPtr = drvPtr;
 
+    /*
+     * Add any extra driver threads, each a copy of the driver config
+     * with its own Sock's, trigger pipe, lock, and stats, following
+     * the main driver in the list.
+     */
+
+    for (i = nthreads - 1; i > 0; --i) {
+	thrPtr = ns_malloc(sizeof(Driver));
+	*thrPtr = *drvPtr;
+	thrPtr->mainPtr = drvPtr;
+	thrPtr->tidx = i;
+	InitDriver(thrPtr);
+	drvPtr->nextPtr = thrPtr;
+    }
+    InitDriver(drvPtr);
+
     /*
      * Map Host headers for drivers not bound to servers.
      */
@@ -496,6 +569,78 @@ Ns_DriverInit(char *server, char *module, Ns_DriverInitData *init)
     return NS_OK;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * InitDriver --
+ *
+ *	Initialize the per-thread state of a driver.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Allocates the reader thread array and Sock structures, creates
+ *	the trigger pipe and, with the epoll pollmode, the event set.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+InitDriver(Driver *drvPtr)
+{
+    Ns_DString ds;
+    Sock *sockPtr;
+    int n;
+
+    Ns_DStringInit(&ds);
+    Ns_DStringAppend(&ds, drvPtr->module);
+    if (drvPtr->tidx > 0) {
+	Ns_DStringPrintf(&ds, ":%d", drvPtr->tidx);
+    }
+    Ns_MutexSetName2(&drvPtr->lock, "ns:drv", ds.string);
+    Ns_DStringFree(&ds);
+    if (ns_sockpair(drvPtr->trigger) != 0) {
+	Ns_Fatal("ns_sockpair() failed: %s", ns_sockstrerror(ns_sockerrno));
+    }
+    drvPtr->sock = INVALID_SOCKET;
+    drvPtr->readers = ns_calloc((size_t) drvPtr->maxreaders,
+				sizeof(Ns_Thread));
+
+    /*
+     * Pre-allocate Sock structures.
+     */
+          
+    drvPtr->freeSockPtr = NULL;
+    sockPtr = drvPtr->socks = ns_malloc(sizeof(Sock) * drvPtr->maxsock);
+    for (n = 0; n < drvPtr->maxsock; ++n) {
+        sockPtr->eflags = 0;
+        sockPtr->wrSockPtr = NULL;
+        sockPtr->nextPtr = drvPtr->freeSockPtr;
+        drvPtr->freeSockPtr = sockPtr;
+        ++sockPtr;
+    }
+
+    /*
+     * Create the persistent event set, if requested.
+     */
+
+    drvPtr->epfd = -1;
+#ifdef HAVE_SYS_EPOLL_H
+    if (drvPtr->flags & DRIVER_EPOLL) {
+	drvPtr->epfd = epoll_create(drvPtr->maxsock);
+	if (drvPtr->epfd < 0) {
+	    Ns_Log(Warning, "%s: epoll_create() failed, using poll: %s",
+		   drvPtr->module, strerror(errno));
+	    drvPtr->epfd = -1;
+	} else {
+	    Ns_CloseOnExec(drvPtr->epfd);
+	}
+    }
+#endif
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -734,7 +879,7 @@ int
 NsTclDriverObjCmd(ClientData dummy, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 {
     Tcl_DString ds;
-    Driver *drvPtr;
+    Driver *drvPtr, *thrPtr;
     char *fullname;
     static CONST char *opts[] = {
         "list", "query", NULL
@@ -756,7 +901,9 @@ NsTclDriverObjCmd(ClientData dummy, Tcl_Interp *interp, int objc, Tcl_Obj **objv
     case DListIdx:
 	drvPtr = firstDrvPtr;
 	while (drvPtr != NULL) {
-	    Tcl_AppendElement(interp, drvPtr->fullname);
+	    if (drvPtr->mainPtr == NULL) {
+	    	Tcl_AppendElement(interp, drvPtr->fullname);
+	    }
 	    drvPtr = drvPtr->nextPtr;
 	}
 	break;
@@ -769,7 +916,7 @@ NsTclDriverObjCmd(ClientData dummy, Tcl_Interp *interp, int objc, Tcl_Obj **objv
 	fullname = Tcl_GetString(objv[2]);
 	drvPtr = firstDrvPtr;
 	while (drvPtr != NULL) {
-	    if (STREQ(fullname, drvPtr->fullname)) {
+	    if (drvPtr->mainPtr == NULL && STREQ(fullname, drvPtr->fullname)) {
 		break;
 	    }
 	    drvPtr = drvPtr->nextPtr;
@@ -779,23 +926,64 @@ NsTclDriverObjCmd(ClientData dummy, Tcl_Interp *interp, int objc, Tcl_Obj **objv
 	    return TCL_ERROR;
 	}
 	Tcl_DStringInit(&ds);
-    	Ns_MutexLock(&drvPtr->lock);
-    	while (drvPtr->flags & DRIVER_QUERY) {
-	    Ns_CondWait(&drvPtr->cond, &drvPtr->lock);
-    	}
-    	drvPtr->queryPtr = &ds;
-    	drvPtr->flags |= DRIVER_QUERY;
-    	TriggerDriver(drvPtr);
-    	while (drvPtr->flags & DRIVER_QUERY) {
-	    Ns_CondWait(&drvPtr->cond, &drvPtr->lock);
-    	}
-    	Ns_MutexUnlock(&drvPtr->lock);
+	QueryDriver(drvPtr, &ds);
+
+	/*
+	 * Append the details of extra driver threads, if any.
+	 */
+
+	thrPtr = drvPtr->nextPtr;
+	if (thrPtr != NULL && thrPtr->mainPtr == drvPtr) {
+	    Tcl_DStringAppendElement(&ds, "threads");
+	    Tcl_DStringStartSublist(&ds);
+	    while (thrPtr != NULL && thrPtr->mainPtr == drvPtr) {
+		Tcl_DStringStartSublist(&ds);
+		QueryDriver(thrPtr, &ds);
+		Tcl_DStringEndSublist(&ds);
+		thrPtr = thrPtr->nextPtr;
+	    }
+	    Tcl_DStringEndSublist(&ds);
+	}
 	Tcl_DStringResult(interp, &ds);
 	break;
     }
     return TCL_OK;
 }
 	
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * QueryDriver --
+ *
+ *	Copy the current details of a driver thread.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Waits for the driver thread to wakeup and append its stats
+ *	and waiting Sock's to the given dstring.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+QueryDriver(Driver *drvPtr, Tcl_DString *dsPtr)
+{
+    Ns_MutexLock(&drvPtr->lock);
+    while (drvPtr->flags & DRIVER_QUERY) {
+	Ns_CondWait(&drvPtr->cond, &drvPtr->lock);
+    }
+    drvPtr->queryPtr = dsPtr;
+    drvPtr->flags |= DRIVER_QUERY;
+    TriggerDriver(drvPtr);
+    while (drvPtr->flags & DRIVER_QUERY) {
+	Ns_CondWait(&drvPtr->cond, &drvPtr->lock);
+    }
+    Ns_MutexUnlock(&drvPtr->lock);
+}
+
 
 /* 
  *----------------------------------------------------------------------
@@ -826,6 +1014,90 @@ NsConnSend(Ns_Conn *conn, struct iovec *bufs, int nbufs)
 		(Ns_Sock *) connPtr->sockPtr, bufs, nbufs);
 }
 
+
+/* 
+ *----------------------------------------------------------------------
+ *
+ * NsConnCanSendFile --
+ *
+ *	Check if the connection's driver opted in to sendfile on
+ *	its plain socket with NS_DRIVER_SENDFILE.
+ *
+ * Results:
+ *	1 if NsConnSendFile may be used, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsConnCanSendFile(Ns_Conn *conn)
+{
+    Conn *connPtr = (Conn *) conn;
+
+    return (connPtr->sockPtr != NULL
+	    && (connPtr->sockPtr->drvPtr->opts & NS_DRIVER_SENDFILE));
+}
+
+
+/* 
+ *----------------------------------------------------------------------
+ *
+ * NsConnSendFile --
+ *
+ *	Send file content directly to the connection's socket with
+ *	sendfile, bypassing the driver callback.  Reads from the
+ *	current file position if off is less than 0.
+ *
+ * Results:
+ *	# of bytes sent or -1 on error.  Fewer bytes than requested
+ *	are sent if the file is truncated.
+ *
+ * Side effects:
+ *	May wait up to the driver sendwait for each write.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsConnSendFile(Ns_Conn *conn, int fd, off_t off, int nsend)
+{
+#ifdef HAVE_SYS_SENDFILE_H
+    Conn *connPtr = (Conn *) conn;
+    Sock *sockPtr = connPtr->sockPtr;
+    off_t *offPtr;
+    int n, nwrote;
+
+    if (sockPtr == NULL) {
+	return -1;
+    }
+    offPtr = (off < 0 ? NULL : &off);
+    nwrote = 0;
+    while (nsend > 0) {
+	++sockPtr->nwrites;
+	n = sendfile(sockPtr->sock, fd, offPtr, (size_t) nsend);
+	if (n < 0 && ns_sockerrno == EWOULDBLOCK
+		&& Ns_SockWait(sockPtr->sock, NS_SOCK_WRITE,
+			       sockPtr->drvPtr->sendwait) == NS_OK) {
+	    continue;
+	}
+	if (n < 0) {
+	    return -1;
+	}
+	if (n == 0) {
+	    break;
+	}
+	nwrote += n;
+	nsend -= n;
+    }
+    return nwrote;
+#else
+    return -1;
+#endif
+}
+
 
 /* 
  *----------------------------------------------------------------------
@@ -861,6 +1133,16 @@ NsSockClose(Sock *sockPtr, int keep)
 	return;
     }
 
+    /*
+     * Hand off a response queued with NsWriterQueue to a writer
+     * thread which will call back when the send is complete.
+     */
+
+    if (sockPtr->wrSockPtr != NULL) {
+	NsWriterStart(sockPtr, keep);
+	return;
+    }
+
     /*
      * If keepalive is requested and enabled, set the read wait
      * state. Otherwise, set close wait which simply drains any
@@ -939,8 +1221,8 @@ static void
 DriverThread(void *arg)
 {
     SOCKET lsock;
-    Driver *drvPtr = (Driver *) arg;
-    int n, flags, stop, lidx, tidx;
+    Driver *drvPtr = (Driver *) arg, *thrPtr;
+    int n, flags, stop, lidx, tidx, eidx;
     Sock *sockPtr, *closePtr, *nextPtr;
     QueWait *queWaitPtr;
     Conn *connPtr, *nextConnPtr, *freeConnPtr;
@@ -961,7 +1243,26 @@ DriverThread(void *arg)
      */
  
     flags = DRIVER_STARTED;
-    lsock = Ns_SockListenEx(drvPtr->bindaddr, drvPtr->port, drvPtr->backlog);
+    if (drvPtr->flags & DRIVER_REUSEPORT) {
+	lsock = NsSockListenReusePort(drvPtr->bindaddr, drvPtr->port,
+				      drvPtr->backlog);
+	if (lsock == INVALID_SOCKET) {
+	    Ns_Log(Warning, "%s: reuseport listen failed: %s",
+		   drvPtr->name, ns_sockstrerror(ns_sockerrno));
+	}
+    } else {
+	lsock = INVALID_SOCKET;
+    }
+    if (lsock == INVALID_SOCKET) {
+	if (drvPtr->mainPtr != NULL) {
+	    /* NB: Main driver thread has already started. */
+	    lsock = drvPtr->mainPtr->sock;
+	} else {
+	    lsock = Ns_SockListenEx(drvPtr->bindaddr, drvPtr->port,
+				    drvPtr->backlog);
+	}
+    }
+    drvPtr->sock = lsock;
     if (lsock != INVALID_SOCKET) {
     	Ns_Log(Notice, "%s: listening on %s:%d", drvPtr->name,
 	       drvPtr->address, drvPtr->port);
@@ -973,10 +1274,15 @@ DriverThread(void *arg)
     }
 
     /*
-     * Update and signal state of driver.
+     * Update and signal state of driver, clearing the stopped flag
+     * set by Ns_DriverInit so shutdown waits for this thread.
      */
 
+    if (!(flags & DRIVER_FAILED)) {
+	NsStartWriters(drvPtr);
+    }
     Ns_MutexLock(&drvPtr->lock);
+    drvPtr->flags &= ~DRIVER_STOPPED;
     drvPtr->flags |= flags;
     Ns_CondBroadcast(&drvPtr->cond);
     Ns_MutexUnlock(&drvPtr->lock);
@@ -989,6 +1295,12 @@ DriverThread(void *arg)
     pdata.nfds = pdata.maxfds = 0;
     pdata.pfds = NULL;
     pdata.timeoutPtr = NULL;
+    pdata.nparked = 0;
+    pdata.parkPtr = NULL;
+#ifdef HAVE_SYS_EPOLL_H
+    pdata.maxevents = drvPtr->maxsock;
+    pdata.events = ns_malloc(sizeof(struct epoll_event) * pdata.maxevents);
+#endif
     stop = (flags & DRIVER_SHUTDOWN);
     while (!stop || drvPtr->nactive) {
 
@@ -1029,6 +1341,18 @@ DriverThread(void *arg)
             sockPtr = sockPtr->nextPtr;
         }
 
+	/*
+	 * Poll the event set, if any, waking up for the next sweep of
+	 * parked Sock's.
+	 */
+
+	if (drvPtr->epfd != -1) {
+	    eidx = Poll(&pdata, drvPtr->epfd, POLLIN,
+			pdata.nparked ? &pdata.sweep : NULL);
+	} else {
+	    eidx = -1;
+	}
+
 	/*
 	 * Poll, drain the trigger pipe if necessary, and get current time.
 	 */
@@ -1090,6 +1414,10 @@ DriverThread(void *arg)
 	 */
 
 	stop = (flags & DRIVER_SHUTDOWN);
+	if (eidx >= 0) {
+	    EventWait(drvPtr, &pdata, PollIn(&pdata, eidx), &now, stop,
+		      &waitPtr);
+	}
 	sockPtr = waitPtr;
 	waitPtr = NULL;
 	while (sockPtr != NULL) {
@@ -1149,6 +1477,7 @@ DriverThread(void *arg)
 		    }
 		    if (!(drvPtr->opts & NS_DRIVER_ASYNC)) {
                         /* Queue for read by reader threads. */
+			EventRemove(sockPtr);
                         SockPush(sockPtr, &readSockPtr);
 		    } else {
                         /* Read directly. */
@@ -1156,6 +1485,7 @@ DriverThread(void *arg)
 			if (sockPtr->state == SOCK_READWAIT) {
                             SockWait(sockPtr, &now, drvPtr->recvwait, &waitPtr);
 			} else {
+			    EventRemove(sockPtr);
                             SockPush(sockPtr, &preqSockPtr);
 			}
 		    }
@@ -1350,6 +1680,26 @@ dropped:
 	    }
 	}
 
+	/*
+	 * Park idle Sock's in the event set, if any.
+	 */
+
+	if (drvPtr->epfd != -1) {
+	    sockPtr = waitPtr;
+	    waitPtr = NULL;
+	    while (sockPtr != NULL) {
+		nextPtr = sockPtr->nextPtr;
+		if ((sockPtr->state == SOCK_READWAIT
+			|| sockPtr->state == SOCK_CLOSEWAIT)
+			&& !(sockPtr->eflags & SOCK_NOEVENT)) {
+		    EventPark(drvPtr, &pdata, sockPtr, &waitPtr);
+		} else {
+		    SockPush(sockPtr, &waitPtr);
+		}
+		sockPtr = nextPtr;
+	    }
+	}
+
 	/*
 	 * Copy current driver details if requested.
 	 */
@@ -1359,37 +1709,27 @@ dropped:
 	    Tcl_DStringAppendElement(drvPtr->queryPtr, "stats");
 	    Tcl_DStringStartSublist(drvPtr->queryPtr);
 	    Ns_DStringPrintf(drvPtr->queryPtr,
-		"time %ld:%ld "
+		"time %ld:%ld pollmode %s "
 		"spins %d accepts %u queued %u reads %u "
-		"dropped %u overflow %d timeout %u",
-	    	now.sec, now.usec,
+		"dropped %u overflow %d timeout %u parked %d",
+	    	now.sec, now.usec, drvPtr->epfd != -1 ? "epoll" : "poll",
 		drvPtr->stats.spins, drvPtr->stats.accepts,
 		drvPtr->stats.queued, drvPtr->stats.reads,
 		drvPtr->stats.dropped, drvPtr->stats.overflow,
-		drvPtr->stats.timeout);
+		drvPtr->stats.timeout, pdata.nparked);
 	    Tcl_DStringEndSublist(drvPtr->queryPtr);
 	    Tcl_DStringAppendElement(drvPtr->queryPtr, "socks");
-	    sockPtr = waitPtr;
 	    Tcl_DStringStartSublist(drvPtr->queryPtr);
+	    sockPtr = waitPtr;
 	    while (sockPtr != NULL) {
-	    	Tcl_DStringStartSublist(drvPtr->queryPtr);
-		Ns_DStringPrintf(drvPtr->queryPtr,
-		    "id %u sock %d state %s idx %d events %d revents %d "
-		    "accept %ld:%ld timeout %ld:%ld",
-		    sockPtr->id, sockPtr->sock, states[sockPtr->state], sockPtr->pidx,
-		    pdata.pfds[sockPtr->pidx].events, 
-		    pdata.pfds[sockPtr->pidx].revents, 
-		    sockPtr->acceptTime.sec, sockPtr->acceptTime.usec,
-		    sockPtr->timeout.sec, sockPtr->timeout.usec);
-		if (sockPtr->connPtr != NULL) {
-		    NsAppendConn(drvPtr->queryPtr, sockPtr->connPtr, "i/o");
-		} else {
-		    Tcl_DStringStartSublist(drvPtr->queryPtr);
-		    Tcl_DStringEndSublist(drvPtr->queryPtr);
-		}
-	    	Tcl_DStringEndSublist(drvPtr->queryPtr);
+		QuerySock(drvPtr, &pdata, sockPtr);
 		sockPtr = sockPtr->nextPtr;
 	    }
+	    sockPtr = pdata.parkPtr;
+	    while (sockPtr != NULL) {
+		QuerySock(drvPtr, &pdata, sockPtr);
+		sockPtr = sockPtr->parkNextPtr;
+	    }
 	    Tcl_DStringEndSublist(drvPtr->queryPtr);
 	    drvPtr->flags &= ~DRIVER_QUERY;
 	    Ns_CondBroadcast(&drvPtr->cond);
@@ -1401,9 +1741,30 @@ dropped:
      * TODO: Handle waiting Sock's on shutdown.
      */
 
-    if (lsock != INVALID_SOCKET) {
+    /*
+     * Wait for any extra driver threads, which may be polling the
+     * listen socket, to stop before closing it.
+     */
+
+    thrPtr = drvPtr->nextPtr;
+    while (drvPtr->mainPtr == NULL && thrPtr != NULL
+	    && thrPtr->mainPtr == drvPtr) {
+	Ns_MutexLock(&thrPtr->lock);
+	while (!(thrPtr->flags & DRIVER_STOPPED)) {
+	    Ns_CondWait(&thrPtr->cond, &thrPtr->lock);
+	}
+	Ns_MutexUnlock(&thrPtr->lock);
+	thrPtr = thrPtr->nextPtr;
+    }
+    if (lsock != INVALID_SOCKET
+	    && (drvPtr->mainPtr == NULL || lsock != drvPtr->mainPtr->sock)) {
         ns_sockclose(lsock);
     }
+#ifdef HAVE_SYS_EPOLL_H
+    ns_free(pdata.events);
+#endif
+    ns_free(pdata.pfds);
+    NsStopWriters(drvPtr);
     while (drvPtr->nreaders > 0) {
     	--drvPtr->nreaders;
 	Ns_ThreadJoin(&drvPtr->readers[drvPtr->nreaders], NULL);
@@ -1468,6 +1829,271 @@ Poll(PollData *pdataPtr, SOCKET sock, int events, Ns_Time *timeoutPtr)
     return idx;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EventPark --
+ *
+ *	Park an idle Sock in the driver event set until it is ready
+ *	or may have timed out.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Sock is added to the epoll set if not already registered and
+ *	the next timeout sweep is updated if necessary.  A Sock which
+ *	can't be registered is returned to the wait list and left to
+ *	poll() until closed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+EventPark(Driver *drvPtr, PollData *pdataPtr, Sock *sockPtr,
+	  Sock **waitPtrPtr)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event ev;
+
+    if (!(sockPtr->eflags & SOCK_EVENTSET)) {
+	ev.events = EPOLLIN;
+	ev.data.ptr = sockPtr;
+	if (epoll_ctl(drvPtr->epfd, EPOLL_CTL_ADD, sockPtr->sock, &ev) != 0) {
+	    Ns_Log(Error, "driver: epoll_ctl(%d) failed: %s",
+		   sockPtr->sock, strerror(errno));
+	    sockPtr->eflags |= SOCK_NOEVENT;
+	    SockPush(sockPtr, waitPtrPtr);
+	    return;
+	}
+	sockPtr->eflags |= SOCK_EVENTSET;
+    }
+    sockPtr->eflags |= SOCK_PARKED;
+    sockPtr->parkPrevPtr = NULL;
+    sockPtr->parkNextPtr = pdataPtr->parkPtr;
+    if (pdataPtr->parkPtr != NULL) {
+	pdataPtr->parkPtr->parkPrevPtr = sockPtr;
+    }
+    pdataPtr->parkPtr = sockPtr;
+    if (pdataPtr->nparked++ == 0
+	    || Ns_DiffTime(&sockPtr->timeout, &pdataPtr->sweep, NULL) < 0) {
+	pdataPtr->sweep = sockPtr->timeout;
+    }
+#endif
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EventUnpark --
+ *
+ *	Remove a Sock from the parked list.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Sock remains registered in the event set.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+EventUnpark(PollData *pdataPtr, Sock *sockPtr)
+{
+    if (sockPtr->parkPrevPtr != NULL) {
+	sockPtr->parkPrevPtr->parkNextPtr = sockPtr->parkNextPtr;
+    } else {
+	pdataPtr->parkPtr = sockPtr->parkNextPtr;
+    }
+    if (sockPtr->parkNextPtr != NULL) {
+	sockPtr->parkNextPtr->parkPrevPtr = sockPtr->parkPrevPtr;
+    }
+    sockPtr->eflags &= ~SOCK_PARKED;
+    --pdataPtr->nparked;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EventWait --
+ *
+ *	Move parked Sock's which are ready or may have timed out
+ *	back to the wait list for processing.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Ready Sock's are added to the poll array with their returned
+ *	events.  When the sweep time has passed or the driver is
+ *	stopping, the parked Sock's are checked for timeout and the
+ *	next sweep is set no sooner than one second from now.
+ *	If epoll_wait() fails, the event set is closed and all parked
+ *	Sock's are returned to the wait list for the driver to poll().
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+EventWait(Driver *drvPtr, PollData *pdataPtr, int ready, Ns_Time *nowPtr,
+	  int stop, Sock **waitPtrPtr)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event *evPtr;
+    Sock *sockPtr, *nextPtr;
+    Ns_Time next;
+    int i, n, idx;
+
+    if (ready) {
+	do {
+	    n = epoll_wait(drvPtr->epfd, pdataPtr->events,
+			   pdataPtr->maxevents, 0);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0) {
+	    /* NB: Close the set and return all parked Sock's to poll(). */
+	    Ns_Log(Error, "driver: epoll_wait() failed, using poll: %s",
+		   strerror(errno));
+	    close(drvPtr->epfd);
+	    drvPtr->epfd = -1;
+	    stop = 1;
+	    n = 0;
+	}
+	for (i = 0; i < n; ++i) {
+	    evPtr = &pdataPtr->events[i];
+	    sockPtr = evPtr->data.ptr;
+	    if (!(sockPtr->eflags & SOCK_PARKED)) {
+		continue;
+	    }
+	    EventUnpark(pdataPtr, sockPtr);
+	    idx = Poll(pdataPtr, sockPtr->sock, POLLIN, NULL);
+	    if (evPtr->events & (EPOLLIN|EPOLLHUP|EPOLLERR)) {
+		/* NB: Errors are left for the next recv() to report. */
+		pdataPtr->pfds[idx].revents = POLLIN;
+	    }
+	    sockPtr->pidx = idx;
+	    SockPush(sockPtr, waitPtrPtr);
+	}
+    }
+    if (pdataPtr->nparked == 0
+	    || (!stop && Ns_DiffTime(&pdataPtr->sweep, nowPtr, NULL) > 0)) {
+	return;
+    }
+    next = *nowPtr;
+    Ns_IncrTime(&next, 1, 0);
+    pdataPtr->sweep.sec = 0;
+    nextPtr = pdataPtr->parkPtr;
+    while ((sockPtr = nextPtr) != NULL) {
+	nextPtr = sockPtr->parkNextPtr;
+	if (stop || Ns_DiffTime(&sockPtr->timeout, nowPtr, NULL) <= 0) {
+	    EventUnpark(pdataPtr, sockPtr);
+	    sockPtr->pidx = Poll(pdataPtr, sockPtr->sock, POLLIN, NULL);
+	    SockPush(sockPtr, waitPtrPtr);
+	} else if (pdataPtr->sweep.sec == 0
+		   || Ns_DiffTime(&sockPtr->timeout, &pdataPtr->sweep, NULL) < 0) {
+	    pdataPtr->sweep = sockPtr->timeout;
+	}
+    }
+    if (Ns_DiffTime(&pdataPtr->sweep, &next, NULL) < 0) {
+	pdataPtr->sweep = next;
+    }
+#endif
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EventRemove --
+ *
+ *	Remove a Sock from the driver event set, if registered.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+EventRemove(Sock *sockPtr)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event ev;
+
+    /*
+     * NB: Event arg required for kernels before 2.6.9.  A failure
+     * is only logged as the close which follows also removes the
+     * socket from the set.
+     */
+
+    if ((sockPtr->eflags & SOCK_EVENTSET) && sockPtr->drvPtr->epfd != -1
+	    && epoll_ctl(sockPtr->drvPtr->epfd, EPOLL_CTL_DEL, sockPtr->sock,
+			 &ev) != 0) {
+	Ns_Log(Warning, "driver: epoll_ctl(%d) failed: %s",
+	       sockPtr->sock, strerror(errno));
+    }
+#endif
+    sockPtr->eflags = 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * QuerySock --
+ *
+ *	Append details of a waiting Sock to the driver query buffer.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+QuerySock(Driver *drvPtr, PollData *pdataPtr, Sock *sockPtr)
+{
+    int idx, events, revents;
+
+    if (sockPtr->eflags & SOCK_PARKED) {
+	idx = -1;
+	events = POLLIN;
+	revents = 0;
+    } else if (sockPtr->pidx < 0 || sockPtr->pidx >= pdataPtr->nfds) {
+	/* NB: Sock added to the wait list after the last poll. */
+	idx = -1;
+	events = revents = 0;
+    } else {
+	idx = sockPtr->pidx;
+	events = pdataPtr->pfds[idx].events;
+	revents = pdataPtr->pfds[idx].revents;
+    }
+    Tcl_DStringStartSublist(drvPtr->queryPtr);
+    Ns_DStringPrintf(drvPtr->queryPtr,
+	"id %u sock %d state %s idx %d events %d revents %d "
+	"accept %ld:%ld timeout %ld:%ld",
+	sockPtr->id, sockPtr->sock, states[sockPtr->state], idx,
+	events, revents,
+	sockPtr->acceptTime.sec, sockPtr->acceptTime.usec,
+	sockPtr->timeout.sec, sockPtr->timeout.usec);
+    if (sockPtr->connPtr != NULL) {
+	NsAppendConn(drvPtr->queryPtr, sockPtr->connPtr, "i/o");
+    } else {
+	Tcl_DStringStartSublist(drvPtr->queryPtr);
+	Tcl_DStringEndSublist(drvPtr->queryPtr);
+    }
+    Tcl_DStringEndSublist(drvPtr->queryPtr);
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -1639,9 +2265,11 @@ SockClose(Sock *sockPtr)
     Driver *drvPtr = sockPtr->drvPtr;
 
     /*
-     * Free the Conn if the Sock is still responsible for it.
+     * Free a response never handed to a writer thread and the Conn
+     * if the Sock is still responsible for it.
      */
      
+    NsWriterFree(sockPtr);
     if (sockPtr->connPtr != NULL) {
 	NsFreeConnInterp(sockPtr->connPtr);
         FreeConn(sockPtr->connPtr);
@@ -1649,6 +2277,7 @@ SockClose(Sock *sockPtr)
     }
 
     (void) (*drvPtr->proc)(DriverClose, (Ns_Sock *) sockPtr, NULL, 0);
+    EventRemove(sockPtr);
     ns_sockclose(sockPtr->sock);
     SockState(sockPtr, SOCK_CLOSED);
     sockPtr->sock = INVALID_SOCKET;
@@ -1737,7 +2366,16 @@ SockRead(Sock *sockPtr)
 	    err = E_FILTER;
 	} else if (connPtr->avail >= (size_t) connPtr->contentLength) {
 	    connPtr->avail = connPtr->contentLength;
-	    if (!(connPtr->flags & NS_CONN_FILECONTENT)) {
+	    if (connPtr->formPtr != NULL) {
+		/*
+		 * Streamed content was consumed by the form parser.
+		 */
+
+		if (NsFormParserEnd(connPtr->formPtr) != NS_OK) {
+		    err = E_FORM;
+		}
+		connPtr->avail = 0;
+	    } else if (!(connPtr->flags & NS_CONN_FILECONTENT)) {
 		connPtr->content[connPtr->avail] = '\0';
 	    } else {
 		if (ftruncate(connPtr->tfd, connPtr->avail) != 0) {
@@ -1790,7 +2428,7 @@ SockReadLine(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr)
     Tcl_HashEntry *hPtr;
     struct iovec buf;
     char *s, *e, *hdr, save;
-    int len, n, max;
+    int len, n, max, id, cont;
 
     /*
      * Setup the request buffer and read more input.
@@ -1831,7 +2469,7 @@ SockReadLine(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr)
 	 */
 
         s = bufPtr->string + connPtr->roff;
-        e = strchr(s, '\n');
+        e = memchr(s, '\n', (size_t) (bufPtr->length - connPtr->roff));
         if (e == NULL) {
             return E_NOERROR;
 	}
@@ -1871,9 +2509,22 @@ SockReadLine(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr)
         	connPtr->flags |= (NS_CONN_SKIPHDRS | NS_CONN_READHDRS);
 	    }
 	} else if (e > s) {
+	    cont = isspace(UCHAR(*s));
             if (Ns_ParseHeader(connPtr->headers, s, Preserve) != NS_OK) {
 		return E_HINVAL;
 	    }
+
+	    /*
+	     * Record the index of the first of each common header.
+	     */
+
+	    if (!cont) {
+		n = Ns_SetLast(connPtr->headers);
+		id = NsHeaderId(Ns_SetKey(connPtr->headers, n));
+		if (id >= 0 && connPtr->hdrs[id] == 0) {
+		    connPtr->hdrs[id] = n + 1;
+		}
+	    }
 	}
 
 	/*
@@ -1885,6 +2536,7 @@ SockReadLine(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr)
             connPtr->flags |= NS_CONN_READHDRS;
 	}
     }
+    connPtr->nhdrs = Ns_SetSize(connPtr->headers);
 
     /*
      * With the request and headers read, setup the connection.  First,  
@@ -1896,7 +2548,7 @@ SockReadLine(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr)
     if (servPtr != NULL) {
     	connPtr->location = connPtr->drvPtr->location;
     } else {
-    	hdr = Ns_SetIGet(connPtr->headers, "host");
+    	hdr = NsConnHeader(connPtr, HDR_HOST);
 	if (hdr == NULL) {
 	    return E_NOHOST;
 	}
@@ -1935,7 +2587,7 @@ SockReadLine(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr)
      * Parse authorization header, if any.
      */
 
-    hdr = Ns_SetIGet(connPtr->headers, "authorization");
+    hdr = NsConnHeader(connPtr, HDR_AUTHORIZATION);
     if (hdr != NULL) {
         s = hdr;
         while (*s != '\0' && !isspace(UCHAR(*s))) {
@@ -1969,7 +2621,7 @@ SockReadLine(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr)
      
     connPtr->limitsPtr = NsGetRequestLimits(connPtr->server,
             				    request->method, request->url);
-    hdr = Ns_SetIGet(connPtr->headers, "content-length");
+    hdr = NsConnHeader(connPtr, HDR_CONTENT_LENGTH);
     if (hdr == NULL) {
         len = 0;
     } else if (sscanf(hdr, "%d", &len) != 1 || len < 0) {
@@ -2009,6 +2661,22 @@ SockReadLine(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr)
 
         Tcl_DStringSetLength(bufPtr, max);
         connPtr->content = bufPtr->string + connPtr->roff;
+    } else if ((servPtr->opts.flags & SERV_STREAMUPLOADS)
+	    && !(connPtr->flags & NS_CONN_ENTITYTOOLARGE)
+	    && (connPtr->formPtr = NsFormParserCreate(connPtr)) != NULL) {
+        /*
+         * Large multipart content is parsed as it arrives with
+         * file uploads written directly to their own temp files.
+         */
+
+	if (connPtr->avail > (size_t) connPtr->contentLength) {
+	    connPtr->avail = connPtr->contentLength;
+	}
+	if (NsFormParserFeed(connPtr->formPtr, bufPtr->string + connPtr->roff,
+			     (int) connPtr->avail) != NS_OK) {
+	    return E_FORM;
+	}
+        Tcl_DStringSetLength(bufPtr, connPtr->roff);
     } else {
         /*
          * Content must overflow to a temp file.
@@ -2061,7 +2729,7 @@ SockReadContent(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr)
      */
 
     buf.iov_len = connPtr->contentLength - connPtr->avail + 2;
-    if (!(connPtr->flags & NS_CONN_FILECONTENT)) {
+    if (!(connPtr->flags & NS_CONN_FILECONTENT) && connPtr->formPtr == NULL) {
         buf.iov_base = connPtr->content + connPtr->avail;
     } else {
         buf.iov_base = fbuf;
@@ -2075,7 +2743,14 @@ SockReadContent(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr)
     } else if (n == 0) {
 	return E_CLOSE;
     }
-    if ((connPtr->flags & NS_CONN_FILECONTENT)
+    if (connPtr->formPtr != NULL) {
+	if (n > (int) (connPtr->contentLength - connPtr->avail)) {
+	    n = connPtr->contentLength - connPtr->avail;
+	}
+	if (NsFormParserFeed(connPtr->formPtr, fbuf, n) != NS_OK) {
+	    return E_FORM;
+	}
+    } else if ((connPtr->flags & NS_CONN_FILECONTENT)
 	    && write(connPtr->tfd, fbuf, n) != n) {
 	return E_FDWRITE;
     }
@@ -2327,6 +3002,9 @@ FreeConn(Conn *connPtr)
     if (connPtr->tfd != -1) {
         Ns_ReleaseTemp(connPtr->tfd);
     }
+    if (connPtr->formPtr != NULL) {
+	NsFormParserFree(connPtr->formPtr);
+    }
     if (connPtr->authUser != NULL) {
         ns_free(connPtr->authUser);
     }
@@ -2470,7 +3148,11 @@ ThreadName(Driver *drvPtr, char *name)
     Tcl_DString ds;
 
     Tcl_DStringInit(&ds);
-    Ns_DStringVarAppend(&ds, "-", drvPtr->module, ":", name, "-", NULL);
+    Ns_DStringVarAppend(&ds, "-", drvPtr->module, ":", name, NULL);
+    if (drvPtr->tidx > 0) {
+	Ns_DStringPrintf(&ds, "%d", drvPtr->tidx);
+    }
+    Ns_DStringAppend(&ds, "-");
     Ns_ThreadSetName(ds.string);
     Tcl_DStringFree(&ds);
     Ns_Log(Notice, "starting");
@@ -2554,6 +3236,9 @@ LogReadError(Conn *connPtr, ReadErr err)
     case E_QUEWAIT:		
 	msg = "attempt to register quewait outside driver thread";
 	break;
+    case E_FORM:
+	msg = "invalid multipart content";
+	break;
     default:
 	msg = "unknown error";
     }
@@ -2562,6 +3247,7 @@ LogReadError(Conn *connPtr, ReadErr err)
     case E_FDWRITE:		
     case E_FDTRUNC:		
     case E_FDSEEK:		
+    case E_FORM:
 	fmt = "conn[%d]: %s: %s";
 	break;
     default:
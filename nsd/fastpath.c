@@ -42,6 +42,10 @@ static const char *RCSID = "@(#) $Header$, compiled: " __DATE__ " " __TIME__;
  * The following constants are defined for this file
  */
 
+#define GZIP_CACHE	1	/* Cache a gzip'ed variant of the file. */
+#define GZIP_SEND	2	/* Send the gzip'ed variant if cached. */
+#define GZIP_FILE	4	/* File itself is gzip'ed, e.g., a .gz sibling. */
+
 /*
  * The following structure defines the contents of a file
  * stored in the file cache.
@@ -51,9 +55,36 @@ typedef struct {
     time_t mtime;
     int size;
     int refcnt;
+    char *gzbytes;	/* Gzip'ed content or NULL if not cached. */
+    int gzsize;
     char bytes[1];	/* Grown to actual file size. */
 } File;
 
+/*
+ * The following structure defines a cached stat result, including
+ * a failed stat for a missing file.
+ */
+
+typedef struct {
+    time_t expires;
+    int found;
+    struct stat st;
+} Stat;
+
+/*
+ * The following structure maintains the inotify watches which flush
+ * stat cache entries for changed files before their TTL expires.
+ */
+
+typedef struct FastNotify {
+    int fd;
+    unsigned int gen;		/* Bumped on each batch of events. */
+    Ns_Cache *cache;		/* Stat cache to flush. */
+    Ns_Mutex lock;
+    Tcl_HashTable dirs;		/* Watched directories to watch id. */
+    Tcl_HashTable wds;		/* Watch id to directory. */
+} FastNotify;
+
 /*
  * Local functions defined in this file
  */
@@ -62,8 +93,17 @@ static Ns_Callback FreeEntry;
 static void DecrEntry(File *);
 static int UrlIs(char *server, char *url, int dir);
 static int FastStat(char *file, struct stat *stPtr);
+static int PathStat(NsServer *servPtr, char *file, struct stat *stPtr);
+static unsigned int NotifyWatch(FastNotify *notifyPtr, char *file);
+static unsigned int NotifyGen(FastNotify *notifyPtr);
+#ifdef HAVE_SYS_INOTIFY_H
+static Ns_ThreadProc NotifyThread;
+#endif
 static int FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
     char *type, char *file, struct stat *stPtr);
+static int FastSend(NsServer *servPtr, Ns_Conn *conn, int status,
+    char *type, char *file, struct stat *stPtr, int gzip);
+static int FastCompressible(char *type);
 
 
 /*
@@ -82,7 +122,7 @@ static int FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
  */
 
 Ns_Cache *
-NsFastpathCache(char *server, int size)
+NsFastpathCache(char *server, int size, int nshards, int policy)
 {
     Ns_DString ds;
     Ns_Cache *fpCache;
@@ -95,11 +135,73 @@ NsFastpathCache(char *server, int size)
 #endif
     Ns_DStringInit(&ds);
     Ns_DStringVarAppend(&ds, "nsfp:", server, NULL);
-    fpCache = Ns_CacheCreateSz(ds.string, keys, (size_t) size, FreeEntry);
+    fpCache = Ns_CacheCreateEx(ds.string, keys, (size_t) size,
+			       FreeEntry, nshards, policy);
     Ns_DStringFree(&ds);
     return fpCache;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ * NsFastpathStatCache --
+ *
+ *	Initialize the fastpath stat cache which holds the results of
+ *	stat(), including missing files, for ttl seconds.  If notify
+ *	is true, entries are also flushed on changes to the file or
+ *	its directory reported by inotify.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May create the inotify thread.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsFastpathStatCache(NsServer *servPtr, int size, int nshards, int ttl,
+		    int notify)
+{
+    Ns_DString ds;
+#ifdef HAVE_SYS_INOTIFY_H
+    FastNotify *notifyPtr;
+    int fd;
+#endif
+
+    Ns_DStringInit(&ds);
+    Ns_DStringVarAppend(&ds, "nsfpstat:", servPtr->server, NULL);
+    servPtr->fastpath.statcache = Ns_CacheCreateEx(ds.string,
+		TCL_STRING_KEYS, (size_t) size, NS_CACHE_FREE, nshards,
+		NS_CACHE_LRU);
+    servPtr->fastpath.statttl = ttl;
+    Ns_DStringFree(&ds);
+    if (!notify) {
+	return;
+    }
+#ifdef HAVE_SYS_INOTIFY_H
+    fd = inotify_init();
+    if (fd < 0) {
+	Ns_Log(Error, "fastpath[%s]: inotify_init() failed: %s",
+	       servPtr->server, strerror(errno));
+	return;
+    }
+    Ns_CloseOnExec(fd);
+    notifyPtr = ns_calloc(1, sizeof(FastNotify));
+    notifyPtr->fd = fd;
+    notifyPtr->cache = servPtr->fastpath.statcache;
+    Ns_MutexSetName2(&notifyPtr->lock, "nsfp:notify", servPtr->server);
+    Tcl_InitHashTable(&notifyPtr->dirs, TCL_STRING_KEYS);
+    Tcl_InitHashTable(&notifyPtr->wds, TCL_ONE_WORD_KEYS);
+    servPtr->fastpath.notifyPtr = notifyPtr;
+    Ns_ThreadCreate(NotifyThread, notifyPtr, 0, NULL);
+#else
+    Ns_Log(Warning, "fastpath[%s]: statcachenotify not supported",
+	   servPtr->server);
+#endif
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -309,7 +411,7 @@ Ns_FastPathOp(void *arg, Ns_Conn *conn)
 
     Ns_DStringInit(&ds);
     if (NsUrlToFile(&ds, servPtr, url) != NS_OK
-    	    || !FastStat(ds.string, &st)) {
+    	    || !PathStat(servPtr, ds.string, &st)) {
 	goto notfound;
     }
     if (S_ISREG(st.st_mode)) {
@@ -331,7 +433,7 @@ Ns_FastPathOp(void *arg, Ns_Conn *conn)
 		goto notfound;
 	    }
 	    Ns_DStringVarAppend(&ds, "/", servPtr->fastpath.dirv[i], NULL);
-            if ((stat(ds.string, &st) == 0) && S_ISREG(st.st_mode)) {
+            if (PathStat(servPtr, ds.string, &st) && S_ISREG(st.st_mode)) {
                 if (url[strlen(url) - 1] != '/') {
                     Ns_DStringTrunc(&ds, 0);
                     Ns_DStringVarAppend(&ds, url, "/", NULL);
@@ -409,6 +511,9 @@ static void
 DecrEntry(File *filePtr)
 {
     if (--filePtr->refcnt == 0) {
+	if (filePtr->gzbytes != NULL) {
+	    ns_free(filePtr->gzbytes);
+	}
 	ns_free(filePtr);
     }
 }
@@ -443,19 +548,298 @@ FastStat(char *file, struct stat *stPtr)
     return 1;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PathStat --
+ *
+ *      Stat a file under the pageroot, using the stat cache if
+ *	enabled.  Missing files are cached as well so repeated
+ *	requests for them need no system calls.
+ *
+ * Results:
+ *      1 if stat ok, 0 otherwise.
+ *
+ * Side effects:
+ *      Result may be cached for the stat cache TTL.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+PathStat(NsServer *servPtr, char *file, struct stat *stPtr)
+{
+    FastNotify	   *notifyPtr = servPtr->fastpath.notifyPtr;
+    Ns_Cache	   *cache;
+    Ns_Entry	   *entPtr;
+    Stat	   *statPtr;
+    time_t	    now;
+    unsigned int    gen = 0;
+    int		    found, new;
+
+    if (servPtr->fastpath.statcache == NULL) {
+	return FastStat(file, stPtr);
+    }
+    now = time(NULL);
+    cache = Ns_CacheShard(servPtr->fastpath.statcache, file);
+    Ns_CacheLock(cache);
+    entPtr = Ns_CacheFindEntry(cache, file);
+    if (entPtr != NULL) {
+	statPtr = Ns_CacheGetValue(entPtr);
+	if (statPtr->expires > now) {
+	    found = statPtr->found;
+	    if (found) {
+		*stPtr = statPtr->st;
+	    }
+	    Ns_CacheUnlock(cache);
+	    return found;
+	}
+	Ns_CacheFlushEntry(entPtr);
+    }
+    Ns_CacheUnlock(cache);
+
+    /*
+     * Watch the directory before the stat so any later change is
+     * reported, then cache the result unless changes were reported
+     * meanwhile.
+     */
+
+    if (notifyPtr != NULL) {
+	gen = NotifyWatch(notifyPtr, file);
+    }
+    found = (stat(file, stPtr) == 0);
+    if (!found && errno != ENOENT && errno != ENOTDIR && errno != EACCES) {
+	Ns_Log(Error, "fastpath: stat(%s) failed: %s", file, strerror(errno));
+	return 0;
+    }
+    statPtr = ns_malloc(sizeof(Stat));
+    statPtr->expires = now + servPtr->fastpath.statttl;
+    statPtr->found = found;
+    if (found) {
+	statPtr->st = *stPtr;
+    }
+    Ns_CacheLock(cache);
+    if (notifyPtr == NULL || NotifyGen(notifyPtr) == gen) {
+	entPtr = Ns_CacheCreateEntry(cache, file, &new);
+	Ns_CacheSetValueSz(entPtr, statPtr, 1);
+	statPtr = NULL;
+    }
+    Ns_CacheUnlock(cache);
+    if (statPtr != NULL) {
+	ns_free(statPtr);
+    }
+    return found;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NotifyWatch --
+ *
+ *      Ensure the directory of the given file is watched.
+ *
+ * Results:
+ *      Current event generation.
+ *
+ * Side effects:
+ *      May add an inotify watch.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static unsigned int
+NotifyWatch(FastNotify *notifyPtr, char *file)
+{
+    Tcl_HashEntry  *hPtr, *wPtr;
+    char	   *slash;
+    unsigned int    gen;
+    int		    wd, new;
+
+    slash = strrchr(file, '/');
+    if (slash != NULL) {
+	*slash = '\0';
+    }
+    Ns_MutexLock(&notifyPtr->lock);
+    if (slash != NULL) {
+	hPtr = Tcl_CreateHashEntry(&notifyPtr->dirs, file, &new);
+	if (new) {
+	    wd = -1;
+#ifdef HAVE_SYS_INOTIFY_H
+	    wd = inotify_add_watch(notifyPtr->fd, file,
+		    IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE
+		    | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF
+		    | IN_MOVE_SELF);
+#endif
+	    if (wd < 0) {
+		/*
+		 * Directory missing or out of watches: results for
+		 * files within are flushed only by the TTL.
+		 */
+
+		Tcl_DeleteHashEntry(hPtr);
+	    } else {
+		Tcl_SetHashValue(hPtr, INT2PTR(wd));
+		wPtr = Tcl_CreateHashEntry(&notifyPtr->wds, INT2PTR(wd), &new);
+		if (new) {
+		    Tcl_SetHashValue(wPtr, ns_strdup(file));
+		}
+	    }
+	}
+    }
+    gen = notifyPtr->gen;
+    Ns_MutexUnlock(&notifyPtr->lock);
+    if (slash != NULL) {
+	*slash = '/';
+    }
+    return gen;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NotifyGen --
+ *
+ *      Return the current event generation.
+ *
+ * Results:
+ *      Generation, incremented before each batch of events is
+ *	processed.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static unsigned int
+NotifyGen(FastNotify *notifyPtr)
+{
+    unsigned int gen;
+
+    Ns_MutexLock(&notifyPtr->lock);
+    gen = notifyPtr->gen;
+    Ns_MutexUnlock(&notifyPtr->lock);
+    return gen;
+}
+
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NotifyThread --
+ *
+ *      Read inotify events and flush the stat cache entries for
+ *	changed files.  The entire cache is flushed on directory
+ *	changes which could affect entries below the directory.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Stat cache entries are flushed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+NotifyThread(void *arg)
+{
+    FastNotify	   *notifyPtr = arg;
+    struct inotify_event *evPtr;
+    Tcl_HashEntry  *hPtr;
+    Ns_Cache	   *cache;
+    Ns_Entry	   *entPtr;
+    Ns_DString	    ds;
+    char	   *p, *dir;
+    int		    n, all;
+    union {
+	struct inotify_event ev;
+	char buf[8192];
+    } events;
+
+    Ns_ThreadSetName("-fastpath:notify-");
+    Ns_DStringInit(&ds);
+    while (1) {
+	n = read(notifyPtr->fd, events.buf, sizeof(events.buf));
+	if (n <= 0) {
+	    if (n < 0 && errno == EINTR) {
+		continue;
+	    }
+	    Ns_Log(Error, "fastpath: inotify read() failed: %s",
+		   strerror(errno));
+	    break;
+	}
+	Ns_MutexLock(&notifyPtr->lock);
+	++notifyPtr->gen;
+	Ns_MutexUnlock(&notifyPtr->lock);
+	all = 0;
+	for (p = events.buf; p < events.buf + n;
+		p += sizeof(struct inotify_event) + evPtr->len) {
+	    evPtr = (struct inotify_event *) p;
+	    if ((evPtr->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF))
+		    || ((evPtr->mask & IN_ISDIR) && (evPtr->mask & (IN_CREATE
+			| IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)))) {
+		all = 1;
+	    }
+	    Ns_DStringTrunc(&ds, 0);
+	    Ns_MutexLock(&notifyPtr->lock);
+	    hPtr = Tcl_FindHashEntry(&notifyPtr->wds, INT2PTR(evPtr->wd));
+	    if (hPtr != NULL) {
+		dir = Tcl_GetHashValue(hPtr);
+		if (evPtr->mask & IN_IGNORED) {
+		    Tcl_DeleteHashEntry(hPtr);
+		    hPtr = Tcl_FindHashEntry(&notifyPtr->dirs, dir);
+		    if (hPtr != NULL) {
+			Tcl_DeleteHashEntry(hPtr);
+		    }
+		    ns_free(dir);
+		} else if (evPtr->len > 0) {
+		    Ns_DStringVarAppend(&ds, dir, "/", evPtr->name, NULL);
+		}
+	    }
+	    Ns_MutexUnlock(&notifyPtr->lock);
+	    if (!all && ds.length > 0) {
+		cache = Ns_CacheShard(notifyPtr->cache, ds.string);
+		Ns_CacheLock(cache);
+		entPtr = Ns_CacheFindEntry(cache, ds.string);
+		if (entPtr != NULL) {
+		    Ns_CacheFlushEntry(entPtr);
+		}
+		Ns_CacheUnlock(cache);
+	    }
+	}
+	if (all) {
+	    Ns_CacheLock(notifyPtr->cache);
+	    Ns_CacheFlush(notifyPtr->cache);
+	    Ns_CacheUnlock(notifyPtr->cache);
+	}
+    }
+    Ns_DStringFree(&ds);
+}
+
+#endif
+
 
 /*
  *----------------------------------------------------------------------
  *
  * FastReturn --
  *
- *      Return an open file, possibly from cache.
+ *      Return a file, or its gzip'ed variant for clients which
+ *	accept gzip encoding if enabled.  A sibling file with a .gz
+ *	extension no older than the file is sent as is, otherwise the
+ *	variant is compressed once and cached with the file content.
  *
  * Results:
  *      Standard Ns_Request result.
  *
  * Side effects:
- *      May map, cache, open, and/or send file out connection.
+ *      See FastSend.
  *
  *----------------------------------------------------------------------
  */
@@ -463,24 +847,107 @@ FastStat(char *file, struct stat *stPtr)
 static int
 FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
     char *type, char *file, struct stat *stPtr)
+{
+    Ns_DString      ds;
+    struct stat     st;
+    char	   *ahdr;
+    int		    gzip, result;
+
+    /*
+     * Determine the mime type if not given.
+     */
+     
+    if (type == NULL) {
+    	type = Ns_GetMimeType(file);
+    }
+    gzip = 0;
+    if (servPtr->fastpath.gzip
+	    && (servPtr->opts.flags & SERV_GZIP)
+	    && stPtr->st_size > (off_t) servPtr->opts.gzipmin
+	    && FastCompressible(type)) {
+	Ns_ConnCondSetHeaders(conn, "Vary", "Accept-Encoding");
+	gzip = GZIP_CACHE;
+	ahdr = NsConnHeader((Conn *) conn, HDR_ACCEPT_ENCODING);
+	if (ahdr != NULL && strstr(ahdr, "gzip") != NULL) {
+	    gzip |= GZIP_SEND;
+	    Ns_DStringInit(&ds);
+	    Ns_DStringVarAppend(&ds, file, ".gz", NULL);
+	    if (PathStat(servPtr, ds.string, &st) && S_ISREG(st.st_mode)
+		    && st.st_mtime >= stPtr->st_mtime) {
+		result = FastSend(servPtr, conn, status, type, ds.string,
+				  &st, GZIP_FILE);
+		Ns_DStringFree(&ds);
+		return result;
+	    }
+	    Ns_DStringFree(&ds);
+	}
+    }
+    return FastSend(servPtr, conn, status, type, file, stPtr, gzip);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FastCompressible --
+ *
+ *      Check if content of the given mime type is worth compressing.
+ *
+ * Results:
+ *      1 for text and text-like application types, 0 otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+FastCompressible(char *type)
+{
+    return (strncmp(type, "text/", 5) == 0
+	    || strstr(type, "javascript") != NULL
+	    || strstr(type, "json") != NULL
+	    || strstr(type, "xml") != NULL);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FastSend --
+ *
+ *      Send an open file, possibly from cache.  If gzip includes
+ *	GZIP_CACHE, a gzip'ed variant is cached with the content and
+ *	sent instead if gzip includes GZIP_SEND.  If gzip includes
+ *	GZIP_FILE, the file is already gzip'ed and the content
+ *	encoding header is set once it has been opened or found in
+ *	the cache, so a not found response is sent without it.
+ *
+ * Results:
+ *      Standard Ns_Request result.
+ *
+ * Side effects:
+ *      May map, cache, open, and/or send file out connection.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+FastSend(NsServer *servPtr, Ns_Conn *conn, int status,
+    char *type, char *file, struct stat *stPtr, int gzip)
 {
     int             result = NS_ERROR, fd, new, nread;
     File	   *filePtr;
     char	   *key;
+    Ns_Cache	   *cache;
     Ns_Entry	   *entPtr;
+    Tcl_DString	    gz;
     void           *map, *arg;
 #ifndef _WIN32
     FileKey	    ukey;
 #endif
 
-    /*
-     * Determine the mime type if not given.
-     */
-     
-    if (type == NULL) {
-    	type = Ns_GetMimeType(file);
-    }
-    
     /*
      * Set the last modified header if not set yet and, if not
      * modified since last request, return now.
@@ -497,6 +964,9 @@ FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
      */
      
     if (conn->flags & NS_CONN_SKIPBODY) {
+	if (gzip & GZIP_FILE) {
+	    Ns_ConnCondSetHeaders(conn, "Content-Encoding", "gzip");
+	}
 	Ns_ConnSetRequiredHeaders(conn, type, (int) stPtr->st_size);
 	return Ns_ConnFlushHeaders(conn, status);
     }
@@ -507,7 +977,9 @@ FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
 	/*
 	 * Caching is disabled, the entry is too large for the cache,
 	 * or the inode was changed too recently to be cached safely,
-	 * so just open, mmap, and send the content directly.
+	 * so just open, mmap, and send the content directly.  The
+	 * open fd is sent without mmap when the driver can use
+	 * sendfile.
 	 */
 
     	fd = open(file, O_RDONLY|O_BINARY);
@@ -516,7 +988,10 @@ FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
 		   file, strerror(errno));
 	    goto notfound;
 	}
-	if (servPtr->fastpath.mmap) {
+	if (gzip & GZIP_FILE) {
+	    Ns_ConnCondSetHeaders(conn, "Content-Encoding", "gzip");
+	}
+	if (servPtr->fastpath.mmap && !NsConnCanSendFile(conn)) {
 	    map = NsMap(fd, 0, stPtr->st_size, 0, &arg);
 	    if (map != MAP_FAILED) {
 	    	close(fd);
@@ -546,13 +1021,14 @@ FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
 	key = (char *) &ukey;
 #endif
 	filePtr = NULL;
-	Ns_CacheLock(servPtr->fastpath.cache);
-	entPtr = Ns_CacheCreateEntry(servPtr->fastpath.cache, key, &new);
+	cache = Ns_CacheShard(servPtr->fastpath.cache, key);
+	Ns_CacheLock(cache);
+	entPtr = Ns_CacheCreateEntry(cache, key, &new);
 	if (!new) {
 	    while (entPtr != NULL &&
 		   (filePtr = Ns_CacheGetValue(entPtr)) == NULL) {
-		Ns_CacheWait(servPtr->fastpath.cache);
-		entPtr = Ns_CacheFindEntry(servPtr->fastpath.cache, key);
+		Ns_CacheWait(cache);
+		entPtr = Ns_CacheFindEntry(cache, key);
 	    }
 	    if (filePtr != NULL &&
 		    (filePtr->mtime != stPtr->st_mtime ||
@@ -566,7 +1042,7 @@ FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
 	     * Read and cache new or invalidated entries in one big chunk.
 	     */
 
-	    Ns_CacheUnlock(servPtr->fastpath.cache);
+	    Ns_CacheUnlock(cache);
 	    fd = open(file, O_RDONLY|O_BINARY);
 	    if (fd < 0) {
 	    	filePtr = NULL;
@@ -577,6 +1053,8 @@ FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
 		filePtr->refcnt = 1;
 		filePtr->size = stPtr->st_size;
 		filePtr->mtime = stPtr->st_mtime;
+		filePtr->gzbytes = NULL;
+		filePtr->gzsize = 0;
 		nread = read(fd, filePtr->bytes, (size_t)filePtr->size);
 		close(fd);
 		if (nread != filePtr->size) {
@@ -584,26 +1062,50 @@ FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
 			   file, strerror(errno));
 		    ns_free(filePtr);
 		    filePtr = NULL;
+		} else if (gzip & GZIP_CACHE) {
+		    /*
+		     * Keep the gzip'ed variant if it is any smaller.
+		     */
+
+		    Tcl_DStringInit(&gz);
+		    if (Ns_Gzip(filePtr->bytes, filePtr->size,
+				servPtr->opts.gziplevel, &gz) == NS_OK
+			    && gz.length < filePtr->size) {
+			filePtr->gzsize = gz.length;
+			filePtr->gzbytes = ns_malloc((size_t) gz.length);
+			memcpy(filePtr->gzbytes, gz.string, (size_t) gz.length);
+		    }
+		    Tcl_DStringFree(&gz);
 		}
 	    }
-	    Ns_CacheLock(servPtr->fastpath.cache);
-	    entPtr = Ns_CacheCreateEntry(servPtr->fastpath.cache, key, &new);
+	    Ns_CacheLock(cache);
+	    entPtr = Ns_CacheCreateEntry(cache, key, &new);
 	    if (filePtr != NULL) {
-		Ns_CacheSetValueSz(entPtr, filePtr, (size_t)filePtr->size);
+		Ns_CacheSetValueSz(entPtr, filePtr,
+			(size_t) (filePtr->size + filePtr->gzsize));
 	    } else {
 		Ns_CacheFlushEntry(entPtr);
 	    }
-	    Ns_CacheBroadcast(servPtr->fastpath.cache);
+	    Ns_CacheBroadcast(cache);
 	}
 	if (filePtr != NULL) {
 	    ++filePtr->refcnt;
-	    Ns_CacheUnlock(servPtr->fastpath.cache);
-            result = Ns_ConnReturnData(conn, status, filePtr->bytes,
-			    filePtr->size, type);
-	    Ns_CacheLock(servPtr->fastpath.cache);
+	    Ns_CacheUnlock(cache);
+	    if ((gzip & GZIP_SEND) && filePtr->gzbytes != NULL) {
+		Ns_ConnCondSetHeaders(conn, "Content-Encoding", "gzip");
+		result = Ns_ConnReturnData(conn, status, filePtr->gzbytes,
+				filePtr->gzsize, type);
+	    } else {
+		if (gzip & GZIP_FILE) {
+		    Ns_ConnCondSetHeaders(conn, "Content-Encoding", "gzip");
+		}
+		result = Ns_ConnReturnData(conn, status, filePtr->bytes,
+				filePtr->size, type);
+	    }
+	    Ns_CacheLock(cache);
 	    DecrEntry(filePtr);
 	}
-	Ns_CacheUnlock(servPtr->fastpath.cache);
+	Ns_CacheUnlock(cache);
 	if (filePtr == NULL) {
 	    goto notfound;
 	}
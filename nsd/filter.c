@@ -49,6 +49,12 @@ typedef struct Filter {
     char          *url;
     int            when;
     void          *arg;
+    int            order;	/* Position in list when indexed. */
+    int            type;	/* URL match type, see below. */
+    int            length;	/* Length of literal URL prefix. */
+    int            glob;	/* Method is a glob pattern. */
+    unsigned long  ncalls;	/* Invocations by exited threads. */
+    Ns_Time        time;	/* Cumulative time in proc, likewise. */
 } Filter;
 
 typedef struct Trace {
@@ -59,11 +65,120 @@ typedef struct Trace {
 
 #define FILTER_GETPRIO(when) ((signed char)((when & 0xFF000000) >> 24))
 
+/*
+ * URL patterns are classified at registration to avoid most calls
+ * to Tcl_StringMatch:  an exact URL, a literal prefix followed by a
+ * single trailing "*", or a residual glob pattern.
+ */
+
+#define FILTER_EXACT	0
+#define FILTER_PREFIX	1
+#define FILTER_GLOB	2
+
+/*
+ * The following structures define the per-server filter index:
+ * filters are bucketed by exact method (or a single bucket for
+ * glob methods) and within each bucket in a tree keyed by the
+ * complete "/" separated elements of the literal URL prefix.
+ * Candidates on the path of a request URL are then checked and
+ * ordered by registration position.  The index is rebuilt on the
+ * next lookup after a filter is registered.
+ */
+
+typedef struct Node {
+    Tcl_HashTable children;	/* URL element to child Node. */
+    int		  nfilters;
+    Filter	**filters;	/* Filters in registration order. */
+} Node;
+
+typedef struct Index {
+    unsigned int  gen;		/* Filter generation indexed. */
+    Tcl_HashTable methods;	/* Method to root Node. */
+    Node	 *globPtr;	/* Root for glob methods, if any. */
+} Index;
+
+/*
+ * The following structure defines the per-thread memo of filters
+ * matching a method and URL: a direct-mapped table valid while no
+ * filters have been registered for the server since.
+ */
+
+#define MEMO_SIZE 64
+
+typedef struct Memo {
+    NsServer	*servPtr;
+    unsigned int gen;
+    Ns_DString   key;		/* Method and URL. */
+    int          when;		/* Union of stages of filters. */
+    int          nfilters;
+    int          maxfilters;
+    Filter     **filters;	/* Matching filters in order. */
+} Memo;
+
+/*
+ * The following structures define the per-thread filter counters,
+ * updated under an uncontended per-thread lock and summed with the
+ * totals of exited threads when read.
+ */
+
+typedef struct Count {
+    unsigned long ncalls;
+    Ns_Time       time;
+} Count;
+
+typedef struct Stats {
+    struct Stats *nextPtr;
+    struct Stats *prevPtr;
+    Ns_Mutex      lock;
+    Tcl_HashTable counts;	/* Filter to Count. */
+} Stats;
+
+static Ns_Tls tls;
+static Ns_Tls stattls;
+static Ns_Mutex lock;		/* Lock for filter lists and indices. */
+static Ns_Mutex statlock;	/* Lock for list of Stats and totals. */
+static Stats *firstStatsPtr;
+
+static Memo *GetMemo(NsServer *servPtr, char *method, char *url);
+static void FreeMemo(void *arg);
+static void CountFilter(Filter *fPtr, Ns_Time *diffPtr);
+static void FreeStats(void *arg);
+static Index *GetIndex(NsServer *servPtr);
+static Node *NewNode(void);
+static void FreeNode(Node *nodePtr);
+static void IndexFilter(Node *nodePtr, Filter *fPtr);
+static void MatchNode(Node *nodePtr, char *method, char *url, Memo *memoPtr);
+static void AppendWhen(Tcl_DString *dsPtr, int when);
 static Trace *NewTrace(Ns_TraceProc *proc, void *arg);
 static void RunTraces(Ns_Conn *conn, Trace *firstPtr);
 static void *RegisterCleanup(NsServer *servPtr, Ns_TraceProc *proc,
 			     void *arg);
 
+
+/*
+ *----------------------------------------------------------------------
+ * NsInitFilters --
+ *
+ *      Initialize the filter memo and locks.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsInitFilters(void)
+{
+    Ns_TlsAlloc(&tls, FreeMemo);
+    Ns_TlsAlloc(&stattls, FreeStats);
+    Ns_MutexSetName(&lock, "ns:filters");
+    Ns_MutexSetName(&statlock, "ns:filterstats");
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -87,16 +202,27 @@ Ns_RegisterFilter(char *server, char *method, char *url,
 {
     NsServer *servPtr = NsGetServer(server);
     Filter *fPtr, **fPtrPtr;
+    char *p;
 
     if (servPtr == NULL) {
 	return NULL;
     }
-    fPtr = ns_malloc(sizeof(Filter));
+    fPtr = ns_calloc(1, sizeof(Filter));
     fPtr->proc = proc;
     fPtr->method = ns_strdup(method);
     fPtr->url = ns_strdup(url);
     fPtr->when = when;
     fPtr->arg = arg;
+    fPtr->glob = (strpbrk(method, "*?[\\") != NULL);
+    p = strpbrk(url, "*?[\\");
+    if (p == NULL) {
+	fPtr->type = FILTER_EXACT;
+	fPtr->length = strlen(url);
+    } else {
+	fPtr->length = p - url;
+	fPtr->type = (STREQ(p, "*") ? FILTER_PREFIX : FILTER_GLOB);
+    }
+    Ns_MutexLock(&lock);
     fPtrPtr = &servPtr->filter.firstFilterPtr;
     /* locate the first filter at this priority */
     while (*fPtrPtr != NULL 
@@ -112,6 +238,9 @@ Ns_RegisterFilter(char *server, char *method, char *url,
     }
     fPtr->nextPtr = *fPtrPtr;
     *fPtrPtr = fPtr;
+    NsMemoryBarrier();
+    ++servPtr->filter.gen;
+    Ns_MutexUnlock(&lock);
     return (void *) fPtr;
 }
 
@@ -135,22 +264,48 @@ int
 NsRunFilters(Ns_Conn *conn, int why)
 {
     Conn *connPtr = (Conn *) conn;
-    Filter *fPtr;
-    char *method, *url;
-    int status;
+    Filter *fPtr, **filters, *buf[16];
+    Memo *memoPtr;
+    Ns_Time start, end, diff;
+    int i, n, status, stats;
 
     status = NS_OK;
     if (conn->request != NULL) {
-	method = conn->request->method;
-	url = conn->request->url;
-	fPtr = connPtr->servPtr->filter.firstFilterPtr;
-	while (fPtr != NULL && status == NS_OK) {
-	    if ((fPtr->when & why)
-		&& Tcl_StringMatch(method, fPtr->method)
-		&& Tcl_StringMatch(url, fPtr->url)) {
+	memoPtr = GetMemo(connPtr->servPtr, conn->request->method,
+			  conn->request->url);
+	if (!(memoPtr->when & why)) {
+	    return NS_OK;
+	}
+
+	/*
+	 * Copy the matching filters as filters may run filters for
+	 * other URLs which reuse the memo slot.
+	 */
+
+	n = memoPtr->nfilters;
+	filters = buf;
+	if (n > 16) {
+	    filters = ns_malloc(sizeof(Filter *) * n);
+	}
+	memcpy(filters, memoPtr->filters, sizeof(Filter *) * n);
+	stats = (connPtr->servPtr->opts.flags & SERV_FILTERSTATS);
+	for (i = 0; i < n && status == NS_OK; ++i) {
+	    fPtr = filters[i];
+	    if (!(fPtr->when & why)) {
+		continue;
+	    }
+	    if (!stats) {
 		status = (*fPtr->proc)(fPtr->arg, conn, why);
+	    } else {
+		Ns_GetTime(&start);
+		status = (*fPtr->proc)(fPtr->arg, conn, why);
+		Ns_GetTime(&end);
+		Ns_DiffTime(&end, &start, &diff);
+		CountFilter(fPtr, &diff);
 	    }
-	    fPtr = fPtr->nextPtr;
+	}
+	if (filters != buf) {
+	    ns_free(filters);
 	}
 	if (status == NS_FILTER_BREAK ||
 	    (why == NS_FILTER_TRACE && status == NS_FILTER_RETURN)) {
@@ -160,6 +315,581 @@ NsRunFilters(Ns_Conn *conn, int why)
     return status;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ * CountFilter --
+ *
+ *      Add an invocation and its time to the counters of this
+ *	thread for a filter.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *	Thread stats are allocated and linked on first use.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CountFilter(Filter *fPtr, Ns_Time *diffPtr)
+{
+    Stats *statsPtr;
+    Count *countPtr;
+    Tcl_HashEntry *hPtr;
+    int new;
+
+    statsPtr = Ns_TlsGet(&stattls);
+    if (statsPtr == NULL) {
+	statsPtr = ns_calloc(1, sizeof(Stats));
+	Tcl_InitHashTable(&statsPtr->counts, TCL_ONE_WORD_KEYS);
+	Ns_MutexSetName(&statsPtr->lock, "ns:filterthread");
+	Ns_MutexLock(&statlock);
+	statsPtr->nextPtr = firstStatsPtr;
+	if (firstStatsPtr != NULL) {
+	    firstStatsPtr->prevPtr = statsPtr;
+	}
+	firstStatsPtr = statsPtr;
+	Ns_MutexUnlock(&statlock);
+	Ns_TlsSet(&stattls, statsPtr);
+    }
+    Ns_MutexLock(&statsPtr->lock);
+    hPtr = Tcl_CreateHashEntry(&statsPtr->counts, (char *) fPtr, &new);
+    if (new) {
+	countPtr = ns_calloc(1, sizeof(Count));
+	Tcl_SetHashValue(hPtr, countPtr);
+    } else {
+	countPtr = Tcl_GetHashValue(hPtr);
+    }
+    ++countPtr->ncalls;
+    Ns_IncrTime(&countPtr->time, diffPtr->sec, diffPtr->usec);
+    Ns_MutexUnlock(&statsPtr->lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ * FreeStats --
+ *
+ *      TLS cleanup to add the counters of an exiting thread to the
+ *	filter totals.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *	Thread stats are unlinked and freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreeStats(void *arg)
+{
+    Stats *statsPtr = arg;
+    Count *countPtr;
+    Filter *fPtr;
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+
+    Ns_MutexLock(&statlock);
+    if (statsPtr->prevPtr != NULL) {
+	statsPtr->prevPtr->nextPtr = statsPtr->nextPtr;
+    } else {
+	firstStatsPtr = statsPtr->nextPtr;
+    }
+    if (statsPtr->nextPtr != NULL) {
+	statsPtr->nextPtr->prevPtr = statsPtr->prevPtr;
+    }
+    hPtr = Tcl_FirstHashEntry(&statsPtr->counts, &search);
+    while (hPtr != NULL) {
+	fPtr = (Filter *) Tcl_GetHashKey(&statsPtr->counts, hPtr);
+	countPtr = Tcl_GetHashValue(hPtr);
+	fPtr->ncalls += countPtr->ncalls;
+	Ns_IncrTime(&fPtr->time, countPtr->time.sec, countPtr->time.usec);
+	ns_free(countPtr);
+	hPtr = Tcl_NextHashEntry(&search);
+    }
+    Ns_MutexUnlock(&statlock);
+    Tcl_DeleteHashTable(&statsPtr->counts);
+    Ns_MutexDestroy(&statsPtr->lock);
+    ns_free(statsPtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ * GetMemo --
+ *
+ *      Get the memo slot for a method and URL, matching the method
+ *	and URL against the filter index if not memoized already.
+ *
+ * Results:
+ *      Pointer to Memo.
+ *
+ * Side effects:
+ *	May replace the slot of another method and URL.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Memo *
+GetMemo(NsServer *servPtr, char *method, char *url)
+{
+    Memo *memoPtr;
+    Index *indexPtr;
+    Tcl_HashEntry *hPtr;
+    Tcl_DString ds;
+    Filter *fPtr;
+    char *p;
+    unsigned int hash, gen;
+    int i, j;
+
+    hash = 0;
+    for (p = url; *p != '\0'; ++p) {
+	hash += (hash << 3) + UCHAR(*p);
+    }
+    for (p = method; *p != '\0'; ++p) {
+	hash += (hash << 3) + UCHAR(*p);
+    }
+    memoPtr = Ns_TlsGet(&tls);
+    if (memoPtr == NULL) {
+	memoPtr = ns_calloc(MEMO_SIZE, sizeof(Memo));
+	for (i = 0; i < MEMO_SIZE; ++i) {
+	    Ns_DStringInit(&memoPtr[i].key);
+	}
+	Ns_TlsSet(&tls, memoPtr);
+    }
+    memoPtr += hash % MEMO_SIZE;
+
+    /*
+     * Check the memo against the generation without the lock.  It
+     * is bumped after the stores of a new filter are made visible
+     * and a memo found stale is rebuilt under the lock.
+     */
+
+    gen = servPtr->filter.gen;
+    if (memoPtr->servPtr == servPtr && memoPtr->gen == gen
+	    && STREQ(memoPtr->key.string, method)
+	    && STREQ(memoPtr->key.string + strlen(method) + 1, url)) {
+	return memoPtr;
+    }
+    memoPtr->servPtr = servPtr;
+    Ns_DStringTrunc(&memoPtr->key, 0);
+    Ns_DStringNAppend(&memoPtr->key, method, (int) strlen(method) + 1);
+    Ns_DStringAppend(&memoPtr->key, url);
+    memoPtr->nfilters = 0;
+    memoPtr->when = 0;
+
+    /*
+     * Collect candidates from the exact method and glob method
+     * trees with the index locked against a concurrent rebuild.
+     */
+
+    Tcl_DStringInit(&ds);
+    Tcl_DStringAppend(&ds, url, -1);
+    Ns_MutexLock(&lock);
+    indexPtr = GetIndex(servPtr);
+    memoPtr->gen = indexPtr->gen;
+    hPtr = Tcl_FindHashEntry(&indexPtr->methods, method);
+    if (hPtr != NULL) {
+	MatchNode(Tcl_GetHashValue(hPtr), method, ds.string, memoPtr);
+    }
+    if (indexPtr->globPtr != NULL) {
+	MatchNode(indexPtr->globPtr, method, ds.string, memoPtr);
+    }
+    Ns_MutexUnlock(&lock);
+    Tcl_DStringFree(&ds);
+
+    /*
+     * Restore registration order, typically of just a few filters.
+     */
+
+    for (i = 1; i < memoPtr->nfilters; ++i) {
+	fPtr = memoPtr->filters[i];
+	for (j = i; j > 0 && memoPtr->filters[j - 1]->order > fPtr->order; --j) {
+	    memoPtr->filters[j] = memoPtr->filters[j - 1];
+	}
+	memoPtr->filters[j] = fPtr;
+    }
+    return memoPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ * MatchNode --
+ *
+ *      Add the filters of the given node and the nodes below it
+ *	along the elements of the URL which match the method and URL.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *	Filters are appended to the memo.  The URL is modified
+ *	during the walk but restored before return.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+MatchNode(Node *nodePtr, char *method, char *url, Memo *memoPtr)
+{
+    Tcl_HashEntry *hPtr;
+    Filter *fPtr;
+    char *p, *slash;
+    int i, match;
+
+    p = url;
+    while (nodePtr != NULL) {
+	for (i = 0; i < nodePtr->nfilters; ++i) {
+	    fPtr = nodePtr->filters[i];
+	    if (fPtr->glob && !Tcl_StringMatch(method, fPtr->method)) {
+		continue;
+	    }
+	    switch (fPtr->type) {
+	    case FILTER_EXACT:
+		match = STREQ(url, fPtr->url);
+		break;
+	    case FILTER_PREFIX:
+		match = (strncmp(url, fPtr->url, (size_t) fPtr->length) == 0);
+		break;
+	    default:
+		match = Tcl_StringMatch(url, fPtr->url);
+		break;
+	    }
+	    if (match) {
+		if (memoPtr->nfilters == memoPtr->maxfilters) {
+		    memoPtr->maxfilters = memoPtr->maxfilters * 2 + 4;
+		    memoPtr->filters = ns_realloc(memoPtr->filters,
+			    sizeof(Filter *) * memoPtr->maxfilters);
+		}
+		memoPtr->filters[memoPtr->nfilters++] = fPtr;
+		memoPtr->when |= fPtr->when;
+	    }
+	}
+	slash = strchr(p, '/');
+	if (slash == NULL) {
+	    break;
+	}
+	*slash = '\0';
+	hPtr = Tcl_FindHashEntry(&nodePtr->children, p);
+	*slash = '/';
+	nodePtr = (hPtr ? Tcl_GetHashValue(hPtr) : NULL);
+	p = slash + 1;
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ * GetIndex --
+ *
+ *      Return the filter index for a server, rebuilding it from
+ *	the filter list if filters have been registered since.
+ *
+ * Results:
+ *      Pointer to Index.
+ *
+ * Side effects:
+ *	Must be called with the filter lock held.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Index *
+GetIndex(NsServer *servPtr)
+{
+    Index *indexPtr = servPtr->filter.indexPtr;
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+    Filter *fPtr;
+    Node *nodePtr;
+    int new, order;
+
+    if (indexPtr != NULL && indexPtr->gen == servPtr->filter.gen) {
+	return indexPtr;
+    }
+    if (indexPtr != NULL) {
+	hPtr = Tcl_FirstHashEntry(&indexPtr->methods, &search);
+	while (hPtr != NULL) {
+	    FreeNode(Tcl_GetHashValue(hPtr));
+	    hPtr = Tcl_NextHashEntry(&search);
+	}
+	Tcl_DeleteHashTable(&indexPtr->methods);
+	if (indexPtr->globPtr != NULL) {
+	    FreeNode(indexPtr->globPtr);
+	}
+    } else {
+	indexPtr = ns_malloc(sizeof(Index));
+	servPtr->filter.indexPtr = indexPtr;
+    }
+    indexPtr->gen = servPtr->filter.gen;
+    indexPtr->globPtr = NULL;
+    Tcl_InitHashTable(&indexPtr->methods, TCL_STRING_KEYS);
+    order = 0;
+    for (fPtr = servPtr->filter.firstFilterPtr; fPtr != NULL;
+	    fPtr = fPtr->nextPtr) {
+	fPtr->order = order++;
+	if (fPtr->glob) {
+	    if (indexPtr->globPtr == NULL) {
+		indexPtr->globPtr = NewNode();
+	    }
+	    nodePtr = indexPtr->globPtr;
+	} else {
+	    hPtr = Tcl_CreateHashEntry(&indexPtr->methods, fPtr->method, &new);
+	    if (new) {
+		Tcl_SetHashValue(hPtr, NewNode());
+	    }
+	    nodePtr = Tcl_GetHashValue(hPtr);
+	}
+	IndexFilter(nodePtr, fPtr);
+    }
+    return indexPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ * IndexFilter --
+ *
+ *      Add a filter to the tree below the given root at the node
+ *	of the last complete element of its literal URL prefix.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *	Nodes are created as needed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+IndexFilter(Node *nodePtr, Filter *fPtr)
+{
+    Tcl_HashEntry *hPtr;
+    Tcl_DString ds;
+    char *p, *slash;
+    int new;
+
+    Tcl_DStringInit(&ds);
+    Tcl_DStringAppend(&ds, fPtr->url, fPtr->length);
+    p = ds.string;
+    while ((slash = strchr(p, '/')) != NULL) {
+	*slash = '\0';
+	hPtr = Tcl_CreateHashEntry(&nodePtr->children, p, &new);
+	if (new) {
+	    Tcl_SetHashValue(hPtr, NewNode());
+	}
+	nodePtr = Tcl_GetHashValue(hPtr);
+	p = slash + 1;
+    }
+    Tcl_DStringFree(&ds);
+    nodePtr->filters = ns_realloc(nodePtr->filters,
+	    sizeof(Filter *) * (nodePtr->nfilters + 1));
+    nodePtr->filters[nodePtr->nfilters++] = fPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ * NewNode, FreeNode --
+ *
+ *      Allocate or free (recursively) an index tree node.
+ *
+ * Results:
+ *      NewNode returns pointer to new Node.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Node *
+NewNode(void)
+{
+    Node *nodePtr;
+
+    nodePtr = ns_malloc(sizeof(Node));
+    Tcl_InitHashTable(&nodePtr->children, TCL_STRING_KEYS);
+    nodePtr->nfilters = 0;
+    nodePtr->filters = NULL;
+    return nodePtr;
+}
+
+static void
+FreeNode(Node *nodePtr)
+{
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+
+    hPtr = Tcl_FirstHashEntry(&nodePtr->children, &search);
+    while (hPtr != NULL) {
+	FreeNode(Tcl_GetHashValue(hPtr));
+	hPtr = Tcl_NextHashEntry(&search);
+    }
+    Tcl_DeleteHashTable(&nodePtr->children);
+    if (nodePtr->filters != NULL) {
+	ns_free(nodePtr->filters);
+    }
+    ns_free(nodePtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ * NsGetFilters --
+ *
+ *      Append a list describing each filter of a server in order
+ *	with its invocation count and cumulative time.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *	Counters are reset if requested.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsGetFilters(Tcl_DString *dsPtr, NsServer *servPtr, int reset)
+{
+    Filter *fPtr;
+    Stats *statsPtr;
+    Count *countPtr;
+    Tcl_HashEntry *hPtr;
+    unsigned long ncalls;
+    Ns_Time time;
+    char buf[100];
+
+    Ns_MutexLock(&lock);
+    for (fPtr = servPtr->filter.firstFilterPtr; fPtr != NULL;
+	    fPtr = fPtr->nextPtr) {
+	Ns_MutexLock(&statlock);
+	ncalls = fPtr->ncalls;
+	time = fPtr->time;
+	if (reset) {
+	    fPtr->ncalls = 0;
+	    fPtr->time.sec = fPtr->time.usec = 0;
+	}
+	for (statsPtr = firstStatsPtr; statsPtr != NULL;
+		statsPtr = statsPtr->nextPtr) {
+	    Ns_MutexLock(&statsPtr->lock);
+	    hPtr = Tcl_FindHashEntry(&statsPtr->counts, (char *) fPtr);
+	    if (hPtr != NULL) {
+		countPtr = Tcl_GetHashValue(hPtr);
+		ncalls += countPtr->ncalls;
+		Ns_IncrTime(&time, countPtr->time.sec, countPtr->time.usec);
+		if (reset) {
+		    countPtr->ncalls = 0;
+		    countPtr->time.sec = countPtr->time.usec = 0;
+		}
+	    }
+	    Ns_MutexUnlock(&statsPtr->lock);
+	}
+	Ns_MutexUnlock(&statlock);
+	Tcl_DStringStartSublist(dsPtr);
+	Tcl_DStringAppendElement(dsPtr, "method");
+	Tcl_DStringAppendElement(dsPtr, fPtr->method);
+	Tcl_DStringAppendElement(dsPtr, "url");
+	Tcl_DStringAppendElement(dsPtr, fPtr->url);
+	Tcl_DStringAppendElement(dsPtr, "when");
+	Tcl_DStringStartSublist(dsPtr);
+	AppendWhen(dsPtr, fPtr->when);
+	Tcl_DStringEndSublist(dsPtr);
+	Tcl_DStringAppendElement(dsPtr, "proc");
+	Tcl_DStringStartSublist(dsPtr);
+	Ns_GetProcInfo(dsPtr, (void *) fPtr->proc, fPtr->arg);
+	Tcl_DStringEndSublist(dsPtr);
+	sprintf(buf, "%lu", ncalls);
+	Tcl_DStringAppendElement(dsPtr, "calls");
+	Tcl_DStringAppendElement(dsPtr, buf);
+	sprintf(buf, "%ld.%06ld", (long) time.sec, time.usec);
+	Tcl_DStringAppendElement(dsPtr, "time");
+	Tcl_DStringAppendElement(dsPtr, buf);
+	Tcl_DStringEndSublist(dsPtr);
+    }
+    Ns_MutexUnlock(&lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ * AppendWhen --
+ *
+ *      Append the names of the stages of a filter.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+AppendWhen(Tcl_DString *dsPtr, int when)
+{
+    static struct {
+	int   when;
+	char *name;
+    } stages[] = {
+	{NS_FILTER_PRE_QUEUE, "prequeue"},
+	{NS_FILTER_READ, "read"},
+	{NS_FILTER_PRE_AUTH, "preauth"},
+	{NS_FILTER_POST_AUTH, "postauth"},
+	{NS_FILTER_PRE_WRITE, "prewrite"},
+	{NS_FILTER_WRITE, "write"},
+	{NS_FILTER_TRACE, "trace"},
+	{NS_FILTER_VOID_TRACE, "voidtrace"},
+	{0, NULL}
+    };
+    int i;
+
+    for (i = 0; stages[i].name != NULL; ++i) {
+	if (when & stages[i].when) {
+	    Tcl_DStringAppendElement(dsPtr, stages[i].name);
+	}
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ * FreeMemo --
+ *
+ *      Free the filter memo of an exiting thread.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreeMemo(void *arg)
+{
+    Memo *memoPtr = arg;
+    int i;
+
+    for (i = 0; i < MEMO_SIZE; ++i) {
+	Ns_DStringFree(&memoPtr[i].key);
+	if (memoPtr[i].filters != NULL) {
+	    ns_free(memoPtr[i].filters);
+	}
+    }
+    ns_free(memoPtr);
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -37,6 +37,55 @@ static const char *RCSID = "@(#) $Header$, compiled: " __DATE__ " " __TIME__;
 
 #include "nsd.h"
 
+/*
+ * The following structures maintain the state of an incremental
+ * multipart/form-data parser, fed by the driver as content arrives
+ * for servers with streamuploads enabled.  Each part is parsed for
+ * headers and then either accumulated as a field value or written
+ * directly to its own temp file, avoiding a spool of the whole
+ * content.  Keys, values and filenames are kept unconverted until
+ * Ns_ConnGetQuery applies the query encoding.
+ */
+
+#define FORM_PREAMBLE	0	/* Discarding input until first boundary. */
+#define FORM_DELIM	1	/* Boundary found, expecting -- or CRLF. */
+#define FORM_HEADERS	2	/* Reading part headers. */
+#define FORM_BODY	3	/* Reading part content. */
+#define FORM_DONE	4	/* Discarding input after last boundary. */
+#define FORM_ERROR	5
+
+#define FORM_MAXHEADERS	8192	/* Max bytes of headers in a part. */
+#define FORM_MAXPARTS	1024	/* Max parts in a form. */
+
+typedef struct Part {
+    struct Part	*nextPtr;
+    Ns_Set	*headers;
+    Tcl_DString	 key;		/* Field name. */
+    Tcl_DString	 value;		/* Field value or filename. */
+    int		 skip;		/* No name, content is discarded. */
+    char	*path;		/* Temp file of file content. */
+    int		 fd;		/* Open fd while content is written. */
+    off_t	 length;	/* Length of file content. */
+} Part;
+
+typedef struct FormParser {
+    int		 state;
+    int		 nhdrs;		/* Bytes of headers in current part. */
+    int		 nparts;	/* Parts read. */
+    int		 maxfield;	/* Max bytes of a field value. */
+    Tcl_DString	 delim;		/* CRLF, "--" and boundary. */
+    Tcl_DString	 buf;		/* Input not yet consumed. */
+    Part	*firstPartPtr;
+    Part       **nextPartPtrPtr;
+    Part	*partPtr;	/* Part being read. */
+} FormParser;
+
+static int ParseForm(FormParser *formPtr);
+static int EndHeaders(FormParser *formPtr);
+static int PutContent(FormParser *formPtr, char *s, int len);
+static void EndPart(FormParser *formPtr);
+static char *FindDelim(char *s, int len, Tcl_DString *dsPtr);
+
 static void ParseQuery(char *form, char *formend, Ns_Set *set,
 		       Tcl_Encoding encoding);
 static void ParseMultiInput(Conn *connPtr, char *form, Tcl_Encoding encoding,
@@ -83,6 +132,8 @@ Ns_ConnGetQuery(Ns_Conn *conn)
 	    if (form != NULL) {
 		ParseQuery(form, NULL, connPtr->query, encoding);
 	    }
+	} else if (connPtr->formPtr != NULL) {
+	    NsFormParserQuery(connPtr, encoding);
 	} else if ((form = Ns_ConnContent(conn)) != NULL) {
 	    Tcl_DStringInit(&bound);
 	    formend = form + connPtr->contentLength;
@@ -144,6 +195,7 @@ Ns_ConnClearQuery(Ns_Conn *conn)
     while (hPtr != NULL) {
 	filePtr = Tcl_GetHashValue(hPtr);
 	Ns_SetFree(filePtr->headers);
+	ns_free(filePtr->path);
 	ns_free(filePtr);
 	hPtr = Tcl_NextHashEntry(&search);
     }
@@ -484,6 +536,7 @@ ParseMultiInput(Conn *connPtr, char *form, Tcl_Encoding encoding,
 		filePtr->headers = set;
 	    	filePtr->offset = start - form;
 		filePtr->length = end - start;
+		filePtr->path = NULL;
 		Tcl_SetHashValue(hPtr, filePtr);
 	    	set = NULL;
 	    }
@@ -503,6 +556,541 @@ ParseMultiInput(Conn *connPtr, char *form, Tcl_Encoding encoding,
     }
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsFormParserCreate --
+ *
+ *	Create an incremental parser for multipart/form-data content.
+ *
+ * Results:
+ *	Pointer to parser or NULL if content is not multipart/form-data.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+FormParser *
+NsFormParserCreate(Conn *connPtr)
+{
+    FormParser *formPtr;
+    Tcl_DString bound;
+
+#ifdef _WIN32
+    /* NB: Temp files require mkstemp(). */
+    return NULL;
+#endif
+    Tcl_DStringInit(&bound);
+    if (!GetBoundary(&bound, (Ns_Conn *) connPtr)) {
+	Tcl_DStringFree(&bound);
+	return NULL;
+    }
+    formPtr = ns_malloc(sizeof(FormParser));
+    formPtr->state = FORM_PREAMBLE;
+    formPtr->nhdrs = 0;
+    formPtr->nparts = 0;
+    formPtr->maxfield = connPtr->drvPtr->maxinput;
+    formPtr->firstPartPtr = formPtr->partPtr = NULL;
+    formPtr->nextPartPtrPtr = &formPtr->firstPartPtr;
+    Tcl_DStringInit(&formPtr->delim);
+    Tcl_DStringAppend(&formPtr->delim, "\r\n", 2);
+    Tcl_DStringAppend(&formPtr->delim, bound.string, bound.length);
+    Tcl_DStringFree(&bound);
+
+    /*
+     * Prime the input with a CRLF so the first boundary, which
+     * need not follow a CRLF, matches the delimiter.
+     */
+
+    Tcl_DStringInit(&formPtr->buf);
+    Tcl_DStringAppend(&formPtr->buf, "\r\n", 2);
+    return formPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsFormParserFeed --
+ *
+ *	Parse the next block of content.
+ *
+ * Results:
+ *	NS_OK or NS_ERROR on malformed content or temp file error.
+ *
+ * Side effects:
+ *	Parts are created and file content written.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsFormParserFeed(FormParser *formPtr, char *buf, int len)
+{
+    int used;
+
+    if (formPtr->state == FORM_ERROR) {
+	return NS_ERROR;
+    }
+    if (formPtr->state == FORM_DONE) {
+	return NS_OK;
+    }
+    Tcl_DStringAppend(&formPtr->buf, buf, len);
+    used = ParseForm(formPtr);
+    if (used > 0) {
+	len = formPtr->buf.length - used;
+	memmove(formPtr->buf.string, formPtr->buf.string + used, (size_t) len);
+	Tcl_DStringSetLength(&formPtr->buf, len);
+    }
+    return (formPtr->state == FORM_ERROR ? NS_ERROR : NS_OK);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsFormParserEnd --
+ *
+ *	Check the parser reached the last boundary at end of content.
+ *
+ * Results:
+ *	NS_OK or NS_ERROR if content was truncated.
+ *
+ * Side effects:
+ *	Input buffer is released.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsFormParserEnd(FormParser *formPtr)
+{
+    Tcl_DStringFree(&formPtr->buf);
+    if (formPtr->state != FORM_DONE) {
+	formPtr->state = FORM_ERROR;
+	return NS_ERROR;
+    }
+    return NS_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsFormParserQuery --
+ *
+ *	Add the fields and files of a streamed multipart form to the
+ *	connection query.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Files are entered in the connection files table with the
+ *	path of their temp file.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsFormParserQuery(Conn *connPtr, Tcl_Encoding encoding)
+{
+    FormParser *formPtr = connPtr->formPtr;
+    Tcl_DString kds, vds;
+    Tcl_HashEntry *hPtr;
+    Ns_ConnFile	*filePtr;
+    Part *partPtr;
+    char *key;
+    int new;
+
+    if (formPtr->state != FORM_DONE) {
+	return;
+    }
+    Tcl_DStringInit(&kds);
+    Tcl_DStringInit(&vds);
+    for (partPtr = formPtr->firstPartPtr; partPtr != NULL;
+	    partPtr = partPtr->nextPtr) {
+	if (partPtr->skip) {
+	    continue;
+	}
+	key = Ext2Utf(&kds, partPtr->key.string, partPtr->key.length,
+		      encoding);
+	Ns_SetPut(connPtr->query, key, Ext2Utf(&vds, partPtr->value.string,
+		  partPtr->value.length, encoding));
+	if (partPtr->path != NULL) {
+	    hPtr = Tcl_CreateHashEntry(&connPtr->files, key, &new);
+	    if (new) {
+		filePtr = ns_malloc(sizeof(Ns_ConnFile));
+		filePtr->name = Tcl_GetHashKey(&connPtr->files, hPtr);
+		filePtr->headers = Ns_SetCopy(partPtr->headers);
+		filePtr->offset = 0;
+		filePtr->length = partPtr->length;
+		filePtr->path = ns_strdup(partPtr->path);
+		Tcl_SetHashValue(hPtr, filePtr);
+	    }
+	}
+    }
+    Tcl_DStringFree(&kds);
+    Tcl_DStringFree(&vds);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsFormParserFree --
+ *
+ *	Free a parser and its parts.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Temp files are closed and removed unless moved elsewhere.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsFormParserFree(FormParser *formPtr)
+{
+    Part *partPtr;
+
+    while ((partPtr = formPtr->firstPartPtr) != NULL) {
+	formPtr->firstPartPtr = partPtr->nextPtr;
+	if (partPtr->fd >= 0) {
+	    close(partPtr->fd);
+	}
+	if (partPtr->path != NULL) {
+	    if (unlink(partPtr->path) != 0 && errno != ENOENT) {
+		Ns_Log(Warning, "form: unlink(%s) failed: %s",
+		       partPtr->path, strerror(errno));
+	    }
+	    ns_free(partPtr->path);
+	}
+	Ns_SetFree(partPtr->headers);
+	Tcl_DStringFree(&partPtr->key);
+	Tcl_DStringFree(&partPtr->value);
+	ns_free(partPtr);
+    }
+    Tcl_DStringFree(&formPtr->delim);
+    Tcl_DStringFree(&formPtr->buf);
+    ns_free(formPtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ParseForm --
+ *
+ *	Consume as much of the parser input as possible.
+ *
+ * Results:
+ *	Number of input bytes consumed.
+ *
+ * Side effects:
+ *	Parser state is updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+ParseForm(FormParser *formPtr)
+{
+    Part *partPtr;
+    char *s, *e, *d;
+    int len, dlen;
+
+    s = formPtr->buf.string;
+    e = s + formPtr->buf.length;
+    dlen = formPtr->delim.length;
+    while (s < e) {
+	len = e - s;
+	switch (formPtr->state) {
+	case FORM_PREAMBLE:
+	case FORM_BODY:
+	    /*
+	     * Consume content up to the next delimiter or all but
+	     * what could be the start of a delimiter.
+	     */
+
+	    d = FindDelim(s, len, &formPtr->delim);
+	    if (d == NULL) {
+		if (len < dlen) {
+		    return s - formPtr->buf.string;
+		}
+		d = e - (dlen - 1);
+	    }
+	    if (formPtr->state == FORM_BODY && d > s
+		    && PutContent(formPtr, s, d - s) != NS_OK) {
+		formPtr->state = FORM_ERROR;
+		return 0;
+	    }
+	    if (d + dlen > e) {
+		return d - formPtr->buf.string;
+	    }
+	    if (formPtr->state == FORM_BODY) {
+		EndPart(formPtr);
+	    }
+	    formPtr->state = FORM_DELIM;
+	    s = d + dlen;
+	    break;
+
+	case FORM_DELIM:
+	    /*
+	     * Skip transport padding after the boundary and check
+	     * for the final boundary.
+	     */
+
+	    if (*s == ' ' || *s == '\t') {
+		++s;
+		break;
+	    }
+	    if (len < 2) {
+		return s - formPtr->buf.string;
+	    }
+	    if (s[0] == '-' && s[1] == '-') {
+		formPtr->state = FORM_DONE;
+	    } else if (s[0] == '\r' && s[1] == '\n') {
+		if (++formPtr->nparts > FORM_MAXPARTS) {
+		    Ns_Log(Warning, "form: more than %d parts",
+			   FORM_MAXPARTS);
+		    formPtr->state = FORM_ERROR;
+		    return 0;
+		}
+		partPtr = ns_calloc(1, sizeof(Part));
+		partPtr->headers = Ns_SetCreate(NULL);
+		partPtr->fd = -1;
+		Tcl_DStringInit(&partPtr->key);
+		Tcl_DStringInit(&partPtr->value);
+		*formPtr->nextPartPtrPtr = partPtr;
+		formPtr->nextPartPtrPtr = &partPtr->nextPtr;
+		formPtr->partPtr = partPtr;
+		formPtr->nhdrs = 0;
+		formPtr->state = FORM_HEADERS;
+	    } else {
+		formPtr->state = FORM_ERROR;
+		return 0;
+	    }
+	    s += 2;
+	    break;
+
+	case FORM_HEADERS:
+	    d = memchr(s, '\n', (size_t) len);
+	    if (d == NULL) {
+		if (formPtr->nhdrs + len > FORM_MAXHEADERS) {
+		    formPtr->state = FORM_ERROR;
+		    return 0;
+		}
+		return s - formPtr->buf.string;
+	    }
+	    formPtr->nhdrs += d - s + 1;
+	    if (formPtr->nhdrs > FORM_MAXHEADERS) {
+		formPtr->state = FORM_ERROR;
+		return 0;
+	    }
+	    e = d;
+	    if (e > s && e[-1] == '\r') {
+		--e;
+	    }
+	    if (e == s) {
+		if (EndHeaders(formPtr) != NS_OK) {
+		    formPtr->state = FORM_ERROR;
+		    return 0;
+		}
+		formPtr->state = FORM_BODY;
+	    } else {
+		*e = '\0';
+		Ns_ParseHeader(formPtr->partPtr->headers, s, ToLower);
+	    }
+	    s = d + 1;
+	    e = formPtr->buf.string + formPtr->buf.length;
+	    break;
+
+	case FORM_DONE:
+	    return e - formPtr->buf.string;
+
+	default:
+	    return 0;
+	}
+    }
+    return s - formPtr->buf.string;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EndHeaders --
+ *
+ *	Determine the name and filename of a part from its
+ *	disposition header, opening a temp file for file content.
+ *
+ * Results:
+ *	NS_OK or NS_ERROR if temp file could not be created.
+ *
+ * Side effects:
+ *	Parts without a name are marked to skip content.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+EndHeaders(FormParser *formPtr)
+{
+    Part *partPtr = formPtr->partPtr;
+    Ns_DString ds;
+    char *disp, *ks, *ke, *fs, *fe;
+
+    disp = Ns_SetGet(partPtr->headers, "content-disposition");
+    if (disp == NULL || !GetValue(disp, "name=", &ks, &ke)) {
+	partPtr->skip = 1;
+	return NS_OK;
+    }
+    Tcl_DStringAppend(&partPtr->key, ks, ke - ks);
+    if (GetValue(disp, "filename=", &fs, &fe)) {
+	Tcl_DStringAppend(&partPtr->value, fs, fe - fs);
+	Ns_DStringInit(&ds);
+	Ns_MakePath(&ds, nsconf.tmpdir, "nsupload.XXXXXX", NULL);
+#ifndef _WIN32
+	partPtr->fd = mkstemp(ds.string);
+#endif
+	if (partPtr->fd < 0) {
+	    Ns_Log(Error, "form: could not create temp file %s: %s",
+		   ds.string, strerror(errno));
+	    Ns_DStringFree(&ds);
+	    return NS_ERROR;
+	}
+	Ns_DupHigh(&partPtr->fd);
+	Ns_CloseOnExec(partPtr->fd);
+	partPtr->path = Ns_DStringExport(&ds);
+    }
+    return NS_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PutContent --
+ *
+ *	Append content to the current part, writing file content
+ *	to its temp file.
+ *
+ * Results:
+ *	NS_OK or NS_ERROR on write error or a field value larger
+ *	than the driver maxinput.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+PutContent(FormParser *formPtr, char *s, int len)
+{
+    Part *partPtr = formPtr->partPtr;
+    int n;
+
+    if (partPtr->skip) {
+	return NS_OK;
+    }
+    if (partPtr->path == NULL) {
+	if (partPtr->value.length + len > formPtr->maxfield) {
+	    Ns_Log(Warning, "form: field %s larger than %d bytes",
+		   partPtr->key.string, formPtr->maxfield);
+	    return NS_ERROR;
+	}
+	Tcl_DStringAppend(&partPtr->value, s, len);
+	return NS_OK;
+    }
+    while (len > 0) {
+	n = write(partPtr->fd, s, (size_t) len);
+	if (n < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    Ns_Log(Error, "form: write(%s) failed: %s", partPtr->path,
+		   strerror(errno));
+	    return NS_ERROR;
+	}
+	partPtr->length += n;
+	s += n;
+	len -= n;
+    }
+    return NS_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EndPart --
+ *
+ *	Finish the current part, closing any temp file.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+EndPart(FormParser *formPtr)
+{
+    Part *partPtr = formPtr->partPtr;
+
+    if (partPtr->fd >= 0) {
+	close(partPtr->fd);
+	partPtr->fd = -1;
+    }
+    formPtr->partPtr = NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FindDelim --
+ *
+ *	Locate a delimiter, scanning with memchr for its first byte.
+ *
+ * Results:
+ *	Pointer to delimiter or NULL if not found.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+FindDelim(char *s, int len, Tcl_DString *dsPtr)
+{
+    char *e, *d;
+
+    e = s + len - dsPtr->length;
+    while (s <= e) {
+	d = memchr(s, dsPtr->string[0], (size_t) (e - s + 1));
+	if (d == NULL) {
+	    break;
+	}
+	if (memcmp(d, dsPtr->string, (size_t) dsPtr->length) == 0) {
+	    return d;
+	}
+	s = d + 1;
+    }
+    return NULL;
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -525,7 +1113,7 @@ GetBoundary(Tcl_DString *dsPtr, Ns_Conn *conn)
 {
     char *type, *bs, *be;
 
-    type = Ns_SetIGet(conn->headers, "content-type");
+    type = NsConnHeader((Conn *) conn, HDR_CONTENT_TYPE);
     if (type != NULL
 	&& Ns_StrCaseFind(type, "multipart/form-data") != NULL
 	&& (bs = Ns_StrCaseFind(type, "boundary=")) != NULL) {
@@ -502,7 +502,7 @@ NsTclInfoObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	"config", "home", "hostname", "label", "locks", "log",
 	"major", "minor", "name", "nsd", "pageroot", "patchlevel",
 	"pid", "platform", "pools", "scheduled", "server", "servers",
-	"sockcallbacks", "tag", "tcllib", "threads", "uptime",
+	"sockcallbacks", "tag", "taskqueues", "tcllib", "threads", "uptime",
 	"version", "winnt", NULL
     };
     enum {
@@ -510,7 +510,8 @@ NsTclInfoObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	IConfigIdx, IHomeIdx, hostINameIdx, ILabelIdx, ILocksIdx, ILogIdx,
 	IMajorIdx, IMinorIdx, INameIdx, INsdIdx, IPageRootIdx, IPatchLevelIdx,
 	IPidIdx, IPlatformIdx, IPoolsIdx, IScheduledIdx, IServerIdx, IServersIdx,
-	sockICallbacksIdx, ITagIdx, ITclLibIdx, IThreadsIdx, IUptimeIdx,
+	sockICallbacksIdx, ITagIdx, ITaskQueuesIdx, ITclLibIdx, IThreadsIdx,
+	IUptimeIdx,
 	IVersionIdx, IWinntIdx,
     } _nsmayalias opt;
 
@@ -556,6 +557,11 @@ NsTclInfoObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	Tcl_DStringResult(interp, &ds);
 	break;
 
+    case ITaskQueuesIdx:
+    	NsGetTaskQueues(&ds);
+	Tcl_DStringResult(interp, &ds);
+	break;
+
     case ILocksIdx:
 	Ns_MutexList(&ds);
 	Tcl_DStringResult(interp, &ds);
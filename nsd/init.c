@@ -95,6 +95,7 @@ Ns_LibInit(void)
     	NsInitConfig();
     	NsInitDrivers();
     	NsInitEncodings();
+    	NsInitFilters();
         NsInitLimits();
     	NsInitListen();
     	NsInitMimeTypes();
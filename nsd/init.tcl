@@ -192,7 +192,7 @@ proc _ns_eval {args} {
 
 proc _ns_helper_eval {args} {
     set didsaveproc 0
-    if {[info proc _saved_ns_eval] == ""} {
+    if {[info proc _saved_ns_eval] == "" && [ns_ictl autoproc ns_eval]} {
 	rename ns_eval _saved_ns_eval
 	proc ns_eval {args} {
             set len [llength $args]
@@ -321,18 +321,22 @@ proc ns_reinit {} {
 #
 
 proc _ns_savenamespaces {} {
+    # NB: Define any procs not yet autoloaded to save them all.
+    ns_ictl autoload
     set script [_ns_getpackages]
     set import ""
+    set procs ""
     _ns_getnamespaces nslist
     foreach n $nslist {
-        foreach {ns_script ns_import} [_ns_getscript $n] {
+        foreach {ns_script ns_import ns_procs} [_ns_getscript $n] {
             append script [list ::namespace eval $n $ns_script] \n
             if {$ns_import != ""} {
                 append import [list ::namespace eval $n $ns_import] \n
             }
+            lappend procs {*}$ns_procs
         }
     }
-    ns_ictl save [append script \n $import]
+    ns_ictl save $script $procs $import
 }
 
 
@@ -515,14 +519,19 @@ proc _ns_getpackages {} {
 #
 # _ns_getscript --
 #
-#   Return a script to create namespaces
-#   and their data (vars and procs).
+#   Return a script to create namespaces and their data (vars and
+#   procs), a script to import commands, and a list of proc names
+#   and definitions.  Procs in namespaces with exports are left in
+#   the script so they can be imported; the rest may be autoloaded
+#   (see the lazyprocs option of ns_ictl save).
 #
 
 proc _ns_getscript n {
     namespace eval $n {
         ::set _script "" ; # script to initialize new interp
         ::set _import "" ; # script to import foreign commands
+        ::set _procs  "" ; # list of proc names and definitions
+        ::set _exp [::namespace export]
 
         #
         # Cover namespace variables (arrays and scalars)
@@ -532,6 +541,8 @@ proc _ns_getscript n {
             ::switch -- $_var {
                 _var -
                 _import -
+                _procs -
+                _exp -
                 env -
                 _script {
                     continue ; # skip local help variables
@@ -570,8 +581,17 @@ proc _ns_getscript n {
                     }
                     ::lappend _args $_arg
                 }
-                ::append _script \
-                      [::list proc $_proc $_args [::info body $_proc]] \n
+                ::if {[::llength $_exp]} {
+                    ::append _script \
+                        [::list proc $_proc $_args [::info body $_proc]] \n
+                } else {
+                    ::set _name [::namespace current]::$_proc
+                    ::if {[::string match ::::* $_name]} {
+                        ::set _name [::string range $_name 2 end]
+                    }
+                    ::lappend _procs $_name \
+                        [::list ::proc $_name $_args [::info body $_proc]]
+                }
             } else {
                 # procedure imported from other namespace
                 ::append _import [::list ::namespace import -force $_orig] \n
@@ -600,12 +620,11 @@ proc _ns_getscript n {
         # Cover commands exported from this namespace
         #
 
-        ::set _exp [::namespace export]
         if {[::llength $_exp]} {
             ::append _script [::concat ::namespace export $_exp] \n
         }
 
-        ::return [::list $_script $_import]
+        ::return [::list $_script $_import $_procs]
     }
 }
 
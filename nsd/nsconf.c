@@ -41,9 +41,13 @@ static const char *RCSID = "@(#) $Header$, compiled: " __DATE__ " " __TIME__;
 #define SCHED_MAXELAPSED	2
 #define SHUTDOWNTIMEOUT		20
 #define LISTEN_BACKLOG		32
+#define SET_INDEXSIZE		32
 #define TCL_INITLCK		0
 #define HTTP_MAJOR		1
 #define HTTP_MINOR		1
+#define HTTP_KEEPMAX		8
+#define HTTP_KEEPTIMEOUT	5
+#define HTTP_TASKTHREADS	1
 
 struct _nsconf nsconf;
 
@@ -101,11 +105,16 @@ NsInitConf(void)
      * Set various default values.
      */
 
+    nsconf.tmpdir = P_tmpdir;
     nsconf.shutdowntimeout = SHUTDOWNTIMEOUT;
     nsconf.sched.maxelapsed = SCHED_MAXELAPSED;
     nsconf.backlog = LISTEN_BACKLOG;
+    nsconf.setindexsize = SET_INDEXSIZE;
     nsconf.http.major = HTTP_MAJOR;
     nsconf.http.minor = HTTP_MINOR;
+    nsconf.http.keepmax = HTTP_KEEPMAX;
+    nsconf.http.keeptimeout = HTTP_KEEPTIMEOUT;
+    nsconf.http.taskthreads = HTTP_TASKTHREADS;
     nsconf.tcl.lockoninit = TCL_INITLCK;
     
     /*
@@ -146,11 +155,20 @@ NsConfUpdate(void)
     Ns_HomePath(&ds, "modules", "tcl", NULL);
     nsconf.tcl.sharedlibrary = Ns_DStringExport(&ds);
 
+    nsconf.tmpdir = NsParamString("tmpdir", P_tmpdir);
     nsconf.shutdowntimeout = NsParamInt("shutdowntimeout", SHUTDOWNTIMEOUT);
     nsconf.sched.maxelapsed = NsParamInt("schedmaxelapsed", SCHED_MAXELAPSED);
     nsconf.backlog = NsParamInt("listenbacklog", LISTEN_BACKLOG);
+    nsconf.setindexsize = NsParamInt("setindexsize", SET_INDEXSIZE);
     nsconf.http.major = (unsigned) NsParamInt("httpmajor", HTTP_MAJOR);
     nsconf.http.minor = (unsigned) NsParamInt("httpmajor", HTTP_MINOR);
+    nsconf.http.keepmax = NsParamInt("httpkeepalivemax", HTTP_KEEPMAX);
+    nsconf.http.keeptimeout = NsParamInt("httpkeepalivetimeout",
+					 HTTP_KEEPTIMEOUT);
+    if (nsconf.http.keeptimeout < 1) {
+	nsconf.http.keeptimeout = 1;
+    }
+    nsconf.http.taskthreads = NsParamInt("httptaskthreads", HTTP_TASKTHREADS);
     nsconf.tcl.lockoninit = NsParamBool("tclinitlock", TCL_INITLCK);
 
     if (!Ns_ConfigGetInt(NS_CONFIG_THREADS, "stacksize", &stacksize)) {
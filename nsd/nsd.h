@@ -85,6 +85,16 @@
 #ifdef __linux
   #include <sys/prctl.h>
 #endif
+#ifdef HAVE_SYS_EPOLL_H
+  #include <sys/epoll.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+  #include <sys/sendfile.h>
+  #include <netinet/tcp.h>
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+  #include <sys/inotify.h>
+#endif
 #ifdef __hp
   #define seteuid(i)     setresuid((-1),(i),(-1))
 #endif
@@ -115,6 +125,17 @@
 #define _MAX(x,y) ((x) > (y) ? (x) : (y))
 #define _MIN(x,y) ((x) > (y) ? (y) : (x))
 
+/*
+ * Make stores visible to other threads before publication of data
+ * which is read without a lock, e.g., a compiled urlspace table.
+ */
+
+#ifdef __GNUC__
+#define NsMemoryBarrier()	__sync_synchronize()
+#else
+#define NsMemoryBarrier()
+#endif
+
 /*
  * constants
  */
@@ -153,12 +174,14 @@ struct _nsconf {
     char           *home;
     char           *config;
     char           *build;
+    char           *tmpdir;
     int             pid;
     time_t          boot_t;
     char            hostname[255];
     char	    address[16];
     int             shutdowntimeout;
     int             backlog;
+    int             setindexsize;
     int             debug;
 
     /*
@@ -180,6 +203,9 @@ struct _nsconf {
     struct {
 	unsigned int major;
 	unsigned int minor;
+	int keepmax;		/* Max idle ns_http sockets per host. */
+	int keeptimeout;	/* Seconds to keep idle ns_http sockets. */
+	int taskthreads;	/* Threads for ns_http task queue. */
     } http;
     
     struct {
@@ -304,6 +330,8 @@ typedef struct Driver {
      */
 
     struct Driver *nextPtr;	    /* Next in list of drivers. */
+    struct Driver *mainPtr;	    /* Main driver of extra driver thread. */
+    int		 tidx;		    /* Driver thread index. */
     struct NsServer *servPtr;	    /* Driver virtual server. */
     char	*fullname;	    /* Full name, i.e., server/module. */
     int          flags;             /* Driver state flags. */
@@ -312,6 +340,7 @@ typedef struct Driver {
     Ns_Cond 	 cond;		    /* Cond to signal reader threads,
 				     * driver query, startup, and shutdown. */
     SOCKET    	 trigger[2];	    /* Wakeup trigger pipe. */
+    SOCKET	 sock;		    /* Listen socket. */
 
     Ns_DriverProc *proc;	    /* Driver callback. */
     int		 opts;		    /* Driver options. */
@@ -322,12 +351,14 @@ typedef struct Driver {
     int          port;		    /* Port in location. */
     int		 backlog;	    /* listen() backlog. */
     int		 maxaccept;	    /* connections to accept per spin. */
+    int		 epfd;		    /* Persistent epoll set or -1 for poll. */
     
     int          maxline;           /* Maximum request line length to read. */
     int          maxheader;         /* Maximum total header length to read. */
     int		 maxinput;	    /* Maximum request bytes to read. */
 
     struct Sock *freeSockPtr;       /* Sock free list. */
+    struct Sock *socks;		    /* Array of pre-allocated Sock's. */
     int     	 maxsock;	    /* Maximum open Sock's. */
     int     	 nactive;	    /* Number of active Sock's. */
     unsigned int nextid;	    /* Next sock unique id. */
@@ -341,6 +372,10 @@ typedef struct Driver {
     struct Sock *runSockPtr;        /* Sock's returning from reader threads. */
     struct Sock *closeSockPtr;      /* Sock's returning from conn threads. */
 
+    struct Writer *writers;	    /* Array of writer threads. */
+    int		 nwriters;	    /* Number of writer threads. */
+    int		 writersize;	    /* Min response size for writers. */
+
     struct Conn *firstConnPtr;      /* First Conn waiting to run. */
     struct Conn *lastConnPtr;       /* Last Conn waiting to run. */
     struct Conn *freeConnPtr;       /* Conn's returning from conn threads. */
@@ -388,10 +423,14 @@ typedef struct Sock {
     unsigned int id;
     int		 state;
     int		 pidx;		    /* poll() index. */
+    int		 eflags;	    /* Event set registration flags. */
+    struct Sock *parkNextPtr;	    /* Parked list links. */
+    struct Sock *parkPrevPtr;
     Ns_Time      acceptTime;
     Ns_Time	 timeout;
     unsigned int nreads;
     unsigned int nwrites;
+    struct WriterSock *wrSockPtr;   /* Response pending for a writer. */
 } Sock;
 
 /*
@@ -412,6 +451,34 @@ typedef struct Limits {
     int             timeout;
 } Limits;
 
+/*
+ * The following ids are assigned to common request headers as
+ * they are parsed for direct access with NsConnHeader.
+ */
+
+typedef enum {
+    HDR_ACCEPT, HDR_ACCEPT_CHARSET, HDR_ACCEPT_ENCODING,
+    HDR_ACCEPT_LANGUAGE, HDR_AUTHORIZATION, HDR_CACHE_CONTROL,
+    HDR_CONNECTION, HDR_CONTENT_ENCODING, HDR_CONTENT_LENGTH,
+    HDR_CONTENT_TYPE, HDR_COOKIE, HDR_DATE, HDR_EXPECT, HDR_FROM,
+    HDR_HOST, HDR_IF_MATCH, HDR_IF_MODIFIED_SINCE, HDR_IF_NONE_MATCH,
+    HDR_IF_RANGE, HDR_IF_UNMODIFIED_SINCE, HDR_KEEP_ALIVE,
+    HDR_MAX_FORWARDS, HDR_ORIGIN, HDR_PRAGMA, HDR_PROXY_AUTHORIZATION,
+    HDR_RANGE, HDR_REFERER, HDR_TE, HDR_TRANSFER_ENCODING, HDR_UPGRADE,
+    HDR_USER_AGENT, HDR_VIA, HDR_X_FORWARDED_FOR,
+    HDR_MAX
+} HdrId;
+
+/*
+ * The following flags track a response handed to a writer thread
+ * (see writer.c) which holds the traces until the send completes.
+ */
+
+#define WRITER_QUEUED	0x01	/* Response queued with NsWriterQueue. */
+#define WRITER_TRACE	0x02	/* Traces to run after the send. */
+#define WRITER_RELEASED	0x04	/* Conn thread finished the request. */
+#define WRITER_DONE	0x08	/* Writer finished the send. */
+
 /*
  * The following structure maintains state for a connection
  * being processed.
@@ -453,6 +520,14 @@ typedef struct Conn {
     char *rstart;
     char *rend;
 
+    /*
+     * Index plus one in headers of the first of each common
+     * header and the number of headers parsed.
+     */
+
+    int hdrs[HDR_MAX];
+    int nhdrs;
+
     /*
      * The following are copied from sockPtr so they're valid
      * after the connection is closed (e.g., within traces).
@@ -499,6 +574,7 @@ typedef struct Conn {
      
     void	   *cls[NS_CONN_MAXCLS];
     struct QueWait *queWaitPtr;
+    int		    wrflags;	/* Writer hand-off state. */
 
     /*
      * The following pointers are used to access the
@@ -509,6 +585,7 @@ typedef struct Conn {
     size_t          avail;	/* Bytes avail in buffer. */
     char	   *content;	/* Start of content. */
     int             tfd;        /* Temp fd for file-based content. */
+    struct FormParser *formPtr; /* Streaming multipart parser, if any. */
     void	   *map;	/* Mmap'ed content, if any. */
     void	   *maparg;	/* Argument for NsUnMap. */
 
@@ -533,6 +610,32 @@ typedef struct Conn {
 
 } Conn;
 
+/*
+ * The following structure maintains a connection queue of a pool.  A
+ * pool spreads connections over one or more queues, each with its own
+ * lock and condition, to reduce contention between the drivers and
+ * connection threads.
+ */
+
+typedef struct ConnQueue {
+    Ns_Mutex        lock;
+    Ns_Cond         cond;
+    struct {
+	int     	    num;
+        struct Conn    *firstPtr;
+        struct Conn    *lastPtr;
+    } wait;
+    struct {
+        struct Conn    *firstPtr;
+        struct Conn    *lastPtr;
+    } active;
+    int		    idle;	/* Threads not running a connection. */
+    int		    waiting;	/* Threads waiting for a connection. */
+    int		    wakeups;	/* Signals not yet seen by waiters. */
+    struct ConnWaiter *waiters;	/* Stack of threads waiting LIFO. */
+    unsigned int    queued;	/* Total connections queued. */
+} ConnQueue;
+
 /*
  * The following structure maintains a connection thread pool.
  */
@@ -541,33 +644,34 @@ typedef struct Pool {
     Ns_Mutex        lock;
     Ns_Cond         cond;
     char           *name;
+    char	   *servers;	/* List of servers using the pool. */
     int             shutdown;
 
     /*
-     * The following struct maintains the active and waiting connection
-     * queues, the next conn id, and the number of waiting connects.
+     * The following maintain the active and waiting connection
+     * queues.  Connections are spread over the queues by id and
+     * threads, each bound to a home queue, steal from the other
+     * queues before waiting.  A single queue is the default.  With
+     * lifo, threads wait on their own condition and the most recently
+     * idle thread is woken first.
      */
 
-    struct {
-	struct {
-	    int     	    num;
-            struct Conn    *firstPtr;
-            struct Conn    *lastPtr;
-        } wait;
-        struct {
-            struct Conn    *firstPtr;
-            struct Conn    *lastPtr;
-	} active;
-    } queue;
+    int		    nqueues;
+    ConnQueue	   *queues;
+    int		    lifo;
 
     /*
      * The following struct maintins the state of the threads.  Min and max
      * threads are determined at startup and then NsQueueConn ensures the
      * current number of threads remains within that range with individual
      * threads waiting no more than the timeout for a connection to
-     * arrive.  The number of idle threads is maintained for the benefit of
-     * the ns_server command.  Threads will handle up to maxconns before
-     * exit (default is the "connsperthread" virtual server config).
+     * arrive.  The number of idle threads is maintained per queue for
+     * the benefit of the ns_server command.  Threads will handle up to
+     * maxconns before exit (default is the "connsperthread" virtual
+     * server config).  Spare threads are created ahead of demand as
+     * connections are queued and, with prewarm, new threads create
+     * the interps of the servers using the pool before accepting
+     * connections.  Threads beyond min and spare exit when idle.
      */
 
     struct {
@@ -575,13 +679,12 @@ typedef struct Pool {
 	int 	    	    min;
 	int 	    	    max;
     	int 	    	    current;
-	int 	    	    idle;
-	int 	    	    waiting;
 	int 	    	    starting;
 	int 	    	    timeout;
 	int		    maxconns;
 	int		    spread;
-    	unsigned int	    queued;
+	int		    spare;
+	int		    prewarm;
     } threads;
 
 } Pool;
@@ -592,6 +695,8 @@ typedef struct Pool {
 #define SERV_NOTICEDETAIL	0x0008	/* Add detail to notice messages. */
 #define SERV_GZIP		0x0010	/* Enable GZIP compression. */
 #define SERV_FILTERREDIRECT     0x0020  /* re-run filters on redirects */
+#define SERV_STREAMUPLOADS      0x0040  /* parse large multipart as read */
+#define SERV_FILTERSTATS        0x0080  /* count and time filter calls */
 
 /*
  * The following struct maintains nsv's, shared string variables.
@@ -661,10 +766,14 @@ typedef struct NsServer {
 	char	    	   *dirproc;
 	char	    	   *diradp;
 	bool	    	    mmap;
+	bool		    gzip;
 	int 	    	    cachemaxentry;
 	int                 cacheminage;
 	Ns_UrlToFileProc   *url2file;
 	Ns_Cache    	   *cache;
+	Ns_Cache	   *statcache;
+	int		    statttl;
+	struct FastNotify  *notifyPtr;
     } fastpath;
 
     /*
@@ -684,6 +793,8 @@ typedef struct NsServer {
 
     struct {
 	struct Filter *firstFilterPtr;
+	volatile unsigned int gen;	/* Bumped on each new filter. */
+	struct Index  *indexPtr;	/* Compiled filter index. */
 	struct Trace  *firstTracePtr;
 	struct Trace  *firstCleanupPtr;
     } filter;
@@ -729,6 +840,13 @@ typedef struct NsServer {
 	int		    epoch;
 	Ns_RWLock	    slock;	/* Lock for init script. */
 	Tcl_DString	    modules;	/* List of server modules. */
+
+	/*
+	 * The following support on-demand proc definition.
+	 */
+
+	int		    lazyprocs;	/* Autoload procs on first call. */
+	Tcl_HashTable	   *procsPtr;	/* Proc name to definition script. */
     } tcl;
 
     /*
@@ -744,6 +862,8 @@ typedef struct NsServer {
 	char	    	   *debuginit;
 	size_t		    bufsize;
 	size_t		    cachesize;
+	Ns_Cache	   *variants;
+	char		   *compiledir;
 	Ns_Cond	    	    pagecond;
 	Ns_Mutex	    pagelock;
 	Tcl_HashTable       pages;
@@ -904,6 +1024,7 @@ extern void NsInitConf(void);
 extern void NsInitConfig(void);
 extern void NsInitEncodings(void);
 extern void NsInitFd(void);
+extern void NsInitFilters(void);
 extern void NsInitListen(void);
 extern void NsInitLog(void);
 extern void NsInitMimeTypes(void);
@@ -922,22 +1043,43 @@ extern void NsInitUrlSpace(void);
 extern void NsInitRequests(void);
 extern char *NsFindVersion(char *request, unsigned int *majorPtr,
 			   unsigned int *minorPtr);
+extern int NsHeaderId(char *name);
+extern void NsSetFreeIndex(Ns_Set *set);
+extern char *NsConnHeader(Conn *connPtr, HdrId id);
+extern struct FormParser *NsFormParserCreate(Conn *connPtr);
+extern int NsFormParserFeed(struct FormParser *formPtr, char *buf, int len);
+extern int NsFormParserEnd(struct FormParser *formPtr);
+extern void NsFormParserQuery(Conn *connPtr, Tcl_Encoding encoding);
+extern void NsFormParserFree(struct FormParser *formPtr);
 extern void NsQueueConn(Conn *connPtr);
 extern int NsCheckQuery(Ns_Conn *conn);
 extern void NsAppendConn(Tcl_DString *bufPtr, Conn *connPtr, char *state);
 extern void NsAppendRequest(Tcl_DString *dsPtr, Ns_Request *request);
 extern int  NsConnSend(Ns_Conn *conn, struct iovec *bufs, int nbufs);
+extern int  NsConnCanSendFile(Ns_Conn *conn);
+extern int  NsConnSendFile(Ns_Conn *conn, int fd, off_t off, int nsend);
 extern void NsSockClose(Sock *sockPtr, int keep);
+extern int  NsWriterQueue(Ns_Conn *conn, int fd, off_t off, int nsend,
+			  char *buf);
+extern void NsWriterStart(Sock *sockPtr, int keep);
+extern void NsWriterRelease(Conn *connPtr, int trace);
+extern void NsWriterFree(Sock *sockPtr);
+extern void NsStartWriters(Driver *drvPtr);
+extern void NsStopWriters(Driver *drvPtr);
 extern int  NsPoll(struct pollfd *pfds, int nfds, Ns_Time *timeoutPtr);
 extern void NsFreeConn(Conn *connPtr);
 extern NsServer *NsGetServer(char *server);
 extern char *NsGetServers(void);
 extern NsServer *NsGetInitServer(void);
 extern NsInterp *NsGetInterpData(Tcl_Interp *interp);
+extern int NsTclAutoload(Tcl_Interp *interp, char *name);
 extern void NsFreeConnInterp(Conn *connPtr);
 extern Ns_OpProc NsAdpProc;
 
-extern Ns_Cache *NsFastpathCache(char *server, int size);
+extern Ns_Cache *NsFastpathCache(char *server, int size, int nshards,
+				 int policy);
+extern void NsFastpathStatCache(NsServer *servPtr, int size, int nshards,
+				int ttl, int notify);
 extern void NsAdpInit(NsInterp *itPtr);
 extern void NsAdpReset(NsInterp *itPtr);
 extern void NsAdpFree(NsInterp *itPtr);
@@ -960,10 +1102,14 @@ extern Ns_SockProc NsTclSockProc;
 extern Ns_ArgProc NsTclSockArgProc;
 extern Ns_ThreadProc NsConnThread;
 extern Ns_ArgProc NsConnArgProc;
+extern Ns_FilterProc NsTclFilterProc;
+extern Ns_ArgProc NsTclFilterArgProc;
 
 extern void NsGetCallbacks(Tcl_DString *dsPtr);
 extern void NsGetSockCallbacks(Tcl_DString *dsPtr);
 extern void NsGetScheduled(Tcl_DString *dsPtr);
+extern void NsGetTaskQueues(Tcl_DString *dsPtr);
+extern void NsGetFilters(Tcl_DString *dsPtr, NsServer *servPtr, int reset);
 
 extern char *NsConnContent(Ns_Conn *conn, char **nextPtr, int *availPtr);
 extern void NsConnSeek(Ns_Conn *conn, int count);
@@ -990,6 +1136,8 @@ extern void NsHandleSignals(void);
 extern void NsStopDrivers(void);
 extern void NsPreBind(char *bindargs, char *bindfile);
 extern SOCKET NsSockGetBound(struct sockaddr_in *saPtr);
+extern SOCKET NsSockListenReusePort(char *address, int port, int backlog);
+extern void NsSockCork(SOCKET sock, int cork);
 extern void NsClosePreBound(void);
 extern void NsInitServer(char *server, Ns_ServerInitProc *initProc);
 extern char *NsConfigRead(char *file);
@@ -1002,6 +1150,10 @@ extern int NsTclGetPool(Tcl_Interp *interp, char *pool, Pool **poolPtrPtr);
 extern Tcl_ObjCmdProc NsTclListPoolsObjCmd;
 extern void NsCreateConnThread(Pool *poolPtr, int joinThreads);
 extern void NsJoinConnThreads(void);
+extern void NsInitConnQueues(Pool *poolPtr, int nqueues);
+extern void NsGetPoolCounts(Pool *poolPtr, int *idlePtr, int *waitPtr,
+			    unsigned int *queuedPtr);
+extern void NsWakeConnQueues(Pool *poolPtr);
 extern int  NsStartDrivers(void);
 extern void NsWaitDriversShutdown(Ns_Time *toPtr);
 extern void NsStartSchedShutdown(void);
@@ -1049,11 +1201,17 @@ extern int NsAdpEval(NsInterp *itPtr, int objc, Tcl_Obj *objv[], int flags,
                      char *resvar);
 extern int NsAdpSource(NsInterp *itPtr, int objc, Tcl_Obj *objv[],
                        int flags, char *resvar);
+extern Ns_Callback NsAdpFreeVariant;
+extern Ns_Callback NsAdpPrecompile;
 extern int NsAdpInclude(NsInterp *itPtr, int objc, Tcl_Obj *objv[],
-			char *file, Ns_Time *ttlPtr);
+			char *file, Ns_Time *ttlPtr, Tcl_Obj *varyObj);
 extern void NsAdpParse(AdpCode *codePtr, NsServer *servPtr, char *utf,
 		       int flags);
 extern void NsAdpFreeCode(AdpCode *codePtr);
+extern int NsAdpLoadCode(AdpCode *codePtr, NsServer *servPtr, char *file,
+			 struct stat *stPtr, int flags, char *encoding);
+extern int NsAdpSaveCode(AdpCode *codePtr, NsServer *servPtr, char *file,
+			 struct stat *stPtr, int flags, char *encoding);
 extern void NsAdpLogError(NsInterp *itPtr);
 
 /*
@@ -45,6 +45,7 @@ typedef struct AppendData {
 typedef void (PoolFunc)(Pool *poolPtr, void *arg);
 
 static Pool *CreatePool(char *name);
+static void AddServer(Pool *poolPtr, char *server);
 static PoolFunc StartPool;
 static PoolFunc StopPool;
 static PoolFunc WaitPool;
@@ -109,9 +110,10 @@ NsInitPools(void)
 int
 NsTclPoolsObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 {
+    NsInterp *itPtr = data;
     Pool *poolPtr, savedPool;
     char *pool;
-    int i, val;
+    int i, val, nqueues;
     static CONST char *opts[] = {
         "get", "set", "list", "register", NULL
     };
@@ -119,10 +121,12 @@ NsTclPoolsObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
         PGetIdx, PSetIdx, PListIdx, PRegisterIdx
     } opt;
     static CONST char *cfgs[] = {
-        "-maxthreads", "-minthreads", "-maxconns", "-timeout", "-spread", NULL
+        "-maxthreads", "-minthreads", "-maxconns", "-timeout", "-spread",
+        "-queues", "-lifo", "-spare", "-prewarm", NULL
     };
     enum {
-        PCMaxThreadsIdx, PCMinThreadsIdx, PCMaxConnsIdx, PCTimeoutIdx, PCSpreadIdx
+        PCMaxThreadsIdx, PCMinThreadsIdx, PCMaxConnsIdx, PCTimeoutIdx, PCSpreadIdx,
+        PCQueuesIdx, PCLifoIdx, PCSpareIdx, PCPrewarmIdx
     } cfg;
 
     if (objc < 2) {
@@ -159,6 +163,7 @@ NsTclPoolsObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
         pool = Tcl_GetString(objv[2]);
 	poolPtr = CreatePool(pool);
         savedPool = *poolPtr;
+        nqueues = poolPtr->nqueues;
         for (i = 3; i < objc; i += 2) {
             if (Tcl_GetIndexFromObj(interp, objv[i], cfgs, "cfg", 0,
                         (int *) &cfg) != TCL_OK || 
@@ -186,6 +191,22 @@ NsTclPoolsObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
             case PCSpreadIdx:
                 poolPtr->threads.spread = val;
                 break;
+
+            case PCQueuesIdx:
+                nqueues = val;
+                break;
+
+            case PCLifoIdx:
+                poolPtr->lifo = val ? 1 : 0;
+                break;
+
+            case PCSpareIdx:
+                poolPtr->threads.spare = val;
+                break;
+
+            case PCPrewarmIdx:
+                poolPtr->threads.prewarm = val ? 1 : 0;
+                break;
             }
         }
         /* catch unsane values */
@@ -209,6 +230,28 @@ NsTclPoolsObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
             Tcl_SetResult(interp, "spread must be between 0 and 100", TCL_STATIC);
             return TCL_ERROR;
         }
+        if (poolPtr->threads.spare < 0
+		|| poolPtr->threads.spare > poolPtr->threads.max) {
+            Tcl_SetResult(interp, "spare must be between 0 and maxthreads", TCL_STATIC);
+            return TCL_ERROR;
+        }
+        if (nqueues < 1) {
+            Tcl_SetResult(interp, "queues cannot be less than 1", TCL_STATIC);
+            return TCL_ERROR;
+        }
+        if (nqueues != poolPtr->nqueues) {
+            Ns_MutexLock(&poolPtr->lock);
+            if (poolPtr->threads.current > 0) {
+                Ns_MutexUnlock(&poolPtr->lock);
+                Tcl_SetResult(interp, "cannot change queues of a running pool", TCL_STATIC);
+                return TCL_ERROR;
+            }
+            NsInitConnQueues(poolPtr, nqueues);
+            Ns_MutexUnlock(&poolPtr->lock);
+        }
+        if (itPtr->servPtr != NULL) {
+            AddServer(poolPtr, itPtr->servPtr->server);
+        }
         if (PoolResult(interp, poolPtr) != TCL_OK) {
             return TCL_ERROR;
         }
@@ -225,6 +268,7 @@ NsTclPoolsObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
         Ns_UrlSpecificSet(Tcl_GetString(objv[3]),
                 Tcl_GetString(objv[4]),
                 Tcl_GetString(objv[5]), poolid, poolPtr, 0, NULL);
+        AddServer(poolPtr, Tcl_GetString(objv[3]));
         break;
     }
 
@@ -403,10 +447,57 @@ CreatePool(char *name)
     	poolPtr->threads.timeout = 120; /* NB: Exit after 2 minutes idle. */
     	poolPtr->threads.maxconns = 0;  /* NB: Never exit thread. */
     	poolPtr->threads.spread = 20;   /* NB: +-20% random variance on timeout and maxconns. */
+	NsInitConnQueues(poolPtr, 1);
    }
     return poolPtr;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AddServer --
+ *
+ *	Add a server to the list of servers using a pool, i.e., the
+ *	servers whose interps are created by prewarm threads.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+AddServer(Pool *poolPtr, char *server)
+{
+    Tcl_DString ds;
+    CONST char **servers;
+    int i, n;
+
+    Tcl_DStringInit(&ds);
+    Ns_MutexLock(&poolPtr->lock);
+    if (poolPtr->servers != NULL
+	    && Tcl_SplitList(NULL, poolPtr->servers, &n, &servers) == TCL_OK) {
+	for (i = 0; i < n && !STREQ(servers[i], server); ++i) {
+	    ;
+	}
+	Tcl_Free((char *) servers);
+	if (i < n) {
+	    Ns_MutexUnlock(&poolPtr->lock);
+	    return;
+	}
+	Tcl_DStringAppend(&ds, poolPtr->servers, -1);
+	ns_free(poolPtr->servers);
+    }
+    Tcl_DStringAppendElement(&ds, server);
+    poolPtr->servers = ns_strdup(ds.string);
+    Ns_MutexUnlock(&poolPtr->lock);
+    Tcl_DStringFree(&ds);
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -427,14 +518,22 @@ CreatePool(char *name)
 static int
 PoolResult(Tcl_Interp *interp, Pool *poolPtr)
 {
+    int idle;
+    unsigned int queued;
+
+    NsGetPoolCounts(poolPtr, &idle, NULL, &queued);
     if (!AppendPool(interp, "minthreads", poolPtr->threads.min) ||
         !AppendPool(interp, "maxthreads", poolPtr->threads.max) ||
-        !AppendPool(interp, "idle", poolPtr->threads.idle) ||
+        !AppendPool(interp, "idle", idle) ||
         !AppendPool(interp, "current", poolPtr->threads.current) ||
         !AppendPool(interp, "maxconns", poolPtr->threads.maxconns) ||
-        !AppendPool(interp, "queued", poolPtr->threads.queued) ||
+        !AppendPool(interp, "queued", queued) ||
         !AppendPool(interp, "timeout", poolPtr->threads.timeout) ||
-        !AppendPool(interp, "spread", poolPtr->threads.spread)
+        !AppendPool(interp, "spread", poolPtr->threads.spread) ||
+        !AppendPool(interp, "queues", poolPtr->nqueues) ||
+        !AppendPool(interp, "lifo", poolPtr->lifo) ||
+        !AppendPool(interp, "spare", poolPtr->threads.spare) ||
+        !AppendPool(interp, "prewarm", poolPtr->threads.prewarm)
       ) {
     	return TCL_ERROR;
     }
@@ -510,8 +609,6 @@ StartPool(Pool *poolPtr, void *ignored)
 
     poolPtr->threads.current = 0;
     poolPtr->threads.starting = 0;
-    poolPtr->threads.waiting = 0;
-    poolPtr->threads.idle = 0;
 
     for (i = 0; i < poolPtr->threads.min; ++i) {
         poolPtr->threads.current ++;
@@ -526,18 +623,20 @@ StopPool(Pool *poolPtr, void *ignored)
     poolPtr->shutdown = 1;
     Ns_CondBroadcast(&poolPtr->cond);
     Ns_MutexUnlock(&poolPtr->lock);
+    NsWakeConnQueues(poolPtr);
 }
 
 static void
 WaitPool(Pool *poolPtr, void *arg)
 {
     Ns_Time *timePtr = arg;
-    int status;
+    int status, waiting;
     
     status = NS_OK;
     Ns_MutexLock(&poolPtr->lock);
     while (status == NS_OK) {
-	if (poolPtr->queue.wait.firstPtr == NULL) {
+	NsGetPoolCounts(poolPtr, NULL, &waiting, NULL);
+	if (waiting == 0) {
 	    break;
 	}
 	if (poolPtr->threads.current == 0) {
@@ -64,6 +64,7 @@ struct proc {
 	{(void *) NsTclSockProc, "ns:tclsockcallback", NsTclSockArgProc},
 	{(void *) NsCachePurge, "ns:cachepurge", NsCacheArgProc},
 	{(void *) NsConnThread, "ns:connthread", NsConnArgProc},
+	{(void *) NsTclFilterProc, "ns:tclfilter", NsTclFilterArgProc},
 	{NULL, NULL, NULL}
 };
 
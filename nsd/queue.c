@@ -43,6 +43,17 @@ static const char *RCSID = "@(#) $Header$, compiled: " __DATE__ " " __TIME__;
 static double round(double x) { return floor (x + 0.5); }
 #endif
 
+/*
+ * The following structure is a wakeup slot for a thread waiting
+ * for a connection on a queue of a lifo pool.
+ */
+
+typedef struct ConnWaiter {
+    struct ConnWaiter *nextPtr;
+    Ns_Cond cond;
+    int signaled;
+} ConnWaiter;
+
 /*
  * The following structure is allocated for each new thread.  The
  * connPtr arg is used for the proc arg callback to list conn
@@ -54,14 +65,25 @@ typedef struct ConnData {
     Pool *poolPtr;
     Conn *connPtr;
     Ns_Thread thread;
+    ConnWaiter waiter;
 } ConnData;
 
 /*
  * Local functions defined in this file
  */
 
-static void ConnRun(Conn *connPtr);	/* Connection run routine. */
+static int ConnRun(Conn *connPtr);	/* Connection run routine. */
 static void AppendConnList(Tcl_DString *dsPtr, Conn *firstPtr, char *state);
+static Conn *NextConn(Pool *poolPtr, int qidx, Ns_Time *timePtr,
+		      ConnWaiter *waitPtr);
+static Conn *PopConn(ConnQueue *queuePtr);
+static Conn *StealConn(Pool *poolPtr, int qidx);
+static int WakeQueue(Pool *poolPtr, int qidx, int n);
+static void SignalQueue(ConnQueue *queuePtr);
+static void SpareThreads(Pool *poolPtr, int extra);
+static void WarmInterps(Pool *poolPtr);
+static int WaitQueue(Pool *poolPtr, ConnQueue *queuePtr, Ns_Time *timePtr,
+		     ConnWaiter *waitPtr);
 
 /*
  * Static variables defined in this file.
@@ -167,53 +189,77 @@ void
 NsQueueConn(Conn *connPtr)
 {
     Pool *poolPtr = NsGetConnPool(connPtr);
-    int create = 0;
+    ConnQueue *queuePtr;
+    int qidx, create = 0;
 
     /*
-     * Queue connection.
+     * Queue connection on the queue selected by connection id.
      */
 
+    qidx = connPtr->id % poolPtr->nqueues;
+    queuePtr = &poolPtr->queues[qidx];
     connPtr->flags |= NS_CONN_RUNNING;
-    Ns_MutexLock(&poolPtr->lock);
-    ++poolPtr->threads.queued;
-    if (poolPtr->queue.wait.firstPtr == NULL) {
-        poolPtr->queue.wait.firstPtr = connPtr;
+    Ns_MutexLock(&queuePtr->lock);
+    ++queuePtr->queued;
+    if (queuePtr->wait.firstPtr == NULL) {
+        queuePtr->wait.firstPtr = connPtr;
     } else {
-        poolPtr->queue.wait.lastPtr->nextPtr = connPtr;
+        queuePtr->wait.lastPtr->nextPtr = connPtr;
     }
-    poolPtr->queue.wait.lastPtr = connPtr;
+    queuePtr->wait.lastPtr = connPtr;
     connPtr->nextPtr = NULL;
+    queuePtr->wait.num ++;
+
+    if (queuePtr->waiting > queuePtr->wakeups) {
+        /*
+          There are threads waiting. Signal to process
+          the request.
+         */
+        SignalQueue(queuePtr);
+        Ns_MutexUnlock(&queuePtr->lock);
+        goto spare;
+    }
+    Ns_MutexUnlock(&queuePtr->lock);
 
-    if (poolPtr->threads.waiting == 0
-        && poolPtr->threads.current < poolPtr->threads.max) {
+    /*
+     * Wake a thread waiting on another queue which will steal the
+     * connection.
+     */
+
+    if (poolPtr->nqueues > 1
+        && WakeQueue(poolPtr, qidx + 1, poolPtr->nqueues - 1)) {
+        goto spare;
+    }
+
+    Ns_MutexLock(&poolPtr->lock);
+    if (poolPtr->threads.current < poolPtr->threads.max) {
         /* 
            Create a new thread if no thread is waiting and the number
            of currently starting or running threads is below max.
         */
+        poolPtr->threads.current ++;
         create = 1;
     }
-
-    poolPtr->queue.wait.num ++;
+    Ns_MutexUnlock(&poolPtr->lock);
     
+    /* 
+       Otherwise we might have missed signaling, since we are already
+       using max resources, and no thread is available. In such a case
+       the autorecovery at thread exist has to care to process the
+       outstanding requests 
+    */
+
     if (create) {
-        poolPtr->threads.current ++;
-        Ns_MutexUnlock(&poolPtr->lock);
         NsCreateConnThread(poolPtr, 1);
-    } else if (poolPtr->threads.waiting > 0) {
-        /*
-          There are threads waiting. Signal to process
-          the request.
-         */
-        Ns_CondSignal(&poolPtr->cond);
-        Ns_MutexUnlock(&poolPtr->lock);
-    } else {
-        /* 
-           We might have missed signaling, since we are already using
-           max resources, and no thread is available. In such a case
-           the autorecovery at thread exist has to care to process
-           the outstanding requests 
-        */
-        Ns_MutexUnlock(&poolPtr->lock);
+    }
+
+    /*
+     * Create spare threads ahead of demand, if configured.
+     */
+
+spare:
+    if (poolPtr->threads.spare > 0) {
+	SpareThreads(poolPtr, 0);
     }
 }
 
@@ -240,8 +286,10 @@ NsTclServerObjCmd(ClientData arg, Tcl_Interp *interp, int objc,
 		  Tcl_Obj **objv)
 {
     Pool *poolPtr;
+    ConnQueue *queuePtr;
     char buf[100], *pool;
     Tcl_DString ds;
+    int i, idle, waiting;
     static CONST char *opts[] = {
 	 "active", "all", "connections", "keepalive", "pools", "queued",
 	 "threads", "waiting", NULL, 
@@ -277,7 +325,8 @@ NsTclServerObjCmd(ClientData arg, Tcl_Interp *interp, int objc,
 	break;
 	  
     case SWaitingIdx:
-        Tcl_SetObjResult(interp, Tcl_NewIntObj(poolPtr->queue.wait.num));
+	NsGetPoolCounts(poolPtr, NULL, &waiting, NULL);
+        Tcl_SetObjResult(interp, Tcl_NewIntObj(waiting));
 	break;
 
     case SKeepaliveIdx:
@@ -289,13 +338,14 @@ NsTclServerObjCmd(ClientData arg, Tcl_Interp *interp, int objc,
 	break;
 
     case SThreadsIdx:
+	NsGetPoolCounts(poolPtr, &idle, NULL, NULL);
         sprintf(buf, "min %d", poolPtr->threads.min);
         Tcl_AppendElement(interp, buf);
         sprintf(buf, "max %d", poolPtr->threads.max);
         Tcl_AppendElement(interp, buf);
         sprintf(buf, "current %d", poolPtr->threads.current);
         Tcl_AppendElement(interp, buf);
-        sprintf(buf, "idle %d", poolPtr->threads.idle);
+        sprintf(buf, "idle %d", idle);
         Tcl_AppendElement(interp, buf);
         sprintf(buf, "stopping 0");
         Tcl_AppendElement(interp, buf);
@@ -306,10 +356,20 @@ NsTclServerObjCmd(ClientData arg, Tcl_Interp *interp, int objc,
     case SAllIdx:
     	Tcl_DStringInit(&ds);
 	if (opt != SQueuedIdx) {
-	    AppendConnList(&ds, poolPtr->queue.active.firstPtr, "running");
+	    for (i = 0; i < poolPtr->nqueues; ++i) {
+		queuePtr = &poolPtr->queues[i];
+		Ns_MutexLock(&queuePtr->lock);
+		AppendConnList(&ds, queuePtr->active.firstPtr, "running");
+		Ns_MutexUnlock(&queuePtr->lock);
+	    }
 	}
 	if (opt != SActiveIdx) {
-	    AppendConnList(&ds, poolPtr->queue.wait.firstPtr, "queued");
+	    for (i = 0; i < poolPtr->nqueues; ++i) {
+		queuePtr = &poolPtr->queues[i];
+		Ns_MutexLock(&queuePtr->lock);
+		AppendConnList(&ds, queuePtr->wait.firstPtr, "queued");
+		Ns_MutexUnlock(&queuePtr->lock);
+	    }
 	}
         Tcl_DStringResult(interp, &ds);
     }
@@ -370,23 +430,43 @@ NsConnThread(void *arg)
 {
     ConnData  	    *dataPtr = arg;
     Pool            *poolPtr = dataPtr->poolPtr;
+    ConnQueue       *homePtr;
     Conn            *connPtr;
     Ns_Time          wait, *timePtr;
     char             name[100];
-    int              status, ncons;
+    int              id, qidx, ncons, idle, waiting, trace;
     char            *msg;
     double           spread;
     
     /*
-     * Set the conn thread name.
+     * Set the conn thread name and bind the thread to a home queue,
+     * marking it idle.
      */
 
     Ns_TlsSet(&ctdtls, dataPtr);
     Ns_MutexLock(&poolPtr->lock);
-    sprintf(name, "-%s:%d-", poolPtr->name, poolPtr->threads.nextid++);
+    id = poolPtr->threads.nextid++;
     Ns_MutexUnlock(&poolPtr->lock);
+    sprintf(name, "-%s:%d-", poolPtr->name, id);
     Ns_ThreadSetName(name);
 
+    /*
+     * Create and initialize the virtual server interps, if
+     * configured, while the thread is still counted as starting.
+     */
+
+    if (poolPtr->threads.prewarm) {
+	WarmInterps(poolPtr);
+    }
+    Ns_MutexLock(&poolPtr->lock);
+    qidx = id % poolPtr->nqueues;
+    homePtr = &poolPtr->queues[qidx];
+    poolPtr->threads.starting--;
+    Ns_MutexLock(&homePtr->lock);
+    homePtr->idle++;
+    Ns_MutexUnlock(&homePtr->lock);
+    Ns_MutexUnlock(&poolPtr->lock);
+
     /* spread is a value of 1.0 +- specified percentage, 
        i.e. between 0.0 and 2.0 when the configured percentage is 100 */
     spread = 1.0 + (2 * poolPtr->threads.spread * Ns_DRand() - poolPtr->threads.spread) / 100.0;
@@ -398,65 +478,39 @@ NsConnThread(void *arg)
      * Start handling connections.
      */
 
-    Ns_MutexLock(&poolPtr->lock);
-
-    poolPtr->threads.starting--;
-    poolPtr->threads.idle++;
-
     while (poolPtr->threads.maxconns <= 0 || ncons-- > 0) {
 
 	/*
 	 * Wait for a connection to arrive, exiting if one doesn't
-	 * arrive in the configured timeout period.
+	 * arrive in the configured timeout period unless no more
+	 * than the min and spare threads remain.  The current
+	 * thread count is read without the pool lock which at worst
+	 * results in one extra wait with or without timeout.
 	 */
         
-	if (poolPtr->threads.current <= poolPtr->threads.min) {
+	if (poolPtr->threads.current
+		<= poolPtr->threads.min + poolPtr->threads.spare) {
 	    timePtr = NULL;
 	} else {
 	    Ns_GetTime(&wait);
 	    Ns_IncrTime(&wait, round(poolPtr->threads.timeout * spread), 0);
 	    timePtr = &wait;
 	}
-
-        status = NS_OK;
-        while (!poolPtr->shutdown
-               && status == NS_OK
-               && poolPtr->queue.wait.firstPtr == NULL) {
-            /* 
-               nothing is queued, we wait for a queue entry 
-            */
-            poolPtr->threads.waiting++;
-            status = Ns_CondTimedWait(&poolPtr->cond, &poolPtr->lock, timePtr);
-            poolPtr->threads.waiting--;
-        }
-
-	if (poolPtr->queue.wait.firstPtr == NULL) {
+	connPtr = NextConn(poolPtr, qidx, timePtr, &dataPtr->waiter);
+	if (connPtr == NULL) {
 	    msg = "timeout waiting for connection";
 	    break;
 	}
 
 	/*
-	 * Pull the first connection off the waiting list.
+	 * Start a replacement before running the last connection
+	 * so it is ready by the time this thread exits.
 	 */
 
-    	connPtr = poolPtr->queue.wait.firstPtr;
-    	poolPtr->queue.wait.firstPtr = connPtr->nextPtr; 
-    	if (poolPtr->queue.wait.lastPtr == connPtr) {
-	    poolPtr->queue.wait.lastPtr = NULL;
-    	}
-	connPtr->nextPtr = NULL;
-	connPtr->prevPtr = poolPtr->queue.active.lastPtr;
-         if (poolPtr->queue.active.lastPtr != NULL) {
-             poolPtr->queue.active.lastPtr->nextPtr = connPtr;
-         }
-         poolPtr->queue.active.lastPtr = connPtr;
-         if (poolPtr->queue.active.firstPtr == NULL) {
-             poolPtr->queue.active.firstPtr = connPtr;
-         }
-         poolPtr->threads.idle--;
-         poolPtr->queue.wait.num--;
-
-         Ns_MutexUnlock(&poolPtr->lock);
+	if (ncons == 0 && poolPtr->threads.maxconns > 0
+		&& poolPtr->threads.spare > 0) {
+	    SpareThreads(poolPtr, 1);
+	}
 
          /*
           * Run the connection.
@@ -466,31 +520,38 @@ NsConnThread(void *arg)
          dataPtr->connPtr = connPtr;
          Ns_MutexUnlock(&connlock);
          
-         Ns_GetTime(&connPtr->times.run);
-         ConnRun(connPtr);
+         if (!(connPtr->wrflags & WRITER_RELEASED)) {
+             Ns_GetTime(&connPtr->times.run);
+         }
+         trace = ConnRun(connPtr);
          Ns_MutexLock(&connlock);
          dataPtr->connPtr = NULL;
          Ns_MutexUnlock(&connlock);
          
          /*
-          * Remove from the active list and push on the free list.
+          * Remove from the active list and push on the free list
+          * unless still held by a writer thread.
           */
 
-         Ns_MutexLock(&poolPtr->lock);
+         Ns_MutexLock(&homePtr->lock);
          if (connPtr->prevPtr != NULL) {
              connPtr->prevPtr->nextPtr = connPtr->nextPtr;
          } else {
-             poolPtr->queue.active.firstPtr = connPtr->nextPtr;
+             homePtr->active.firstPtr = connPtr->nextPtr;
          }
          if (connPtr->nextPtr != NULL) {
              connPtr->nextPtr->prevPtr = connPtr->prevPtr;
          } else {
-             poolPtr->queue.active.lastPtr = connPtr->prevPtr;
+             homePtr->active.lastPtr = connPtr->prevPtr;
+         }
+         homePtr->idle++;
+         Ns_MutexUnlock(&homePtr->lock);
+         if ((connPtr->wrflags & (WRITER_QUEUED|WRITER_RELEASED))
+		 == WRITER_QUEUED) {
+             NsWriterRelease(connPtr, trace);
+         } else {
+             NsFreeConn(connPtr);
          }
-         poolPtr->threads.idle++;
-         Ns_MutexUnlock(&poolPtr->lock);
-         NsFreeConn(connPtr);
-         Ns_MutexLock(&poolPtr->lock);
     }
     
     /*
@@ -506,37 +567,49 @@ NsConnThread(void *arg)
      * Mark this thread as no longer active.
      */
     
+    Ns_MutexLock(&homePtr->lock);
+    homePtr->idle--;
+    Ns_MutexUnlock(&homePtr->lock);
+    Ns_MutexLock(&poolPtr->lock);
     if (poolPtr->shutdown) {
         msg = "shutdown pending";
     }
     poolPtr->threads.current--;
-    poolPtr->threads.idle--;
+    NsGetPoolCounts(poolPtr, &idle, &waiting, NULL);
     
-    if (((poolPtr->queue.wait.num > 0 
-          && poolPtr->threads.idle == 0 
+    if (((waiting > 0 
+          && idle == 0 
           && poolPtr->threads.starting == 0
           )
-         || (poolPtr->threads.current < poolPtr->threads.min)
+         || (poolPtr->threads.current
+             < poolPtr->threads.min + poolPtr->threads.spare)
          ) && !poolPtr->shutdown) {
         /* 
            Recreate a thread when on of the condings hold
            - there are more queue entries are still waiting, 
            but no thread is either starting or idle, or
-           - there are less than minthreads connection threads alive.
+           - there are less than minthreads plus sparethreads
+           connection threads alive, e.g., after several threads
+           timed out at once.
         */
         poolPtr->threads.current ++;
         Ns_MutexUnlock(&poolPtr->lock);
         NsCreateConnThread(poolPtr, 0); /* joinThreads == 0 to avoid deadlock */
-    } else if (poolPtr->queue.wait.num > 0 && poolPtr->threads.waiting > 0) {
+    } else {
         /*
-          Wake up a waiting thread
+          Wake up a waiting thread, or the pool shutdown waiting for
+          the queues to drain.
         */
-        Ns_CondSignal(&poolPtr->cond);
-        Ns_MutexUnlock(&poolPtr->lock);
-    } else {
+        if (poolPtr->shutdown) {
+            Ns_CondBroadcast(&poolPtr->cond);
+        }
         Ns_MutexUnlock(&poolPtr->lock);
+        if (waiting > 0) {
+            WakeQueue(poolPtr, qidx, poolPtr->nqueues);
+        }
     }
     
+    Ns_CondDestroy(&dataPtr->waiter.cond);
     Ns_Log(Notice, "exiting: %s", msg);
     Ns_ThreadExit(dataPtr);
 }
@@ -545,27 +618,531 @@ NsConnThread(void *arg)
 /*
  *----------------------------------------------------------------------
  *
- * ConnRun --
+ * SpareThreads --
+ *
+ *	Create threads as needed to maintain the configured number of
+ *	spare threads beyond those required by waiting connections,
+ *	plus the given number of extra threads, up to maxthreads.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	New threads may be created.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SpareThreads(Pool *poolPtr, int extra)
+{
+    int idle, waiting, n;
+
+    NsGetPoolCounts(poolPtr, &idle, &waiting, NULL);
+    Ns_MutexLock(&poolPtr->lock);
+    n = poolPtr->threads.spare + extra + waiting
+	- idle - poolPtr->threads.starting;
+    if (n > poolPtr->threads.max - poolPtr->threads.current) {
+	n = poolPtr->threads.max - poolPtr->threads.current;
+    }
+    if (n < 0 || poolPtr->shutdown) {
+	n = 0;
+    }
+    poolPtr->threads.current += n;
+    Ns_MutexUnlock(&poolPtr->lock);
+    while (n-- > 0) {
+	NsCreateConnThread(poolPtr, 0);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WarmInterps --
+ *
+ *	Allocate and return an interp for each virtual server using
+ *	the pool to evaluate the create and allocate traces before
+ *	the thread accepts connections.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Interps are left in the per-thread cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WarmInterps(Pool *poolPtr)
+{
+    Tcl_Interp *interp;
+    CONST char **servers;
+    int i, nservers, status;
+
+    Ns_MutexLock(&poolPtr->lock);
+    if (poolPtr->servers == NULL) {
+	status = TCL_ERROR;
+    } else {
+	status = Tcl_SplitList(NULL, poolPtr->servers, &nservers, &servers);
+    }
+    Ns_MutexUnlock(&poolPtr->lock);
+    if (status != TCL_OK) {
+	return;
+    }
+    for (i = 0; i < nservers; ++i) {
+	interp = Ns_TclAllocateInterp((char *) servers[i]);
+	if (interp != NULL) {
+	    Ns_TclDeAllocateInterp(interp);
+	}
+    }
+    Tcl_Free((char *) servers);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NextConn --
+ *
+ *	Wait for the next connection, taking it from the thread's
+ *	home queue or stealing it from another queue of the pool.
+ *
+ * Results:
+ *	Pointer to Conn or NULL on timeout or shutdown.
+ *
+ * Side effects:
+ *	Connection is moved to the active list of the home queue.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Conn *
+NextConn(Pool *poolPtr, int qidx, Ns_Time *timePtr, ConnWaiter *waitPtr)
+{
+    ConnQueue *homePtr = &poolPtr->queues[qidx];
+    Conn *connPtr;
+    int status, rewake;
+
+    status = NS_OK;
+    rewake = 0;
+    Ns_MutexLock(&homePtr->lock);
+    while ((connPtr = PopConn(homePtr)) == NULL
+	   && !poolPtr->shutdown
+	   && status == NS_OK) {
+
+	/*
+	 * Register as waiting before looking at the other queues.  A
+	 * connection queued meanwhile is then either found by the
+	 * steal or leaves a wakeup on this queue so the thread looks
+	 * again instead of sleeping.
+	 */
+
+	homePtr->waiting++;
+	if (poolPtr->nqueues > 1) {
+	    Ns_MutexUnlock(&homePtr->lock);
+	    connPtr = StealConn(poolPtr, qidx);
+	    Ns_MutexLock(&homePtr->lock);
+	}
+	if (connPtr == NULL) {
+	    if (homePtr->wakeups > 0) {
+		homePtr->wakeups--;
+	    } else if (homePtr->wait.firstPtr == NULL && !poolPtr->shutdown) {
+		status = WaitQueue(poolPtr, homePtr, timePtr, waitPtr);
+		if (status == NS_OK && homePtr->wakeups > 0) {
+		    homePtr->wakeups--;
+		}
+	    }
+	}
+	homePtr->waiting--;
+	if (homePtr->wakeups > homePtr->waiting) {
+	    homePtr->wakeups = homePtr->waiting;
+
+	    /*
+	     * A wakeup dropped after a steal may be the only one left
+	     * for a connection queued here meanwhile, so pass it on.
+	     */
+
+	    if (connPtr != NULL && homePtr->wait.firstPtr != NULL) {
+		rewake = 1;
+	    }
+	}
+	if (connPtr != NULL) {
+	    break;
+	}
+    }
+    if (connPtr != NULL) {
+	connPtr->prevPtr = homePtr->active.lastPtr;
+	if (homePtr->active.lastPtr != NULL) {
+	    homePtr->active.lastPtr->nextPtr = connPtr;
+	}
+	homePtr->active.lastPtr = connPtr;
+	if (homePtr->active.firstPtr == NULL) {
+	    homePtr->active.firstPtr = connPtr;
+	}
+	homePtr->idle--;
+    }
+    Ns_MutexUnlock(&homePtr->lock);
+    if (rewake) {
+	(void) WakeQueue(poolPtr, qidx + 1, poolPtr->nqueues - 1);
+    }
+    return connPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PopConn --
+ *
+ *	Pull the first connection off the waiting list of a queue
+ *	which must be locked.
+ *
+ * Results:
+ *	Pointer to Conn or NULL if no connection is waiting.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Conn *
+PopConn(ConnQueue *queuePtr)
+{
+    Conn *connPtr;
+
+    connPtr = queuePtr->wait.firstPtr;
+    if (connPtr != NULL) {
+	queuePtr->wait.firstPtr = connPtr->nextPtr; 
+	if (queuePtr->wait.lastPtr == connPtr) {
+	    queuePtr->wait.lastPtr = NULL;
+	}
+	connPtr->nextPtr = NULL;
+	queuePtr->wait.num--;
+    }
+    return connPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StealConn --
+ *
+ *	Take a waiting connection from a queue other than the given
+ *	home queue.
+ *
+ * Results:
+ *	Pointer to Conn or NULL if all other queues are empty.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Conn *
+StealConn(Pool *poolPtr, int qidx)
+{
+    ConnQueue *queuePtr;
+    Conn *connPtr;
+    int i;
+
+    for (i = 1; i < poolPtr->nqueues; ++i) {
+	queuePtr = &poolPtr->queues[(qidx + i) % poolPtr->nqueues];
+	Ns_MutexLock(&queuePtr->lock);
+	connPtr = PopConn(queuePtr);
+	Ns_MutexUnlock(&queuePtr->lock);
+	if (connPtr != NULL) {
+	    return connPtr;
+	}
+    }
+    return NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WakeQueue --
+ *
+ *	Signal a thread waiting on one of n queues starting at the
+ *	given queue index.
+ *
+ * Results:
+ *	1 if a thread was signaled, 0 if no thread is waiting.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+WakeQueue(Pool *poolPtr, int qidx, int n)
+{
+    ConnQueue *queuePtr;
+    int woke = 0;
+
+    while (!woke && n-- > 0) {
+	queuePtr = &poolPtr->queues[qidx++ % poolPtr->nqueues];
+	Ns_MutexLock(&queuePtr->lock);
+	if (queuePtr->waiting > queuePtr->wakeups) {
+	    SignalQueue(queuePtr);
+	    woke = 1;
+	}
+	Ns_MutexUnlock(&queuePtr->lock);
+    }
+    return woke;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SignalQueue --
+ *
+ *	Wake a thread waiting on a locked queue, popping the most
+ *	recently idle thread off the waiter stack if any or else
+ *	signaling the shared queue condition.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Pending wakeups are incremented.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SignalQueue(ConnQueue *queuePtr)
+{
+    ConnWaiter *waitPtr;
+
+    ++queuePtr->wakeups;
+    waitPtr = queuePtr->waiters;
+    if (waitPtr != NULL) {
+	queuePtr->waiters = waitPtr->nextPtr;
+	waitPtr->signaled = 1;
+	Ns_CondSignal(&waitPtr->cond);
+    } else {
+	Ns_CondSignal(&queuePtr->cond);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WaitQueue --
+ *
+ *	Wait on a locked queue for a signal.  In a lifo pool, the
+ *	thread pushes its own wakeup slot on the waiter stack so the
+ *	most recently idle threads are woken first and the others
+ *	time out.
+ *
+ * Results:
+ *	NS_OK if signaled, NS_TIMEOUT on timeout.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+WaitQueue(Pool *poolPtr, ConnQueue *queuePtr, Ns_Time *timePtr,
+	  ConnWaiter *waitPtr)
+{
+    ConnWaiter **nextPtrPtr;
+    int status;
+
+    if (!poolPtr->lifo) {
+	return Ns_CondTimedWait(&queuePtr->cond, &queuePtr->lock, timePtr);
+    }
+    waitPtr->signaled = 0;
+    waitPtr->nextPtr = queuePtr->waiters;
+    queuePtr->waiters = waitPtr;
+    status = Ns_CondTimedWait(&waitPtr->cond, &queuePtr->lock, timePtr);
+    if (waitPtr->signaled) {
+	status = NS_OK;
+    } else {
+	nextPtrPtr = &queuePtr->waiters;
+	while (*nextPtrPtr != waitPtr) {
+	    nextPtrPtr = &(*nextPtrPtr)->nextPtr;
+	}
+	*nextPtrPtr = waitPtr->nextPtr;
+    }
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsInitConnQueues --
+ *
+ *	Allocate the connection queues of a pool, replacing any
+ *	existing queues.  The pool must have no threads running.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsInitConnQueues(Pool *poolPtr, int nqueues)
+{
+    ConnQueue *queuePtr;
+    int i;
+
+    if (poolPtr->queues != NULL) {
+	for (i = 0; i < poolPtr->nqueues; ++i) {
+	    queuePtr = &poolPtr->queues[i];
+	    Ns_MutexDestroy(&queuePtr->lock);
+	    Ns_CondDestroy(&queuePtr->cond);
+	}
+	ns_free(poolPtr->queues);
+    }
+    poolPtr->nqueues = nqueues;
+    poolPtr->queues = ns_calloc((size_t) nqueues, sizeof(ConnQueue));
+    for (i = 0; i < nqueues; ++i) {
+	queuePtr = &poolPtr->queues[i];
+	Ns_MutexInit(&queuePtr->lock);
+	Ns_MutexSetName2(&queuePtr->lock, "ns:queue", poolPtr->name);
+	Ns_CondInit(&queuePtr->cond);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsGetPoolCounts --
+ *
+ *	Sum the idle threads, waiting connections, and total queued
+ *	connections over all queues of a pool.  Any result pointer
+ *	may be NULL.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsGetPoolCounts(Pool *poolPtr, int *idlePtr, int *waitPtr,
+		unsigned int *queuedPtr)
+{
+    ConnQueue *queuePtr;
+    int i, idle, waiting;
+    unsigned int queued;
+
+    idle = waiting = 0;
+    queued = 0;
+    for (i = 0; i < poolPtr->nqueues; ++i) {
+	queuePtr = &poolPtr->queues[i];
+	Ns_MutexLock(&queuePtr->lock);
+	idle += queuePtr->idle;
+	waiting += queuePtr->wait.num;
+	queued += queuePtr->queued;
+	Ns_MutexUnlock(&queuePtr->lock);
+    }
+    if (idlePtr != NULL) {
+	*idlePtr = idle;
+    }
+    if (waitPtr != NULL) {
+	*waitPtr = waiting;
+    }
+    if (queuedPtr != NULL) {
+	*queuedPtr = queued;
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsWakeConnQueues --
  *
- *	Run a valid connection.
+ *	Wake all threads waiting on the queues of a pool, e.g., on
+ *	shutdown.
  *
  * Results:
  *	None.
  *
  * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsWakeConnQueues(Pool *poolPtr)
+{
+    ConnQueue *queuePtr;
+    int i;
+
+    for (i = 0; i < poolPtr->nqueues; ++i) {
+	queuePtr = &poolPtr->queues[i];
+	Ns_MutexLock(&queuePtr->lock);
+	Ns_CondBroadcast(&queuePtr->cond);
+	while (queuePtr->waiters != NULL) {
+	    queuePtr->waiters->signaled = 1;
+	    Ns_CondSignal(&queuePtr->waiters->cond);
+	    queuePtr->waiters = queuePtr->waiters->nextPtr;
+	}
+	Ns_MutexUnlock(&queuePtr->lock);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ConnRun --
+ *
+ *	Run a valid connection.  A connection whose response was
+ *	handed to a writer thread is run a second time, once the
+ *	send completes, to call the traces and cleanups.
+ *
+ * Results:
+ *	For a response handed to a writer thread, 1 if the traces
+ *	are to be called after the send, 0 otherwise.
+ *
+ * Side effects:
  *	Connection request is read and parsed and the cooresponding
  *	service routine is called.
  *
  *----------------------------------------------------------------------
  */
 
-static void
+static int
 ConnRun(Conn *connPtr)
 {
     Tcl_Encoding    encoding = NULL;
     Ns_Conn 	  *conn = (Ns_Conn *) connPtr;
     NsServer	  *servPtr = connPtr->servPtr;
     int		   i, status;
+
+    /*
+     * Skip to the traces of a response sent by a writer thread.
+     */
+
+    if (connPtr->wrflags & WRITER_RELEASED) {
+	status = (connPtr->wrflags & WRITER_TRACE) ? NS_OK : NS_ERROR;
+	goto trace;
+    }
 	
     /*
      * Initialize the connection encodings. 
@@ -587,6 +1164,7 @@ ConnRun(Conn *connPtr)
 		Ns_StrToUpper(Ns_SetKey(connPtr->headers, i));
 	    }
 	}
+	NsSetFreeIndex(connPtr->headers);
     }
 
     /*
@@ -599,6 +1177,20 @@ ConnRun(Conn *connPtr)
 	status = NsConnRunDirectRequest((Ns_Conn *) connPtr);
     }
     Ns_ConnClose(conn);
+
+    /*
+     * Hold the traces of a response handed to a writer thread so
+     * they are called with the bytes actually sent.  The writer
+     * may already be updating wrflags so the trace decision is
+     * returned for NsWriterRelease to record under its lock.
+     */
+
+    if (connPtr->wrflags & WRITER_QUEUED) {
+	NsFreeConnInterp(connPtr);
+	return (status == NS_OK || status == NS_FILTER_RETURN);
+    }
+
+trace:
     if (status == NS_OK || status == NS_FILTER_RETURN) {
 	status = NsRunFilters(conn, NS_FILTER_TRACE);
 	if (status == NS_OK) {
@@ -614,6 +1206,7 @@ ConnRun(Conn *connPtr)
 
     NsRunCleanups(conn);
     NsFreeConnInterp(connPtr);
+    return 0;
 }
 
 
@@ -653,6 +1246,7 @@ NsCreateConnThread(Pool *poolPtr, int joinThreads)
     dataPtr = ns_malloc(sizeof(ConnData));
     dataPtr->poolPtr = poolPtr;
     dataPtr->connPtr = NULL;
+    Ns_CondInit(&dataPtr->waiter.cond);
     Ns_MutexLock(&poolPtr->lock);
     poolPtr->threads.starting ++;
     Ns_MutexUnlock(&poolPtr->lock);
@@ -49,6 +49,29 @@ static void SetUrl(Ns_Request * request, char *url, Tcl_Encoding encoding);
 static void FreeUrl(Ns_Request * request);
 static Ns_Mutex reqlock;
 
+/*
+ * The following table defines the names of the common headers,
+ * in the order of the HdrId enum.
+ */
+
+static struct {
+    char *name;
+    int   length;
+} hdrs[] = {
+#define HDR(s) {s, sizeof(s) - 1}
+    HDR("Accept"), HDR("Accept-Charset"), HDR("Accept-Encoding"),
+    HDR("Accept-Language"), HDR("Authorization"), HDR("Cache-Control"),
+    HDR("Connection"), HDR("Content-Encoding"), HDR("Content-Length"),
+    HDR("Content-Type"), HDR("Cookie"), HDR("Date"), HDR("Expect"),
+    HDR("From"), HDR("Host"), HDR("If-Match"), HDR("If-Modified-Since"),
+    HDR("If-None-Match"), HDR("If-Range"), HDR("If-Unmodified-Since"),
+    HDR("Keep-Alive"), HDR("Max-Forwards"), HDR("Origin"), HDR("Pragma"),
+    HDR("Proxy-Authorization"), HDR("Range"), HDR("Referer"), HDR("TE"),
+    HDR("Transfer-Encoding"), HDR("Upgrade"), HDR("User-Agent"),
+    HDR("Via"), HDR("X-Forwarded-For")
+#undef HDR
+};
+
 
 /*
  *----------------------------------------------------------------------
@@ -523,29 +546,102 @@ Ns_ParseHeader(Ns_Set *set, char *line, Ns_HeaderCaseDisposition disp)
         while (*value != '\0' && isspace(UCHAR(*value))) {
             ++value;
         }
-        index = Ns_SetPut(set, line, value);
-        key = Ns_SetKey(set, index);
-	if (disp == ToLower) {
-            while (*key != '\0') {
-	        if (isupper(UCHAR(*key))) {
-            	    *key = tolower(UCHAR(*key));
-		}
-            	++key;
-	    }
-	} else if (disp == ToUpper) {
-            while (*key != '\0') {
-	        if (islower(UCHAR(*key))) {
+
+	/*
+	 * Convert the case of a copy of the key before the put to keep
+	 * the key index of a large set, if any, current.
+	 */
+
+	if (disp == Preserve) {
+	    Ns_SetPut(set, line, value);
+	} else {
+	    Ns_DStringInit(&ds);
+	    Ns_DStringAppend(&ds, line);
+	    for (key = ds.string; *key != '\0'; ++key) {
+		if (disp == ToLower && isupper(UCHAR(*key))) {
+		    *key = tolower(UCHAR(*key));
+		} else if (disp == ToUpper && islower(UCHAR(*key))) {
 		    *key = toupper(UCHAR(*key));
 		}
-		++key;
 	    }
-        }
+	    Ns_SetPut(set, ds.string, value);
+	    Ns_DStringFree(&ds);
+	}
         *sep = ':';
     }
     return NS_OK;
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHeaderId --
+ *
+ *	Find the id of a common header name.
+ *
+ * Results:
+ *	HdrId or -1 if not a common header.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsHeaderId(char *name)
+{
+    int i, length;
+
+    length = strlen(name);
+    for (i = 0; i < HDR_MAX; ++i) {
+	if (hdrs[i].length == length && STRIEQ(hdrs[i].name, name)) {
+	    return i;
+	}
+    }
+    return -1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsConnHeader --
+ *
+ *	Get the value of a common request header, using the index
+ *	recorded when parsed if the header set still has the header
+ *	at that index.
+ *
+ * Results:
+ *	Pointer to value or NULL if no such header.
+ *
+ * Side effects:
+ *	Index is updated if the set has been modified.
+ *
+ *----------------------------------------------------------------------
+ */
+
+char *
+NsConnHeader(Conn *connPtr, HdrId id)
+{
+    Ns_Set *set = connPtr->headers;
+    int i;
+
+    i = connPtr->hdrs[id] - 1;
+    if (i < 0) {
+	if (Ns_SetSize(set) == connPtr->nhdrs) {
+	    return NULL;
+	}
+    } else if (i < Ns_SetSize(set) && STRIEQ(Ns_SetKey(set, i), hdrs[id].name)) {
+	return Ns_SetValue(set, i);
+    }
+    i = Ns_SetIFind(set, hdrs[id].name);
+    connPtr->hdrs[id] = i + 1;
+    return (i < 0 ? NULL : Ns_SetValue(set, i));
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
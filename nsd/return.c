@@ -1365,6 +1365,9 @@ ReturnOpen(Ns_Conn *conn, int status, char *type, Tcl_Channel chan,
 	result = Ns_ConnSendChannel(conn, chan, len);
     } else if (fp != NULL) {
 	result = Ns_ConnSendFp(conn, fp, len);
+    } else if (NsWriterQueue(conn, fd, off, len, NULL)) {
+	result = (NsRunFilters(conn, NS_FILTER_WRITE) == NS_OK ?
+		  NS_OK : NS_ERROR);
     } else if (off < 0) {
 	result = Ns_ConnSendFd(conn, fd, len);
     } else {
@@ -1421,7 +1424,8 @@ CheckKeep(Ns_Conn *conn, int status)
     if (connPtr->drvPtr->keepwait > 0 &&
 	conn->request != NULL &&
 	STREQ(conn->request->method, "GET") &&
-	HdrEq(conn->headers, "connection", "keep-alive")) {
+	(hdr = NsConnHeader(connPtr, HDR_CONNECTION)) != NULL &&
+	STRIEQ(hdr, "keep-alive")) {
 
 	/*
 	 * Status 304, without any content, is ok.
@@ -245,7 +245,7 @@ CreateServer(char *server)
     NsServer *servPtr;
     char *path, *spath, *dirf, *p;
     Ns_Set *set;
-    int i, n;
+    int i, n, policy, notify, shards;
 
     Ns_DStringInit(&ds);
     servPtr = ns_calloc(1, sizeof(NsServer));
@@ -273,6 +273,12 @@ CreateServer(char *server)
     if (!Ns_ConfigGetBool(path, "filterredirect", &i) || i) {
     	servPtr->opts.flags |= SERV_FILTERREDIRECT;
     }
+    if (Ns_ConfigGetBool(path, "streamuploads", &i) && i) {
+    	servPtr->opts.flags |= SERV_STREAMUPLOADS;
+    }
+    if (Ns_ConfigGetBool(path, "filterstats", &i) && i) {
+    	servPtr->opts.flags |= SERV_FILTERSTATS;
+    }
     p = Ns_ConfigGetValue(path, "headercase");
     if (p != NULL && STRIEQ(p, "tolower")) {
     	servPtr->opts.hdrcase = ToLower;
@@ -362,6 +368,9 @@ CreateServer(char *server)
 	Ns_HomePath(&ds, "bin", "init.tcl", NULL);
 	servPtr->tcl.initfile = Ns_DStringExport(&ds);
     }
+    if (!Ns_ConfigGetBool(path, "lazyprocs", &servPtr->tcl.lazyprocs)) {
+	servPtr->tcl.lazyprocs = 0;
+    }
 
     /*
      * Initialize Tcl shared variables, sets, and channels interfaces.
@@ -399,11 +408,24 @@ CreateServer(char *server)
 	    i = 1;
 	}
 	servPtr->fastpath.cacheminage = i;
-    	servPtr->fastpath.cache = NsFastpathCache(server, n);
+	policy = NS_CACHE_LRU;
+	p = Ns_ConfigGetValue(path, "cachepolicy");
+	if (p != NULL && (policy = Ns_CacheGetPolicy(p)) < 0) {
+	    Ns_Log(Warning, "fastpath[%s]: invalid cachepolicy: %s",
+		   server, p);
+	    policy = NS_CACHE_LRU;
+	}
+	if (!Ns_ConfigGetInt(path, "cacheshards", &i) || i < 1) {
+	    i = 1;
+	}
+    	servPtr->fastpath.cache = NsFastpathCache(server, n, i, policy);
     }
     if (!Ns_ConfigGetBool(path, "mmap", &servPtr->fastpath.mmap)) {
     	servPtr->fastpath.mmap = 0;
     }
+    if (!Ns_ConfigGetBool(path, "gzip", &servPtr->fastpath.gzip)) {
+    	servPtr->fastpath.gzip = 0;
+    }
     dirf = Ns_ConfigGetValue(path, "directoryfile");
     if (dirf == NULL) {
     	dirf = Ns_ConfigGetValue(spath, "directoryfile");
@@ -445,6 +467,23 @@ CreateServer(char *server)
     }
     servPtr->fastpath.diradp = Ns_ConfigGetValue(path, "directoryadp");
 
+    /*
+     * Enable the stat cache if a positive TTL is configured.
+     */
+
+    if (Ns_ConfigGetInt(path, "statcachettl", &i) && i > 0) {
+	if (!Ns_ConfigGetInt(path, "statcachesize", &n) || n < 1) {
+	    n = 10000;
+	}
+	if (!Ns_ConfigGetInt(path, "cacheshards", &shards) || shards < 1) {
+	    shards = 1;
+	}
+	if (!Ns_ConfigGetBool(path, "statcachenotify", &notify)) {
+	    notify = 0;
+	}
+	NsFastpathStatCache(servPtr, n, shards, i, notify);
+    }
+
     /*
      * Configure the url, proxy and redirect requests.
      */
@@ -511,6 +550,30 @@ CreateServer(char *server)
 	i = 1 * 1024 * 1000;
     }
     servPtr->adp.bufsize = i;
+    if (!Ns_ConfigGetInt(path, "variantcachesize", &i)) {
+	i = 5 * 1024 * 1000;
+    }
+    Ns_DStringTrunc(&ds, 0);
+    Ns_DStringVarAppend(&ds, "nsadp:variants:", server, NULL);
+    servPtr->adp.variants = Ns_CacheCreateSz(ds.string, TCL_STRING_KEYS,
+					     (size_t) i, NsAdpFreeVariant);
+    p = Ns_ConfigGetValue(path, "compiledir");
+    if (p != NULL) {
+	Ns_DStringTrunc(&ds, 0);
+	if (!Ns_PathIsAbsolute(p)) {
+	    p = Ns_HomePath(&ds, p, NULL);
+	}
+	if (mkdir(p, 0755) != 0 && errno != EEXIST) {
+	    Ns_Log(Error, "adp[%s]: mkdir(%s) failed: %s", server, p,
+		   strerror(errno));
+	} else {
+	    servPtr->adp.compiledir = ns_strdup(p);
+	}
+    }
+    if (Ns_ConfigGetBool(path, "precompile", &i) && i) {
+	Ns_RegisterAtStartup(NsAdpPrecompile, servPtr);
+    }
+    Ns_DStringFree(&ds);
 
     /*
      * Initialize the ADP page and tag tables and locks.
@@ -38,6 +38,34 @@ static const char *RCSID = "@(#) $Header$, compiled: " __DATE__ " " __TIME__;
 
 #include "nsd.h"
 
+/*
+ * The following structure extends a set created by Ns_SetCreate with
+ * an index of the first field for each key, built on the first case
+ * sensitive or insensitive lookup once the set reaches
+ * nsconf.setindexsize fields.  The index is updated as fields are put
+ * and dropped when fields are deleted.  Like the fields, the index is
+ * updated without a lock by the thread which owns the set.  Only the
+ * build is locked, as a set shared read-only between threads, e.g.,
+ * a config section, may be indexed on a lookup in any thread, and a
+ * built table is published with a memory barrier.
+ */
+
+#define INDEX_KEYS	0
+#define INDEX_IKEYS	1
+#define KEY_SIZE	128
+
+typedef struct Set {
+    Ns_Set	   set;		/* Public set, must be first. */
+    Tcl_HashTable *index[2];	/* Key and lowercase key to field. */
+} Set;
+
+static int Find(Ns_Set *set, char *key, int which);
+static Tcl_HashTable *BuildIndex(Ns_Set *set, int which);
+static void IndexField(Tcl_HashTable *tablePtr, int which, char *key, int i);
+static char *LowerKey(char *key, char *buf, Ns_DString *dsPtr);
+
+static Ns_Mutex lock;
+
 
 /*
  *----------------------------------------------------------------------
@@ -82,14 +110,15 @@ Ns_SetUpdate(Ns_Set *set, char *key, char *value)
 Ns_Set *
 Ns_SetCreate(char *name)
 {
-    Ns_Set *setPtr;
-
-    setPtr = ns_malloc(sizeof(Ns_Set));
-    setPtr->size = 0;
-    setPtr->maxSize = 10;
-    setPtr->name = ns_strcopy(name);
-    setPtr->fields = ns_malloc(sizeof(Ns_SetField) * setPtr->maxSize);
-    return setPtr;
+    Set *setPtr;
+
+    setPtr = ns_malloc(sizeof(Set));
+    setPtr->set.size = 0;
+    setPtr->set.maxSize = 10;
+    setPtr->set.name = ns_strcopy(name);
+    setPtr->set.fields = ns_malloc(sizeof(Ns_SetField) * setPtr->set.maxSize);
+    setPtr->index[INDEX_KEYS] = setPtr->index[INDEX_IKEYS] = NULL;
+    return (Ns_Set *) setPtr;
 }
 
 
@@ -119,6 +148,7 @@ Ns_SetFree(Ns_Set *set)
             ns_free(set->fields[i].name);
             ns_free(set->fields[i].value);
         }
+        NsSetFreeIndex(set);
         ns_free(set->fields);
         ns_free(set->name);
         ns_free(set);
@@ -145,7 +175,8 @@ Ns_SetFree(Ns_Set *set)
 int
 Ns_SetPut(Ns_Set *set, char *key, char *value)
 {
-    int index;
+    Set *setPtr = (Set *) set;
+    int index, which;
 
     index = set->size;
     set->size++;
@@ -156,6 +187,13 @@ Ns_SetPut(Ns_Set *set, char *key, char *value)
     }
     set->fields[index].name = ns_strcopy(key);
     set->fields[index].value = ns_strcopy(value);
+    if (key != NULL) {
+	for (which = INDEX_KEYS; which <= INDEX_IKEYS; ++which) {
+	    if (setPtr->index[which] != NULL) {
+		IndexField(setPtr->index[which], which, key, index);
+	    }
+	}
+    }
     
     return index;
 }
@@ -333,7 +371,7 @@ Ns_SetIUnique(Ns_Set *set, char *key)
 int
 Ns_SetFind(Ns_Set *set, char *key)
 {
-    return Ns_SetFindCmp(set, key, (int (*) (char *, char *)) strcmp);
+    return Find(set, key, INDEX_KEYS);
 }
 
 
@@ -356,7 +394,7 @@ Ns_SetFind(Ns_Set *set, char *key)
 int
 Ns_SetIFind(Ns_Set *set, char *key)
 {
-    return Ns_SetFindCmp(set, key, (int (*) (char *, char *)) strcasecmp);
+    return Find(set, key, INDEX_IKEYS);
 }
 
 
@@ -379,7 +417,10 @@ Ns_SetIFind(Ns_Set *set, char *key)
 char *
 Ns_SetGet(Ns_Set *set, char *key)
 {
-    return Ns_SetGetCmp(set, key, (int (*) (char *, char *)) strcmp);
+    int i;
+
+    i = Find(set, key, INDEX_KEYS);
+    return (i < 0 ? NULL : set->fields[i].value);
 }
 
 
@@ -402,7 +443,10 @@ Ns_SetGet(Ns_Set *set, char *key)
 char *
 Ns_SetIGet(Ns_Set *set, char *key)
 {
-    return Ns_SetGetCmp(set, key, (int (*) (char *, char *)) strcasecmp);
+    int i;
+
+    i = Find(set, key, INDEX_IKEYS);
+    return (i < 0 ? NULL : set->fields[i].value);
 }
 
 
@@ -428,6 +472,7 @@ Ns_SetTrunc(Ns_Set *set, int size)
     if (size < set->size) {
 	int index;
 
+	NsSetFreeIndex(set);
         for (index = size; index < set->size; index++) {
             ns_free(set->fields[index].name);
             ns_free(set->fields[index].value);
@@ -459,6 +504,7 @@ Ns_SetDelete(Ns_Set *set, int index)
     if ((index != -1) && (index < set->size)) {
 	int i;
 
+	NsSetFreeIndex(set);
         ns_free(set->fields[index].name);
         ns_free(set->fields[index].value);
         for (i = index; i < set->size; ++i) {
@@ -800,3 +846,209 @@ Ns_SetPrint(Ns_Set *set)
         }
     }
 }
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Find --
+ *
+ *	Locate the index of the first field with the given key, case
+ *	sensitive or not, through the key index for large sets.
+ *
+ * Results:
+ *	A field index or -1 if not found.
+ *
+ * Side effects:
+ *	Index may be built.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+Find(Ns_Set *set, char *key, int which)
+{
+    Tcl_HashTable *tablePtr;
+    Tcl_HashEntry *hPtr;
+    Ns_DString ds;
+    char *name, buf[KEY_SIZE];
+    int i;
+
+    if (key != NULL && nsconf.setindexsize > 0
+	    && set->size >= nsconf.setindexsize) {
+	tablePtr = ((Set *) set)->index[which];
+	if (tablePtr == NULL) {
+	    tablePtr = BuildIndex(set, which);
+	}
+	if (which == INDEX_KEYS) {
+	    hPtr = Tcl_FindHashEntry(tablePtr, key);
+	} else {
+	    Ns_DStringInit(&ds);
+	    hPtr = Tcl_FindHashEntry(tablePtr, LowerKey(key, buf, &ds));
+	    Ns_DStringFree(&ds);
+	}
+	if (hPtr == NULL) {
+	    return -1;
+	}
+
+	/*
+	 * Confirm the field in case a key was modified in place.
+	 */
+
+	i = PTR2INT(Tcl_GetHashValue(hPtr));
+	if (i < set->size) {
+	    name = set->fields[i].name;
+	    if (name != NULL && (which == INDEX_KEYS ?
+		    STREQ(key, name) : STRIEQ(key, name))) {
+		return i;
+	    }
+	}
+    }
+    return Ns_SetFindCmp(set, key, (int (*) (char *, char *))
+			 (which == INDEX_KEYS ? strcmp : strcasecmp));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * BuildIndex --
+ *
+ *	Build the case sensitive or insensitive key table of the
+ *	index of a set.
+ *
+ * Results:
+ *	Pointer to table.
+ *
+ * Side effects:
+ *	The table is built under a lock, once, and published for
+ *	lookups without a lock.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tcl_HashTable *
+BuildIndex(Ns_Set *set, int which)
+{
+    Set *setPtr = (Set *) set;
+    Tcl_HashTable *tablePtr;
+    int i;
+
+    Ns_MutexLock(&lock);
+    tablePtr = setPtr->index[which];
+    if (tablePtr == NULL) {
+	tablePtr = ns_malloc(sizeof(Tcl_HashTable));
+	Tcl_InitHashTable(tablePtr, TCL_STRING_KEYS);
+	for (i = 0; i < set->size; ++i) {
+	    if (set->fields[i].name != NULL) {
+		IndexField(tablePtr, which, set->fields[i].name, i);
+	    }
+	}
+	NsMemoryBarrier();
+	setPtr->index[which] = tablePtr;
+    }
+    Ns_MutexUnlock(&lock);
+    return tablePtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * IndexField --
+ *
+ *	Add a field to a key table unless a prior field has the
+ *	same key.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+IndexField(Tcl_HashTable *tablePtr, int which, char *key, int i)
+{
+    Tcl_HashEntry *hPtr;
+    Ns_DString ds;
+    char buf[KEY_SIZE];
+    int new;
+
+    Ns_DStringInit(&ds);
+    if (which == INDEX_IKEYS) {
+	key = LowerKey(key, buf, &ds);
+    }
+    hPtr = Tcl_CreateHashEntry(tablePtr, key, &new);
+    if (new) {
+	Tcl_SetHashValue(hPtr, INT2PTR(i));
+    }
+    Ns_DStringFree(&ds);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * LowerKey --
+ *
+ *	Copy a key in lowercase to the given buffer of KEY_SIZE
+ *	bytes or, if longer, the given dstring.
+ *
+ * Results:
+ *	Pointer to lowercase key.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+LowerKey(char *key, char *buf, Ns_DString *dsPtr)
+{
+    size_t len;
+
+    len = strlen(key);
+    if (len < KEY_SIZE) {
+	memcpy(buf, key, len + 1);
+    } else {
+	buf = Ns_DStringNAppend(dsPtr, key, (int) len);
+    }
+    return Ns_StrToLower(buf);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsSetFreeIndex --
+ *
+ *	Free the key index of a set, if any, e.g., after keys are
+ *	modified in place.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Index will be rebuilt on the next lookup of a large set.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsSetFreeIndex(Ns_Set *set)
+{
+    Set *setPtr = (Set *) set;
+    int which;
+
+    for (which = INDEX_KEYS; which <= INDEX_IKEYS; ++which) {
+	if (setPtr->index[which] != NULL) {
+	    Tcl_DeleteHashTable(setPtr->index[which]);
+	    ns_free(setPtr->index[which]);
+	    setPtr->index[which] = NULL;
+	}
+    }
+}
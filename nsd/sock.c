@@ -214,6 +214,88 @@ Ns_SockListenEx(char *address, int port, int backlog)
     return sock;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsSockListenReusePort --
+ *
+ *	Listen on a new TCP socket with SO_REUSEPORT set so several
+ *	driver threads may each listen on the same address and port.
+ *	Pre-bound sockets are not used.  IPv4 only, as with
+ *	Ns_SockListenEx.
+ *
+ * Results:
+ *	A socket or INVALID_SOCKET on error, including when
+ *	SO_REUSEPORT is not supported.
+ *
+ * Side effects:
+ *	The kernel will distribute new connections among all sockets
+ *	listening on the address.
+ *
+ *----------------------------------------------------------------------
+ */
+
+SOCKET
+NsSockListenReusePort(char *address, int port, int backlog)
+{
+#ifdef SO_REUSEPORT
+    SOCKET sock;
+    struct sockaddr_in sa;
+    int n;
+
+    if (Ns_GetSockAddr(&sa, address, port) != NS_OK) {
+	return INVALID_SOCKET;
+    }
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock != INVALID_SOCKET) {
+	sock = SockSetup(sock);
+    }
+    if (sock != INVALID_SOCKET) {
+	n = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *) &n, sizeof(n));
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (char *) &n,
+		       sizeof(n)) != 0
+		|| bind(sock, (struct sockaddr *) &sa, sizeof(sa)) != 0
+		|| listen(sock, backlog) != 0) {
+	    ns_sockclose(sock);
+	    sock = INVALID_SOCKET;
+	}
+    }
+    return sock;
+#else
+    errno = ENOTSUP;
+    return INVALID_SOCKET;
+#endif
+}
+
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsSockCork --
+ *
+ *	Set or clear TCP_CORK so headers and content sent separately,
+ *	e.g., with sendfile, are coalesced into full packets.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Clearing the option flushes any partial packet.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsSockCork(SOCKET sock, int cork)
+{
+#ifdef TCP_CORK
+    setsockopt(sock, IPPROTO_TCP, TCP_CORK, (char *) &cork, sizeof(cork));
+#endif
+}
+
 
 /*
  *----------------------------------------------------------------------
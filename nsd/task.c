@@ -38,13 +38,16 @@ static const char *RCSID = "@(#) $Header$, compiled: " __DATE__ " " __TIME__;
 #include "nsd.h"
 
 /*
- * The following defines a task queue.
+ * The following defines a task queue thread.  A queue created with
+ * more than one thread is a list of these linked by nextThreadPtr,
+ * the first of which is the queue handle.
  */
 
 #define NAME_SIZE 31
 
 typedef struct TaskQueue {
     struct TaskQueue *nextPtr;	  /* Next in list of all queues. */
+    struct TaskQueue *nextThreadPtr; /* Next thread of same queue. */
     struct Task  *firstSignalPtr; /* First in list of task signals. */
     Ns_Thread	  tid;		  /* Thread id. */
     Ns_Mutex	  lock;		  /* Queue list and signal lock. */
@@ -52,6 +55,14 @@ typedef struct TaskQueue {
     int		  shutdown;	  /* Shutdown flag. */
     int		  stopped;	  /* Stop flag. */
     SOCKET	  trigger[2];	  /* Trigger pipe. */
+    int		  epfd;		  /* Persistent epoll set or -1 for poll. */
+    int		  id;		  /* Thread number within queue. */
+    int		  nthreads;	  /* Number of threads in queue. */
+    int		  ntasks;	  /* Tasks currently assigned. */
+    unsigned long ndone;	  /* Tasks completed. */
+    unsigned long nloops;	  /* Event loop iterations. */
+    Ns_Time	  busy;		  /* Time spent outside poll. */
+    Ns_Time	  maxloop;	  /* Longest single iteration. */
     char	  name[NAME_SIZE+1]; /* String name. */
 } TaskQueue;
 
@@ -67,6 +78,18 @@ typedef struct TaskQueue {
 #define TASK_DONE			0x10
 #define TASK_PENDING		0x20
 
+/*
+ * The following defines a thread waiting in Ns_TaskWaitList for
+ * some number of tasks to complete.
+ */
+
+typedef struct TaskWaiter {
+    Ns_Mutex	  lock;		  /* Lock for counts. */
+    Ns_Cond	  cond;		  /* Signalled when enough tasks done. */
+    int		  ndone;	  /* Tasks completed while waiting. */
+    int		  nwait;	  /* Completions needed, -1 while setup. */
+} TaskWaiter;
+
 /*
  * The following defines a task.
  */
@@ -83,6 +106,9 @@ typedef struct Task {
     Ns_Time	  timeout;	  /* Non-null timeout data. */
     int		  signal;	  /* Signal bits sent to/from queue thread. */
     int		  flags;	  /* Flags private to queue. */
+    TaskWaiter   *waiterPtr;	  /* Ns_TaskWaitList waiter, if any. */
+    int		  epevents;	  /* Events registered in epoll set. */
+    int		  revents;	  /* Events returned by epoll. */
 } Task;
 
 /*
@@ -95,6 +121,9 @@ static void StopQueue(TaskQueue *queuePtr);
 static int SignalQueue(Task *taskPtr, int bit);
 static Ns_ThreadProc TaskThread;
 static void RunTask(Task *taskPtr, int revents, Ns_Time *nowPtr);
+static void SignalWaiter(Task *taskPtr);
+static int EventSet(TaskQueue *queuePtr, Task *taskPtr, int events);
+static int EventWait(TaskQueue *queuePtr, Ns_Time *timeoutPtr);
 #define Call(tp,w) ((*((tp)->proc))((Ns_Task *)(tp),(tp)->sock,(tp)->arg,(w)))
 
 /*
@@ -139,20 +168,58 @@ static struct {
 Ns_TaskQueue *
 Ns_CreateTaskQueue(char *name)
 {
-    TaskQueue *queuePtr;
+    return Ns_CreateTaskQueueEx(name, 1);
+}
 
-    queuePtr = ns_calloc(1, sizeof(TaskQueue));
-    strncpy(queuePtr->name, name ? name : "", NAME_SIZE);
-    if (ns_sockpair(queuePtr->trigger) != 0) {
-	Ns_Fatal("queue: ns_sockpair() failed: %s",
-		 ns_sockstrerror(ns_sockerrno));
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CreateTaskQueueEx --
+ *
+ *	Create a new task queue run by one or more threads.  Tasks
+ *	are assigned to the thread with the fewest tasks when
+ *	enqueued.
+ *
+ * Results:
+ *	Handle to task queue.
+ *
+ * Side effects:
+ *	Will create nthreads task threads.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_TaskQueue *
+Ns_CreateTaskQueueEx(char *name, int nthreads)
+{
+    TaskQueue *queuePtr, *firstPtr, **nextPtrPtr;
+    int i;
+
+    if (nthreads < 1) {
+	nthreads = 1;
     }
+    firstPtr = NULL;
+    nextPtrPtr = &firstPtr;
     Ns_MutexLock(&lock);
-    queuePtr->nextPtr = firstQueuePtr;
-    firstQueuePtr = queuePtr;
-    Ns_ThreadCreate(TaskThread, queuePtr, 0, &queuePtr->tid);
+    for (i = 0; i < nthreads; ++i) {
+    	queuePtr = ns_calloc(1, sizeof(TaskQueue));
+    	strncpy(queuePtr->name, name ? name : "", NAME_SIZE);
+	queuePtr->id = i;
+	queuePtr->nthreads = nthreads;
+	queuePtr->epfd = -1;
+    	if (ns_sockpair(queuePtr->trigger) != 0) {
+	    Ns_Fatal("queue: ns_sockpair() failed: %s",
+		     ns_sockstrerror(ns_sockerrno));
+    	}
+    	queuePtr->nextPtr = firstQueuePtr;
+    	firstQueuePtr = queuePtr;
+	*nextPtrPtr = queuePtr;
+	nextPtrPtr = &queuePtr->nextThreadPtr;
+    	Ns_ThreadCreate(TaskThread, queuePtr, 0, &queuePtr->tid);
+    }
     Ns_MutexUnlock(&lock);
-    return (Ns_TaskQueue *) queuePtr;
+    return (Ns_TaskQueue *) firstPtr;
 }
 
 
@@ -175,27 +242,38 @@ Ns_CreateTaskQueue(char *name)
 void
 Ns_DestroyTaskQueue(Ns_TaskQueue *queue)
 {
-    TaskQueue *queuePtr = (TaskQueue *) queue;
+    TaskQueue *queuePtr, *nextPtr;
     TaskQueue **nextPtrPtr;
 
     /*
-     * Remove queue from list of all queues.
+     * Remove queue threads from list of all queues.
      */
 
     Ns_MutexLock(&lock);
-    nextPtrPtr = &firstQueuePtr;
-    while (*nextPtrPtr != queuePtr) {
-	nextPtrPtr = &(*nextPtrPtr)->nextPtr;
+    for (queuePtr = (TaskQueue *) queue; queuePtr != NULL;
+	    queuePtr = queuePtr->nextThreadPtr) {
+    	nextPtrPtr = &firstQueuePtr;
+    	while (*nextPtrPtr != queuePtr) {
+	    nextPtrPtr = &(*nextPtrPtr)->nextPtr;
+    	}
+    	*nextPtrPtr = queuePtr->nextPtr;
     }
-    *nextPtrPtr = queuePtr->nextPtr;
     Ns_MutexUnlock(&lock);
 
     /*
      * Signal stop and wait for join.
      */
 
-    StopQueue(queuePtr);
-    JoinQueue(queuePtr);
+    for (queuePtr = (TaskQueue *) queue; queuePtr != NULL;
+	    queuePtr = queuePtr->nextThreadPtr) {
+    	StopQueue(queuePtr);
+    }
+    queuePtr = (TaskQueue *) queue;
+    while (queuePtr != NULL) {
+	nextPtr = queuePtr->nextThreadPtr;
+    	JoinQueue(queuePtr);
+	queuePtr = nextPtr;
+    }
 }
 
 
@@ -249,7 +327,20 @@ Ns_TaskEnqueue(Ns_Task *task, Ns_TaskQueue *queue)
 {
     Task *taskPtr = (Task *) task;
     TaskQueue *queuePtr = (TaskQueue *) queue;
+    TaskQueue *threadPtr;
+
+    /*
+     * Assign the task to the least loaded thread.  NB: Counts are
+     * read without locking and may be slightly stale.
+     */
 
+    threadPtr = queuePtr->nextThreadPtr;
+    while (threadPtr != NULL) {
+	if (threadPtr->ntasks < queuePtr->ntasks) {
+	    queuePtr = threadPtr;
+	}
+	threadPtr = threadPtr->nextThreadPtr;
+    }
     taskPtr->queuePtr = queuePtr;
     if (!SignalQueue(taskPtr, TASK_INIT)) {
 	return NS_ERROR;
@@ -375,6 +466,141 @@ Ns_TaskWait(Ns_Task *task, Ns_Time *timeoutPtr)
     return status;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_TaskWaitList --
+ *
+ *	Wait for any or all of a list of tasks to complete.  Unlike
+ *	repeated calls to Ns_TaskWait, the caller is woken once, when
+ *	the first (any) or last (all) task completes or the absolute
+ *	timeout expires.  Infinite wait is indicated by a NULL
+ *	timeoutPtr.
+ *
+ * Results:
+ *	NS_OK if any or all tasks completed, NS_TIMEOUT otherwise.
+ *	Use Ns_TaskCompleted to check individual tasks.
+ *
+ * Side effects:
+ *	May wait up to specified timeout.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ns_TaskWaitList(Ns_Task **tasks, int ntasks, int all, Ns_Time *timeoutPtr)
+{
+    TaskWaiter waiter;
+    Task *taskPtr;
+    TaskQueue *queuePtr;
+    int i, ndone, npending, status;
+
+    Ns_MutexInit(&waiter.lock);
+    Ns_CondInit(&waiter.cond);
+    waiter.ndone = 0;
+    waiter.nwait = -1;
+
+    /*
+     * Register with each pending task so the queue thread
+     * counts completions.
+     */
+
+    ndone = npending = 0;
+    for (i = 0; i < ntasks; ++i) {
+	taskPtr = (Task *) tasks[i];
+	queuePtr = taskPtr->queuePtr;
+	if (queuePtr == NULL) {
+	    if (taskPtr->signal & TASK_DONE) {
+		++ndone;
+	    }
+	    continue;
+	}
+	Ns_MutexLock(&queuePtr->lock);
+	if (taskPtr->signal & TASK_DONE) {
+	    ++ndone;
+	} else {
+	    taskPtr->waiterPtr = &waiter;
+	    ++npending;
+	}
+	Ns_MutexUnlock(&queuePtr->lock);
+    }
+
+    /*
+     * Wait for the first or all remaining pending tasks.
+     */
+
+    status = NS_OK;
+    Ns_MutexLock(&waiter.lock);
+    if (npending > 0 && (all || ndone == 0)) {
+	waiter.nwait = all ? npending : 1;
+	while (status == NS_OK && waiter.ndone < waiter.nwait) {
+	    status = Ns_CondTimedWait(&waiter.cond, &waiter.lock, timeoutPtr);
+	}
+    }
+    Ns_MutexUnlock(&waiter.lock);
+
+    /*
+     * Unregister from tasks still pending and count completed tasks.
+     */
+
+    ndone = 0;
+    for (i = 0; i < ntasks; ++i) {
+	taskPtr = (Task *) tasks[i];
+	queuePtr = taskPtr->queuePtr;
+	if (queuePtr != NULL) {
+	    Ns_MutexLock(&queuePtr->lock);
+	    if (taskPtr->waiterPtr == &waiter) {
+	    	taskPtr->waiterPtr = NULL;
+	    }
+	    Ns_MutexUnlock(&queuePtr->lock);
+	}
+	if (Ns_TaskCompleted(tasks[i])) {
+	    ++ndone;
+	}
+    }
+    Ns_CondDestroy(&waiter.cond);
+    Ns_MutexDestroy(&waiter.lock);
+    if (all ? (ndone < ntasks) : (ndone == 0)) {
+	return NS_TIMEOUT;
+    }
+    return NS_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_TaskCompleted --
+ *
+ *	Check if a task has completed without waiting.
+ *
+ * Results:
+ *	1 if task is done, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ns_TaskCompleted(Ns_Task *task)
+{
+    Task *taskPtr = (Task *) task;
+    TaskQueue *queuePtr = taskPtr->queuePtr;
+    int done;
+
+    if (queuePtr == NULL) {
+	done = (taskPtr->signal & TASK_DONE);
+    } else {
+	Ns_MutexLock(&queuePtr->lock);
+	done = (taskPtr->signal & TASK_DONE);
+	Ns_MutexUnlock(&queuePtr->lock);
+    }
+    return (done ? 1 : 0);
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -656,6 +882,9 @@ SignalQueue(Task *taskPtr, int bit)
 	 */
 
 	taskPtr->signal |= bit;
+	if (bit == TASK_INIT) {
+	    ++queuePtr->ntasks;
+	}
     	pending = (taskPtr->signal & TASK_PENDING);
     	if (!pending) {
 	    taskPtr->signal |= TASK_PENDING;
@@ -673,6 +902,39 @@ SignalQueue(Task *taskPtr, int bit)
     return 1;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SignalWaiter --
+ *
+ *	Count a completed task for an Ns_TaskWaitList waiter.  Must
+ *	be called with the queue lock held.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Waiter is woken when its last needed task completes.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SignalWaiter(Task *taskPtr)
+{
+    TaskWaiter *waiterPtr = taskPtr->waiterPtr;
+
+    if (waiterPtr != NULL) {
+	taskPtr->waiterPtr = NULL;
+	Ns_MutexLock(&waiterPtr->lock);
+	if (++waiterPtr->ndone == waiterPtr->nwait) {
+	    Ns_CondSignal(&waiterPtr->cond);
+	}
+	Ns_MutexUnlock(&waiterPtr->lock);
+    }
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -749,6 +1011,9 @@ JoinQueue(TaskQueue *queuePtr)
     Ns_ThreadJoin(&queuePtr->tid, NULL);
     ns_sockclose(queuePtr->trigger[0]);
     ns_sockclose(queuePtr->trigger[1]);
+    if (queuePtr->epfd >= 0) {
+	close(queuePtr->epfd);
+    }
     Ns_MutexDestroy(&queuePtr->lock);
     ns_free(queuePtr);
 }
@@ -775,28 +1040,67 @@ TaskThread(void *arg)
 {
     TaskQueue	 *queuePtr = arg;
     char          c;
-    int           n, broadcast, max, nfds, shutdown;
+    int           n, broadcast, max, nfds, shutdown, ready, epoll;
     Task	 *taskPtr, *nextPtr, *firstWaitPtr;
     struct pollfd *pfds;
-    Ns_Time	  now, *timeoutPtr;
-    char	  name[NAME_SIZE+10];
-
-    sprintf(name, "task:%s", queuePtr->name);
+    Ns_Time	  now, start, end, loop, diff, *timeoutPtr;
+    char	  name[NAME_SIZE+20];
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event ev;
+#endif
+
+    if (queuePtr->nthreads > 1) {
+    	sprintf(name, "task:%s:%d", queuePtr->name, queuePtr->id);
+    } else {
+    	sprintf(name, "task:%s", queuePtr->name);
+    }
     Ns_ThreadSetName(name);
     Ns_Log(Notice, "starting");
 
+    /*
+     * Create the persistent epoll set, if available, with the
+     * trigger pipe.
+     */
+
+#ifdef HAVE_SYS_EPOLL_H
+    queuePtr->epfd = epoll_create(100);
+    if (queuePtr->epfd < 0) {
+	Ns_Log(Warning, "epoll_create() failed, using poll: %s",
+	       strerror(errno));
+    } else {
+	Ns_CloseOnExec(queuePtr->epfd);
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(queuePtr->epfd, EPOLL_CTL_ADD, queuePtr->trigger[0],
+		      &ev) != 0) {
+	    Ns_Log(Warning, "epoll_ctl() failed, using poll: %s",
+		   strerror(errno));
+	    close(queuePtr->epfd);
+	    queuePtr->epfd = -1;
+	}
+    }
+#endif
+
     max = 100;
     pfds = ns_malloc(sizeof(struct pollfd) * max);
     firstWaitPtr = NULL;
+    loop.sec = loop.usec = 0;
 
     while (1) {
+	Ns_GetTime(&start);
 
 	/*
-	 * Get the shutdown flag and process any incoming signals.
+	 * Get the shutdown flag, update stats of the last iteration
+	 * and process any incoming signals.
 	 */
 
     	Ns_MutexLock(&queuePtr->lock);
 	shutdown = queuePtr->shutdown;
+	++queuePtr->nloops;
+	Ns_IncrTime(&queuePtr->busy, loop.sec, loop.usec);
+	if (Ns_DiffTime(&loop, &queuePtr->maxloop, NULL) > 0) {
+	    queuePtr->maxloop = loop;
+	}
 	while ((taskPtr = queuePtr->firstSignalPtr) != NULL) {
 	    queuePtr->firstSignalPtr = taskPtr->nextSignalPtr;
 	    taskPtr->nextSignalPtr = NULL;
@@ -819,7 +1123,7 @@ TaskThread(void *arg)
 
 	/*
 	 * Invoke pre-poll callbacks, determine minimum timeout, and set
-	 * the pollfd structs for all waiting tasks.
+	 * the pollfd structs or epoll events for all waiting tasks.
 	 */
 
     	pfds[0].fd = queuePtr->trigger[0];
@@ -830,6 +1134,8 @@ TaskThread(void *arg)
 	taskPtr = firstWaitPtr;
 	firstWaitPtr = NULL;
 	broadcast = 0;
+	ready = 0;
+	epoll = (queuePtr->epfd >= 0);
 	while (taskPtr != NULL) {
 	    nextPtr = taskPtr->nextWaitPtr;
 	    
@@ -851,20 +1157,43 @@ TaskThread(void *arg)
 	    }
 	    if (taskPtr->flags & TASK_DONE) {
 		taskPtr->flags &= ~(TASK_DONE|TASK_WAIT);
+
+		/*
+		 * NB: Remove from epoll set before signalling done as
+		 * the socket may then be closed or reused.
+		 */
+
+		EventSet(queuePtr, taskPtr, 0);
     		Ns_MutexLock(&queuePtr->lock);
+		if (!(taskPtr->signal & TASK_DONE)) {
+		    /* NB: Not counted again on cancel after done. */
+		    --queuePtr->ntasks;
+		    ++queuePtr->ndone;
+		}
     		taskPtr->signal |= TASK_DONE;
+		SignalWaiter(taskPtr);
     		Ns_MutexUnlock(&queuePtr->lock);
 		broadcast = 1;
 	    }
-	    if (taskPtr->flags & TASK_WAIT) {
-		if (max <= nfds) {
-	    	    max  = nfds + 100;
-	    	    pfds = ns_realloc(pfds, (size_t) max);
+	    if (!(taskPtr->flags & TASK_WAIT)) {
+		EventSet(queuePtr, taskPtr, 0);
+	    } else {
+		if (epoll) {
+		    taskPtr->revents = 0;
+		    if (!EventSet(queuePtr, taskPtr, taskPtr->events)) {
+			ready = 1;
+		    }
+		} else {
+		    if (max <= nfds) {
+	    	    	max  = nfds + 100;
+	    	    	pfds = ns_realloc(pfds, sizeof(struct pollfd) * max);
+		    }
+	    	    taskPtr->idx = nfds;
+	    	    pfds[nfds].fd = taskPtr->sock;
+	    	    pfds[nfds].events = taskPtr->events;
+	    	    pfds[nfds].revents = 0;
+		    ++nfds;
 		}
-	    	taskPtr->idx = nfds;
-	    	pfds[nfds].fd = taskPtr->sock;
-	    	pfds[nfds].events = taskPtr->events;
-	    	pfds[nfds].revents = 0;
 	    	if ((taskPtr->flags & TASK_TIMEOUT) && (timeoutPtr == NULL
 			|| Ns_DiffTime(&taskPtr->timeout,
 				       timeoutPtr, NULL) < 0)) {
@@ -872,7 +1201,6 @@ TaskThread(void *arg)
 	    	}
 		taskPtr->nextWaitPtr = firstWaitPtr;
 		firstWaitPtr = taskPtr;
-		++nfds;
 	    }
 	    taskPtr = nextPtr;
         }
@@ -897,10 +1225,20 @@ TaskThread(void *arg)
 	 * Poll sockets and drain the trigger pipe if necessary.
 	 */
 
-	n = NsPoll(pfds, nfds, timeoutPtr);
-	if ((pfds[0].revents & POLLIN) && recv(pfds[0].fd, &c, 1, 0) != 1) {
-	    Ns_Fatal("queue: trigger read() failed: %s",
-		      ns_sockstrerror(ns_sockerrno));
+	Ns_GetTime(&end);
+	Ns_DiffTime(&end, &start, &loop);
+	if (ready) {
+	    timeoutPtr = &end;
+	}
+	if (epoll) {
+	    EventWait(queuePtr, timeoutPtr);
+	} else {
+	    n = NsPoll(pfds, nfds, timeoutPtr);
+	    if ((pfds[0].revents & POLLIN)
+		    && recv(pfds[0].fd, &c, 1, 0) != 1) {
+	    	Ns_Fatal("queue: trigger read() failed: %s",
+		      	  ns_sockstrerror(ns_sockerrno));
+	    }
 	}
 
     	/*
@@ -910,9 +1248,13 @@ TaskThread(void *arg)
 	Ns_GetTime(&now);
 	taskPtr = firstWaitPtr;
 	while (taskPtr != NULL) {
-	    RunTask(taskPtr, pfds[taskPtr->idx].revents, &now);
+	    n = epoll ? taskPtr->revents : pfds[taskPtr->idx].revents;
+	    RunTask(taskPtr, n, &now);
 	    taskPtr = taskPtr->nextWaitPtr;
         }
+	Ns_GetTime(&end);
+	Ns_DiffTime(&end, &now, &diff);
+	Ns_IncrTime(&loop, diff.sec, diff.usec);
     }
 
     Ns_Log(Notice, "shutdown pending");
@@ -934,11 +1276,186 @@ TaskThread(void *arg)
     Ns_MutexLock(&queuePtr->lock);
     while ((taskPtr = firstWaitPtr) != NULL) {
 	firstWaitPtr = taskPtr->nextWaitPtr;
+	EventSet(queuePtr, taskPtr, 0);
+	if (!(taskPtr->signal & TASK_DONE)) {
+	    --queuePtr->ntasks;
+	}
     	taskPtr->signal |= TASK_DONE;
+	SignalWaiter(taskPtr);
     }
     queuePtr->stopped = 1;
     Ns_MutexUnlock(&queuePtr->lock);
     Ns_CondBroadcast(&queuePtr->cond);
+    ns_free(pfds);
 
     Ns_Log(Notice, "shutdown complete");
 }
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EventSet --
+ *
+ *	Update the events registered for a task in the persistent
+ *	epoll set of a task queue thread, if any.  Zero events
+ *	removes the task.
+ *
+ * Results:
+ *	1 if updated, 0 if epoll_ctl() failed in which case the task
+ *	is marked ready for its callback to find the socket error.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+EventSet(TaskQueue *queuePtr, Task *taskPtr, int events)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event ev;
+    int op;
+
+    if (queuePtr->epfd < 0 || taskPtr->epevents == events) {
+	return 1;
+    }
+    if (events == 0) {
+	op = EPOLL_CTL_DEL;
+    } else if (taskPtr->epevents == 0) {
+	op = EPOLL_CTL_ADD;
+    } else {
+	op = EPOLL_CTL_MOD;
+    }
+
+    /*
+     * NB: Poll and epoll event bits are the same on Linux.
+     */
+
+    ev.events = events;
+    ev.data.ptr = taskPtr;
+    if (epoll_ctl(queuePtr->epfd, op, taskPtr->sock, &ev) != 0
+	    && op != EPOLL_CTL_DEL) {
+	Ns_Log(Warning, "queue: epoll_ctl() failed: %s", strerror(errno));
+	taskPtr->revents = events;
+	taskPtr->epevents = 0;
+	return 0;
+    }
+    taskPtr->epevents = events;
+#endif
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EventWait --
+ *
+ *	Wait for events on the persistent epoll set of a task queue
+ *	thread until the given absolute timeout.
+ *
+ * Results:
+ *	Number of ready events or -1 on error.
+ *
+ * Side effects:
+ *	Sets revents of ready tasks and drains the trigger pipe.
+ *	On error, the epoll set is closed and the thread uses poll
+ *	from the next iteration.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+EventWait(TaskQueue *queuePtr, Ns_Time *timeoutPtr)
+{
+    int n = 0;
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event events[100];
+    Task *taskPtr;
+    Ns_Time now, diff;
+    char c;
+    int i, ms;
+
+    if (timeoutPtr == NULL) {
+	ms = -1;
+    } else {
+	Ns_GetTime(&now);
+	if (Ns_DiffTime(timeoutPtr, &now, &diff) <= 0) {
+	    ms = 0;
+	} else {
+	    ms = diff.sec * 1000 + (diff.usec + 999) / 1000;
+	}
+    }
+    do {
+	n = epoll_wait(queuePtr->epfd, events, 100, ms);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+	Ns_Log(Error, "queue: epoll_wait() failed, using poll: %s",
+	       strerror(errno));
+	Ns_MutexLock(&queuePtr->lock);
+	close(queuePtr->epfd);
+	queuePtr->epfd = -1;
+	Ns_MutexUnlock(&queuePtr->lock);
+    }
+    for (i = 0; i < n; ++i) {
+	taskPtr = events[i].data.ptr;
+	if (taskPtr == NULL) {
+	    if (recv(queuePtr->trigger[0], &c, 1, 0) != 1) {
+	    	Ns_Fatal("queue: trigger read() failed: %s",
+		      	  ns_sockstrerror(ns_sockerrno));
+	    }
+	} else {
+	    taskPtr->revents |= (events[i].events
+				 & (POLLIN|POLLOUT|POLLPRI|POLLHUP));
+	    if (events[i].events & EPOLLERR) {
+		taskPtr->revents |= taskPtr->events;
+	    }
+	}
+    }
+#endif
+    return n;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsGetTaskQueues --
+ *
+ *	Append info on each task queue thread for ns_info taskqueues.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsGetTaskQueues(Tcl_DString *dsPtr)
+{
+    TaskQueue *queuePtr;
+    char buf[200];
+
+    Ns_MutexLock(&lock);
+    for (queuePtr = firstQueuePtr; queuePtr != NULL;
+	    queuePtr = queuePtr->nextPtr) {
+	Tcl_DStringStartSublist(dsPtr);
+	Tcl_DStringAppendElement(dsPtr, queuePtr->name);
+	Ns_MutexLock(&queuePtr->lock);
+	sprintf(buf, "%d %s %d %lu %lu %ld.%06ld %ld.%06ld", queuePtr->id,
+		queuePtr->epfd >= 0 ? "epoll" : "poll",
+		queuePtr->ntasks, queuePtr->ndone, queuePtr->nloops,
+		(long) queuePtr->busy.sec, queuePtr->busy.usec,
+		(long) queuePtr->maxloop.sec, queuePtr->maxloop.usec);
+	Ns_MutexUnlock(&queuePtr->lock);
+	Tcl_DStringAppend(dsPtr, " ", 1);
+	Tcl_DStringAppend(dsPtr, buf, -1);
+	Tcl_DStringEndSublist(dsPtr);
+    }
+    Ns_MutexUnlock(&lock);
+}
@@ -153,6 +153,7 @@ NsTclCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	CAppendIdx, CLappendIdx, CFlushIdx
     } opt;
     TclCache *cachePtr;
+    Ns_Cache *cache;
     Val *valPtr;
     int i, cur, err, new, status;
     char *key, *pattern, *var;
@@ -249,8 +250,9 @@ NsTclCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	}
 	valPtr = NULL;
 	key = Tcl_GetString(objv[3]);
-	Ns_CacheLock(cachePtr->cache);
-	entry = Ns_CacheFindEntry(cachePtr->cache, key);
+	cache = Ns_CacheShard(cachePtr->cache, key);
+	Ns_CacheLock(cache);
+	entry = Ns_CacheFindEntry(cache, key);
 	if (entry != NULL
 		&& (valPtr = Ns_CacheGetValue(entry)) != NULL
 		&& Expired(cachePtr, valPtr, &now)) {
@@ -261,7 +263,7 @@ NsTclCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	    var = (objc < 5 ? NULL : Tcl_GetString(objv[4]));
 	    err = SetResult(interp, valPtr, var);
 	}
-	Ns_CacheUnlock(cachePtr->cache);
+	Ns_CacheUnlock(cache);
 	if (err) {
 	    return TCL_ERROR;
 	} else if (objc == 5) {
@@ -283,10 +285,11 @@ NsTclCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	}
 	valPtr = NewVal(cachePtr, objv[4], &now);
 	key = Tcl_GetString(objv[3]);
-	Ns_CacheLock(cachePtr->cache);
-	entry = Ns_CacheCreateEntry(cachePtr->cache, key, &new);
+	cache = Ns_CacheShard(cachePtr->cache, key);
+	Ns_CacheLock(cache);
+	entry = Ns_CacheCreateEntry(cache, key, &new);
 	Ns_CacheSetValueSz(entry, valPtr, valPtr->length);
-	Ns_CacheUnlock(cachePtr->cache);
+	Ns_CacheUnlock(cache);
 	Tcl_SetObjResult(interp, objv[4]);
 	break;
 
@@ -307,8 +310,9 @@ NsTclCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	}
 	err = 0;
 	key = Tcl_GetString(objv[3]);
-	Ns_CacheLock(cachePtr->cache);
-	entry = Ns_CacheCreateEntry(cachePtr->cache, key, &new);
+	cache = Ns_CacheShard(cachePtr->cache, key);
+	Ns_CacheLock(cache);
+	entry = Ns_CacheCreateEntry(cache, key, &new);
 	if (!new
 		&& (valPtr = Ns_CacheGetValue(entry)) != NULL
 		&& Expired(cachePtr, valPtr, &now)) {
@@ -328,7 +332,7 @@ NsTclCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	    valPtr = NewVal(cachePtr, objPtr, &now);
 	    Ns_CacheSetValueSz(entry, valPtr, valPtr->length);
 	}
-	Ns_CacheUnlock(cachePtr->cache);
+	Ns_CacheUnlock(cache);
 	if (err) {
 	    return TCL_ERROR;
 	}
@@ -347,9 +351,10 @@ NsTclCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	}
 	err = 0;
 	key = Tcl_GetString(objv[3]);
+	cache = Ns_CacheShard(cachePtr->cache, key);
 	objPtr = Tcl_NewObj();
-	Ns_CacheLock(cachePtr->cache);
-	entry = Ns_CacheCreateEntry(cachePtr->cache, key, &new);
+	Ns_CacheLock(cache);
+	entry = Ns_CacheCreateEntry(cache, key, &new);
 	if (!new) {
 	    valPtr = Ns_CacheGetValue(entry);
 	    if (valPtr == NULL) {
@@ -372,7 +377,7 @@ NsTclCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	    valPtr = NewVal(cachePtr, objPtr, &now);
 	    Ns_CacheSetValueSz(entry, valPtr, valPtr->length);
 	}
-	Ns_CacheUnlock(cachePtr->cache);
+	Ns_CacheUnlock(cache);
 	if (err) {
 	    return TCL_ERROR;
 	}
@@ -393,8 +398,9 @@ NsTclCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	}
         status = TCL_OK;
 	key = Tcl_GetString(objv[3]);
-	Ns_CacheLock(cachePtr->cache);
-	entry = Ns_CacheCreateEntry(cachePtr->cache, key, &new);
+	cache = Ns_CacheShard(cachePtr->cache, key);
+	Ns_CacheLock(cache);
+	entry = Ns_CacheCreateEntry(cache, key, &new);
 	if (!new && (valPtr = Ns_CacheGetValue(entry)) == NULL) {
 	    /*
 	     * Wait for another thread to complete an update.
@@ -404,9 +410,9 @@ NsTclCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	    timeout = now;
 	    Ns_IncrTime(&timeout, cachePtr->wait.sec, cachePtr->wait.usec);
 	    do {
-	    	status = Ns_CacheTimedWait(cachePtr->cache, &timeout);
+	    	status = Ns_CacheTimedWait(cache, &timeout);
 	    } while (status == NS_OK
-		&& (entry = Ns_CacheFindEntry(cachePtr->cache, key)) != NULL
+		&& (entry = Ns_CacheFindEntry(cache, key)) != NULL
 		&& (valPtr = Ns_CacheGetValue(entry)) == NULL);
 	    if (entry == NULL) {
 		Tcl_AppendResult(interp, "update failed: ", key, NULL);
@@ -435,10 +441,10 @@ NsTclCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 		 * Refresh the entry.
 		 */
 
-	    	Ns_CacheUnlock(cachePtr->cache);
+	    	Ns_CacheUnlock(cache);
 	    	status = Tcl_EvalObjEx(interp, objv[4], 0);
-	    	Ns_CacheLock(cachePtr->cache);
-		entry = Ns_CacheCreateEntry(cachePtr->cache, key, &new);
+	    	Ns_CacheLock(cache);
+		entry = Ns_CacheCreateEntry(cache, key, &new);
 
 	    	if (status == TCL_OK || status == TCL_RETURN) {
 		    objPtr = Tcl_GetObjResult(interp);
@@ -451,10 +457,10 @@ NsTclCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 		} else {
 		    Ns_CacheFlushEntry(entry);
 	    	}
-	    	Ns_CacheBroadcast(cachePtr->cache);
+	    	Ns_CacheBroadcast(cache);
 	    }
 	}
-	Ns_CacheUnlock(cachePtr->cache);
+	Ns_CacheUnlock(cache);
 	if (err) {
 	    return TCL_ERROR;
 	}
@@ -485,16 +491,18 @@ NsTclCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 static int
 CreateCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 {
-    int i, new, size, expires;
+    int i, new, size, expires, shards, policy;
     Ns_Time ttl, wait;
     Tcl_HashEntry *hPtr;
     TclCache *cachePtr;
     char *cache;
     static CONST char *flags[] = {
-	"-timeout", "-size", "-thread", "-server", "-maxwait", NULL
+	"-timeout", "-size", "-thread", "-server", "-maxwait", "-shards",
+	"-policy", NULL
     };
     enum {
-	FTimeoutIdx, FSizeIdx, FThreadIdx, FServerIdx, FWaitIdx
+	FTimeoutIdx, FSizeIdx, FThreadIdx, FServerIdx, FWaitIdx, FShardsIdx,
+	FPolicyIdx
     } flag;
 
     if (objc < 3 || !(objc & 1)) {
@@ -507,6 +515,8 @@ CreateCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
     wait.usec = ttl.usec = 0;
     expires = 0;
     size = 1024 * 1000;
+    shards = 1;
+    policy = NS_CACHE_LRU;
     for (i = 3; i < objc; i += 2) {
 	if (Tcl_GetIndexFromObj(interp, objv[i], flags, "flag", 0,
 	 			(int *) &flag) != TCL_OK) {
@@ -537,6 +547,27 @@ CreateCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	    }
 	    break;
 
+	case FShardsIdx:
+	    if (Tcl_GetIntFromObj(interp, objv[i+1], &shards) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    if (shards < 1) {
+		Tcl_AppendResult(interp, "invalid shards: ", 
+				 Tcl_GetString(objv[i+1]), NULL);
+		return TCL_ERROR;
+	    }
+	    break;
+
+	case FPolicyIdx:
+	    policy = Ns_CacheGetPolicy(Tcl_GetString(objv[i+1]));
+	    if (policy < 0) {
+		Tcl_AppendResult(interp, "invalid policy: ",
+				 Tcl_GetString(objv[i+1]),
+				 ": should be lru, 2q, or tinylfu", NULL);
+		return TCL_ERROR;
+	    }
+	    break;
+
 	case FThreadIdx:
 	case FServerIdx:
 	    /* NB: Previous nscache options currently ignored. */
@@ -552,8 +583,9 @@ CreateCacheObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	cachePtr->ttl = ttl;
 	cachePtr->wait = wait;
 	cachePtr->expires = expires;
-	cachePtr->cache = Ns_CacheCreateSz(cache, TCL_STRING_KEYS,
-					   (size_t) size, ns_free);
+	cachePtr->cache = Ns_CacheCreateEx(cache, TCL_STRING_KEYS,
+					   (size_t) size, ns_free, shards,
+					   policy);
 	Tcl_SetHashValue(hPtr, cachePtr);
     }
     Ns_MutexUnlock(&lock);
@@ -49,6 +49,7 @@ extern Tcl_ObjCmdProc
     NsTclAdpBindArgsObjCmd,
     NsTclAdpBreakObjCmd,
     NsTclAdpCloseObjCmd,
+    NsTclAdpCompileObjCmd,
     NsTclAdpCompressObjCmd,
     NsTclAdpCtlObjCmd,
     NsTclAdpDirObjCmd,
@@ -83,6 +84,7 @@ extern Tcl_ObjCmdProc
     NsTclCryptObjCmd,
     NsTclDriverObjCmd,
     NsTclFTruncateObjCmd,
+    NsTclFilterStatsObjCmd,
     NsTclForObjCmd,
     NsTclForeachObjCmd,
     NsTclGetAddrObjCmd,
@@ -257,6 +259,7 @@ static Cmd cmds[] = {
     {"ns_adp_bind_args", NULL, NsTclAdpBindArgsObjCmd},
     {"ns_adp_break", NULL, NsTclAdpBreakObjCmd},
     {"ns_adp_close", NULL, NsTclAdpCloseObjCmd},
+    {"ns_adp_compile", NULL, NsTclAdpCompileObjCmd},
     {"ns_adp_compress", NULL, NsTclAdpCompressObjCmd},
     {"ns_adp_ctl", NULL, NsTclAdpCtlObjCmd},
     {"ns_adp_debug", NsTclAdpDebugCmd, NULL},
@@ -313,6 +316,7 @@ static Cmd cmds[] = {
     {"ns_encodingforcharset", NsTclEncodingForCharsetCmd, NULL},
     {"ns_env", NsTclEnvCmd, NULL},
     {"ns_event", NULL, NsTclCondObjCmd},
+    {"ns_filter_stats", NULL, NsTclFilterStatsObjCmd},
     {"ns_fmttime", NULL, NsTclStrftimeObjCmd},
     {"ns_for", NULL, NsTclForObjCmd},
     {"ns_foreach", NULL, NsTclForeachObjCmd},
@@ -50,8 +50,43 @@ typedef struct {
     Ns_Time stime;
     Ns_Time etime;
     Tcl_DString ds;
+    Tcl_DString req;		/* Request, kept for retry. */
+    char *key;			/* Keep-alive pool key, "host:port". */
+    char *host;			/* Host for reconnect on retry. */
+    int port;			/* Port for reconnect on retry. */
+    int head;			/* HEAD request, no response body. */
+    int retry;			/* Method may be retried, e.g., GET. */
+    int reused;			/* Socket was taken from keep-alive pool. */
+    int stale;			/* Reused socket closed before response. */
+    int keep;			/* Socket may be returned to pool. */
+    int done;			/* Response is complete. */
+    int hdrlen;			/* Length of response headers, if read. */
+    int length;			/* Content-Length or -1 if not given. */
+    int chunked;		/* Response uses chunked encoding. */
+    int chunk;			/* Offset of next chunk size line. */
+    int body;			/* Length of decoded chunked response. */
 } Http;
 
+/*
+ * The following structures maintain idle keep-alive sockets
+ * for each host:port, most recently used first.
+ */
+
+typedef struct HttpIdle {
+    struct HttpIdle *nextPtr;
+    SOCKET sock;
+    time_t expires;
+} HttpIdle;
+
+typedef struct HttpPool {
+    HttpIdle *firstPtr;
+    int nidle;
+    unsigned long nconnect;	/* New connections. */
+    unsigned long nreuse;	/* Requests on pooled sockets. */
+    unsigned long nretry;	/* Retries after a stale pooled socket. */
+    unsigned long nexpire;	/* Idle sockets timed out or closed. */
+} HttpPool;
+
 /*
  * Local functions defined in this file
  */
@@ -65,7 +100,20 @@ static char *HttpResult(Tcl_DString ds, int *statusPtr, Ns_Set *hdrs, Tcl_Obj **
 static void HttpClose(Http *httpPtr);
 static void HttpCancel(Http *httpPtr);
 static void HttpAbort(Http *httpPtr);
+static void HttpRetry(Http *httpPtr);
+static int HttpComplete(Http *httpPtr);
+static int HttpChunks(Http *httpPtr);
+static int MatchHeader(char *line, char *name, char **valuePtr);
 static int GetHttp(NsInterp *itPtr, Tcl_Obj *obj, Http **httpPtrPtr);
+static int HttpStatsCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv);
+static int HttpWaitListCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv,
+			   int all);
+static void PoolInit(void);
+static HttpPool *GetPool(char *key);
+static int SockAlive(SOCKET sock);
+static SOCKET PoolGet(char *key);
+static void PoolPut(char *key, SOCKET sock);
+static Ns_SchedProc PoolSweep;
 static Ns_TaskProc HttpProc;
 
 /*
@@ -73,6 +121,9 @@ static Ns_TaskProc HttpProc;
  */
  
 static Ns_TaskQueue *queue;
+static Ns_Mutex       poollock;
+static Tcl_HashTable  pools;
+static int	      poolsinit;
 
 
 /*
@@ -100,10 +151,10 @@ NsTclNHttpObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj *CONST ob
     Tcl_HashSearch search;
     int run = 0;
     static CONST char *opts[] = {
-       "cancel", "cleanup", "run", "queue", "wait", NULL
+       "cancel", "cleanup", "run", "queue", "stats", "wait", NULL
     };
     enum {
-        HCancelIdx, HCleanupIdx, HRunIdx, HQueueIdx, HWaitIdx
+        HCancelIdx, HCleanupIdx, HRunIdx, HQueueIdx, HStatsIdx, HWaitIdx
     } opt;
 
     if (objc < 2) {
@@ -127,6 +178,10 @@ NsTclNHttpObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj *CONST ob
 	return HttpWaitCmd(itPtr, objc, objv);
 	break;
 
+    case HStatsIdx:
+	return HttpStatsCmd(itPtr, objc, objv);
+	break;
+
     case HCancelIdx:
         if (objc != 2) {
             Tcl_WrongNumArgs(interp, 2, objv, "id");
@@ -242,7 +297,8 @@ HttpQueueCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv, int run)
 	if (queue == NULL) {
 	    Ns_MasterLock();
 	    if (queue == NULL) {
-		queue = Ns_CreateTaskQueue("tclhttp");
+		queue = Ns_CreateTaskQueueEx("tclhttp",
+					     nsconf.http.taskthreads);
 	    }
 	    Ns_MasterUnlock();
 	}
@@ -301,6 +357,12 @@ HttpWaitCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv)
         WElapsedIdx, WResultIdx, WHeadersIdx, WStatusIdx
     } opt;
 
+    if (objc > 2) {
+	arg = Tcl_GetString(objv[2]);
+	if (STREQ(arg, "-any") || STREQ(arg, "-all")) {
+	    return HttpWaitListCmd(itPtr, objc, objv, STREQ(arg, "-all"));
+	}
+    }
     for (i = 2; i < objc; ++i) {
 	arg = Tcl_GetString(objv[i]);
 	if (arg[0] != '-') {
@@ -344,6 +406,9 @@ HttpWaitCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv)
 	Tcl_AppendResult(interp, "timeout waiting for task", NULL);
 	return TCL_ERROR;
     }
+    if (httpPtr->stale && httpPtr->retry) {
+	HttpRetry(httpPtr);
+    }
     result = TCL_ERROR;
     if (elapsedPtr != NULL) {
     	Ns_DiffTime(&httpPtr->etime, &httpPtr->stime, &diff);
@@ -377,6 +442,123 @@ err:
     return result;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HttpWaitListCmd --
+ *
+ *	Implements "ns_http wait -any" and "ns_http wait -all" to wait
+ *	once for the first or all of a list of queued requests.
+ *
+ * Results:
+ *	Standard Tcl result.  Sets interp result to a list of id and
+ *	status, elapsed time and error, if any, for each completed
+ *	request, in the order given.
+ *
+ * Side effects:
+ *	Requests remain pending for "ns_http wait" to get results.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HttpWaitListCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv, int all)
+{
+    Tcl_Interp *interp = itPtr->interp;
+    Tcl_HashEntry *hPtr;
+    Tcl_Obj **idv, *listPtr, *infoPtr, *valPtr;
+    Ns_Time timeout, incr, diff, *timeoutPtr;
+    Ns_Task **tasks;
+    Http *httpPtr, **https;
+    char *arg;
+    int i, n, idc, major, minor, status;
+
+    timeoutPtr = NULL;
+    for (i = 3; i < objc; ++i) {
+	arg = Tcl_GetString(objv[i]);
+	if (arg[0] != '-') {
+	    break;
+	}
+	if (!STREQ(arg, "-timeout")) {
+	    Tcl_AppendResult(interp, "bad option \"", arg,
+			     "\": must be -timeout", NULL);
+	    return TCL_ERROR;
+	}
+	if (++i == objc) {
+	    Tcl_AppendResult(interp, "no argument given to ", arg, NULL);
+	    return TCL_ERROR;
+	}
+	if (Ns_TclGetTimeFromObj(interp, objv[i], &incr) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	Ns_GetTime(&timeout);
+	Ns_IncrTime(&timeout, incr.sec, incr.usec);
+	timeoutPtr = &timeout;
+    }
+    if ((objc - i) != 1) {
+        Tcl_WrongNumArgs(interp, 2, objv, "-any|-all ?-timeout t? idlist");
+        return TCL_ERROR;
+    }
+    if (Tcl_ListObjGetElements(interp, objv[i], &idc, &idv) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    https = ns_malloc(sizeof(Http *) * (idc + 1));
+    tasks = ns_malloc(sizeof(Ns_Task *) * (idc + 1));
+    for (n = 0; n < idc; ++n) {
+	arg = Tcl_GetString(idv[n]);
+	hPtr = Tcl_FindHashEntry(&itPtr->https, arg);
+	if (hPtr == NULL) {
+	    Tcl_AppendResult(interp, "no such request: ", arg, NULL);
+	    ns_free(https);
+	    ns_free(tasks);
+	    return TCL_ERROR;
+	}
+	https[n] = Tcl_GetHashValue(hPtr);
+	tasks[n] = https[n]->task;
+    }
+    (void) Ns_TaskWaitList(tasks, idc, all, timeoutPtr);
+
+    listPtr = Tcl_NewObj();
+    for (n = 0; n < idc; ++n) {
+	if (!Ns_TaskCompleted(tasks[n])) {
+	    continue;
+	}
+	httpPtr = https[n];
+	if (httpPtr->stale && httpPtr->retry) {
+	    Ns_TaskWait(httpPtr->task, NULL);
+	    HttpRetry(httpPtr);
+	}
+	status = 0;
+	if (httpPtr->error == NULL && sscanf(httpPtr->ds.string,
+		"HTTP/%d.%d %d", &major, &minor, &status) != 3) {
+	    status = 0;
+	}
+	infoPtr = Tcl_NewObj();
+	Tcl_ListObjAppendElement(interp, infoPtr,
+				 Tcl_NewStringObj("status", -1));
+	Tcl_ListObjAppendElement(interp, infoPtr, Tcl_NewIntObj(status));
+	Ns_DiffTime(&httpPtr->etime, &httpPtr->stime, &diff);
+	valPtr = Tcl_NewObj();
+	Ns_TclSetTimeObj(valPtr, &diff);
+	Tcl_ListObjAppendElement(interp, infoPtr,
+				 Tcl_NewStringObj("elapsed", -1));
+	Tcl_ListObjAppendElement(interp, infoPtr, valPtr);
+	if (httpPtr->error != NULL) {
+	    Tcl_ListObjAppendElement(interp, infoPtr,
+				     Tcl_NewStringObj("error", -1));
+	    Tcl_ListObjAppendElement(interp, infoPtr,
+				     Tcl_NewStringObj(httpPtr->error, -1));
+	}
+	Tcl_ListObjAppendElement(interp, listPtr, idv[n]);
+	Tcl_ListObjAppendElement(interp, listPtr, infoPtr);
+    }
+    ns_free(https);
+    ns_free(tasks);
+    Tcl_SetObjResult(interp, listPtr);
+    return TCL_OK;
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -462,10 +644,9 @@ int
 HttpConnect(Tcl_Interp *interp, char *method, char *url, Ns_Set *hdrs,
 	    Tcl_Obj *bodyPtr, Http **httpPtrPtr)
 {
-    Http *httpPtr = NULL;
-    SOCKET sock;
+    Http *httpPtr;
     char *body, *host, *file, *port;
-    int i, len;
+    int i, len, keep;
 
     if (strncmp(url, "http://", 7) != 0 || url[7] == '\0') {
 	Tcl_AppendResult(interp, "invalid url: ", url, NULL);
@@ -483,65 +664,89 @@ HttpConnect(Tcl_Interp *interp, char *method, char *url, Ns_Set *hdrs,
         *port = '\0';
         i = (int) strtol(port+1, NULL, 10);
     }
-    sock = Ns_SockAsyncConnect(host, i);
+    httpPtr = ns_calloc(1, sizeof(Http));
+    httpPtr->host = ns_strdup(host);
+    httpPtr->port = i;
+    httpPtr->key = ns_malloc(strlen(host) + 20);
+    sprintf(httpPtr->key, "%s:%d", host, i);
     if (port != NULL) {
         *port = ':';
     }
-    if (sock != INVALID_SOCKET) {
-        httpPtr = ns_malloc(sizeof(Http));
-        httpPtr->sock = sock;
-	    httpPtr->error = NULL;
-        Tcl_DStringInit(&httpPtr->ds);
-        if (file != NULL) {
-            *file = '/';
-        }
-        Ns_DStringAppend(&httpPtr->ds, method);
-        Ns_StrToUpper(Ns_DStringValue(&httpPtr->ds));
-        Ns_DStringVarAppend(&httpPtr->ds, " ", file ? file : "/",
-			    " HTTP/1.0\r\n", NULL);
-        if (file != NULL) {
-            *file = '\0';
-        }
-        Ns_DStringVarAppend(&httpPtr->ds,
-            "User-Agent: ", Ns_InfoServerName(), "/",
-			    Ns_InfoServerVersion(), "\r\n"
-            "Connection: close\r\n"
-            "Host: ", host, "\r\n", NULL);
-        if (file != NULL) {
-            *file = '/';
-        }
-        if (hdrs != NULL) {
-            for (i = 0; i < Ns_SetSize(hdrs); i++) {
-                Ns_DStringVarAppend(&httpPtr->ds,
-                    Ns_SetKey(hdrs, i), ": ",
-		            Ns_SetValue(hdrs, i), "\r\n", NULL);
-            }
-        }
-	    body = NULL;
-	    if (bodyPtr != NULL) {
-	        body = Tcl_GetByteArrayFromObj(bodyPtr, &len);
-	        if (len == 0) {
-		        body = NULL;
-	        }
-	    }
-        if (body != NULL) {
-            Ns_DStringPrintf(&httpPtr->ds, "Content-Length: %d\r\n", len);
-        }
-        Tcl_DStringAppend(&httpPtr->ds, "\r\n", 2);
-        if (body != NULL) {
-            Tcl_DStringAppend(&httpPtr->ds, body, len);
-        }
-        httpPtr->next = httpPtr->ds.string;
-        httpPtr->len = httpPtr->ds.length;
+    httpPtr->head = STRIEQ(method, "HEAD");
+    httpPtr->retry = httpPtr->head || STRIEQ(method, "GET")
+	|| STRIEQ(method, "OPTIONS");
+    keep = (nsconf.http.keepmax > 0);
+
+    /*
+     * Use an idle keep-alive socket for the host if available.
+     */
+
+    httpPtr->sock = INVALID_SOCKET;
+    if (keep) {
+	httpPtr->sock = PoolGet(httpPtr->key);
     }
-    if (file != NULL) {
-        *file = '/';
+    if (httpPtr->sock != INVALID_SOCKET) {
+	httpPtr->reused = 1;
+    } else {
+	httpPtr->sock = Ns_SockAsyncConnect(httpPtr->host, httpPtr->port);
     }
-    if (httpPtr == NULL) {
+    if (httpPtr->sock == INVALID_SOCKET) {
 	Tcl_AppendResult(interp, "connect to \"", url, "\" failed: ",
 	 		 ns_sockstrerror(ns_sockerrno), NULL);
+	if (file != NULL) {
+	    *file = '/';
+	}
+	ns_free(httpPtr->host);
+	ns_free(httpPtr->key);
+	ns_free(httpPtr);
 	return 0;
     }
+    httpPtr->error = NULL;
+    httpPtr->keep = keep;
+    httpPtr->length = -1;
+    Tcl_DStringInit(&httpPtr->ds);
+    Tcl_DStringInit(&httpPtr->req);
+    if (file != NULL) {
+	*file = '/';
+    }
+    Ns_DStringAppend(&httpPtr->req, method);
+    Ns_StrToUpper(Ns_DStringValue(&httpPtr->req));
+    Ns_DStringVarAppend(&httpPtr->req, " ", file ? file : "/",
+			keep ? " HTTP/1.1\r\n" : " HTTP/1.0\r\n", NULL);
+    if (file != NULL) {
+	*file = '\0';
+    }
+    Ns_DStringVarAppend(&httpPtr->req,
+	"User-Agent: ", Ns_InfoServerName(), "/",
+			Ns_InfoServerVersion(), "\r\n",
+	keep ? "" : "Connection: close\r\n",
+	"Host: ", host, "\r\n", NULL);
+    if (file != NULL) {
+	*file = '/';
+    }
+    if (hdrs != NULL) {
+	for (i = 0; i < Ns_SetSize(hdrs); i++) {
+	    Ns_DStringVarAppend(&httpPtr->req,
+		Ns_SetKey(hdrs, i), ": ",
+		Ns_SetValue(hdrs, i), "\r\n", NULL);
+	}
+    }
+    body = NULL;
+    if (bodyPtr != NULL) {
+	body = Tcl_GetByteArrayFromObj(bodyPtr, &len);
+	if (len == 0) {
+	    body = NULL;
+	}
+    }
+    if (body != NULL) {
+	Ns_DStringPrintf(&httpPtr->req, "Content-Length: %d\r\n", len);
+    }
+    Tcl_DStringAppend(&httpPtr->req, "\r\n", 2);
+    if (body != NULL) {
+	Tcl_DStringAppend(&httpPtr->req, body, len);
+    }
+    httpPtr->next = httpPtr->req.string;
+    httpPtr->len = httpPtr->req.length;
     *httpPtrPtr = httpPtr;
     return 1;
 }
@@ -624,9 +829,20 @@ HttpResult(Tcl_DString ds, int *statusPtr, Ns_Set *hdrs, Tcl_Obj **objPtrPtr)
 static void
 HttpClose(Http *httpPtr)
 {
-    Ns_TaskFree(httpPtr->task);
+    if (httpPtr->task != NULL) {
+	Ns_TaskFree(httpPtr->task);
+    }
+    if (httpPtr->sock != INVALID_SOCKET) {
+	if (httpPtr->keep && httpPtr->done && httpPtr->error == NULL) {
+	    PoolPut(httpPtr->key, httpPtr->sock);
+	} else {
+	    ns_sockclose(httpPtr->sock);
+	}
+    }
     Tcl_DStringFree(&httpPtr->ds);
-    ns_sockclose(httpPtr->sock);
+    Tcl_DStringFree(&httpPtr->req);
+    ns_free(httpPtr->host);
+    ns_free(httpPtr->key);
     ns_free(httpPtr);
 }
 
@@ -646,6 +862,56 @@ HttpAbort(Http *httpPtr)
     HttpClose(httpPtr);
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HttpRetry --
+ *
+ *	Retry a request on a new connection after a pooled keep-alive
+ *	socket was found closed by the peer before any response.
+ *	Only called for idempotent methods.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Runs the request again in the calling thread, within the
+ *	original timeout.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HttpRetry(Http *httpPtr)
+{
+    HttpPool *poolPtr;
+
+    Ns_TaskFree(httpPtr->task);
+    httpPtr->task = NULL;
+    ns_sockclose(httpPtr->sock);
+    httpPtr->sock = Ns_SockAsyncConnect(httpPtr->host, httpPtr->port);
+    Ns_MutexLock(&poollock);
+    poolPtr = GetPool(httpPtr->key);
+    ++poolPtr->nretry;
+    ++poolPtr->nconnect;
+    Ns_MutexUnlock(&poollock);
+    if (httpPtr->sock == INVALID_SOCKET) {
+	httpPtr->error = "connect failed";
+	return;
+    }
+    httpPtr->error = NULL;
+    httpPtr->reused = httpPtr->stale = httpPtr->done = 0;
+    httpPtr->hdrlen = httpPtr->chunked = httpPtr->chunk = httpPtr->body = 0;
+    httpPtr->length = -1;
+    httpPtr->keep = 1;
+    httpPtr->next = httpPtr->req.string;
+    httpPtr->len = httpPtr->req.length;
+    Tcl_DStringTrunc(&httpPtr->ds, 0);
+    httpPtr->task = Ns_TaskCreate(httpPtr->sock, HttpProc, httpPtr);
+    Ns_TaskRun(httpPtr->task);
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -681,12 +947,14 @@ HttpProc(Ns_Task *task, SOCKET sock, void *arg, int why)
     	n = send(sock, httpPtr->next, httpPtr->len, 0);
     	if (n < 0) {
 	    httpPtr->error = "send failed";
+	    httpPtr->stale = httpPtr->reused;
 	} else {
     	    httpPtr->next += n;
     	    httpPtr->len -= n;
     	    if (httpPtr->len == 0) {
-            	shutdown(sock, 1);
-            	Tcl_DStringTrunc(&httpPtr->ds, 0);
+		if (!httpPtr->keep) {
+            	    shutdown(sock, 1);
+		}
 	    	Ns_TaskCallback(task, NS_SOCK_READ, &httpPtr->timeout);
 	    }
 	    return;
@@ -697,11 +965,27 @@ HttpProc(Ns_Task *task, SOCKET sock, void *arg, int why)
     	n = recv(sock, buf, sizeof(buf), 0);
     	if (n > 0) {
             Tcl_DStringAppend(&httpPtr->ds, buf, n);
-	    return;
+	    if (!HttpComplete(httpPtr)) {
+	    	return;
+	    }
+	    httpPtr->done = 1;
+	    break;
+	}
+	if (httpPtr->chunked) {
+	    Tcl_DStringTrunc(&httpPtr->ds, httpPtr->body);
 	}
-	if (n < 0) {
+	if (httpPtr->ds.length == 0 && httpPtr->reused) {
+	    /* NB: Pooled socket closed by peer, may be retried. */
+	    httpPtr->error = "connection closed";
+	    httpPtr->stale = 1;
+	} else if (n < 0) {
 	    httpPtr->error = "recv failed";
+	} else if (httpPtr->hdrlen > 0
+		   && (httpPtr->chunked || httpPtr->length >= 0)) {
+	    /* NB: EOF before Content-Length bytes or last chunk. */
+	    httpPtr->error = "connection closed before end of response";
 	}
+	httpPtr->keep = 0;
 	break;
 
     case NS_SOCK_TIMEOUT:
@@ -724,3 +1008,496 @@ HttpProc(Ns_Task *task, SOCKET sock, void *arg, int why)
     Ns_GetTime(&httpPtr->etime);
     Ns_TaskDone(httpPtr->task);
 }
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HttpComplete --
+ *
+ *	Check if a full response has been read, using the framing
+ *	given in the response headers.
+ *
+ * Results:
+ *	1 if response is complete, 0 if more should be read.
+ *
+ * Side effects:
+ *	Will clear the keep flag if the socket can't be reused and
+ *	decode chunked responses in place.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HttpComplete(Http *httpPtr)
+{
+    char *response, *eoh, *line, *next, *value;
+    int major, minor, status, n, ka;
+
+    if (httpPtr->hdrlen == 0) {
+	while (1) {
+	    response = httpPtr->ds.string;
+	    n = 4;
+	    eoh = strstr(response, "\r\n\r\n");
+	    if (eoh == NULL) {
+		n = 2;
+		eoh = strstr(response, "\n\n");
+		if (eoh == NULL) {
+		    return 0;
+		}
+	    }
+	    if (sscanf(response, "HTTP/%d.%d %d", &major, &minor,
+		       &status) != 3) {
+		httpPtr->keep = 0;
+		return 0;
+	    }
+	    httpPtr->hdrlen = eoh - response + n;
+	    if (status >= 200 || status < 100) {
+		break;
+	    }
+
+	    /*
+	     * Discard interim 1xx responses.
+	     */
+
+	    n = httpPtr->ds.length - httpPtr->hdrlen;
+	    memmove(response, response + httpPtr->hdrlen, (size_t) n);
+	    Tcl_DStringTrunc(&httpPtr->ds, n);
+	    httpPtr->hdrlen = 0;
+	}
+	ka = (major > 1 || (major == 1 && minor > 0));
+	line = strchr(response, '\n');
+	while (line != NULL && ++line < eoh) {
+	    next = strchr(line, '\n');
+	    if (MatchHeader(line, "content-length", &value)) {
+		httpPtr->length = atoi(value);
+	    } else if (MatchHeader(line, "transfer-encoding", &value)) {
+		httpPtr->chunked = !strncasecmp(value, "chunked", 7);
+	    } else if (MatchHeader(line, "connection", &value)) {
+		if (!strncasecmp(value, "close", 5)) {
+		    ka = 0;
+		} else if (!strncasecmp(value, "keep-alive", 10)) {
+		    ka = 1;
+		}
+	    }
+	    line = next;
+	}
+	if (!ka) {
+	    httpPtr->keep = 0;
+	}
+	if (httpPtr->head || status == 204 || status == 304) {
+	    httpPtr->chunked = 0;
+	    httpPtr->length = 0;
+	} else if (httpPtr->chunked) {
+	    httpPtr->chunk = httpPtr->body = httpPtr->hdrlen;
+	}
+    }
+    if (httpPtr->chunked) {
+	return HttpChunks(httpPtr);
+    }
+    if (httpPtr->length < 0) {
+	/* NB: Read until EOF. */
+	httpPtr->keep = 0;
+	return 0;
+    }
+    n = httpPtr->ds.length - httpPtr->hdrlen;
+    if (n < httpPtr->length) {
+	return 0;
+    }
+    if (n > httpPtr->length) {
+	httpPtr->keep = 0;
+	Tcl_DStringTrunc(&httpPtr->ds, httpPtr->hdrlen + httpPtr->length);
+    }
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HttpChunks --
+ *
+ *	Decode available chunks of a chunked response, moving the
+ *	chunk data down over the chunk size lines.
+ *
+ * Results:
+ *	1 if the last chunk and trailer have been read, 0 otherwise.
+ *
+ * Side effects:
+ *	Updates the chunk and body offsets.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HttpChunks(Http *httpPtr)
+{
+    char *string, *end, *p, *eol, *data;
+    long size;
+
+    string = httpPtr->ds.string;
+    end = string + httpPtr->ds.length;
+    while (1) {
+	p = string + httpPtr->chunk;
+	eol = memchr(p, '\n', (size_t) (end - p));
+	if (eol == NULL) {
+	    return 0;
+	}
+	size = strtol(p, NULL, 16);
+	if (size < 0) {
+	    httpPtr->error = "invalid chunk";
+	    httpPtr->keep = 0;
+	    return 1;
+	}
+	data = eol + 1;
+	if (size == 0) {
+	    break;
+	}
+	if ((end - data) <= size) {
+	    return 0;
+	}
+	eol = memchr(data + size, '\n', (size_t) (end - data - size));
+	if (eol == NULL) {
+	    return 0;
+	}
+	memmove(string + httpPtr->body, data, (size_t) size);
+	httpPtr->body += size;
+	httpPtr->chunk = eol + 1 - string;
+    }
+
+    /*
+     * Skip trailer headers up to the closing blank line.
+     */
+
+    p = data;
+    while ((eol = memchr(p, '\n', (size_t) (end - p))) != NULL) {
+	if (eol == p || (eol == p + 1 && *p == '\r')) {
+	    if (eol + 1 < end) {
+		httpPtr->keep = 0;
+	    }
+	    Tcl_DStringTrunc(&httpPtr->ds, httpPtr->body);
+	    return 1;
+	}
+	p = eol + 1;
+    }
+    return 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MatchHeader --
+ *
+ *	Check if a raw header line is for the given lowercase name.
+ *
+ * Results:
+ *	1 if header matches, 0 otherwise.
+ *
+ * Side effects:
+ *	Will update valuePtr with start of header value.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+MatchHeader(char *line, char *name, char **valuePtr)
+{
+    size_t len;
+
+    len = strlen(name);
+    if (strncasecmp(line, name, len) != 0 || line[len] != ':') {
+	return 0;
+    }
+    line += len + 1;
+    while (*line == ' ' || *line == '\t') {
+	++line;
+    }
+    *valuePtr = line;
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HttpStatsCmd --
+ *
+ *	Implements "ns_http stats" subcommand.
+ *
+ * Results:
+ *	Standard Tcl result.
+ *
+ * Side effects:
+ *	Sets interp result to a list of host:port and counters for
+ *	each keep-alive pool.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HttpStatsCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv)
+{
+    Tcl_Interp *interp = itPtr->interp;
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+    HttpPool *poolPtr;
+    Tcl_DString ds;
+    char buf[200];
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, NULL);
+        return TCL_ERROR;
+    }
+    PoolInit();
+    Tcl_DStringInit(&ds);
+    Ns_MutexLock(&poollock);
+    hPtr = Tcl_FirstHashEntry(&pools, &search);
+    while (hPtr != NULL) {
+	poolPtr = Tcl_GetHashValue(hPtr);
+	Tcl_DStringAppendElement(&ds, Tcl_GetHashKey(&pools, hPtr));
+	sprintf(buf, "idle %d connects %lu reuses %lu retries %lu "
+		"expired %lu", poolPtr->nidle, poolPtr->nconnect,
+		poolPtr->nreuse, poolPtr->nretry, poolPtr->nexpire);
+	Tcl_DStringAppendElement(&ds, buf);
+	hPtr = Tcl_NextHashEntry(&search);
+    }
+    Ns_MutexUnlock(&poollock);
+    Tcl_DStringResult(interp, &ds);
+    return TCL_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PoolInit --
+ *
+ *	Initialize the keep-alive pools on first use.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Schedules PoolSweep to close expired idle sockets.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PoolInit(void)
+{
+    if (!poolsinit) {
+	Ns_MasterLock();
+	if (!poolsinit) {
+	    Ns_MutexSetName(&poollock, "ns:httppool");
+	    Tcl_InitHashTable(&pools, TCL_STRING_KEYS);
+	    Ns_ScheduleProcEx(PoolSweep, NULL, 0, nsconf.http.keeptimeout,
+			      NULL);
+	    poolsinit = 1;
+	}
+	Ns_MasterUnlock();
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetPool --
+ *
+ *	Find or create the pool for a host:port.  Must be called with
+ *	poollock held.
+ *
+ * Results:
+ *	Pointer to HttpPool.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static HttpPool *
+GetPool(char *key)
+{
+    Tcl_HashEntry *hPtr;
+    HttpPool *poolPtr;
+    int new;
+
+    hPtr = Tcl_CreateHashEntry(&pools, key, &new);
+    if (new) {
+	poolPtr = ns_calloc(1, sizeof(HttpPool));
+	Tcl_SetHashValue(hPtr, poolPtr);
+    } else {
+	poolPtr = Tcl_GetHashValue(hPtr);
+    }
+    return poolPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PoolGet --
+ *
+ *	Take the most recently used idle socket for a host:port.
+ *
+ * Results:
+ *	Open socket or INVALID_SOCKET if none is available.
+ *
+ * Side effects:
+ *	Expired or closed idle sockets are closed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static SOCKET
+PoolGet(char *key)
+{
+    HttpPool *poolPtr;
+    HttpIdle *idlePtr;
+    SOCKET sock;
+    time_t now;
+
+    PoolInit();
+    time(&now);
+    sock = INVALID_SOCKET;
+    Ns_MutexLock(&poollock);
+    poolPtr = GetPool(key);
+    while (sock == INVALID_SOCKET && (idlePtr = poolPtr->firstPtr) != NULL) {
+	poolPtr->firstPtr = idlePtr->nextPtr;
+	--poolPtr->nidle;
+	if (idlePtr->expires > now && SockAlive(idlePtr->sock)) {
+	    sock = idlePtr->sock;
+	} else {
+	    ns_sockclose(idlePtr->sock);
+	    ++poolPtr->nexpire;
+	}
+	ns_free(idlePtr);
+    }
+    if (sock == INVALID_SOCKET) {
+	++poolPtr->nconnect;
+    } else {
+	++poolPtr->nreuse;
+    }
+    Ns_MutexUnlock(&poollock);
+    return sock;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PoolPut --
+ *
+ *	Return a socket to the idle list for a host:port.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Socket is closed if the pool is full.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PoolPut(char *key, SOCKET sock)
+{
+    HttpPool *poolPtr;
+    HttpIdle *idlePtr;
+
+    PoolInit();
+    Ns_MutexLock(&poollock);
+    poolPtr = GetPool(key);
+    if (poolPtr->nidle < nsconf.http.keepmax) {
+	idlePtr = ns_malloc(sizeof(HttpIdle));
+	idlePtr->sock = sock;
+	idlePtr->expires = time(NULL) + nsconf.http.keeptimeout;
+	idlePtr->nextPtr = poolPtr->firstPtr;
+	poolPtr->firstPtr = idlePtr;
+	++poolPtr->nidle;
+	sock = INVALID_SOCKET;
+    }
+    Ns_MutexUnlock(&poollock);
+    if (sock != INVALID_SOCKET) {
+	ns_sockclose(sock);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PoolSweep --
+ *
+ *	Scheduled callback to close expired idle sockets.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PoolSweep(void *arg, int id)
+{
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+    HttpPool *poolPtr;
+    HttpIdle *idlePtr, **nextPtrPtr;
+    time_t now;
+
+    time(&now);
+    Ns_MutexLock(&poollock);
+    hPtr = Tcl_FirstHashEntry(&pools, &search);
+    while (hPtr != NULL) {
+	poolPtr = Tcl_GetHashValue(hPtr);
+	nextPtrPtr = &poolPtr->firstPtr;
+	while ((idlePtr = *nextPtrPtr) != NULL) {
+	    if (idlePtr->expires > now) {
+		nextPtrPtr = &idlePtr->nextPtr;
+	    } else {
+		*nextPtrPtr = idlePtr->nextPtr;
+		ns_sockclose(idlePtr->sock);
+		ns_free(idlePtr);
+		--poolPtr->nidle;
+		++poolPtr->nexpire;
+	    }
+	}
+	hPtr = Tcl_NextHashEntry(&search);
+    }
+    Ns_MutexUnlock(&poollock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockAlive --
+ *
+ *	Check an idle socket has not been closed by the peer.
+ *
+ * Results:
+ *	1 if socket appears usable, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SockAlive(SOCKET sock)
+{
+    /*
+     * An idle socket becomes readable only on EOF, reset, or stray
+     * data, none of which leave it usable for a new request.
+     */
+
+    return (Ns_SockWaitEx(sock, NS_SOCK_READ, 0) != NS_OK);
+}
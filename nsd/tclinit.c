@@ -178,6 +178,12 @@ static void ForeachTrace(NsInterp *itPtr, int why, int append);
 static void DoTrace(Tcl_Interp *interp, TclTrace *tracePtr, int append);
 static int EvalTrace(Tcl_Interp *interp, void *arg);
 static int RegisterAt(Ns_TclTraceProc *proc, void *arg, int when);
+static int SaveProcs(Tcl_Interp *interp, NsServer *servPtr,
+		     Tcl_DString *dsPtr, Tcl_Obj *procsObj,
+		     Tcl_HashTable **tablePtrPtr);
+static void FreeProcs(Tcl_HashTable *tablePtr);
+static int AutoloadProc(NsInterp *itPtr, char *name);
+static int AutoloadAll(NsInterp *itPtr, int reload);
 static Tcl_AsyncProc AsyncCancel;
 static Ns_TclTraceProc PkgRequire;
 
@@ -820,7 +826,7 @@ Ns_TclLogErrorRequest(Tcl_Interp *interp, Ns_Conn *conn)
     if (errorInfo == NULL) {
         errorInfo = Tcl_GetStringResult(interp);
     }
-    agent = Ns_SetIGet(conn->headers, "user-agent");
+    agent = NsConnHeader((Conn *) conn, HDR_USER_AGENT);
     if (agent == NULL) {
 	agent = "?";
     }
@@ -924,21 +930,24 @@ NsTclICtlObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
     Tcl_HashEntry *hPtr;
     Tcl_HashSearch search;
     TclData *dataPtr;
-    Tcl_Obj *objPtr, *listPtr;
+    Tcl_Obj *objPtr, *listPtr, **elemv;
+    Tcl_HashTable *procsPtr, *tablePtr;
+    Tcl_DString ds;
     Package *pkgPtr;
-    int	      when, length, result, tid, new, exact;
+    int	      when, length, result, tid, new, exact, reload;
     char     *script, *name, *pattern, *version;
     static CONST char *opts[] = {
 	"addmodule", "cleanup", "epoch", "get", "getmodules", "save",
 	"update", "oncreate", "oncleanup", "oninit", "ondelete", "trace",
 	"threads", "cancel", "runtraces", "gettraces", "package", "once",
-	NULL
+	"autoload", "autoproc", NULL
     };
     enum {
 	IAddModuleIdx, ICleanupIdx, IEpochIdx, IGetIdx, IGetModulesIdx,
 	ISaveIdx, IUpdateIdx, IOnCreateIdx, IOnCleanupIdx, IOnInitIdx,
         IOnDeleteIdx, ITraceIdx, IThreadsIdx, ICancelIdx, IRunIdx, 
-	IGetTracesIdx, IPackageIdx, IOnceIdx
+	IGetTracesIdx, IPackageIdx, IOnceIdx, IAutoloadIdx,
+	IAutoprocIdx
     } opt;
     static CONST char *popts[] = {
 	"require", "names", NULL
@@ -1026,14 +1035,33 @@ NsTclICtlObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
    
     case ISaveIdx:
 	/*
-	 * Save the init script.
+	 * Save the init script.  Proc definitions, if given separately,
+	 * are either appended to the script or saved in the autoload
+	 * table, followed by the script to import commands.
 	 */
 
-	if (objc != 3) {
-            Tcl_WrongNumArgs(interp, 2, objv, "script");
+	if (objc != 3 && objc != 5) {
+            Tcl_WrongNumArgs(interp, 2, objv, "script ?procs imports?");
 	    return TCL_ERROR;
     	}
-	script = ns_strdup(Tcl_GetStringFromObj(objv[2], &length));
+	procsPtr = NULL;
+	if (objc == 3) {
+	    script = ns_strdup(Tcl_GetStringFromObj(objv[2], &length));
+	} else {
+	    Tcl_DStringInit(&ds);
+	    script = Tcl_GetStringFromObj(objv[2], &length);
+	    Tcl_DStringAppend(&ds, script, length);
+	    Tcl_DStringAppend(&ds, "\n", 1);
+	    if (SaveProcs(interp, servPtr, &ds, objv[3],
+			  &procsPtr) != TCL_OK) {
+		Tcl_DStringFree(&ds);
+		return TCL_ERROR;
+	    }
+	    script = Tcl_GetStringFromObj(objv[4], &length);
+	    Tcl_DStringAppend(&ds, script, length);
+	    length = ds.length;
+	    script = Ns_DStringExport(&ds);
+	}
 	Ns_RWLockWrLock(&servPtr->tcl.slock);
 	ns_free(servPtr->tcl.script);
 	servPtr->tcl.script = script;
@@ -1042,7 +1070,57 @@ NsTclICtlObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	    /* NB: Epoch zero reserved for new interps. */
 	    ++servPtr->tcl.epoch;
 	}
+	if (objc == 5) {
+	    tablePtr = servPtr->tcl.procsPtr;
+	    servPtr->tcl.procsPtr = procsPtr;
+	    procsPtr = tablePtr;
+	}
 	Ns_RWLockUnlock(&servPtr->tcl.slock);
+	if (procsPtr != NULL) {
+	    FreeProcs(procsPtr);
+	}
+	break;
+
+    case IAutoloadIdx:
+	/*
+	 * Define all procs from the autoload table or, as the
+	 * unknown command handler, define the given command if
+	 * possible and invoke it.
+	 */
+
+	if (objc == 2) {
+	    Tcl_SetIntObj(Tcl_GetObjResult(interp), AutoloadAll(itPtr, 0));
+	    break;
+	}
+	if (AutoloadProc(itPtr, Tcl_GetString(objv[2]))) {
+	    return Tcl_EvalObjv(interp, objc - 2, (Tcl_Obj **) objv + 2, 0);
+	}
+	if (Tcl_FindCommand(interp, "::unknown", NULL,
+			    TCL_GLOBAL_ONLY) == NULL) {
+	    Tcl_AppendResult(interp, "invalid command name \"",
+			     Tcl_GetString(objv[2]), "\"", NULL);
+	    return TCL_ERROR;
+	}
+	listPtr = Tcl_NewListObj(objc - 2, (Tcl_Obj **) objv + 2);
+	Tcl_IncrRefCount(listPtr);
+	objPtr = Tcl_NewStringObj("::unknown", -1);
+	Tcl_ListObjReplace(interp, listPtr, 0, 0, 1, &objPtr);
+	Tcl_ListObjGetElements(interp, listPtr, &length, &elemv);
+	result = Tcl_EvalObjv(interp, length, elemv, 0);
+	Tcl_DecrRefCount(listPtr);
+	break;
+
+    case IAutoprocIdx:
+	/*
+	 * Ensure a proc is defined, e.g., before a rename.
+	 */
+
+	if (objc != 3) {
+            Tcl_WrongNumArgs(interp, 2, objv, "name");
+	    return TCL_ERROR;
+	}
+	Tcl_SetBooleanObj(Tcl_GetObjResult(interp),
+			  NsTclAutoload(interp, Tcl_GetString(objv[2])));
 	break;
 
     case IUpdateIdx:
@@ -1058,9 +1136,21 @@ NsTclICtlObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
     	if (itPtr->epoch != servPtr->tcl.epoch) {
 	    result = Tcl_EvalEx(itPtr->interp, servPtr->tcl.script,
 		    	    	servPtr->tcl.length, TCL_EVAL_GLOBAL);
+
+	    /*
+	     * NB: Replace any procs autoloaded for an earlier epoch
+	     * which would otherwise go stale.
+	     */
+
+	    reload = (itPtr->epoch != 0);
 	    itPtr->epoch = servPtr->tcl.epoch;
+	} else {
+	    reload = 0;
     	}
     	Ns_RWLockUnlock(&servPtr->tcl.slock);
+	if (reload && result == TCL_OK && servPtr->tcl.lazyprocs) {
+	    (void) AutoloadAll(itPtr, 1);
+	}
 	break;
 
     case ICleanupIdx:
@@ -1303,6 +1393,265 @@ badargs:
     return result;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclAutoload --
+ *
+ *	Ensure the given command is defined, autoloading it if
+ *	necessary, e.g., before introspection with info args.
+ *
+ * Results:
+ *	1 if command exists, 0 otherwise.
+ *
+ * Side effects:
+ *	See AutoloadProc.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsTclAutoload(Tcl_Interp *interp, char *name)
+{
+    NsInterp *itPtr;
+
+    if (Tcl_FindCommand(interp, name, NULL, 0) != NULL) {
+	return 1;
+    }
+    itPtr = NsGetInterpData(interp);
+    if (itPtr == NULL || itPtr->servPtr == NULL
+	    || !itPtr->servPtr->tcl.lazyprocs) {
+	return 0;
+    }
+    return AutoloadProc(itPtr, name);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SaveProcs --
+ *
+ *	Process the list of proc names and definition scripts given
+ *	to ns_ictl save.  With lazyprocs enabled, the definitions are
+ *	saved in a new autoload table and the init script installs
+ *	ns_ictl autoload as the unknown command handler.  Otherwise,
+ *	the definitions are appended to the init script.
+ *
+ * Results:
+ *	TCL_OK or TCL_ERROR if list is invalid.
+ *
+ * Side effects:
+ *	New table, if any, is returned in given tablePtrPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SaveProcs(Tcl_Interp *interp, NsServer *servPtr, Tcl_DString *dsPtr,
+	  Tcl_Obj *procsObj, Tcl_HashTable **tablePtrPtr)
+{
+    Tcl_HashTable *tablePtr;
+    Tcl_HashEntry *hPtr;
+    Tcl_Obj **objv;
+    char *def;
+    int i, objc, new, length;
+
+    *tablePtrPtr = NULL;
+    if (Tcl_ListObjGetElements(interp, procsObj, &objc, &objv) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    if (objc % 2 != 0) {
+	Tcl_AppendResult(interp, "invalid procs list: ",
+			 Tcl_GetString(procsObj), NULL);
+	return TCL_ERROR;
+    }
+    if (!servPtr->tcl.lazyprocs) {
+	for (i = 1; i < objc; i += 2) {
+	    def = Tcl_GetStringFromObj(objv[i], &length);
+	    Tcl_DStringAppend(dsPtr, def, length);
+	    Tcl_DStringAppend(dsPtr, "\n", 1);
+	}
+	return TCL_OK;
+    }
+    tablePtr = ns_malloc(sizeof(Tcl_HashTable));
+    Tcl_InitHashTable(tablePtr, TCL_STRING_KEYS);
+    for (i = 0; i < objc; i += 2) {
+	hPtr = Tcl_CreateHashEntry(tablePtr, Tcl_GetString(objv[i]), &new);
+	if (!new) {
+	    ns_free(Tcl_GetHashValue(hPtr));
+	}
+	Tcl_SetHashValue(hPtr, ns_strdup(Tcl_GetString(objv[i+1])));
+    }
+    Tcl_DStringAppend(dsPtr, "::namespace unknown {::ns_ictl autoload}\n", -1);
+    *tablePtrPtr = tablePtr;
+    return TCL_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreeProcs --
+ *
+ *	Free an autoload table replaced by ns_ictl save.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreeProcs(Tcl_HashTable *tablePtr)
+{
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+
+    hPtr = Tcl_FirstHashEntry(tablePtr, &search);
+    while (hPtr != NULL) {
+	ns_free(Tcl_GetHashValue(hPtr));
+	hPtr = Tcl_NextHashEntry(&search);
+    }
+    Tcl_DeleteHashTable(tablePtr);
+    ns_free(tablePtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AutoloadProc --
+ *
+ *	Define a proc from the autoload table, resolving a relative
+ *	name first in the current namespace and then the global
+ *	namespace as Tcl does for commands.
+ *
+ * Results:
+ *	1 if proc was defined, 0 otherwise.
+ *
+ * Side effects:
+ *	Proc definition errors are logged.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+AutoloadProc(NsInterp *itPtr, char *name)
+{
+    NsServer *servPtr = itPtr->servPtr;
+    Tcl_Interp *interp = itPtr->interp;
+    Tcl_Namespace *nsPtr;
+    Tcl_HashEntry *hPtr;
+    Tcl_Obj *defPtr;
+    Tcl_DString ds;
+    char *key;
+
+    Tcl_DStringInit(&ds);
+    if (name[0] == ':' && name[1] == ':') {
+	key = name;
+    } else {
+	nsPtr = Tcl_GetCurrentNamespace(interp);
+	if (nsPtr->parentPtr != NULL) {
+	    Tcl_DStringAppend(&ds, nsPtr->fullName, -1);
+	}
+	Tcl_DStringAppend(&ds, "::", 2);
+	Tcl_DStringAppend(&ds, name, -1);
+	key = ds.string;
+    }
+    defPtr = NULL;
+    Ns_RWLockRdLock(&servPtr->tcl.slock);
+    if (servPtr->tcl.procsPtr != NULL) {
+	hPtr = Tcl_FindHashEntry(servPtr->tcl.procsPtr, key);
+	if (hPtr == NULL && key == ds.string
+		&& ds.length > (int) strlen(name) + 2) {
+	    key = ds.string + ds.length - strlen(name) - 2;
+	    hPtr = Tcl_FindHashEntry(servPtr->tcl.procsPtr, key);
+	}
+	if (hPtr != NULL) {
+	    defPtr = Tcl_NewStringObj(Tcl_GetHashValue(hPtr), -1);
+	}
+    }
+    Ns_RWLockUnlock(&servPtr->tcl.slock);
+    Tcl_DStringFree(&ds);
+    if (defPtr == NULL) {
+	return 0;
+    }
+    Tcl_IncrRefCount(defPtr);
+    if (Tcl_EvalObjEx(interp, defPtr, TCL_EVAL_GLOBAL) != TCL_OK) {
+	Ns_TclLogError(interp);
+	Tcl_DecrRefCount(defPtr);
+	return 0;
+    }
+    Tcl_DecrRefCount(defPtr);
+    Tcl_ResetResult(interp);
+    return (Tcl_FindCommand(interp, name, NULL, 0) != NULL);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AutoloadAll --
+ *
+ *	Define all procs in the autoload table, e.g., before saving
+ *	the namespaces of an interp with ns_eval, or, if reload is
+ *	set, replace those already autoloaded after an update.
+ *
+ * Results:
+ *	Number of procs defined.
+ *
+ * Side effects:
+ *	Only procs not yet defined are defined unless reload is set
+ *	in which case only procs already defined are replaced.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+AutoloadAll(NsInterp *itPtr, int reload)
+{
+    NsServer *servPtr = itPtr->servPtr;
+    Tcl_Interp *interp = itPtr->interp;
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+    Tcl_DString ds;
+    char *name;
+    int n;
+
+    n = 0;
+    Tcl_DStringInit(&ds);
+    Ns_RWLockRdLock(&servPtr->tcl.slock);
+    if (servPtr->tcl.procsPtr != NULL) {
+	hPtr = Tcl_FirstHashEntry(servPtr->tcl.procsPtr, &search);
+	while (hPtr != NULL) {
+	    name = Tcl_GetHashKey(servPtr->tcl.procsPtr, hPtr);
+	    if (reload == (Tcl_FindCommand(interp, name, NULL,
+					   TCL_GLOBAL_ONLY) != NULL)) {
+		Tcl_DStringAppend(&ds, Tcl_GetHashValue(hPtr), -1);
+		Tcl_DStringAppend(&ds, "\n", 1);
+		++n;
+	    }
+	    hPtr = Tcl_NextHashEntry(&search);
+	}
+    }
+    Ns_RWLockUnlock(&servPtr->tcl.slock);
+    if (ds.length > 0) {
+	if (Tcl_EvalEx(interp, ds.string, ds.length,
+		       TCL_EVAL_GLOBAL) != TCL_OK) {
+	    Ns_TclLogError(interp);
+	    n = 0;
+	}
+	Tcl_ResetResult(interp);
+    }
+    Tcl_DStringFree(&ds);
+    return n;
+}
+
 
 /*
  *----------------------------------------------------------------------
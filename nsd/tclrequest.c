@@ -56,7 +56,6 @@ typedef struct {
 
 static Ns_OpProc ProcRequest;
 static Ns_OpProc AdpRequest;
-static Ns_FilterProc ProcFilter;
 static Proc *NewProc(char *name, char *args);
 static Ns_Callback FreeProc;
 static void AppendConnId(Tcl_DString *dsPtr, Ns_Conn *conn);
@@ -366,6 +365,46 @@ NsTclRegisterTraceObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj *
     return RegisterFilterObj(itPtr, NS_FILTER_VOID_TRACE, objc - 1, objv + 1);
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclFilterStatsObjCmd --
+ *
+ *	Implements ns_filter_stats to return the invocation counts
+ *	and cumulative times of the filters of the server.
+ *
+ * Results:
+ *	Tcl result. 
+ *
+ * Side effects:
+ *	Counters are reset with -reset.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsTclFilterStatsObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[])
+{
+    NsInterp *itPtr = arg;
+    Tcl_DString ds;
+    char *server;
+    int reset;
+
+    if (objc > 2 || (objc == 2 && !STREQ(Tcl_GetString(objv[1]), "-reset"))) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-reset?");
+        return TCL_ERROR;
+    }
+    if (NsTclGetServer(itPtr, &server) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    reset = (objc == 2);
+    Tcl_DStringInit(&ds);
+    NsGetFilters(&ds, itPtr->servPtr, reset);
+    Tcl_DStringResult(interp, &ds);
+    return TCL_OK;
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -502,7 +541,7 @@ ProcRequest(void *arg, Ns_Conn *conn)
 /*
  *----------------------------------------------------------------------
  *
- * ProcFilter --
+ * NsTclFilterProc --
  *
  *	Callback for Tcl-based connection filters.
  *
@@ -515,8 +554,8 @@ ProcRequest(void *arg, Ns_Conn *conn)
  *----------------------------------------------------------------------
  */
 
-static int
-ProcFilter(void *arg, Ns_Conn *conn, int why)
+int
+NsTclFilterProc(void *arg, Ns_Conn *conn, int why)
 {
     Proc	        *procPtr = arg;
     Tcl_Interp          *interp = Ns_GetConnInterp(conn);
@@ -598,6 +637,34 @@ ProcFilter(void *arg, Ns_Conn *conn, int why)
     return status;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclFilterArgProc --
+ *
+ *	Ns_GetProcInfo callback for Tcl-based connection filters.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Proc name and args are appended to given dsPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsTclFilterArgProc(Tcl_DString *dsPtr, void *arg)
+{
+    Proc *procPtr = arg;
+
+    Tcl_DStringAppendElement(dsPtr, procPtr->name);
+    if (procPtr->args != NULL) {
+	Tcl_DStringAppendElement(dsPtr, procPtr->args);
+    }
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -623,6 +690,7 @@ GetNumArgs(Tcl_Interp *interp, Proc *procPtr)
     Tcl_DString ds;
 
     if (procPtr->nargs == ARGS_UNKNOWN) {
+	(void) NsTclAutoload(interp, procPtr->name);
     	Tcl_DStringInit(&ds);
     	Tcl_DStringAppend(&ds, "llength [info args ", -1);
     	Tcl_DStringAppendElement(&ds, procPtr->name);
@@ -671,7 +739,7 @@ RegisterFilterObj(NsInterp *itPtr, int when, int objc, Tcl_Obj *CONST objv[])
     name = Tcl_GetString(objv[2]);
     args = (objc > 3 ? Tcl_GetString(objv[3]) : NULL);
     procPtr = NewProc(name, args);
-    Ns_RegisterFilter(server, method, url, ProcFilter, when, procPtr);
+    Ns_RegisterFilter(server, method, url, NsTclFilterProc, when, procPtr);
     return TCL_OK;
 }
 
@@ -36,6 +36,11 @@
  *	a handler for all GET /foo/bar/ *.html requests, the data
  *	structure that holds that information is implemented herein.
  *	For full details see the file doc/urlspace.txt.
+ *
+ *	Lookups with Ns_UrlSpecificGet use a read-only copy of the
+ *	trie compiled into a single tree, which is published without
+ *	a lock and rebuilt on the next lookup after any change.  The
+ *	data for all ids found for a URL is memoized per thread.
  */
 
 static const char *RCSID = "@(#) $Header$, compiled: " __DATE__ " " __TIME__;
@@ -123,6 +128,83 @@ typedef struct {
 #endif
 } Junction;
 
+/*
+ * The following structures define the compiled routing table.  A
+ * Route is the merge of the tries of all channels: each node holds
+ * the data set at the node's sequence for every id and channel,
+ * sorted by id and then channel search order.
+ */
+
+typedef struct {
+    int    id;
+    int    chan;                        /* Channel search order. */
+    void  *dataInherit;
+    void  *dataNoInherit;
+} RouteData;
+
+typedef struct Route {
+    Tcl_HashTable  children;            /* Sub-routes by sequence word. */
+    int            ndata;
+    RouteData     *data;
+} Route;
+
+/*
+ * Channel filters are classified when compiled to avoid most calls
+ * to Tcl_StringMatch during lookup.
+ */
+
+#define FILTER_ALL	0		/* "*" matches everything. */
+#define FILTER_EXACT	1		/* No wildcards, use strcmp. */
+#define FILTER_SUFFIX	2		/* "*" followed by literal suffix. */
+#define FILTER_GLOB	3		/* Anything else, use Tcl_StringMatch. */
+
+typedef struct {
+    int    type;
+    char  *pattern;
+    int    length;                      /* Length of suffix. */
+} Filter;
+
+typedef struct Routes {
+    struct Routes *nextPtr;             /* Next retired table. */
+    unsigned long  epoch;               /* Epoch when retired. */
+    unsigned int   serial;              /* Unique serial of table. */
+    int            nids;                /* Ids allocated when compiled. */
+    int            nfilters;
+    Filter        *filters;             /* Filters in search order. */
+    Route          root;
+} Routes;
+
+/*
+ * The following structure defines the per-thread memo of lookups
+ * with Ns_UrlSpecificGet: a direct-mapped table of URLs with the
+ * data for every id, valid while the compiled table they were
+ * found in is current.
+ */
+
+#define MEMO_SIZE	256
+
+typedef struct {
+    unsigned int   serial;              /* Serial of table or 0 if unused. */
+    Ns_DString     key;                 /* Server, method and URL. */
+    int            ndata;
+    void         **data;                /* Data by id. */
+} Memo;
+
+/*
+ * The following structure defines the per-thread state of lookups.
+ * Retired tables may still be in use by lookups which started before
+ * they were retired, so each lookup publishes the epoch in which it
+ * started and a table is freed only when no lookup that started
+ * before its retirement is still in progress.
+ */
+
+typedef struct Reader {
+    struct Reader *nextPtr;
+    struct Reader *prevPtr;
+    volatile unsigned long epoch;       /* Epoch of lookup or 0 if idle. */
+    Memo           memo[MEMO_SIZE];
+} Reader;
+
 /*
  * Local functions defined in this file
  */
@@ -188,12 +270,37 @@ static void *JunctionFindExact(Junction *juncPtr, char *seq, int id, int flags,
 			       int fast);
 static void *JunctionDelete(Junction *juncPtr, char *seq, int id, int flags);
 
+/*
+ * Compiled routing table functions
+ */
+
+static Routes *RoutesCompile(Junction *juncPtr);
+static void  RoutesRetire(void);
+static void  RoutesReclaim(void);
+static void  RoutesFree(Routes *routesPtr);
+static Routes *RoutesGet(void);
+static void  RoutesFind(Routes *routesPtr, char *seq, void **data);
+static void *RoutesFindId(Routes *routesPtr, char *seq, int id);
+static Reader *GetReader(void);
+static void  FreeReader(void *arg);
+static void  RouteInit(Route *routePtr);
+static void  RouteAdd(Route *routePtr, Trie *triePtr, int chan);
+static void  RouteFree(Route *routePtr);
+static int   FilterMatch(Filter *filterPtr, char *key);
+
 /*
  * Static variables defined in this file
  */
 
 static Junction urlspace;    /* All URL-specific data stored here */
 static Ns_Mutex lock;
+static Routes *volatile routes;  /* Compiled urlspace or NULL if stale */
+static Routes *retired;      /* Retired compiled tables */
+static Reader *readers;      /* Threads which have done lookups */
+static volatile unsigned long epoch = 1;  /* Incremented on retirement */
+static unsigned int serial;  /* Serial of last compiled table */
+static int nextid;           /* Next id for Ns_UrlSpecificAlloc */
+static Ns_Tls tls;           /* Per-thread lookup memo */
 
 
 /*
@@ -216,6 +323,7 @@ void
 NsInitUrlSpace(void)
 {
     Ns_MutexSetName(&lock, "ns:urlspace");
+    Ns_TlsAlloc(&tls, FreeReader);
     JunctionInit(&urlspace);
 }
 
@@ -240,7 +348,6 @@ int
 Ns_UrlSpecificAlloc(void)
 {
     int        id;
-    static int nextid = 0;
 
     Ns_MutexLock(&lock);
     id = nextid++;
@@ -278,6 +385,7 @@ Ns_UrlSpecificSet(char *server, char *method, char *url, int id, void *data,
     MkSeq(&ds, server, method, url);
     Ns_MutexLock(&lock);
     JunctionAdd(&urlspace, ds.string, id, data, flags, deletefunc);
+    RoutesRetire();
     Ns_MutexUnlock(&lock);
     Ns_DStringFree(&ds);
 }
@@ -304,15 +412,66 @@ void *
 Ns_UrlSpecificGet(char *server, char *method, char *url, int id)
 {
     Ns_DString  ds;
+    Routes     *routesPtr;
+    Reader     *readerPtr;
+    Memo       *memoPtr;
+    char       *p;
     void       *data;
+    unsigned int hash;
+
+    /*
+     * Publish the lookup's epoch before loading the table so the
+     * table is not freed while in use.
+     */
 
+    readerPtr = GetReader();
+    readerPtr->epoch = epoch;
+    NsMemoryBarrier();
+    routesPtr = RoutesGet();
+    data = NULL;
+    if (id < 0 || id >= routesPtr->nids) {
+	goto done;
+    }
     Ns_DStringInit(&ds);
-    MkSeq(&ds, server, method, url);
-    Ns_MutexLock(&lock);
-    data = JunctionFind(&urlspace, ds.string, id, 0);
-    Ns_MutexUnlock(&lock);
+    if (method == NULL || url == NULL) {
+	MkSeq(&ds, server, method, url);
+	data = RoutesFindId(routesPtr, ds.string, id);
+	Ns_DStringFree(&ds);
+	goto done;
+    }
+
+    /*
+     * Check the memo slot for the URL, searching the compiled table
+     * for all ids on a miss or if the table has changed since.
+     */
+
+    Ns_DStringVarAppend(&ds, server, "\001", method, "\001", url, NULL);
+    hash = 0;
+    for (p = ds.string; *p != '\0'; ++p) {
+	hash += (hash << 3) + UCHAR(*p);
+    }
+    memoPtr = &readerPtr->memo[hash % MEMO_SIZE];
+    if (memoPtr->serial != routesPtr->serial
+	    || memoPtr->key.length != ds.length
+	    || memcmp(memoPtr->key.string, ds.string, (size_t) ds.length) != 0) {
+	Ns_DStringTrunc(&memoPtr->key, 0);
+	Ns_DStringNAppend(&memoPtr->key, ds.string, ds.length);
+	if (memoPtr->ndata < routesPtr->nids) {
+	    memoPtr->ndata = routesPtr->nids;
+	    memoPtr->data = ns_realloc(memoPtr->data,
+				       sizeof(void *) * memoPtr->ndata);
+	}
+	Ns_DStringTrunc(&ds, 0);
+	MkSeq(&ds, server, method, url);
+	RoutesFind(routesPtr, ds.string, memoPtr->data);
+	memoPtr->serial = routesPtr->serial;
+    }
     Ns_DStringFree(&ds);
+    data = memoPtr->data[id];
 
+done:
+    NsMemoryBarrier();
+    readerPtr->epoch = 0;
     return data;
 }
 
@@ -419,6 +578,7 @@ Ns_UrlSpecificDestroy(char *server, char *method, char *url, int id, int flags)
     } else {
 	data = JunctionDelete(&urlspace, ds.string, id, flags);
     }
+    RoutesRetire();
     Ns_MutexUnlock(&lock);
     Ns_DStringFree(&ds);
     
@@ -1861,6 +2021,621 @@ JunctionDelete(Junction *juncPtr, char *seq, int id, int flags)
     return data;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RoutesCompile --
+ *
+ *	Compile the tries of all channels in a junction into a single
+ *	routing table.  Must be called with the urlspace lock held.
+ *
+ * Results:
+ *	Pointer to new Routes.
+ *
+ * Side effects:
+ *	Memory is allocated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Routes *
+RoutesCompile(Junction *juncPtr)
+{
+    Routes  *routesPtr;
+    Channel *channelPtr;
+    Filter  *filterPtr;
+    char    *filter;
+    int      i, n;
+
+#ifndef __URLSPACE_OPTIMIZE__
+    n = Ns_IndexCount(&juncPtr->byuse);
+#else
+    n = Ns_IndexCount(&juncPtr->byname);
+#endif
+    routesPtr = ns_malloc(sizeof(Routes));
+    routesPtr->nextPtr = NULL;
+    routesPtr->epoch = 0;
+    routesPtr->serial = ++serial;
+    routesPtr->nids = nextid;
+    routesPtr->nfilters = n;
+    routesPtr->filters = ns_malloc(sizeof(Filter) * (n + 1));
+    RouteInit(&routesPtr->root);
+
+    /*
+     * Add channels in the order searched by JunctionFind, which
+     * determines the winner of matches at equal depth.
+     */
+
+    for (i = 0; i < n; ++i) {
+#ifndef __URLSPACE_OPTIMIZE__
+        channelPtr = Ns_IndexEl(&juncPtr->byuse, i);
+#else
+        channelPtr = Ns_IndexEl(&juncPtr->byname, n - i - 1);
+#endif
+	filter = channelPtr->filter;
+	filterPtr = &routesPtr->filters[i];
+	filterPtr->pattern = ns_strdup(filter);
+	filterPtr->length = 0;
+	if (STREQ(filter, "*")) {
+	    filterPtr->type = FILTER_ALL;
+	} else if (strpbrk(filter, "*?[\\") == NULL) {
+	    filterPtr->type = FILTER_EXACT;
+	} else if (*filter == '*' && strpbrk(filter + 1, "*?[\\") == NULL) {
+	    filterPtr->type = FILTER_SUFFIX;
+	    filterPtr->length = strlen(filter + 1);
+	} else {
+	    filterPtr->type = FILTER_GLOB;
+	}
+	RouteAdd(&routesPtr->root, &channelPtr->trie, i);
+    }
+    NsMemoryBarrier();
+
+    return routesPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RoutesRetire --
+ *
+ *	Mark the compiled table stale after a change to the urlspace
+ *	and free retired tables no longer in use.  Must be called
+ *	with the urlspace lock held.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Next lookup will compile a new table.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RoutesRetire(void)
+{
+    Routes *routesPtr;
+
+    routesPtr = routes;
+    if (routesPtr != NULL) {
+	routes = NULL;
+	NsMemoryBarrier();
+	routesPtr->epoch = ++epoch;
+	routesPtr->nextPtr = retired;
+	retired = routesPtr;
+    }
+    RoutesReclaim();
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RoutesReclaim --
+ *
+ *	Free retired tables which no lookup in progress can be using,
+ *	i.e., those retired before the oldest such lookup started.
+ *	Must be called with the urlspace lock held.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RoutesReclaim(void)
+{
+    Routes *routesPtr, **nextPtrPtr;
+    Reader *readerPtr;
+    unsigned long oldest, active;
+
+    if (retired == NULL) {
+	return;
+    }
+    NsMemoryBarrier();
+    oldest = epoch;
+    for (readerPtr = readers; readerPtr != NULL;
+	    readerPtr = readerPtr->nextPtr) {
+	active = readerPtr->epoch;
+	if (active != 0 && active < oldest) {
+	    oldest = active;
+	}
+    }
+    nextPtrPtr = &retired;
+    while ((routesPtr = *nextPtrPtr) != NULL) {
+	if (routesPtr->epoch <= oldest) {
+	    *nextPtrPtr = routesPtr->nextPtr;
+	    RoutesFree(routesPtr);
+	} else {
+	    nextPtrPtr = &routesPtr->nextPtr;
+	}
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RoutesFree --
+ *
+ *	Free a compiled table.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RoutesFree(Routes *routesPtr)
+{
+    int i;
+
+    for (i = 0; i < routesPtr->nfilters; ++i) {
+	ns_free(routesPtr->filters[i].pattern);
+    }
+    ns_free(routesPtr->filters);
+    RouteFree(&routesPtr->root);
+    ns_free(routesPtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RoutesGet --
+ *
+ *	Return the current compiled table, compiling it first if
+ *	stale.  The whole table is compiled under the urlspace lock,
+ *	so each change made after startup briefly stalls lookups.
+ *
+ * Results:
+ *	Pointer to Routes.
+ *
+ * Side effects:
+ *	May compile a new table.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Routes *
+RoutesGet(void)
+{
+    Routes *routesPtr;
+
+    routesPtr = routes;
+    if (routesPtr == NULL) {
+	Ns_MutexLock(&lock);
+	if (routes == NULL) {
+	    RoutesReclaim();
+	    routes = RoutesCompile(&urlspace);
+	}
+	routesPtr = routes;
+	Ns_MutexUnlock(&lock);
+    }
+    return routesPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RoutesFind --
+ *
+ *	Find the data for a sequence for every id in a compiled table.
+ *	The result for each id is the same as JunctionFind: the data
+ *	at the deepest node along the sequence in any channel whose
+ *	filter matches the last element, with ties won by the first
+ *	channel in search order.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Data for each id, or NULL if not found, is set in the given
+ *	array of nids elements.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RoutesFind(Routes *routesPtr, char *seq, void **data)
+{
+    Route         *routePtr;
+    RouteData     *dataPtr;
+    Tcl_HashEntry *hPtr;
+    char          *p, *matches, buf[64];
+    void          *candidate;
+    int            i, l, n, found;
+
+    /*
+     * Set p to the last element of the sequence, or the end for
+     * sequences of less than 3 elements, as in JunctionFind.
+     */
+
+    n = 0;
+    for (p = seq; p[l = strlen(p) + 1] != '\0'; p += l) {
+        n++;
+    }
+    if (n < 2) {
+        p += strlen(p) + 1;
+    }
+
+    /*
+     * Filter matches are computed once per channel when first needed.
+     */
+
+    if (routesPtr->nfilters <= sizeof(buf)) {
+	matches = buf;
+    } else {
+	matches = ns_malloc((size_t) routesPtr->nfilters);
+    }
+    memset(matches, -1, (size_t) routesPtr->nfilters);
+    memset(data, 0, sizeof(void *) * routesPtr->nids);
+
+    /*
+     * Walk down the sequence, replacing the result for each id with
+     * data found deeper.  As data is sorted by id and then channel,
+     * the first data found for an id at a node with a matching
+     * filter is the one.
+     */
+
+    routePtr = &routesPtr->root;
+    while (1) {
+	found = -1;
+	for (i = 0; i < routePtr->ndata; ++i) {
+	    dataPtr = &routePtr->data[i];
+	    if (dataPtr->id == found) {
+		continue;
+	    }
+	    if (matches[dataPtr->chan] < 0) {
+		matches[dataPtr->chan] =
+		    FilterMatch(&routesPtr->filters[dataPtr->chan], p);
+	    }
+	    if (!matches[dataPtr->chan]) {
+		continue;
+	    }
+	    if (*seq == '\0' && dataPtr->dataNoInherit != NULL) {
+		candidate = dataPtr->dataNoInherit;
+	    } else {
+		candidate = dataPtr->dataInherit;
+	    }
+	    if (candidate != NULL) {
+		data[dataPtr->id] = candidate;
+		found = dataPtr->id;
+	    }
+	}
+	if (*seq == '\0') {
+	    break;
+	}
+	hPtr = Tcl_FindHashEntry(&routePtr->children, seq);
+	if (hPtr == NULL) {
+	    break;
+	}
+	routePtr = Tcl_GetHashValue(hPtr);
+	seq += strlen(seq) + 1;
+    }
+    if (matches != buf) {
+	ns_free(matches);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RoutesFindId --
+ *
+ *	Find the data for a sequence for a single id.
+ *
+ * Results:
+ *	User data or NULL if not found.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void *
+RoutesFindId(Routes *routesPtr, char *seq, int id)
+{
+    void *buf[16], **data, *result;
+
+    if (routesPtr->nids <= 16) {
+	data = buf;
+    } else {
+	data = ns_malloc(sizeof(void *) * routesPtr->nids);
+    }
+    RoutesFind(routesPtr, seq, data);
+    result = data[id];
+    if (data != buf) {
+	ns_free(data);
+    }
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetReader --
+ *
+ *	Return the lookup state of the calling thread, registering
+ *	it with the urlspace on first use.
+ *
+ * Results:
+ *	Pointer to Reader.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Reader *
+GetReader(void)
+{
+    Reader *readerPtr;
+    int     i;
+
+    readerPtr = Ns_TlsGet(&tls);
+    if (readerPtr == NULL) {
+	readerPtr = ns_calloc(1, sizeof(Reader));
+	for (i = 0; i < MEMO_SIZE; ++i) {
+	    Ns_DStringInit(&readerPtr->memo[i].key);
+	}
+	Ns_MutexLock(&lock);
+	readerPtr->nextPtr = readers;
+	if (readers != NULL) {
+	    readers->prevPtr = readerPtr;
+	}
+	readers = readerPtr;
+	Ns_MutexUnlock(&lock);
+	Ns_TlsSet(&tls, readerPtr);
+    }
+    return readerPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreeReader --
+ *
+ *	Unregister and free the lookup state of an exiting thread.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreeReader(void *arg)
+{
+    Reader *readerPtr = arg;
+    int     i;
+
+    Ns_MutexLock(&lock);
+    if (readerPtr->prevPtr != NULL) {
+	readerPtr->prevPtr->nextPtr = readerPtr->nextPtr;
+    } else {
+	readers = readerPtr->nextPtr;
+    }
+    if (readerPtr->nextPtr != NULL) {
+	readerPtr->nextPtr->prevPtr = readerPtr->prevPtr;
+    }
+    Ns_MutexUnlock(&lock);
+    for (i = 0; i < MEMO_SIZE; ++i) {
+	Ns_DStringFree(&readerPtr->memo[i].key);
+	if (readerPtr->memo[i].data != NULL) {
+	    ns_free(readerPtr->memo[i].data);
+	}
+    }
+    ns_free(readerPtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FilterMatch --
+ *
+ *	Match the last element of a sequence against a compiled
+ *	channel filter.
+ *
+ * Results:
+ *	1 if the filter matches, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+FilterMatch(Filter *filterPtr, char *key)
+{
+    int len;
+
+    switch (filterPtr->type) {
+    case FILTER_ALL:
+	return 1;
+
+    case FILTER_EXACT:
+	return STREQ(key, filterPtr->pattern);
+
+    case FILTER_SUFFIX:
+	len = strlen(key);
+	return (len >= filterPtr->length
+		&& STREQ(key + len - filterPtr->length,
+			 filterPtr->pattern + 1));
+    }
+    return Tcl_StringMatch(key, filterPtr->pattern);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RouteInit --
+ *
+ *	Initialize a compiled route node.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RouteInit(Route *routePtr)
+{
+    Tcl_InitHashTable(&routePtr->children, TCL_STRING_KEYS);
+    routePtr->ndata = 0;
+    routePtr->data = NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RouteAdd --
+ *
+ *	Merge the nodes of a channel trie into a compiled route.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Sub-routes and data are allocated as needed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RouteAdd(Route *routePtr, Trie *triePtr, int chan)
+{
+    Tcl_HashEntry *hPtr;
+    RouteData     *dataPtr;
+    Branch        *branchPtr;
+    Route         *subPtr;
+    Node          *nodePtr;
+    int            i, j, n, new;
+
+    if (triePtr->indexnode != NULL) {
+	n = Ns_IndexCount(triePtr->indexnode);
+	if (n > 0) {
+	    routePtr->data = ns_realloc(routePtr->data,
+		    sizeof(RouteData) * (routePtr->ndata + n));
+	}
+	for (i = 0; i < n; ++i) {
+	    nodePtr = Ns_IndexEl(triePtr->indexnode, i);
+
+	    /*
+	     * Insert sorted by id, after data of earlier channels.
+	     */
+
+	    for (j = routePtr->ndata; j > 0
+		     && routePtr->data[j - 1].id > nodePtr->id; --j) {
+		routePtr->data[j] = routePtr->data[j - 1];
+	    }
+	    dataPtr = &routePtr->data[j];
+	    dataPtr->id = nodePtr->id;
+	    dataPtr->chan = chan;
+	    dataPtr->dataInherit = nodePtr->dataInherit;
+	    dataPtr->dataNoInherit = nodePtr->dataNoInherit;
+	    ++routePtr->ndata;
+	}
+    }
+    n = Ns_IndexCount(&triePtr->branches);
+    for (i = 0; i < n; ++i) {
+	branchPtr = Ns_IndexEl(&triePtr->branches, i);
+	hPtr = Tcl_CreateHashEntry(&routePtr->children, branchPtr->word, &new);
+	if (new) {
+	    subPtr = ns_malloc(sizeof(Route));
+	    RouteInit(subPtr);
+	    Tcl_SetHashValue(hPtr, subPtr);
+	} else {
+	    subPtr = Tcl_GetHashValue(hPtr);
+	}
+	RouteAdd(subPtr, &branchPtr->node, chan);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RouteFree --
+ *
+ *	Free a compiled route node and its sub-routes.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RouteFree(Route *routePtr)
+{
+    Tcl_HashEntry  *hPtr;
+    Tcl_HashSearch  search;
+    Route          *subPtr;
+
+    hPtr = Tcl_FirstHashEntry(&routePtr->children, &search);
+    while (hPtr != NULL) {
+	subPtr = Tcl_GetHashValue(hPtr);
+	RouteFree(subPtr);
+	ns_free(subPtr);
+	hPtr = Tcl_NextHashEntry(&search);
+    }
+    Tcl_DeleteHashTable(&routePtr->children);
+    if (routePtr->data != NULL) {
+	ns_free(routePtr->data);
+    }
+}
+
 
 /*
  *----------------------------------------------------------------------
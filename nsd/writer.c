@@ -0,0 +1,615 @@
+/*
+ * The contents of this file are subject to the AOLserver Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://aolserver.com/.
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is AOLserver Code and related documentation
+ * distributed by AOL.
+ * 
+ * The Initial Developer of the Original Code is America Online,
+ * Inc. Portions created by AOL are Copyright (C) 1999 America Online,
+ * Inc. All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+
+/*
+ * writer.c --
+ *
+ *	Support for driver writer threads which send large responses
+ *	to clients, releasing connection threads as soon as the
+ *	complete response is available.
+ */
+
+static const char *RCSID = "@(#) $Header$, compiled: " __DATE__ " " __TIME__;
+
+#include "nsd.h"
+
+/*
+ * The following structure defines a response queued for a writer
+ * thread: the pending bytes of the buffer, i.e., headers and any
+ * content, followed by the pending range of an open file.
+ */
+
+typedef struct WriterSock {
+    struct WriterSock *nextPtr;
+    Sock	*sockPtr;	/* Client socket. */
+    Conn	*connPtr;	/* Connection held for its traces. */
+    int		 keep;		/* Keepalive requested by conn thread. */
+    int		 pidx;		/* poll() index. */
+    int		 fd;		/* Duped file descriptor or -1. */
+    off_t	 off;		/* Next offset in file. */
+    size_t	 nfile;		/* Remaining bytes in file. */
+    char	*buf;		/* Next byte in buffer. */
+    size_t	 nbuf;		/* Remaining bytes in buffer. */
+    Ns_Time	 timeout;	/* Time to abandon a stalled client. */
+    char	 data[1];	/* Copied buffer data. */
+} WriterSock;
+
+/*
+ * The following structure defines a writer thread of a driver.
+ */
+
+typedef struct Writer {
+    Driver	*drvPtr;
+    int		 idx;
+    Ns_Thread	 thread;
+    Ns_Mutex	 lock;		/* Lock around queue and shutdown. */
+    SOCKET	 trigger[2];	/* Wakeup trigger pipe. */
+    WriterSock	*queuePtr;	/* Responses waiting for the writer. */
+    int		 shutdown;
+} Writer;
+
+/*
+ * Local functions defined in this file
+ */
+
+static Ns_ThreadProc WriterThread;
+static void WriterTrigger(Writer *wrPtr);
+static int WriterSend(WriterSock *wsPtr);
+static void WriterDone(WriterSock *wsPtr, int ok);
+static void ReleaseConn(Conn *connPtr, int flag);
+
+/*
+ * Static variables defined in this file.
+ */
+
+static Ns_Mutex lock;	/* Lock around Conn wrflags. */
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsWriterQueue --
+ *
+ *	Attach a complete response to the connection's socket for
+ *	delivery by a writer thread once the connection is closed.
+ *	The content is either the given buffer or, if buf is NULL,
+ *	nsend bytes of the open file at the given offset or at the
+ *	current file position if off is less than zero.
+ *
+ * Results:
+ *	1 if queued, 0 if the driver has no writers or the response
+ *	is too small or not from a regular file in which case the
+ *	caller must send it.
+ *
+ * Side effects:
+ *	Pending headers are moved with the content and the file
+ *	descriptor is duped so the caller may close it.  The conn is
+ *	held after the request for the writer which counts the bytes
+ *	sent and then releases it to run the traces.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsWriterQueue(Ns_Conn *conn, int fd, off_t off, int nsend, char *buf)
+{
+    Conn *connPtr = (Conn *) conn;
+    Sock *sockPtr = connPtr->sockPtr;
+    WriterSock *wsPtr;
+    struct stat st;
+    size_t hlen, blen;
+    int wfd;
+
+    if (sockPtr == NULL || sockPtr->drvPtr->nwriters == 0
+	    || sockPtr->wrSockPtr != NULL
+	    || nsend < sockPtr->drvPtr->writersize) {
+	return 0;
+    }
+    wfd = -1;
+    blen = nsend;
+    if (buf == NULL) {
+	if (off < 0) {
+	    off = lseek(fd, (off_t) 0, SEEK_CUR);
+	}
+	if (off < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+		|| (wfd = dup(fd)) < 0) {
+	    return 0;
+	}
+	Ns_CloseOnExec(wfd);
+	blen = 0;
+    }
+    hlen = connPtr->obuf.length;
+    wsPtr = ns_malloc(sizeof(WriterSock) + hlen + blen);
+    memcpy(wsPtr->data, connPtr->obuf.string, hlen);
+    if (blen > 0) {
+	memcpy(wsPtr->data + hlen, buf, blen);
+    }
+    wsPtr->buf = wsPtr->data;
+    wsPtr->nbuf = hlen + blen;
+    wsPtr->fd = wfd;
+    wsPtr->off = off;
+    wsPtr->nfile = (wfd < 0 ? 0 : nsend);
+    wsPtr->sockPtr = sockPtr;
+    wsPtr->connPtr = connPtr;
+    wsPtr->keep = 0;
+    sockPtr->wrSockPtr = wsPtr;
+    connPtr->wrflags = WRITER_QUEUED;
+    Tcl_DStringTrunc(&connPtr->obuf, 0);
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsWriterStart --
+ *
+ *	Hand a socket with a queued response to a writer thread,
+ *	called by NsSockClose when the connection is closed.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Writer thread will send the response and then close the
+ *	socket or return it to the driver for keepalive.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsWriterStart(Sock *sockPtr, int keep)
+{
+    Driver *drvPtr = sockPtr->drvPtr;
+    WriterSock *wsPtr = sockPtr->wrSockPtr;
+    Writer *wrPtr;
+
+    sockPtr->wrSockPtr = NULL;
+    wsPtr->keep = keep;
+    wrPtr = &drvPtr->writers[sockPtr->id % drvPtr->nwriters];
+    Ns_MutexLock(&wrPtr->lock);
+    wsPtr->nextPtr = wrPtr->queuePtr;
+    wrPtr->queuePtr = wsPtr;
+    Ns_MutexUnlock(&wrPtr->lock);
+    WriterTrigger(wrPtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsStartWriters --
+ *
+ *	Create the writer threads of a driver thread, if any.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Threads are created.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsStartWriters(Driver *drvPtr)
+{
+    Writer *wrPtr;
+    int i;
+
+    if (drvPtr->nwriters == 0) {
+	return;
+    }
+    drvPtr->writers = ns_calloc((size_t) drvPtr->nwriters, sizeof(Writer));
+    for (i = 0; i < drvPtr->nwriters; ++i) {
+	wrPtr = &drvPtr->writers[i];
+	wrPtr->drvPtr = drvPtr;
+	wrPtr->idx = i;
+	Ns_MutexSetName2(&wrPtr->lock, "ns:writer", drvPtr->module);
+	if (ns_sockpair(wrPtr->trigger) != 0) {
+	    Ns_Fatal("ns_sockpair() failed: %s",
+		     ns_sockstrerror(ns_sockerrno));
+	}
+	Ns_ThreadCreate(WriterThread, wrPtr, 0, &wrPtr->thread);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsStopWriters --
+ *
+ *	Signal and wait for the writer threads of a driver thread,
+ *	called after the driver has finished all active sockets.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Writer threads are joined and freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsStopWriters(Driver *drvPtr)
+{
+    Writer *wrPtr;
+    int i;
+
+    if (drvPtr->writers == NULL) {
+	return;
+    }
+    for (i = 0; i < drvPtr->nwriters; ++i) {
+	wrPtr = &drvPtr->writers[i];
+	Ns_MutexLock(&wrPtr->lock);
+	wrPtr->shutdown = 1;
+	Ns_MutexUnlock(&wrPtr->lock);
+	WriterTrigger(wrPtr);
+    }
+    for (i = 0; i < drvPtr->nwriters; ++i) {
+	wrPtr = &drvPtr->writers[i];
+	Ns_ThreadJoin(&wrPtr->thread, NULL);
+	ns_sockclose(wrPtr->trigger[0]);
+	ns_sockclose(wrPtr->trigger[1]);
+	Ns_MutexDestroy(&wrPtr->lock);
+    }
+    ns_free(drvPtr->writers);
+    drvPtr->writers = NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriterThread --
+ *
+ *	Multiplex sends of queued responses, writing to each client
+ *	as its socket becomes writable.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Clients which make no progress within the driver sendwait
+ *	are dropped.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WriterThread(void *arg)
+{
+    Writer *wrPtr = arg;
+    Driver *drvPtr = wrPtr->drvPtr;
+    WriterSock *wsPtr, *nextPtr, *activePtr, *newPtr;
+    struct pollfd *pfds;
+    Ns_Time now, *timeoutPtr;
+    Tcl_DString ds;
+    int nfds, maxfds, status, stop;
+    char c;
+
+    Tcl_DStringInit(&ds);
+    Ns_DStringPrintf(&ds, "-%s:writer", drvPtr->module);
+    if (drvPtr->tidx > 0) {
+	Ns_DStringPrintf(&ds, "%d", drvPtr->tidx);
+    }
+    Ns_DStringPrintf(&ds, ":%d-", wrPtr->idx);
+    Ns_ThreadSetName(ds.string);
+    Tcl_DStringFree(&ds);
+    Ns_Log(Notice, "starting");
+
+    maxfds = 100;
+    pfds = ns_malloc(sizeof(struct pollfd) * maxfds);
+    pfds[0].fd = wrPtr->trigger[0];
+    pfds[0].events = POLLIN;
+    activePtr = NULL;
+    stop = 0;
+    while (!stop || activePtr != NULL) {
+
+	/*
+	 * Poll the trigger pipe and each active client for
+	 * writability until the earliest timeout.
+	 */
+
+	nfds = 1;
+	timeoutPtr = NULL;
+	for (wsPtr = activePtr; wsPtr != NULL; wsPtr = wsPtr->nextPtr) {
+	    if (nfds == maxfds) {
+		maxfds += 100;
+		pfds = ns_realloc(pfds, sizeof(struct pollfd) * maxfds);
+	    }
+	    pfds[nfds].fd = wsPtr->sockPtr->sock;
+	    pfds[nfds].events = POLLOUT;
+	    wsPtr->pidx = nfds++;
+	    if (timeoutPtr == NULL
+		    || Ns_DiffTime(&wsPtr->timeout, timeoutPtr, NULL) < 0) {
+		timeoutPtr = &wsPtr->timeout;
+	    }
+	}
+	NsPoll(pfds, nfds, timeoutPtr);
+	if ((pfds[0].revents & POLLIN)
+		&& recv(wrPtr->trigger[0], &c, 1, 0) != 1) {
+	    Ns_Fatal("writer: trigger recv() failed: %s",
+		     ns_sockstrerror(ns_sockerrno));
+	}
+
+	Ns_MutexLock(&wrPtr->lock);
+	newPtr = wrPtr->queuePtr;
+	wrPtr->queuePtr = NULL;
+	stop = wrPtr->shutdown;
+	Ns_MutexUnlock(&wrPtr->lock);
+
+	/*
+	 * Send on writable sockets, dropping those that stalled.
+	 */
+
+	Ns_GetTime(&now);
+	wsPtr = activePtr;
+	activePtr = NULL;
+	while (wsPtr != NULL) {
+	    nextPtr = wsPtr->nextPtr;
+	    if (pfds[wsPtr->pidx].revents) {
+		status = WriterSend(wsPtr);
+	    } else if (Ns_DiffTime(&wsPtr->timeout, &now, NULL) <= 0) {
+		Ns_Log(Notice, "writer: timeout sending to %s",
+		       ns_inet_ntoa(wsPtr->sockPtr->sa.sin_addr));
+		status = NS_ERROR;
+	    } else {
+		status = NS_TIMEOUT;
+	    }
+	    if (status == NS_TIMEOUT) {
+		if (pfds[wsPtr->pidx].revents) {
+		    wsPtr->timeout = now;
+		    Ns_IncrTime(&wsPtr->timeout, drvPtr->sendwait, 0);
+		}
+		wsPtr->nextPtr = activePtr;
+		activePtr = wsPtr;
+	    } else {
+		WriterDone(wsPtr, status == NS_OK);
+	    }
+	    wsPtr = nextPtr;
+	}
+
+	/*
+	 * Start new responses with an immediate send which often
+	 * completes without polling.
+	 */
+
+	while (newPtr != NULL) {
+	    nextPtr = newPtr->nextPtr;
+	    status = WriterSend(newPtr);
+	    if (status == NS_TIMEOUT) {
+		newPtr->timeout = now;
+		Ns_IncrTime(&newPtr->timeout, drvPtr->sendwait, 0);
+		newPtr->nextPtr = activePtr;
+		activePtr = newPtr;
+	    } else {
+		WriterDone(newPtr, status == NS_OK);
+	    }
+	    newPtr = nextPtr;
+	}
+    }
+    ns_free(pfds);
+    Ns_Log(Notice, "exiting");
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriterSend --
+ *
+ *	Send as much of the pending buffer and file as the socket
+ *	will accept without blocking.
+ *
+ * Results:
+ *	NS_OK if complete, NS_TIMEOUT if the socket would block, or
+ *	NS_ERROR on a send error or truncated file.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+WriterSend(WriterSock *wsPtr)
+{
+    Sock *sockPtr = wsPtr->sockPtr;
+    int n, flags;
+
+    while (wsPtr->nbuf > 0 || wsPtr->nfile > 0) {
+	if (wsPtr->nbuf > 0) {
+	    flags = 0;
+#ifdef MSG_MORE
+	    if (wsPtr->nfile > 0) {
+		flags = MSG_MORE;
+	    }
+#endif
+	    n = send(sockPtr->sock, wsPtr->buf, wsPtr->nbuf, flags);
+	    if (n > 0) {
+		wsPtr->buf += n;
+		wsPtr->nbuf -= n;
+	    }
+	} else {
+#ifdef HAVE_SYS_SENDFILE_H
+	    n = sendfile(sockPtr->sock, wsPtr->fd, &wsPtr->off, wsPtr->nfile);
+	    if (n == 0) {
+		Ns_Log(Warning, "writer: file truncated, %lu bytes unsent",
+		       (unsigned long) wsPtr->nfile);
+		return NS_ERROR;
+	    }
+	    if (n > 0) {
+		wsPtr->nfile -= n;
+	    }
+#else
+	    /* NB: Not reached, writers require NS_DRIVER_SENDFILE. */
+	    return NS_ERROR;
+#endif
+	}
+	if (n < 0) {
+	    return (ns_sockerrno == EWOULDBLOCK ? NS_TIMEOUT : NS_ERROR);
+	}
+	wsPtr->connPtr->nContentSent += n;
+	++sockPtr->nwrites;
+    }
+    return NS_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriterDone --
+ *
+ *	Return the socket of a finished response to the driver.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Socket is reused for keepalive only if the complete response
+ *	was sent.  The conn is released to run its traces.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WriterDone(WriterSock *wsPtr, int ok)
+{
+    if (wsPtr->fd >= 0) {
+	close(wsPtr->fd);
+    }
+    NsSockClose(wsPtr->sockPtr, wsPtr->keep && ok);
+    ReleaseConn(wsPtr->connPtr, WRITER_DONE);
+    ns_free(wsPtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsWriterRelease, ReleaseConn --
+ *
+ *	Release a conn held for a writer thread, called by the conn
+ *	thread when the request is finished, noting whether traces
+ *	are to be called, and by the writer when the send is finished.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The last to release queues the conn again to run the traces
+ *	and cleanups.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsWriterRelease(Conn *connPtr, int trace)
+{
+    ReleaseConn(connPtr, WRITER_RELEASED | (trace ? WRITER_TRACE : 0));
+}
+
+static void
+ReleaseConn(Conn *connPtr, int flag)
+{
+    int queue;
+
+    Ns_MutexLock(&lock);
+    connPtr->wrflags |= flag;
+    queue = ((connPtr->wrflags & (WRITER_RELEASED|WRITER_DONE))
+	     == (WRITER_RELEASED|WRITER_DONE));
+    Ns_MutexUnlock(&lock);
+    if (queue) {
+	NsQueueConn(connPtr);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsWriterFree --
+ *
+ *	Free a response which was queued but never handed to a
+ *	writer thread, called when the socket is closed directly.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The duped file descriptor is closed and the conn released.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsWriterFree(Sock *sockPtr)
+{
+    WriterSock *wsPtr = sockPtr->wrSockPtr;
+
+    if (wsPtr != NULL) {
+	sockPtr->wrSockPtr = NULL;
+	if (wsPtr->fd >= 0) {
+	    close(wsPtr->fd);
+	}
+	ReleaseConn(wsPtr->connPtr, WRITER_DONE);
+	ns_free(wsPtr);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriterTrigger --
+ *
+ *	Wakeup a writer thread.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WriterTrigger(Writer *wrPtr)
+{
+    if (send(wrPtr->trigger[1], "", 1, 0) != 1) {
+	Ns_Fatal("writer: trigger send() failed: %s",
+		 ns_sockstrerror(ns_sockerrno));
+    }
+}
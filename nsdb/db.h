@@ -42,6 +42,12 @@ extern struct DbDriver *NsDbGetDriver(Ns_DbHandle *);
 extern struct DbDriver *NsDbLoadDriver(char *driver);
 extern void 		NsDbLogSql(Ns_DbHandle *, char *sql);
 extern int 		NsDbOpen(Ns_DbHandle *);
+extern int 		NsDbPing(Ns_DbHandle *, char *sql);
+extern void	       *NsDbPrepare(Ns_DbHandle *, char *sql);
+extern int 		NsDbExecPrepared(Ns_DbHandle *, void *stmt, char *sql,
+					 int nvalues, char **values);
+extern void 		NsDbFreePrepared(Ns_DbHandle *, void *stmt);
+extern int 		NsDbPoolStats(char *pool, Tcl_DString *dsPtr);
 extern void 		NsDbDriverInit(char *server, struct DbDriver *);
 
 #endif
@@ -62,6 +62,11 @@ typedef int (SpExecProc) (Ns_DbHandle *handle);
 typedef int (SpReturnCodeProc) (Ns_DbHandle *dbhandle, char *returnCode,
 				int bufsize);
 typedef Ns_Set *(SpGetParamsProc) (Ns_DbHandle *handle);
+typedef int (PingProc) (Ns_DbHandle *handle);
+typedef void *(PrepareProc) (Ns_DbHandle *handle, char *sql);
+typedef int (ExecPreparedProc) (Ns_DbHandle *handle, void *stmt,
+				int nvalues, char **values);
+typedef void (FreePreparedProc) (Ns_DbHandle *handle, void *stmt);
 
 /*
  * The following structure specifies the driver-specific functions
@@ -89,6 +94,10 @@ typedef struct DbDriver {
     SpExecProc       *spexecProc;
     SpReturnCodeProc *spreturncodeProc;
     SpGetParamsProc  *spgetparamsProc;
+    PingProc         *pingProc;
+    PrepareProc      *prepareProc;
+    ExecPreparedProc *execpreparedProc;
+    FreePreparedProc *freepreparedProc;
 } DbDriver;
     
 /*
@@ -203,6 +212,22 @@ Ns_DbRegisterDriver(char *driver, Ns_DbProc *procs)
 		driverPtr->spgetparamsProc = (SpGetParamsProc *) procs->func;
 		break;
 
+	    case DbFn_Ping:
+		driverPtr->pingProc = (PingProc *) procs->func;
+		break;
+
+	    case DbFn_Prepare:
+		driverPtr->prepareProc = (PrepareProc *) procs->func;
+		break;
+
+	    case DbFn_ExecPrepared:
+		driverPtr->execpreparedProc = (ExecPreparedProc *) procs->func;
+		break;
+
+	    case DbFn_FreePrepared:
+		driverPtr->freepreparedProc = (FreePreparedProc *) procs->func;
+		break;
+
 	    /*
 	     * The following functions are no longer supported.
 	     */
@@ -593,6 +618,156 @@ Ns_DbResetHandle (Ns_DbHandle *handle)
     return status;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsDbPing --
+ *
+ *	Check that an idle handle is still connected to the database,
+ *	using the driver's DbFn_Ping function if registered or else
+ *	the given probe statement, if any.
+ *
+ * Results:
+ *	NS_OK if the handle appears alive or could not be probed,
+ *	NS_ERROR if the probe failed.
+ *
+ * Side effects:
+ *	Any exception left by a failed probe is cleared.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsDbPing(Ns_DbHandle *handle, char *sql)
+{
+    DbDriver *driverPtr = NsDbGetDriver(handle);
+    int status = NS_OK;
+
+    if (!handle->connected || driverPtr == NULL) {
+	return NS_ERROR;
+    }
+    if (driverPtr->pingProc != NULL) {
+	status = (*driverPtr->pingProc)(handle);
+    } else if (sql != NULL) {
+	status = Ns_DbExec(handle, sql);
+	if (status == NS_ROWS) {
+	    status = Ns_DbFlush(handle);
+	} else if (status == NS_DML) {
+	    status = NS_OK;
+	}
+    }
+    if (status != NS_OK) {
+	handle->cExceptionCode[0] = '\0';
+	Ns_DStringFree(&handle->dsExceptionMsg);
+	status = NS_ERROR;
+    }
+    return status;
+}
+
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsDbPrepare --
+ *
+ *	Have the driver parse an SQL statement with bind variables
+ *	for later execution with NsDbExecPrepared.  This routine is
+ *	called from the per-handle statement cache in dbinit.c.
+ *
+ * Results:
+ *	Driver statement or NULL on error.
+ *
+ * Side effects:
+ *	Exception is set if the driver does not support prepared
+ *	statements.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void *
+NsDbPrepare(Ns_DbHandle *handle, char *sql)
+{
+    DbDriver *driverPtr = NsDbGetDriver(handle);
+    void *stmt = NULL;
+
+    if (handle->connected && driverPtr != NULL) {
+	if (driverPtr->prepareProc == NULL
+		|| driverPtr->execpreparedProc == NULL) {
+	    Ns_DbSetException(handle, "NSDB",
+		"Prepared statements not supported by driver.");
+	} else {
+	    stmt = (*driverPtr->prepareProc)(handle, sql);
+	}
+    }
+
+    return stmt;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsDbExecPrepared --
+ *
+ *	Execute a statement returned by NsDbPrepare with the given
+ *	bind values.
+ *
+ * Results:
+ *	NS_DML, NS_ROWS, or NS_ERROR.
+ *
+ * Side effects:
+ *	Rows, if any, are fetched as after Ns_DbExec.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsDbExecPrepared(Ns_DbHandle *handle, void *stmt, char *sql, int nvalues,
+		 char **values)
+{
+    DbDriver *driverPtr = NsDbGetDriver(handle);
+    int status = NS_ERROR;
+
+    if (handle->connected &&
+	driverPtr != NULL &&
+	driverPtr->execpreparedProc != NULL) {
+
+	status = (*driverPtr->execpreparedProc)(handle, stmt, nvalues, values);
+	NsDbLogSql(handle, sql);
+    }
+
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsDbFreePrepared --
+ *
+ *	Release a statement returned by NsDbPrepare.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsDbFreePrepared(Ns_DbHandle *handle, void *stmt)
+{
+    DbDriver *driverPtr = NsDbGetDriver(handle);
+
+    if (driverPtr != NULL && driverPtr->freepreparedProc != NULL) {
+	(*driverPtr->freepreparedProc)(handle, stmt);
+    }
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -59,6 +59,7 @@ typedef struct Pool {
     struct DbDriver  *driverPtr;
     int		    waiting;
     int             nhandles;
+    struct Handle **handles;
     struct Handle  *firstPtr;
     struct Handle  *lastPtr;
     int             fVerbose;
@@ -66,8 +67,26 @@ typedef struct Pool {
     time_t          maxidle;
     time_t          maxopen;
     int             stale_on_close;
+    int             minconnected;
+    int             warming;
+    time_t          pinginterval;
+    char           *pingquery;
+    int             maxprepared;
 }               Pool;
 
+/*
+ * The following structure defines a prepared statement
+ * cached on a handle, keyed by SQL text and linked in
+ * most recently used order.
+ */
+
+typedef struct Prepared {
+    struct Prepared *nextPtr;
+    struct Prepared *prevPtr;
+    Tcl_HashEntry   *hPtr;
+    void            *stmt;
+}               Prepared;
+
 /*
  * The following structure defines the internal
  * state of a database handle.
@@ -95,6 +114,13 @@ typedef struct Handle {
     time_t          atime;
     int             stale;
     int             stale_on_close;
+    time_t          ptime;
+    Tcl_HashTable   prepared;
+    struct Prepared *firstPrepPtr;
+    struct Prepared *lastPrepPtr;
+    unsigned long   nhits;
+    unsigned long   nmisses;
+    unsigned long   nevicted;
 }               Handle;
 
 /*
@@ -112,13 +138,18 @@ typedef struct ServData {
 
 static Pool    *GetPool(char *pool);
 static void     ReturnHandle(Handle * handle);
-static int      IsStale(Handle *, time_t now);
+static int      IsStale(Handle *, time_t now, int idle);
 static int	Connect(Handle *);
+static Handle  *TakeHandle(Pool *poolPtr, time_t since);
+static void	ScheduleWarm(Pool *poolPtr);
+static Prepared *GetPrepared(Handle *handlePtr, char *sql);
+static void	FreePrepared(Handle *handlePtr, Prepared *prepPtr);
 static Pool    *CreatePool(char *pool, char *path, char *driver);
 static int	IncrCount(Pool *poolPtr, int incr);
 static ServData *GetServer(char *server);
 static Ns_TlsCleanup FreeTable;
 static Ns_Callback CheckPool;
+static Ns_SchedProc WarmPool;
 static Ns_ArgProc CheckArgProc;
 
 /*
@@ -281,11 +312,12 @@ Ns_DbPoolPutHandle(Ns_DbHandle *handle)
 
     /*
      * Close the handle if it's stale, otherwise update
-     * the last access time.
+     * the last access time.  Idle handles are left to
+     * CheckPool when the pool keeps a minimum connected.
      */
 
     time(&now);
-    if (IsStale(handlePtr, now)) {
+    if (IsStale(handlePtr, now, poolPtr->minconnected == 0)) {
         NsDbDisconnect(handle);
     } else {
         handlePtr->atime = now;
@@ -520,6 +552,8 @@ Ns_DbPoolTimedGetMultipleHandles(Ns_DbHandle **handles, char *pool,
  *
  * Side effects:
  *	Handles are all marked stale and then closed by CheckPool.
+ *	The pool's minimum connected handles are then reopened in
+ *	the background.
  *
  *----------------------------------------------------------------------
  */
@@ -546,10 +580,67 @@ Ns_DbBouncePool(char *pool)
     }
     Ns_MutexUnlock(&poolPtr->lock);
     CheckPool(poolPtr);
+    ScheduleWarm(poolPtr);
 
     return NS_OK;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_DbPrepare --
+ *
+ *	Prepare an SQL statement with bind variables on a handle,
+ *	reusing the statement cached for the same SQL text if any.
+ *
+ * Results:
+ *	NS_OK or NS_ERROR.
+ *
+ * Side effects:
+ *	The least recently used statement is released if the
+ *	handle already caches the pool's maxprepared statements.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ns_DbPrepare(Ns_DbHandle *handle, char *sql)
+{
+    return (GetPrepared((Handle *) handle, sql) != NULL ? NS_OK : NS_ERROR);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_DbExecPrepared --
+ *
+ *	Execute an SQL statement with the given bind values,
+ *	preparing it first unless already cached on the handle.
+ *
+ * Results:
+ *	NS_DML, NS_ROWS, or NS_ERROR.
+ *
+ * Side effects:
+ *	See Ns_DbPrepare.  Rows, if any, are fetched as after
+ *	Ns_DbExec.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ns_DbExecPrepared(Ns_DbHandle *handle, char *sql, int nvalues, char **values)
+{
+    Prepared *prepPtr;
+
+    prepPtr = GetPrepared((Handle *) handle, sql);
+    if (prepPtr == NULL) {
+	return NS_ERROR;
+    }
+    return NsDbExecPrepared(handle, prepPtr->stmt, sql, nvalues, values);
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -602,6 +693,7 @@ NsDbInitPools(void)
 	}
     }
     Ns_RegisterProcInfo(CheckPool, "nsdb:check", CheckArgProc);
+    Ns_RegisterProcInfo(WarmPool, "nsdb:warm", CheckArgProc);
 }
 
 
@@ -701,7 +793,7 @@ NsDbInitServer(char *server)
  *	None.
  *
  * Side effects:
- *	None.
+ *	Cached prepared statements are released.
  *
  *----------------------------------------------------------------------
  */
@@ -711,6 +803,9 @@ NsDbDisconnect(Ns_DbHandle *handle)
 {
     Handle *handlePtr = (Handle *) handle;
 
+    while (handlePtr->firstPrepPtr != NULL) {
+	FreePrepared(handlePtr, handlePtr->firstPrepPtr);
+    }
     NsDbClose(handle);
     handlePtr->connected = NS_FALSE;
     handlePtr->atime = handlePtr->otime = 0;
@@ -780,6 +875,62 @@ NsDbGetDriver(Ns_DbHandle *handle)
     return NULL;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsDbPoolStats --
+ *
+ *	Append prepared statement cache statistics for a pool,
+ *	summed over the counts of its handles.
+ *
+ * Results:
+ *	NS_OK or NS_ERROR if no such pool.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsDbPoolStats(char *pool, Tcl_DString *dsPtr)
+{
+    Pool          *poolPtr;
+    Handle        *handlePtr;
+    unsigned long  nhits, nmisses, nevicted;
+    int            i;
+    char           buf[100];
+
+    poolPtr = GetPool(pool);
+    if (poolPtr == NULL) {
+	return NS_ERROR;
+    }
+    nhits = nmisses = nevicted = 0;
+    Ns_MutexLock(&poolPtr->lock);
+    for (i = 0; i < poolPtr->nhandles; ++i) {
+	handlePtr = poolPtr->handles[i];
+	nhits += handlePtr->nhits;
+	nmisses += handlePtr->nmisses;
+	nevicted += handlePtr->nevicted;
+    }
+    Ns_MutexUnlock(&poolPtr->lock);
+    sprintf(buf, "%d", poolPtr->maxprepared);
+    Tcl_DStringAppendElement(dsPtr, "maxprepared");
+    Tcl_DStringAppendElement(dsPtr, buf);
+    sprintf(buf, "%lu", nhits);
+    Tcl_DStringAppendElement(dsPtr, "hits");
+    Tcl_DStringAppendElement(dsPtr, buf);
+    sprintf(buf, "%lu", nmisses);
+    Tcl_DStringAppendElement(dsPtr, "misses");
+    Tcl_DStringAppendElement(dsPtr, buf);
+    sprintf(buf, "%lu", nevicted);
+    Tcl_DStringAppendElement(dsPtr, "evicted");
+    Tcl_DStringAppendElement(dsPtr, buf);
+
+    return NS_OK;
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -817,8 +968,9 @@ GetPool(char *pool)
  * ReturnHandle --
  *
  *	Return a handle to its pool.  Connected handles are pushed on
- *	the front of the list, disconnected handles are appened to
- *	the end.
+ *	the front of the list ordered by last access so the most
+ *	recently used handles are reused first and the rest age out
+ *	by maxidle, disconnected handles are appened to the end.
  *
  * Results:
  *	None.
@@ -835,14 +987,23 @@ static void
 ReturnHandle(Handle *handlePtr)
 {
     Pool         *poolPtr;
+    Handle      **nextPtrPtr;
 
     poolPtr = handlePtr->poolPtr;
     if (poolPtr->firstPtr == NULL) {
 	poolPtr->firstPtr = poolPtr->lastPtr = handlePtr;
     	handlePtr->nextPtr = NULL;
     } else if (handlePtr->connected) {
-	handlePtr->nextPtr = poolPtr->firstPtr;
-	poolPtr->firstPtr = handlePtr;
+	nextPtrPtr = &poolPtr->firstPtr;
+	while (*nextPtrPtr != NULL && (*nextPtrPtr)->connected
+		&& (*nextPtrPtr)->atime > handlePtr->atime) {
+	    nextPtrPtr = &(*nextPtrPtr)->nextPtr;
+	}
+	handlePtr->nextPtr = *nextPtrPtr;
+	*nextPtrPtr = handlePtr;
+	if (handlePtr->nextPtr == NULL) {
+	    poolPtr->lastPtr = handlePtr;
+	}
     } else {
 	poolPtr->lastPtr->nextPtr = handlePtr;
 	poolPtr->lastPtr = handlePtr;
@@ -856,7 +1017,8 @@ ReturnHandle(Handle *handlePtr)
  *
  * IsStale --
  *
- *	Check to see if a handle is stale.
+ *	Check to see if a handle is stale.  Idle time is only
+ *	considered if idle is set.
  *
  * Results:
  *	NS_TRUE if handle stale, NS_FALSE otherwise.
@@ -868,21 +1030,22 @@ ReturnHandle(Handle *handlePtr)
  */
 
 static int
-IsStale(Handle *handlePtr, time_t now)
+IsStale(Handle *handlePtr, time_t now, int idle)
 {
     time_t    minAccess, minOpen;
     
     if (handlePtr->connected) {
 	minAccess = now - handlePtr->poolPtr->maxidle;
 	minOpen = now - handlePtr->poolPtr->maxopen;
-	if ((handlePtr->poolPtr->maxidle && handlePtr->atime < minAccess) || 
+	if ((idle && handlePtr->poolPtr->maxidle
+		&& handlePtr->atime < minAccess) ||
 	    (handlePtr->poolPtr->maxopen && (handlePtr->otime < minOpen)) ||
 	    (handlePtr->stale == NS_TRUE) ||
 	    (handlePtr->poolPtr->stale_on_close > handlePtr->stale_on_close)) {
 
 	    if (handlePtr->poolPtr->fVerbose) {
 		Ns_Log(Notice, "dbinit: closing %s handle in pool '%s'",
-		       handlePtr->atime < minAccess ? "idle" : "old",
+		       idle && handlePtr->atime < minAccess ? "idle" : "old",
 		       handlePtr->poolname);
 	    }
 	    return NS_TRUE;
@@ -929,7 +1092,8 @@ CheckArgProc(Tcl_DString *dsPtr, void *arg)
  *	None.
  *
  * Side effects:
- *	Stale handles, if any, are closed.
+ *	Stale handles, if any, are closed.  The most recently used
+ *	minconnected handles are not closed for being idle.
  *
  *----------------------------------------------------------------------
  */
@@ -941,9 +1105,11 @@ CheckPool(void *arg)
     Handle       *handlePtr, *nextPtr;
     Handle       *checkedPtr;
     time_t	  now;
+    int		  nkeep;
 
     time(&now);
     checkedPtr = NULL;
+    nkeep = 0;
 
     /*
      * Grab the entire list of handles from the pool.
@@ -955,16 +1121,18 @@ CheckPool(void *arg)
     Ns_MutexUnlock(&poolPtr->lock);
 
     /*
-     * Run through the list of handles, closing any
-     * which have gone stale, and then return them
-     * all to the pool.
+     * Run through the list of handles, most recently used
+     * first, closing any which have gone stale, and then
+     * return them all to the pool.
      */
 
     if (handlePtr != NULL) {
     	while (handlePtr != NULL) {
 	    nextPtr = handlePtr->nextPtr;
-	    if (IsStale(handlePtr, now)) {
+	    if (IsStale(handlePtr, now, nkeep >= poolPtr->minconnected)) {
                 NsDbDisconnect((Ns_DbHandle *) handlePtr);
+	    } else if (handlePtr->connected) {
+		++nkeep;
 	    }
 	    handlePtr->nextPtr = checkedPtr;
 	    checkedPtr = handlePtr;
@@ -985,6 +1153,297 @@ CheckPool(void *arg)
     }
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WarmPool --
+ *
+ *	Scheduled callback to probe handles idle longer than the
+ *	pool's pinginterval and to open handles until minconnected
+ *	are connected.  Handles are taken from the pool one at a time
+ *	so the rest remain available while the database is contacted.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Handles which fail the probe are closed; new database
+ *	connections may be opened.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WarmPool(void *arg, int id)
+{
+    Pool   *poolPtr = arg;
+    Handle *handlePtr;
+    time_t  now;
+    int     status;
+
+    Ns_MutexLock(&poolPtr->lock);
+    if (poolPtr->warming) {
+	Ns_MutexUnlock(&poolPtr->lock);
+	return;
+    }
+    poolPtr->warming = 1;
+    Ns_MutexUnlock(&poolPtr->lock);
+
+    time(&now);
+    if (poolPtr->pinginterval > 0) {
+	while ((handlePtr = TakeHandle(poolPtr,
+				       now - poolPtr->pinginterval)) != NULL) {
+	    handlePtr->ptime = now;
+	    if (NsDbPing((Ns_DbHandle *) handlePtr,
+			 poolPtr->pingquery) != NS_OK) {
+		Ns_Log(Warning, "dbinit: closing dead handle in pool '%s'",
+		       poolPtr->name);
+		NsDbDisconnect((Ns_DbHandle *) handlePtr);
+	    }
+	    Ns_MutexLock(&poolPtr->lock);
+	    ReturnHandle(handlePtr);
+	    if (poolPtr->waiting) {
+		Ns_CondSignal(&poolPtr->getCond);
+	    }
+	    Ns_MutexUnlock(&poolPtr->lock);
+	}
+    }
+    status = NS_OK;
+    while (status == NS_OK && (handlePtr = TakeHandle(poolPtr, 0)) != NULL) {
+	status = Connect(handlePtr);
+	if (status == NS_OK) {
+	    handlePtr->ptime = handlePtr->otime;
+	    if (poolPtr->fVerbose) {
+		Ns_Log(Notice, "dbinit: opened warm handle in pool '%s'",
+		       poolPtr->name);
+	    }
+	}
+	Ns_MutexLock(&poolPtr->lock);
+	ReturnHandle(handlePtr);
+	if (poolPtr->waiting) {
+	    Ns_CondSignal(&poolPtr->getCond);
+	}
+	Ns_MutexUnlock(&poolPtr->lock);
+    }
+
+    Ns_MutexLock(&poolPtr->lock);
+    poolPtr->warming = 0;
+    Ns_MutexUnlock(&poolPtr->lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TakeHandle --
+ *
+ *	Remove a handle from the pool for WarmPool.  If since is
+ *	non-zero, the least recently used connected handle neither
+ *	accessed nor probed since that time is taken, otherwise
+ *	a disconnected handle if fewer than minconnected handles
+ *	are connected.
+ *
+ * Results:
+ *	Pointer to Handle or NULL if none needs attention.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Handle *
+TakeHandle(Pool *poolPtr, time_t since)
+{
+    Handle *handlePtr, *prevPtr, *takePtr, *takePrevPtr;
+    int     i, nconnected;
+
+    takePtr = takePrevPtr = prevPtr = NULL;
+    Ns_MutexLock(&poolPtr->lock);
+    for (handlePtr = poolPtr->firstPtr; handlePtr != NULL;
+	    handlePtr = handlePtr->nextPtr) {
+	if (!handlePtr->connected) {
+	    if (since == 0 && takePtr == NULL) {
+		takePtr = handlePtr;
+		takePrevPtr = prevPtr;
+	    }
+	} else if (since != 0 && !handlePtr->stale
+		   && handlePtr->atime < since && handlePtr->ptime < since) {
+	    takePtr = handlePtr;
+	    takePrevPtr = prevPtr;
+	}
+	prevPtr = handlePtr;
+    }
+    if (since == 0 && takePtr != NULL) {
+
+	/*
+	 * Count all handles, including those checked out, by their
+	 * own connected state.
+	 */
+
+	nconnected = 0;
+	for (i = 0; i < poolPtr->nhandles; ++i) {
+	    if (poolPtr->handles[i]->connected) {
+		++nconnected;
+	    }
+	}
+	if (nconnected >= poolPtr->minconnected) {
+	    takePtr = NULL;
+	}
+    }
+    if (takePtr != NULL) {
+	if (takePrevPtr == NULL) {
+	    poolPtr->firstPtr = takePtr->nextPtr;
+	} else {
+	    takePrevPtr->nextPtr = takePtr->nextPtr;
+	}
+	if (poolPtr->lastPtr == takePtr) {
+	    poolPtr->lastPtr = takePrevPtr;
+	}
+	takePtr->nextPtr = NULL;
+    }
+    Ns_MutexUnlock(&poolPtr->lock);
+
+    return takePtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ScheduleWarm --
+ *
+ *	Schedule a one-time background run of WarmPool to open the
+ *	pool's minimum connected handles, e.g., at startup or after
+ *	a bounce.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	See WarmPool.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ScheduleWarm(Pool *poolPtr)
+{
+    if (poolPtr->minconnected > 0) {
+	Ns_ScheduleProcEx(WarmPool, poolPtr, NS_SCHED_ONCE|NS_SCHED_THREAD,
+			  0, NULL);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetPrepared --
+ *
+ *	Find the cached statement for the given SQL on a handle,
+ *	or prepare and cache a new one, releasing the least recently
+ *	used statement when the cache is full.
+ *
+ * Results:
+ *	Pointer to Prepared or NULL if the driver failed to prepare.
+ *
+ * Side effects:
+ *	Handle hit, miss and eviction counts are updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Prepared *
+GetPrepared(Handle *handlePtr, char *sql)
+{
+    Pool          *poolPtr = handlePtr->poolPtr;
+    Prepared      *prepPtr;
+    Tcl_HashEntry *hPtr;
+    void          *stmt;
+    int            new;
+
+    hPtr = Tcl_FindHashEntry(&handlePtr->prepared, sql);
+    if (hPtr != NULL) {
+	prepPtr = Tcl_GetHashValue(hPtr);
+	if (prepPtr != handlePtr->firstPrepPtr) {
+	    prepPtr->prevPtr->nextPtr = prepPtr->nextPtr;
+	    if (prepPtr->nextPtr != NULL) {
+		prepPtr->nextPtr->prevPtr = prepPtr->prevPtr;
+	    } else {
+		handlePtr->lastPrepPtr = prepPtr->prevPtr;
+	    }
+	    prepPtr->prevPtr = NULL;
+	    prepPtr->nextPtr = handlePtr->firstPrepPtr;
+	    handlePtr->firstPrepPtr->prevPtr = prepPtr;
+	    handlePtr->firstPrepPtr = prepPtr;
+	}
+	++handlePtr->nhits;
+	return prepPtr;
+    }
+
+    prepPtr = NULL;
+    stmt = NsDbPrepare((Ns_DbHandle *) handlePtr, sql);
+    if (stmt != NULL) {
+	while (handlePtr->prepared.numEntries >= poolPtr->maxprepared) {
+	    FreePrepared(handlePtr, handlePtr->lastPrepPtr);
+	    ++handlePtr->nevicted;
+	}
+	prepPtr = ns_malloc(sizeof(Prepared));
+	prepPtr->stmt = stmt;
+	prepPtr->hPtr = Tcl_CreateHashEntry(&handlePtr->prepared, sql, &new);
+	Tcl_SetHashValue(prepPtr->hPtr, prepPtr);
+	prepPtr->prevPtr = NULL;
+	prepPtr->nextPtr = handlePtr->firstPrepPtr;
+	if (prepPtr->nextPtr != NULL) {
+	    prepPtr->nextPtr->prevPtr = prepPtr;
+	} else {
+	    handlePtr->lastPrepPtr = prepPtr;
+	}
+	handlePtr->firstPrepPtr = prepPtr;
+    }
+    ++handlePtr->nmisses;
+
+    return prepPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreePrepared --
+ *
+ *	Remove a statement from a handle's cache and release it
+ *	in the driver.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreePrepared(Handle *handlePtr, Prepared *prepPtr)
+{
+    if (prepPtr->prevPtr != NULL) {
+	prepPtr->prevPtr->nextPtr = prepPtr->nextPtr;
+    } else {
+	handlePtr->firstPrepPtr = prepPtr->nextPtr;
+    }
+    if (prepPtr->nextPtr != NULL) {
+	prepPtr->nextPtr->prevPtr = prepPtr->prevPtr;
+    } else {
+	handlePtr->lastPrepPtr = prepPtr->prevPtr;
+    }
+    Tcl_DeleteHashEntry(prepPtr->hPtr);
+    NsDbFreePrepared((Ns_DbHandle *) handlePtr, prepPtr->stmt);
+    ns_free(prepPtr);
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -1038,6 +1497,7 @@ CreatePool(char *pool, char *path, char *driver)
     poolPtr->pass = Ns_ConfigGetValue(path, "password");
     poolPtr->desc = Ns_ConfigGetValue("ns/db/pools", pool);
     poolPtr->stale_on_close = 0;
+    poolPtr->warming = 0;
     if (!Ns_ConfigGetBool(path, "verbose", &poolPtr->fVerbose)) {
         poolPtr->fVerbose = 0;
     } 
@@ -1056,9 +1516,27 @@ CreatePool(char *pool, char *path, char *driver)
         i = 3600;                   /* 1 hour */
     }
     poolPtr->maxopen = i;
+    if (!Ns_ConfigGetInt(path, "minconnected", &poolPtr->minconnected)
+	|| poolPtr->minconnected < 0) {
+        poolPtr->minconnected = 0;
+    }
+    if (poolPtr->minconnected > poolPtr->nhandles) {
+	poolPtr->minconnected = poolPtr->nhandles;
+    }
+    if (Ns_ConfigGetInt(path, "pinginterval", &i) == NS_FALSE || i < 0) {
+        i = 0;
+    }
+    poolPtr->pinginterval = i;
+    poolPtr->pingquery = Ns_ConfigGetValue(path, "pingquery");
+    if (!Ns_ConfigGetInt(path, "maxprepared", &poolPtr->maxprepared)
+	|| poolPtr->maxprepared < 1) {
+        poolPtr->maxprepared = 32;
+    }
     poolPtr->firstPtr = poolPtr->lastPtr = NULL;
+    poolPtr->handles = ns_malloc(sizeof(Handle *) * poolPtr->nhandles);
     for (i = 0; i < poolPtr->nhandles; ++i) {
     	handlePtr = ns_malloc(sizeof(Handle));
+    	poolPtr->handles[i] = handlePtr;
     	Ns_DStringInit(&handlePtr->dsExceptionMsg);
     	handlePtr->poolPtr = poolPtr;
     	handlePtr->connection = NULL;
@@ -1069,6 +1547,10 @@ CreatePool(char *pool, char *path, char *driver)
     	handlePtr->otime = handlePtr->atime = 0;
     	handlePtr->stale = NS_FALSE;
     	handlePtr->stale_on_close = 0;
+    	handlePtr->ptime = 0;
+    	Tcl_InitHashTable(&handlePtr->prepared, TCL_STRING_KEYS);
+    	handlePtr->firstPrepPtr = handlePtr->lastPrepPtr = NULL;
+    	handlePtr->nhits = handlePtr->nmisses = handlePtr->nevicted = 0;
 
 	/*
 	 * The following elements of the Handle structure could
@@ -1090,6 +1572,20 @@ CreatePool(char *pool, char *path, char *driver)
 	i = 600;	/* 10 minutes. */
     }
     Ns_ScheduleProc(CheckPool, poolPtr, 0, i);
+
+    /*
+     * Probe idle handles and keep the minimum connected in a
+     * background thread every pinginterval, or every checkinterval
+     * if probes are disabled, and open the first handles now.
+     */
+
+    if (poolPtr->pinginterval > 0) {
+	i = poolPtr->pinginterval;
+    }
+    if (i > 0 && (poolPtr->pinginterval > 0 || poolPtr->minconnected > 0)) {
+	Ns_ScheduleProcEx(WarmPool, poolPtr, NS_SCHED_THREAD, i, NULL);
+    }
+    ScheduleWarm(poolPtr);
     return poolPtr;
 }
 
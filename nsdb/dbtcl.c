@@ -165,8 +165,9 @@ DbObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
     Ns_Set         *row;
     Tcl_HashEntry  *hPtr;
     Tcl_Obj	   *resultPtr;
-    char           *arg, *pool, buf[32];
-    int		    timeout, nhandles, n, status;
+    Tcl_DString     ds;
+    char           *arg, *pool, buf[32], **values;
+    int		    timeout, nhandles, n, i, status;
     static CONST char *opts[] = {
 	"getrow", "gethandle", "releasehandle", "select", "dml",
 	"1row", "0or1row", "bindrow", "exec", "sp_exec", "sp_getparams",
@@ -174,7 +175,7 @@ DbObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	"flush", "bouncepool", "cancel", "connected", "datasource",
 	"dbtype", "disconnect", "driver", "interpretsqlfile",
 	"password", "poolname", "pools", "resethandle", "setexception",
-	"user", "verbose", NULL
+	"user", "verbose", "prepare", "exec_prepared", "stats", NULL
     }; enum {
 	Db_getrowIdx, Db_gethandleIdx, Db_releasehandleIdx,
 	Db_selectIdx, Db_dmlIdx, Db_1rowIdx, Db_0or1rowIdx,
@@ -184,7 +185,8 @@ DbObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	Db_connectedIdx, Db_datasourceIdx, Db_dbtypeIdx, Db_disconnectIdx,
 	Db_driverIdx, Db_interpretsqlfileIdx, Db_passwordIdx,
 	Db_poolnameIdx, Db_poolsIdx, Db_resethandleIdx, Db_setexceptionIdx,
-	Db_userIdx, Db_verboseIdx
+	Db_userIdx, Db_verboseIdx, Db_prepareIdx, Db_exec_preparedIdx,
+	Db_statsIdx
     } opt;
     static CONST char *spopts[] = {
 	"in", "out", NULL
@@ -345,6 +347,7 @@ DbObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
     case Db_execIdx:
     case Db_getrowIdx:
     case Db_interpretsqlfileIdx:
+    case Db_prepareIdx:
     case Db_selectIdx:
     case Db_sp_startIdx:
     	if (objc != 4) {
@@ -400,6 +403,10 @@ DbObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	    status = Ns_DbInterpretSqlFile(handle, arg);
 	    break;
 
+    	case Db_prepareIdx:
+	    status = Ns_DbPrepare(handle, arg);
+	    break;
+
     	case Db_selectIdx:
             row = Ns_DbSelect(handle, arg);
             EnterRow(interp, row, NS_TCL_SET_STATIC, &status);
@@ -440,6 +447,29 @@ DbObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	}
 	break;
 
+    case Db_exec_preparedIdx:
+	if (objc < 4) {
+            Tcl_WrongNumArgs(interp, 2, objv, "dbId sql ?value ...?");
+	    return TCL_ERROR;
+	}
+    	if (GetHandleObj(idataPtr, objv[2], &handle, 1, &hPtr) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	n = objc - 4;
+	values = ns_malloc((n + 1) * sizeof(char *));
+	for (i = 0; i < n; ++i) {
+	    values[i] = Tcl_GetString(objv[i + 4]);
+	}
+	values[n] = NULL;
+	status = Ns_DbExecPrepared(handle, Tcl_GetString(objv[3]), n, values);
+	ns_free(values);
+	if (status == NS_DML) {
+            Tcl_SetResult(interp, "NS_DML", TCL_STATIC);
+	} else if (status == NS_ROWS) {
+            Tcl_SetResult(interp, "NS_ROWS", TCL_STATIC);
+	}
+	break;
+
     case Db_gethandleIdx:
 	timeout = -1;
 	if (objc >= 4) {
@@ -527,6 +557,21 @@ DbObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	status = Ns_DbBouncePool(Tcl_GetString(objv[2]));
 	break;
 
+    case Db_statsIdx:
+	if (objc != 3) {
+            Tcl_WrongNumArgs(interp, 2, objv, "pool");
+	    return TCL_ERROR;
+	}
+	Tcl_DStringInit(&ds);
+	if (NsDbPoolStats(Tcl_GetString(objv[2]), &ds) != NS_OK) {
+	    Tcl_DStringFree(&ds);
+            Tcl_AppendResult(interp, "no such pool: \"",
+			     Tcl_GetString(objv[2]), "\"", NULL);
+	    return TCL_ERROR;
+	}
+	Tcl_DStringResult(interp, &ds);
+	break;
+
     case Db_poolsIdx:
         if (objc > 2) {
             Tcl_WrongNumArgs(interp, 2, objv, NULL);
@@ -0,0 +1,296 @@
+/*
+ * The contents of this file are subject to the AOLserver Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://aolserver.com/.
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is AOLserver Code and related documentation
+ * distributed by AOL.
+ * 
+ * The Initial Developer of the Original Code is America Online,
+ * Inc. Portions created by AOL are Copyright (C) 1999 America Online,
+ * Inc. All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+
+/*
+ * nsdbtest.c --
+ *
+ *	Database driver for testing the nsdb pool and prepared
+ *	statement cache without a database.  Every statement
+ *	succeeds as DML and prepared statements check the number
+ *	of bind values against the "?" placeholders in the SQL.
+ */
+
+static const char *RCSID = "@(#) $Header$, compiled: " __DATE__ " " __TIME__;
+
+#include "ns.h"
+#include "nsdb.h"
+
+/*
+ * The following structure defines a prepared statement.
+ */
+
+typedef struct Stmt {
+    char *sql;
+    int   nparams;
+} Stmt;
+
+static char    *DbName(Ns_DbHandle *handle);
+static char    *DbType(Ns_DbHandle *handle);
+static int      OpenDb(Ns_DbHandle *handle);
+static void     CloseDb(Ns_DbHandle *handle);
+static int      Exec(Ns_DbHandle *handle, char *sql);
+static int      Flush(Ns_DbHandle *handle);
+static int      ResetHandle(Ns_DbHandle *handle);
+static int      Ping(Ns_DbHandle *handle);
+static void    *Prepare(Ns_DbHandle *handle, char *sql);
+static int      ExecPrepared(Ns_DbHandle *handle, void *stmt, int nvalues,
+			     char **values);
+static void     FreePrepared(Ns_DbHandle *handle, void *stmt);
+
+static Ns_DbProc procs[] = {
+    {DbFn_Name, (void *) DbName},
+    {DbFn_DbType, (void *) DbType},
+    {DbFn_OpenDb, (void *) OpenDb},
+    {DbFn_CloseDb, (void *) CloseDb},
+    {DbFn_Exec, (void *) Exec},
+    {DbFn_Flush, (void *) Flush},
+    {DbFn_ResetHandle, (void *) ResetHandle},
+    {DbFn_Ping, (void *) Ping},
+    {DbFn_Prepare, (void *) Prepare},
+    {DbFn_ExecPrepared, (void *) ExecPrepared},
+    {DbFn_FreePrepared, (void *) FreePrepared},
+    {0, NULL}
+};
+
+NS_EXPORT int Ns_ModuleVersion = 1;
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_DbDriverInit --
+ *
+ *	Register the test driver functions with nsdb.
+ *
+ * Results:
+ *	NS_OK or NS_ERROR.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+NS_EXPORT int
+Ns_DbDriverInit(char *driver, char *path)
+{
+    return Ns_DbRegisterDriver(driver, procs);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DbName, DbType --
+ *
+ *	Return the driver name and database type.
+ *
+ * Results:
+ *	Static string.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+DbName(Ns_DbHandle *handle)
+{
+    return "nsdbtest";
+}
+
+static char *
+DbType(Ns_DbHandle *handle)
+{
+    return "test";
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * OpenDb, CloseDb --
+ *
+ *	Open or close a test connection.
+ *
+ * Results:
+ *	NS_OK for OpenDb.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+OpenDb(Ns_DbHandle *handle)
+{
+    handle->connection = handle;
+    return NS_OK;
+}
+
+static void
+CloseDb(Ns_DbHandle *handle)
+{
+    handle->connection = NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Exec, Flush, ResetHandle, Ping --
+ *
+ *	Execute a statement, flush or reset the handle, or check
+ *	the connection, which always succeed.
+ *
+ * Results:
+ *	NS_DML for Exec, NS_OK otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+Exec(Ns_DbHandle *handle, char *sql)
+{
+    return NS_DML;
+}
+
+static int
+Flush(Ns_DbHandle *handle)
+{
+    return NS_OK;
+}
+
+static int
+ResetHandle(Ns_DbHandle *handle)
+{
+    return NS_OK;
+}
+
+static int
+Ping(Ns_DbHandle *handle)
+{
+    return NS_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Prepare --
+ *
+ *	Prepare a statement, counting its "?" placeholders.
+ *
+ * Results:
+ *	Pointer to Stmt.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void *
+Prepare(Ns_DbHandle *handle, char *sql)
+{
+    Stmt *stmtPtr;
+    char *p;
+
+    stmtPtr = ns_malloc(sizeof(Stmt));
+    stmtPtr->sql = ns_strdup(sql);
+    stmtPtr->nparams = 0;
+    for (p = sql; *p != '\0'; ++p) {
+	if (*p == '?') {
+	    ++stmtPtr->nparams;
+	}
+    }
+    return stmtPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ExecPrepared --
+ *
+ *	Execute a prepared statement with bind values.
+ *
+ * Results:
+ *	NS_DML or NS_ERROR if the number of values does not match
+ *	the placeholders.
+ *
+ * Side effects:
+ *	Exception is set on error.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+ExecPrepared(Ns_DbHandle *handle, void *stmt, int nvalues, char **values)
+{
+    Stmt *stmtPtr = stmt;
+
+    if (nvalues != stmtPtr->nparams) {
+	Ns_DbSetException(handle, "07001", "wrong number of bind values");
+	return NS_ERROR;
+    }
+    return NS_DML;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreePrepared --
+ *
+ *	Release a prepared statement.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreePrepared(Ns_DbHandle *handle, void *stmt)
+{
+    Stmt *stmtPtr = stmt;
+
+    ns_free(stmtPtr->sql);
+    ns_free(stmtPtr);
+}
@@ -62,23 +62,31 @@ NsSock_ModInit(char *server, char *module)
 {
     Ns_DriverInitData init;
     char *path;
-    int async;
+    int async, usesendfile;
 
     path = Ns_ConfigGetPath(server, module, NULL);
     if (!Ns_ConfigGetBool(path, "async", &async)) {
 	async = 1;
     }
+    if (!Ns_ConfigGetBool(path, "sendfile", &usesendfile)) {
+	usesendfile = 0;
+    }
 
     /*
      * Initialize the driver with the async option so that the driver thread
      * will perform event-driven read-ahead of the request before
-     * passing to the connection for processing.
+     * passing to the connection for processing.  The sendfile option,
+     * off unless enabled in the config, allows open files to be sent
+     * without copying and is required for writer threads.
      */
 
     init.version = NS_DRIVER_VERSION_1;
     init.name = "nssock";
     init.proc = SockProc;
     init.opts = (async ? NS_DRIVER_ASYNC : 0);
+    if (usesendfile) {
+	init.opts |= NS_DRIVER_SENDFILE;
+    }
     init.arg = NULL;
     init.path = NULL;
 
@@ -149,15 +149,18 @@ proc ns_getform {{charset ""}}  {
 		set len [ns_conn filelength $file]
 		set hdr [ns_conn fileheaders $file]
 		set type [ns_set get $hdr content-type]
-	    	set fp ""
-	    	while {$fp eq ""} {
+		set tmpfile [ns_conn filepath $file]
+		if {$tmpfile eq ""} {
+		    set fp ""
+		    while {$fp eq ""} {
 			set tmpfile [ns_tmpnam]
 			set fp [ns_openexcl $tmpfile]
-	    	}
-		fconfigure $fp -translation binary 
-		ns_conn copy $off $len $fp
-		close $fp
-		ns_atclose "ns_unlink -nocomplain $tmpfile"
+		    }
+		    fconfigure $fp -translation binary 
+		    ns_conn copy $off $len $fp
+		    close $fp
+		    ns_atclose "ns_unlink -nocomplain $tmpfile"
+		}
 		set _ns_formfiles($file) $tmpfile
 	    	ns_set put $_ns_form $file.content-type $type
 		# NB: Insecure, access via ns_getformfile.
@@ -36,7 +36,11 @@ set maxthreads [ns_config $cfgsection maxthreads 10]
 set maxconns [ns_config $cfgsection maxconnections 0]
 set timeout [ns_config $cfgsection threadtimeout 30]
 set spread [ns_config $cfgsection spread 20]
+set queues [ns_config $cfgsection connqueues 1]
+set lifo [ns_config -bool $cfgsection lifothreads 0]
+set spare [ns_config $cfgsection sparethreads 0]
+set prewarm [ns_config -bool $cfgsection prewarmthreads 0]
 
-ns_pools set default -minthreads $minthreads -maxthreads $maxthreads -maxconns $maxconns -timeout $timeout -spread $spread
+ns_pools set default -minthreads $minthreads -maxthreads $maxthreads -maxconns $maxconns -timeout $timeout -spread $spread -queues $queues -lifo $lifo -spare $spare -prewarm $prewarm
 
 ns_log notice "default thread pool: [ns_pools get default]"